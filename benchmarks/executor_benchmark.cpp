@@ -0,0 +1,134 @@
+#include "engine.h"
+#include "memory_storage.h"
+#include "synthetic.h"
+
+#include <benchmark/benchmark.h>
+
+#include <map>
+
+using namespace promql;
+
+static const uint64_t MINUTE = 60 * 1000;
+
+/* the datasets are populated once and shared by all benchmarks, by series
+ * count and churn in percent. Aggregations are not pushed down to the
+ * storage so that the operators of the executor are measured. */
+static MemoryStorage* synthetic_storage(size_t num_series, int churn)
+{
+    static std::map<std::pair<size_t, int>, std::unique_ptr<MemoryStorage>>
+        storages;
+
+    auto& storage = storages[{num_series, churn}];
+    if (!storage) {
+        SyntheticOptions options;
+        options.num_series = num_series;
+        options.churn = churn / 100.0;
+
+        storage = std::make_unique<MemoryStorage>(false);
+        populate_synthetic(*storage, options);
+    }
+    return storage.get();
+}
+
+static SystemTime time_at(uint64_t t)
+{
+    return SystemTime{std::chrono::milliseconds(t)};
+}
+
+/* a range query over the last half hour of the dataset at a one minute step,
+ * args are the series count and the churn */
+static void BM_RangeQuery(benchmark::State& state, const char* query)
+{
+    auto* storage = synthetic_storage(state.range(0), state.range(1));
+    Engine engine(storage);
+    auto prepared = engine.prepare(query);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(prepared->exec_range(
+            time_at(30 * MINUTE), time_at(60 * MINUTE), Duration{MINUTE}));
+    }
+    state.counters["series"] = state.range(0);
+}
+
+/* an instant query at the end of the dataset */
+static void BM_InstantQuery(benchmark::State& state, const char* query)
+{
+    auto* storage = synthetic_storage(state.range(0), state.range(1));
+    Engine engine(storage);
+    auto prepared = engine.prepare(query);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(prepared->exec(time_at(60 * MINUTE)));
+    }
+    state.counters["series"] = state.range(0);
+}
+
+static void series_args(benchmark::internal::Benchmark* b)
+{
+    b->ArgNames({"series", "churn"});
+    for (auto series : {1000, 10000}) {
+        b->Args({series, 0});
+    }
+    b->Args({10000, 20});
+    b->Unit(benchmark::kMillisecond);
+}
+
+/* selection */
+BENCHMARK_CAPTURE(BM_InstantQuery, vector_selector, "http_requests_total")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_InstantQuery, matrix_selector, "http_requests_total[5m]")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, vector_selector,
+                  "http_requests_total{job=\"job-1\"}")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, regex_selector,
+                  "http_requests_total{path=~\"/api/v1/1.*\"}")
+    ->Apply(series_args);
+
+/* functions */
+BENCHMARK_CAPTURE(BM_RangeQuery, rate, "rate(http_requests_total[5m])")
+    ->Apply(series_args);
+
+/* aggregations */
+BENCHMARK_CAPTURE(BM_RangeQuery, sum,
+                  "sum by (job) (rate(http_requests_total[5m]))")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, avg,
+                  "avg by (job) (process_resident_memory_bytes)")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, min,
+                  "min by (job) (process_resident_memory_bytes)")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, max,
+                  "max by (job) (process_resident_memory_bytes)")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, count,
+                  "count by (job) (process_resident_memory_bytes)")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, stddev,
+                  "stddev by (job) (process_resident_memory_bytes)")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, stdvar,
+                  "stdvar by (job) (process_resident_memory_bytes)")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, topk,
+                  "topk by (job) (3, process_resident_memory_bytes)")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, bottomk,
+                  "bottomk by (job) (3, process_resident_memory_bytes)")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, quantile,
+                  "quantile by (job) (0.9, process_resident_memory_bytes)")
+    ->Apply(series_args);
+
+/* binary operations */
+BENCHMARK_CAPTURE(BM_RangeQuery, vector_scalar,
+                  "process_resident_memory_bytes / 1024")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, vector_vector,
+                  "process_resident_memory_bytes - "
+                  "process_resident_memory_bytes offset 5m")
+    ->Apply(series_args);
+BENCHMARK_CAPTURE(BM_RangeQuery, comparison,
+                  "process_resident_memory_bytes > 5e7")
+    ->Apply(series_args);
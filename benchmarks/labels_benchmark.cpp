@@ -0,0 +1,50 @@
+#include "labels.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace promql;
+
+static std::vector<std::string> label_values(size_t n)
+{
+    std::vector<std::string> values;
+    for (size_t i = 0; i < n; i++) {
+        values.push_back("/api/v1/" + std::to_string(i));
+    }
+    return values;
+}
+
+static void BM_LabelMatcher(benchmark::State& state, MatchOp op,
+                            const char* value)
+{
+    auto values = label_values(1000);
+    LabelMatcher matcher(op, "path", value);
+
+    for (auto _ : state) {
+        size_t matched = 0;
+        for (auto&& v : values) {
+            matched += matcher.match_value(v);
+        }
+        benchmark::DoNotOptimize(matched);
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+
+BENCHMARK_CAPTURE(BM_LabelMatcher, equal, MatchOp::EQL, "/api/v1/500");
+BENCHMARK_CAPTURE(BM_LabelMatcher, not_equal, MatchOp::NEQ, "/api/v1/500");
+BENCHMARK_CAPTURE(BM_LabelMatcher, regex_literal, MatchOp::EQL_REGEX,
+                  "/api/v1/500");
+BENCHMARK_CAPTURE(BM_LabelMatcher, regex_prefix, MatchOp::EQL_REGEX,
+                  "/api/v1/5.*");
+BENCHMARK_CAPTURE(BM_LabelMatcher, regex_alternation, MatchOp::EQL_REGEX,
+                  "/api/v1/(1|22|333)");
+BENCHMARK_CAPTURE(BM_LabelMatcher, not_regex, MatchOp::NEQ_REGEX,
+                  "/api/v1/5.*");
+
+static void BM_LabelMatcherCompile(benchmark::State& state)
+{
+    for (auto _ : state) {
+        LabelMatcher matcher(MatchOp::EQL_REGEX, "path", "/api/v1/(1|22|3.*)");
+        benchmark::DoNotOptimize(matcher);
+    }
+}
+BENCHMARK(BM_LabelMatcherCompile);
@@ -0,0 +1,318 @@
+#include "histogram.h"
+#include "memory_storage.h"
+#include "synthetic.h"
+#include "web/http_server.h"
+
+#include "client_http.hpp"
+
+#include <atomic>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <thread>
+
+using namespace promql;
+
+using HttpClient = SimpleWeb::Client<SimpleWeb::HTTP>;
+using Clock = std::chrono::steady_clock;
+
+/* load test of HttpServer over loopback: the server is started in-process on
+ * a synthetic dataset ending now, then client threads send inserts and
+ * queries at fixed rates and the latencies are reported per endpoint.
+ *
+ * Each client is closed-loop: it sends one request at a time on its
+ * connection and waits for the response before sending the next one. The
+ * requests are scheduled at fixed intervals and the latency of a request is
+ * counted from the time it was scheduled at, which corrects for coordinated
+ * omission: a request delayed by a stalled server is charged the time it
+ * waited to be sent. A client falls behind its rate once the latency
+ * exceeds its interval, the req/s column shows the rate achieved, use more
+ * clients for higher rates. */
+struct LoadOptions {
+    SyntheticOptions dataset;
+    unsigned short port = 9091;
+    int workers = 4;        /* workers of the server */
+    int insert_clients = 2; /* client threads sending inserts */
+    int query_clients = 8;  /* client threads sending queries */
+    double insert_rate = 1000; /* requests/s of all insert clients */
+    double query_rate = 50;    /* requests/s of all query clients */
+    int run_time = 30;         /* seconds */
+};
+
+/* latencies and errors of the requests to one endpoint */
+struct EndpointStats {
+    std::string name;
+    Histogram latency; /* us */
+    std::atomic<uint64_t> errors{0};
+
+    EndpointStats(const std::string& name) : name(name) {}
+};
+
+static const char* INSTANT_QUERIES[] = {
+    "sum by (job) (rate(http_requests_total[5m]))",
+    "process_resident_memory_bytes{job=\"job-3\"}",
+    "sum by (le) (rate(http_request_duration_seconds_bucket[5m]))",
+    "topk(5, process_resident_memory_bytes)",
+};
+
+static const char* RANGE_QUERIES[] = {
+    "sum by (job) (rate(http_requests_total[5m]))",
+    "avg by (job) (process_resident_memory_bytes)",
+    "sum by (le) (rate(http_request_duration_seconds_bucket{job=\"job-1\"}"
+    "[5m]))",
+};
+
+static void usage(const char* prog)
+{
+    std::cerr
+        << "usage: " << prog << " [options]\n"
+        << "  --series=N              series of the dataset (1000)\n"
+        << "  --scrape-interval=MS    interval of the samples (15000)\n"
+        << "  --duration=MS           data before the test starts (3600000)\n"
+        << "  --churn=F               instances replaced per interval (0)\n"
+        << "  --histogram-buckets=N   buckets of the histograms (10)\n"
+        << "  --port=N                port of the server (9091)\n"
+        << "  --workers=N             workers of the server (4)\n"
+        << "  --insert-clients=N      insert client threads (2)\n"
+        << "  --query-clients=N       query client threads (8)\n"
+        << "  --insert-rate=R         inserts per second (1000)\n"
+        << "  --query-rate=R          queries per second (50)\n"
+        << "  --run-time=S            length of the test (30)\n";
+}
+
+static bool parse_args(int argc, char** argv, LoadOptions& options)
+{
+    options.dataset.histogram_buckets = 10;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        if (arg.compare(0, 2, "--") || eq == std::string::npos) return false;
+
+        auto name = arg.substr(2, eq - 2);
+        auto value = arg.substr(eq + 1);
+        double v = ::atof(value.c_str());
+
+        if (name == "series")
+            options.dataset.num_series = v;
+        else if (name == "scrape-interval")
+            options.dataset.scrape_interval = v;
+        else if (name == "duration")
+            options.dataset.duration = v;
+        else if (name == "churn")
+            options.dataset.churn = v;
+        else if (name == "histogram-buckets")
+            options.dataset.histogram_buckets = v;
+        else if (name == "port")
+            options.port = v;
+        else if (name == "workers")
+            options.workers = v;
+        else if (name == "insert-clients")
+            options.insert_clients = v;
+        else if (name == "query-clients")
+            options.query_clients = v;
+        else if (name == "insert-rate")
+            options.insert_rate = v;
+        else if (name == "query-rate")
+            options.query_rate = v;
+        else if (name == "run-time")
+            options.run_time = v;
+        else
+            return false;
+    }
+
+    return options.dataset.scrape_interval > 0;
+}
+
+static std::string url_encode(const std::string& str)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string encoded;
+
+    for (unsigned char c : str) {
+        if (::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            encoded += c;
+        } else {
+            encoded += '%';
+            encoded += hex[c >> 4];
+            encoded += hex[c & 15];
+        }
+    }
+    return encoded;
+}
+
+static uint64_t now_seconds()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+/* the next request of a client: the endpoint it is counted in and its path */
+using RequestFunc = std::function<std::pair<EndpointStats*, std::string>(
+    std::mt19937_64&)>;
+
+/* send requests at rate per second until deadline */
+static void run_client(const LoadOptions& options, int index, double rate,
+                       Clock::time_point deadline, const RequestFunc& next,
+                       const std::string& method)
+{
+    if (rate <= 0) return;
+
+    HttpClient client("localhost:" + std::to_string(options.port));
+    std::mt19937_64 rng(options.dataset.seed + index);
+
+    auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / rate));
+    auto scheduled = Clock::now();
+
+    while (scheduled < deadline) {
+        std::this_thread::sleep_until(scheduled);
+
+        auto request = next(rng);
+        auto* stats = request.first;
+        try {
+            auto response = client.request(method, request.second);
+            if (response->status_code.compare(0, 3, "200"))
+                stats->errors++;
+            else
+                response->content.string();
+        } catch (const std::exception& e) {
+            stats->errors++;
+        }
+
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - scheduled);
+        stats->latency.record(latency.count());
+
+        scheduled += interval;
+    }
+}
+
+static bool wait_for_server(const LoadOptions& options)
+{
+    HttpClient client("localhost:" + std::to_string(options.port));
+
+    for (int i = 0; i < 100; i++) {
+        try {
+            auto response = client.request("GET", "/api/v1/query?query=1");
+            if (!response->status_code.compare(0, 3, "200")) return true;
+        } catch (const std::exception& e) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+static void report(const std::vector<EndpointStats*>& endpoints, double secs)
+{
+    auto ms = [](uint64_t us) { return us / 1000.0; };
+
+    std::cout << std::left << std::setw(12) << "endpoint" << std::right
+              << std::setw(10) << "requests" << std::setw(8) << "errors"
+              << std::setw(10) << "req/s" << std::setw(10) << "p50 ms"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "p999 ms"
+              << std::setw(10) << "max ms" << std::endl;
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto* e : endpoints) {
+        auto& h = e->latency;
+        std::cout << std::left << std::setw(12) << e->name << std::right
+                  << std::setw(10) << h.get_count() << std::setw(8)
+                  << e->errors.load() << std::setw(10)
+                  << h.get_count() / secs << std::setw(10)
+                  << ms(h.quantile(0.5)) << std::setw(10)
+                  << ms(h.quantile(0.99)) << std::setw(10)
+                  << ms(h.quantile(0.999)) << std::setw(10)
+                  << ms(h.get_max()) << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    LoadOptions options;
+    if (!parse_args(argc, argv, options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* the dataset ends when the test starts */
+    MemoryStorage storage;
+    options.dataset.start = now_seconds() * 1000 - options.dataset.duration;
+    std::cerr << "populating " << options.dataset.to_string() << std::endl;
+    auto samples = populate_synthetic(storage, options.dataset);
+    std::cerr << samples << " samples" << std::endl;
+
+    HttpServer server(&storage, options.workers);
+    server.set_port(options.port);
+    std::thread server_thread([&server] { server.start(); });
+
+    if (!wait_for_server(options)) {
+        std::cerr << "server not listening on port " << options.port
+                  << std::endl;
+        server.stop();
+        server_thread.join();
+        return 1;
+    }
+
+    EndpointStats insert("insert"), query("query"), query_range("query_range");
+    size_t num_instances = std::max<size_t>(1, options.dataset.num_series / 2);
+
+    RequestFunc next_insert = [&](std::mt19937_64& rng) {
+        size_t i = rng() % num_instances;
+        std::string series =
+            "http_requests_total{job=\"job-" +
+            std::to_string(i % SYNTHETIC_JOBS) + "\", instance=\"host-" +
+            std::to_string(i) + "\", path=\"/api/v1/" +
+            std::to_string(i % SYNTHETIC_PATHS) + "\"}";
+        return std::make_pair(&insert, "/insert?series=" + url_encode(series) +
+                                           "&value=" +
+                                           std::to_string(rng() % 1000));
+    };
+
+    RequestFunc next_query = [&](std::mt19937_64& rng) {
+        /* one range query every four queries, over the last hour */
+        if (rng() % 4 == 0) {
+            const char* q = RANGE_QUERIES[rng() % std::size(RANGE_QUERIES)];
+            auto end = now_seconds();
+            return std::make_pair(
+                &query_range, "/api/v1/query_range?query=" + url_encode(q) +
+                                  "&start=" + std::to_string(end - 3600) +
+                                  "&end=" + std::to_string(end) + "&step=60");
+        }
+
+        const char* q = INSTANT_QUERIES[rng() % std::size(INSTANT_QUERIES)];
+        return std::make_pair(&query, "/api/v1/query?query=" + url_encode(q));
+    };
+
+    std::cerr << "running for " << options.run_time << "s" << std::endl;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::seconds(options.run_time);
+    std::vector<std::thread> clients;
+    for (int i = 0; i < options.insert_clients; i++) {
+        clients.emplace_back([&, i] {
+            run_client(options, i,
+                       options.insert_rate / options.insert_clients, deadline,
+                       next_insert, "POST");
+        });
+    }
+    for (int i = 0; i < options.query_clients; i++) {
+        clients.emplace_back([&, i] {
+            run_client(options, options.insert_clients + i,
+                       options.query_rate / options.query_clients, deadline,
+                       next_query, "GET");
+        });
+    }
+    for (auto&& t : clients) {
+        t.join();
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    server.stop();
+    server_thread.join();
+
+    report({&insert, &query, &query_range}, secs);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include "synthetic.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <vector>
+
+/* report in JSON unless another format is asked for, the benchmark names and
+ * the synthetic datasets are fixed so that the reports of two builds can be
+ * compared with the compare.py tool of Google Benchmark */
+int main(int argc, char** argv)
+{
+    std::vector<char*> args(argv, argv + argc);
+    bool has_format = false;
+    for (int i = 1; i < argc; i++) {
+        if (!::strncmp(argv[i], "--benchmark_format", 18)) has_format = true;
+    }
+
+    char json_format[] = "--benchmark_format=json";
+    if (!has_format) args.insert(args.begin() + 1, json_format);
+
+    int nargs = args.size();
+    benchmark::Initialize(&nargs, args.data());
+    if (benchmark::ReportUnrecognizedArguments(nargs, args.data())) return 1;
+
+    /* the series count and the churn are arguments of the benchmarks */
+    benchmark::AddCustomContext("synthetic_dataset",
+                                promql::SyntheticOptions().to_string());
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include "parse/lexer.h"
+#include "parse/parser.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace promql;
+
+/* a query of about size bytes made of many selectors, aggregations, functions
+ * and string literals joined by binary operators */
+static std::string generate_query(size_t size)
+{
+    std::string query;
+    for (int i = 0; query.length() < size; i++) {
+        if (i) query += i % 2 ? " + " : " / ";
+        query += "sum by (job, instance) (rate(http_requests_total_" +
+                 std::to_string(i) +
+                 "{job=\"api\", instance=\"host-[0-9]+\", "
+                 "path!=\"/health\\\"z\"}[5m] offset 1h)) * 1.5e3";
+    }
+    return query;
+}
+
+static void BM_Lex(benchmark::State& state)
+{
+    auto query = generate_query(state.range(0));
+
+    for (auto _ : state) {
+        Lexer lexer(query);
+        size_t tokens = 0;
+        while (lexer.get_token() != Token::EOS) tokens++;
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed(state.iterations() * query.length());
+}
+BENCHMARK(BM_Lex)->Range(1 << 10, 1 << 20);
+
+static void BM_Parse(benchmark::State& state)
+{
+    auto query = generate_query(state.range(0));
+
+    for (auto _ : state) {
+        Parser parser(query);
+        benchmark::DoNotOptimize(parser.parse());
+    }
+    state.SetBytesProcessed(state.iterations() * query.length());
+}
+BENCHMARK(BM_Parse)->Range(1 << 10, 1 << 20);
@@ -0,0 +1,167 @@
+#include "synthetic.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace promql {
+
+std::string SyntheticOptions::to_string() const
+{
+    std::stringstream ss;
+    ss << "series=" << num_series << " scrape_interval=" << scrape_interval
+       << "ms duration=" << duration << "ms churn=" << churn
+       << " churn_interval=" << churn_interval
+       << "ms histogram_buckets=" << histogram_buckets << " seed=" << seed;
+    return ss.str();
+}
+
+namespace {
+
+/* cumulative buckets, sum and count of a histogram */
+struct SyntheticHistogram {
+    std::vector<double> bounds;
+    std::vector<std::vector<Label>> bucket_labels;
+    std::vector<double> buckets;
+    std::vector<Label> sum_labels, count_labels;
+    double sum, count;
+};
+
+struct SyntheticSeries {
+    std::vector<Label> labels;
+    double value;
+    bool counter;
+    SyntheticHistogram histogram;
+};
+
+} // namespace
+
+static std::vector<Label> with_name(std::vector<Label> labels,
+                                    const std::string& name)
+{
+    labels[0].value = name;
+    return labels;
+}
+
+static void make_histogram(SyntheticSeries& s, size_t num_buckets)
+{
+    auto& h = s.histogram;
+    const std::string name = "http_request_duration_seconds";
+
+    /* exponential buckets from 5ms, the last one is +Inf */
+    for (size_t i = 0; i < num_buckets; i++) {
+        double bound = i + 1 < num_buckets ? std::ldexp(0.005, i) : INFINITY;
+        auto labels = with_name(s.labels, name + "_bucket");
+        std::stringstream le;
+        le << bound;
+        labels.emplace_back("le", std::isinf(bound) ? "+Inf" : le.str());
+
+        h.bounds.push_back(bound);
+        h.bucket_labels.push_back(std::move(labels));
+    }
+    h.buckets.assign(num_buckets, 0);
+    h.sum_labels = with_name(s.labels, name + "_sum");
+    h.count_labels = with_name(s.labels, name + "_count");
+    h.sum = h.count = 0;
+}
+
+/* series i is the gauge of the instance of series i - 1 if i is odd, so that
+ * half of the series are counters and half are gauges */
+static SyntheticSeries make_series(size_t i, size_t instance,
+                                   size_t histogram_buckets)
+{
+    SyntheticSeries s;
+    s.counter = i % 2 == 0;
+    s.labels = {
+        {METRIC_NAME,
+         s.counter ? "http_requests_total" : "process_resident_memory_bytes"},
+        {"job", "job-" + std::to_string((i / 2) % SYNTHETIC_JOBS)},
+        {"instance", "host-" + std::to_string(instance)},
+    };
+    if (s.counter) {
+        s.labels.emplace_back(
+            "path", "/api/v1/" + std::to_string((i / 2) % SYNTHETIC_PATHS));
+        if (histogram_buckets) make_histogram(s, histogram_buckets);
+    }
+    s.value = 0;
+    return s;
+}
+
+size_t populate_synthetic(Storage& storage, const SyntheticOptions& options)
+{
+    std::mt19937_64 rng(options.seed);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    std::exponential_distribution<double> latency(10.0); /* mean 100ms */
+
+    auto new_series = [&](size_t i, size_t instance) {
+        auto s = make_series(i, instance, options.histogram_buckets);
+        s.value = s.counter ? 0 : 1e8 * dist(rng);
+        return s;
+    };
+
+    std::vector<SyntheticSeries> series;
+    for (size_t i = 0; i < options.num_series; i++) {
+        series.push_back(new_series(i, i / 2));
+    }
+    size_t next_instance = (options.num_series + 1) / 2;
+
+    auto app = storage.appender();
+    size_t samples = 0;
+    uint64_t next_churn = options.churn_interval;
+
+    for (uint64_t t = 0; t <= options.duration; t += options.scrape_interval) {
+        if (options.churn > 0 && options.churn_interval && t >= next_churn) {
+            next_churn += options.churn_interval;
+
+            for (size_t i = 0; i < series.size(); i += 2) {
+                if (dist(rng) >= options.churn) continue;
+
+                for (size_t j = i; j < std::min(i + 2, series.size()); j++) {
+                    series[j] = new_series(j, next_instance);
+                }
+                next_instance++;
+            }
+        }
+
+        uint64_t ts = options.start + t;
+        for (auto&& s : series) {
+            if (!s.counter) {
+                s.value += 1e6 * (dist(rng) - 0.5);
+                app->add(s.labels, ts, s.value);
+                samples++;
+                continue;
+            }
+
+            double requests = ::floor(10 * dist(rng));
+            s.value += requests;
+            app->add(s.labels, ts, s.value);
+            samples++;
+
+            auto& h = s.histogram;
+            if (h.bounds.empty()) continue;
+
+            for (int r = 0; r < requests; r++) {
+                double l = latency(rng);
+                for (size_t b = 0; b < h.bounds.size(); b++) {
+                    if (l <= h.bounds[b]) h.buckets[b]++;
+                }
+                h.sum += l;
+            }
+            h.count += requests;
+
+            for (size_t b = 0; b < h.bounds.size(); b++) {
+                app->add(h.bucket_labels[b], ts, h.buckets[b]);
+            }
+            app->add(h.sum_labels, ts, h.sum);
+            app->add(h.count_labels, ts, h.count);
+            samples += h.bounds.size() + 2;
+        }
+    }
+
+    app->commit();
+    return samples;
+}
+
+} // namespace promql
@@ -0,0 +1,42 @@
+#ifndef _PROMQL_BENCHMARKS_SYNTHETIC_H_
+#define _PROMQL_BENCHMARKS_SYNTHETIC_H_
+
+#include "promql/storage.h"
+
+#include <cstdint>
+#include <string>
+
+namespace promql {
+
+/* shape of a synthetic dataset. The data only depends on the options, so
+ * that runs of the benchmarks on different builds can be compared. */
+struct SyntheticOptions {
+    size_t num_series = 1000;          /* series alive at any time */
+    uint64_t scrape_interval = 15000;  /* ms between two samples */
+    uint64_t duration = 3600 * 1000;   /* ms of data, starting at 0 */
+    double churn = 0;                  /* fraction of the series replaced by
+                                          new ones every churn_interval */
+    uint64_t churn_interval = 600 * 1000;
+    /* buckets of the histogram of each counter, zero for none */
+    size_t histogram_buckets = 0;
+    uint64_t start = 0; /* timestamp of the first samples */
+    uint64_t seed = 42;
+
+    std::string to_string() const;
+};
+
+/* label values of the synthetic series */
+const size_t SYNTHETIC_JOBS = 10;
+const size_t SYNTHETIC_PATHS = 20;
+
+/* fill the storage with series of the counter http_requests_total and the
+ * gauge process_resident_memory_bytes, labelled with job, instance and path.
+ * With histogram_buckets, the latencies of the requests of each counter are
+ * also counted by the histogram http_request_duration_seconds, whose series
+ * come on top of num_series. Series replaced by churn get a new instance.
+ * Returns the number of samples added. */
+size_t populate_synthetic(Storage& storage, const SyntheticOptions& options);
+
+} // namespace promql
+
+#endif
@@ -0,0 +1,52 @@
+#include "value.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace promql;
+
+static LabelSet series_labels(size_t i)
+{
+    return LabelSet({{METRIC_NAME, "http_requests_total"},
+                     {"job", "job-" + std::to_string(i % 10)},
+                     {"instance", "host-" + std::to_string(i)}});
+}
+
+static void BM_VectorToJson(benchmark::State& state)
+{
+    VectorValue vec;
+    for (int64_t i = 0; i < state.range(0); i++) {
+        vec.add_sample(VectorValue::Sample(
+            series_labels(i), ScalarValue(3600 * 1000, i * 1.5)));
+    }
+
+    size_t bytes = 0;
+    for (auto _ : state) {
+        auto json = vec.to_json();
+        bytes += json.length();
+        benchmark::DoNotOptimize(json);
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_VectorToJson)->Arg(100)->Arg(10000);
+
+/* series of one point per minute over an hour */
+static void BM_MatrixToJson(benchmark::State& state)
+{
+    MatrixValue mat;
+    for (int64_t i = 0; i < state.range(0); i++) {
+        MatrixValue::Series series(series_labels(i));
+        for (uint64_t t = 0; t <= 3600 * 1000; t += 60 * 1000) {
+            series.values.emplace_back(t, t * 0.001 + i);
+        }
+        mat.add_series(std::move(series));
+    }
+
+    size_t bytes = 0;
+    for (auto _ : state) {
+        auto json = mat.to_json();
+        bytes += json.length();
+        benchmark::DoNotOptimize(json);
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_MatrixToJson)->Arg(100)->Arg(1000);
@@ -9,6 +9,12 @@ namespace promql {
 using Duration = std::chrono::milliseconds;
 using SystemTime = std::chrono::time_point<std::chrono::system_clock>;
 
+/* how far back an instant vector selector looks for the latest sample */
+const Duration LOOKBACK_DELTA = std::chrono::minutes(5);
+/* step of the subqueries without one, e.g. x[5m:], the default evaluation
+ * interval of Prometheus */
+const Duration DEFAULT_SUBQUERY_STEP = std::chrono::minutes(1);
+
 } // namespace promql
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef _PROMQL_ENGINE_H_
+#define _PROMQL_ENGINE_H_
+
+#include "promql/parse/cancellation.h"
+#include "promql/parse/memory_tracker.h"
+#include "promql/parse/plan_cache.h"
+#include "promql/storage.h"
+#include "promql/value.h"
+
+namespace promql {
+
+/* a query parsed and planned once that may be executed any number of times
+ * over different time ranges, also concurrently */
+class PreparedQuery {
+public:
+    PreparedQuery(Queryable* queryable, std::shared_ptr<const QueryPlan> plan,
+                  const QueryLimits& limits)
+        : queryable(queryable), plan(std::move(plan)), limits(limits)
+    {}
+
+    /* evaluate the query at a single timestamp */
+    std::unique_ptr<ExecValue>
+    exec(SystemTime time,
+         std::shared_ptr<CancellationToken> token = nullptr) const;
+    /* evaluate the query at each step in [start, end] */
+    std::unique_ptr<ExecValue>
+    exec_range(SystemTime start, SystemTime end, Duration interval,
+               std::shared_ptr<CancellationToken> token = nullptr) const;
+
+    const QueryPlan* get_plan() const { return plan.get(); }
+
+private:
+    Queryable* queryable;
+    std::shared_ptr<const QueryPlan> plan;
+    QueryLimits limits;
+};
+
+/* entry point of the query engine for embedders, the plans of the prepared
+ * queries are cached */
+class Engine {
+public:
+    Engine(Queryable* queryable, size_t plan_cache_size = 1024)
+        : queryable(queryable), plan_cache(plan_cache_size)
+    {}
+
+    /* limits of the queries prepared from now on */
+    void set_query_limits(const QueryLimits& limits) { this->limits = limits; }
+
+    /* parse and plan the query, or take its plan from the cache. Throws if
+     * the query is invalid. */
+    std::unique_ptr<PreparedQuery> prepare(const std::string& query);
+
+    PlanCache& get_plan_cache() { return plan_cache; }
+
+private:
+    Queryable* queryable;
+    PlanCache plan_cache;
+    QueryLimits limits;
+};
+
+} // namespace promql
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _PROMQL_HISTOGRAM_H_
+#define _PROMQL_HISTOGRAM_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace promql {
+
+/* HDR-style histogram of non-negative integers, e.g. latencies in
+ * microseconds. Values below 2^SUB_BUCKET_BITS are counted exactly, above
+ * that each power of two is split into 2^(SUB_BUCKET_BITS - 1) linear
+ * buckets, so that the quantiles are within 1/2^(SUB_BUCKET_BITS - 1) of the
+ * recorded values over the whole range of uint64_t.
+ *
+ * Recording is lock-free and may happen from any thread. The readers see a
+ * consistent histogram only once the writers are done, which is good enough
+ * for reporting. */
+class Histogram {
+public:
+    static const int SUB_BUCKET_BITS = 7;
+    static const size_t SUB_BUCKETS = size_t{1} << SUB_BUCKET_BITS;
+    static const size_t NUM_BUCKETS =
+        (64 - SUB_BUCKET_BITS) * (SUB_BUCKETS / 2) + SUB_BUCKETS;
+
+    Histogram() { reset(); }
+
+    void record(uint64_t value)
+    {
+        buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+
+        auto cur = max.load(std::memory_order_relaxed);
+        while (cur < value &&
+               !max.compare_exchange_weak(cur, value,
+                                          std::memory_order_relaxed))
+            ;
+    }
+
+    /* add the counts of another histogram to this one */
+    void merge(const Histogram& other);
+    void reset();
+
+    uint64_t get_count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t get_sum() const { return sum.load(std::memory_order_relaxed); }
+    uint64_t get_max() const { return max.load(std::memory_order_relaxed); }
+    double get_mean() const;
+
+    /* the highest value equivalent to the q-quantile of the recorded values,
+     * 0 if the histogram is empty */
+    uint64_t quantile(double q) const;
+    /* the number of recorded values up to the end of the bucket of value,
+     * i.e. the values less than or equal to it within the precision */
+    uint64_t count_le(uint64_t value) const;
+
+    static size_t bucket_index(uint64_t value);
+    /* the range of the values counted by a bucket */
+    static uint64_t bucket_lower_bound(size_t index);
+    static uint64_t bucket_upper_bound(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets;
+    std::atomic<uint64_t> total, sum, max;
+};
+
+} // namespace promql
+
+#endif
@@ -1,14 +1,23 @@
 #ifndef _PROMQL_LABELS_H_
 #define _PROMQL_LABELS_H_
 
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
 #include <memory>
+#include <mutex>
 #include <regex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace promql {
 
 #define METRIC_NAME "__name__"
+/* pseudo label selecting one shard of the series, see shard_matcher() */
+#define SHARD_LABEL "__shard__"
 
 struct Label {
     std::string name, value;
@@ -35,17 +44,20 @@ enum class MatchOp {
     NEQ_REGEX,
 };
 
+/* the name and value of a matcher are views, the strings must outlive it:
+ * the matchers of a query refer to its text, see QueryText. Copies share the
+ * compiled pattern of a regex matcher. */
 struct LabelMatcher {
     MatchOp op;
-    std::string name, value;
-    std::regex pattern;
+    std::string_view name, value;
+    std::shared_ptr<const std::regex> pattern;
 
-    LabelMatcher() {}
-    LabelMatcher(MatchOp op, const std::string& name, const std::string& value)
+    LabelMatcher() : op(MatchOp::ERROR) {}
+    LabelMatcher(MatchOp op, std::string_view name, std::string_view value)
         : op(op), name(name), value(value)
     {
         if (op == MatchOp::EQL_REGEX || op == MatchOp::NEQ_REGEX) {
-            pattern = std::regex(value);
+            pattern = std::make_shared<std::regex>(value.begin(), value.end());
         }
     }
 
@@ -75,7 +87,161 @@ static std::string mop2str(MatchOp op)
     return "ERROR";
 }
 
-static std::string lset2str(const std::vector<Label>& lset)
+/* table of interned label names and values. Symbols are never freed, so a
+ * symbol id and the string it refers to stay valid for the lifetime of the
+ * table. Lookups do not lock. The ids of the strings are kept in shards
+ * picked by hash, interning a known string only takes a shared lock on its
+ * shard, new strings are added under an exclusive one.
+ *
+ * The table grows with every distinct label name and value ever seen, e.g.
+ * with the instance labels of churning targets. It holds at most
+ * MAX_SYMBOLS symbols, interning more throws std::length_error. */
+class SymbolTable {
+public:
+    static const size_t MAX_SYMBOLS = 1 << 28;
+
+    SymbolTable();
+
+    /* the table shared by the storage and the executors */
+    static SymbolTable& global();
+
+    uint32_t intern(std::string_view str);
+    std::vector<uint32_t> intern(const std::vector<std::string>& strs);
+    std::vector<uint32_t> intern(const std::vector<std::string_view>& strs);
+    const std::string& lookup(uint32_t id) const
+    {
+        return chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+    }
+
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+    /* bytes held by the strings of the symbols, estimated */
+    size_t get_bytes() const { return bytes.load(std::memory_order_relaxed); }
+
+private:
+    static const size_t CHUNK_BITS = 14;
+    static const size_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const size_t MAX_CHUNKS = MAX_SYMBOLS / CHUNK_SIZE;
+    static const size_t NUM_SHARDS = 16;
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string_view, uint32_t> ids;
+    };
+
+    Shard shards[NUM_SHARDS];
+    /* taken to add a symbol to the chunks */
+    std::mutex add_mutex;
+    /* fixed array of chunk pointers, strings never move once added */
+    std::unique_ptr<std::unique_ptr<std::string[]>[]> chunks;
+    std::atomic<uint32_t> count;
+    std::atomic<size_t> bytes;
+};
+
+/* immutable set of labels sorted by name. The labels are stored as pairs of
+ * symbols in a single refcounted block with a precomputed hash, so that copies
+ * are cheap and comparisons only look at the symbol ids. */
+class LabelSet {
+public:
+    struct Symbols {
+        uint32_t name, value;
+
+        bool operator==(const Symbols& rhs) const
+        {
+            return name == rhs.name && value == rhs.value;
+        }
+    };
+
+    /* a label of the set, the strings are owned by the symbol table */
+    struct LabelRef {
+        const std::string& name;
+        const std::string& value;
+    };
+
+    class const_iterator {
+    public:
+        const_iterator(const Symbols* p) : p(p) {}
+
+        LabelRef operator*() const
+        {
+            auto& table = SymbolTable::global();
+            return {table.lookup(p->name), table.lookup(p->value)};
+        }
+        const_iterator& operator++()
+        {
+            p++;
+            return *this;
+        }
+        bool operator==(const const_iterator& rhs) const { return p == rhs.p; }
+        bool operator!=(const const_iterator& rhs) const { return p != rhs.p; }
+
+    private:
+        const Symbols* p;
+    };
+
+    LabelSet() : rep(nullptr) {}
+    LabelSet(const std::vector<Label>& labels);
+    LabelSet(std::initializer_list<Label> labels)
+        : LabelSet(std::vector<Label>(labels))
+    {}
+    LabelSet(const LabelSet& rhs) : rep(rhs.rep)
+    {
+        if (rep) rep->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    LabelSet(LabelSet&& rhs) noexcept : rep(rhs.rep) { rhs.rep = nullptr; }
+    ~LabelSet() { release(); }
+
+    LabelSet& operator=(const LabelSet& rhs);
+    LabelSet& operator=(LabelSet&& rhs) noexcept;
+
+    /* build a label set from symbol pairs in any order */
+    static LabelSet from_symbols(std::vector<Symbols>&& symbols);
+
+    size_t size() const { return rep ? rep->size : 0; }
+    bool empty() const { return size() == 0; }
+    const Symbols* symbols() const { return rep ? rep->data() : nullptr; }
+    const_iterator begin() const { return symbols(); }
+    const_iterator end() const { return symbols() + size(); }
+    size_t hash() const { return rep ? rep->hash : 0; }
+
+    bool operator==(const LabelSet& rhs) const;
+    bool operator!=(const LabelSet& rhs) const { return !(*this == rhs); }
+
+    /* value of the label, empty if the set does not have it */
+    const std::string& get(std::string_view name) const;
+
+    /* labels identifying the aggregation group of this set: the labels in
+     * names for by, or all but those in names and the metric name for
+     * without */
+    LabelSet grouping(const std::vector<uint32_t>& names, bool without) const;
+    LabelSet drop_metric_name() const;
+
+private:
+    struct Rep {
+        std::atomic<uint32_t> refs;
+        uint32_t size;
+        size_t hash;
+
+        Symbols* data() { return reinterpret_cast<Symbols*>(this + 1); }
+    };
+
+    Rep* rep;
+
+    void release();
+};
+
+/* matcher of the series in shard index of count, i.e. __shard__="1_of_4". It
+ * is not a label of the series, the queriers select the series whose
+ * series_shard() is index. Its value is interned, so the matcher stays
+ * valid. */
+LabelMatcher shard_matcher(size_t index, size_t count);
+/* the shard selected by a matcher, false if it is not a shard matcher */
+bool parse_shard_matcher(const LabelMatcher& matcher, size_t& index,
+                         size_t& count);
+/* the shard of a series, from a hash of the label names and values so that
+ * it does not depend on the symbol table of the process */
+size_t series_shard(const LabelSet& labels, size_t count);
+
+inline std::string lset2str(const LabelSet& lset)
 {
     std::string str = "";
     for (auto&& l : lset) {
@@ -86,4 +252,13 @@ static std::string lset2str(const std::vector<Label>& lset)
 
 } // namespace promql
 
+namespace std {
+template <> struct hash<promql::LabelSet> {
+    size_t operator()(const promql::LabelSet& lset) const
+    {
+        return lset.hash();
+    }
+};
+} // namespace std
+
 #endif
@@ -0,0 +1,48 @@
+#ifndef _PROMQL_MEMORY_STORAGE_H_
+#define _PROMQL_MEMORY_STORAGE_H_
+
+#include "promql/storage.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace promql {
+
+/* simple in-memory storage, mainly useful for tests and as a reference
+ * implementation of the optional querier capabilities */
+class MemoryStorage : public Storage {
+public:
+    struct MemSeries {
+        LabelSet labels;
+        std::vector<std::pair<uint64_t, double>> samples;
+    };
+
+    MemoryStorage(bool aggregate_pushdown = true)
+        : num_samples(0), aggregate_pushdown(aggregate_pushdown)
+    {}
+
+    virtual std::shared_ptr<Querier> querier(uint64_t mint, uint64_t maxt);
+    virtual void label_values(const std::string& name,
+                              std::unordered_set<std::string>& values);
+    virtual std::shared_ptr<Appender> appender();
+    /* the samples of each series are kept in a single chunk */
+    virtual bool get_stats(StorageStats& stats);
+
+    void add(const LabelSet& labels, uint64_t t, double v);
+
+    /* copy the samples in [mint, maxt] of all series matching the matchers */
+    void snapshot(const std::vector<LabelMatcher>& matchers, uint64_t mint,
+                  uint64_t maxt, std::vector<MemSeries>& result);
+
+    bool is_aggregate_pushdown() const { return aggregate_pushdown; }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<LabelSet, MemSeries> series;
+    size_t num_samples;
+    bool aggregate_pushdown;
+};
+
+} // namespace promql
+
+#endif
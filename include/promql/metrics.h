@@ -0,0 +1,100 @@
+#ifndef _PROMQL_METRICS_H_
+#define _PROMQL_METRICS_H_
+
+#include "promql/histogram.h"
+#include "promql/labels.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace promql {
+
+/* monotonic counter updated from many threads. The count is split over
+ * cache-line sized slots picked by thread, so that the threads incrementing
+ * it do not contend on the same cache line, and summed when read. */
+class Counter {
+public:
+    static const size_t NUM_SLOTS = 16;
+
+    Counter()
+    {
+        for (auto&& slot : slots) {
+            slot.value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(uint64_t n = 1)
+    {
+        slots[thread_slot()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t get_value() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value;
+    };
+
+    Slot slots[NUM_SLOTS];
+
+    static size_t thread_slot();
+};
+
+/* metrics of a process exposed in the Prometheus text format. The metrics
+ * are registered once, typically when the process starts, and the returned
+ * counters and histograms are updated without going through the registry.
+ * Gauges are computed by a function when the metrics are rendered. */
+class MetricRegistry {
+public:
+    using GaugeFunc = std::function<double()>;
+
+    /* upper bounds of the buckets of the rendered histograms, in the unit of
+     * the metric after scaling */
+    static const std::vector<double> DEFAULT_BUCKETS;
+
+    Counter& counter(const std::string& name, const std::string& help,
+                     const std::vector<Label>& labels = {});
+    /* the values recorded in the histogram are multiplied by scale when
+     * rendered, e.g. 1e-6 for latencies recorded in microseconds and
+     * exposed in seconds */
+    Histogram& histogram(const std::string& name, const std::string& help,
+                         const std::vector<Label>& labels = {},
+                         double scale = 1.0);
+    void gauge(const std::string& name, const std::string& help,
+               const std::vector<Label>& labels, GaugeFunc func);
+
+    std::string render() const;
+
+private:
+    enum class MetricType { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Metric {
+        std::vector<Label> labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Histogram> histogram;
+        double scale = 1.0;
+        GaugeFunc gauge;
+    };
+
+    struct Family {
+        std::string name, help;
+        MetricType type;
+        std::vector<Metric> metrics;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<Family> families; /* in the order they are registered */
+    std::unordered_map<std::string, size_t> index;
+
+    void add_metric(const std::string& name, const std::string& help,
+                    MetricType type, Metric&& metric);
+};
+
+} // namespace promql
+
+#endif
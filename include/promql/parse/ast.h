@@ -7,24 +7,66 @@
 #include "promql/parse/token.h"
 #include "promql/value.h"
 
+#include <deque>
 #include <memory>
+#include <memory_resource>
+#include <new>
+#include <string_view>
 #include <vector>
 
 namespace promql {
 
 class ASTVisitor;
 
+/* the text of a query, which the names, matchers, groupings and string
+ * literals of its nodes are views of. A literal with escapes is decoded into
+ * literals, so that it does not differ from its text only in the query. The
+ * nodes are allocated from its arena and released all at once with it. The
+ * parser and the plan of the query hold it, the nodes may be used and must be
+ * destroyed while either is alive. */
+struct QueryText {
+    explicit QueryText(std::string query) : query(std::move(query)) {}
+
+    std::string query;
+    std::deque<std::string> literals;
+    std::pmr::monotonic_buffer_resource arena;
+};
+
+/* @ modifier of selectors and subqueries */
+enum class AtModifier {
+    NONE,
+    TIMESTAMP, /* @ <timestamp> */
+    START,     /* @ start() */
+    END,       /* @ end() */
+};
+
 class ASTNode {
 public:
+    virtual ~ASTNode() {}
+
     virtual Duration get_range() const { return Duration{0}; }
     virtual Duration get_offset() const { return Duration{0}; }
+    virtual AtModifier get_at() const { return AtModifier::NONE; }
+    virtual uint64_t get_at_timestamp() const { return 0; }
 
     virtual ValueType type() const { return ValueType::NONE; }
 
     virtual void visit(ASTVisitor& visitor) = 0;
 };
 
-using PASTNode = std::unique_ptr<ASTNode>;
+/* destroys a node in the arena of its text, which keeps the memory */
+struct NodeDeleter {
+    void operator()(ASTNode* node) const { node->~ASTNode(); }
+};
+
+template <typename T> using PNode = std::unique_ptr<T, NodeDeleter>;
+using PASTNode = PNode<ASTNode>;
+
+template <typename T> PNode<T> make_node(QueryText& text)
+{
+    void* mem = text.arena.allocate(sizeof(T), alignof(T));
+    return PNode<T>(new (mem) T());
+}
 
 class UnaryNode;
 class BinaryNode;
@@ -54,6 +96,7 @@ public:
     UnaryNode() : operand(nullptr) {}
     ASTNode* get_operand() const { return this->operand.get(); }
     void set_operand(PASTNode&& operand) { this->operand = std::move(operand); }
+    PASTNode release_operand() { return std::move(operand); }
     Token get_op() const { return this->op; }
     void set_op(Token op) { this->op = op; }
 
@@ -72,6 +115,8 @@ public:
     ASTNode* get_rhs() const { return this->rhs.get(); }
     void set_lhs(PASTNode&& lhs) { this->lhs = std::move(lhs); }
     void set_rhs(PASTNode&& rhs) { this->rhs = std::move(rhs); }
+    PASTNode release_lhs() { return std::move(lhs); }
+    PASTNode release_rhs() { return std::move(rhs); }
     Token get_op() const { return this->op; }
     void set_op(Token op) { this->op = op; }
     bool is_return_bool() const { return return_bool; }
@@ -79,8 +124,10 @@ public:
 
     virtual ValueType type() const
     {
-        if (lhs->type() == ValueType::SCALAR &&
-            rhs->type() == ValueType::SCALAR)
+        /* binary expressions nest on the left, check the right operand first
+         * so that typing a long chain of them stays linear */
+        if (rhs->type() == ValueType::SCALAR &&
+            lhs->type() == ValueType::SCALAR)
             return ValueType::SCALAR;
         return ValueType::VECTOR;
     }
@@ -90,20 +137,20 @@ public:
 private:
     PASTNode lhs, rhs;
     Token op;
-    bool return_bool;
+    bool return_bool = false;
 };
 
 class StringLiteralNode : public ASTNode {
 public:
-    std::string get_value() const { return value; }
-    void set_value(const std::string& val) { value = val; }
+    std::string_view get_value() const { return value; }
+    void set_value(std::string_view val) { value = val; }
 
     virtual ValueType type() const { return ValueType::STRING; }
 
     virtual void visit(ASTVisitor& visitor) { visitor.visit(this); }
 
 private:
-    std::string value;
+    std::string_view value;
 };
 
 class NumberLiteralNode : public ASTNode {
@@ -125,6 +172,8 @@ public:
     void set_func(const ExecFunction* f) { func = f; }
     const std::vector<PASTNode>& get_args() const { return args; }
     void add_arg(PASTNode&& arg) { args.push_back(std::move(arg)); }
+    void set_arg(size_t idx, PASTNode&& arg) { args[idx] = std::move(arg); }
+    PASTNode release_arg(size_t idx) { return std::move(args[idx]); }
 
     virtual ValueType type() const { return func->return_type; }
 
@@ -143,10 +192,18 @@ public:
     void set_op(Token op) { this->op = op; }
     ASTNode* get_expr() const { return expr.get(); }
     void set_expr(PASTNode&& expr) { this->expr = std::move(expr); }
+    PASTNode release_expr() { return std::move(expr); }
     ASTNode* get_param() const { return param.get(); }
     void set_param(PASTNode&& param) { this->param = std::move(param); }
-    const std::vector<std::string>& get_grouping() const { return grouping; }
-    void add_grouping(const std::string& gr) { grouping.push_back(gr); }
+    PASTNode release_param() { return std::move(param); }
+    const std::vector<std::string_view>& get_grouping() const
+    {
+        return grouping;
+    }
+    void set_grouping(std::vector<std::string_view>&& grouping)
+    {
+        this->grouping = std::move(grouping);
+    }
     void set_without(bool w) { without = w; }
     bool is_without() const { return without; }
 
@@ -157,56 +214,80 @@ public:
 private:
     PASTNode expr, param;
     Token op;
-    std::vector<std::string> grouping;
+    std::vector<std::string_view> grouping;
     bool without;
 };
 
 class VectorSelectorNode : public ASTNode {
 public:
-    std::string get_name() const { return name; }
-    void set_name(const std::string& name) { this->name = name; }
+    std::string_view get_name() const { return name; }
+    void set_name(std::string_view name) { this->name = name; }
     const std::vector<LabelMatcher>& get_matchers() const { return matchers; }
-    void add_matcher(MatchOp op, const std::string& name,
-                     const std::string& value)
+    void add_matcher(MatchOp op, std::string_view name, std::string_view value)
     {
         matchers.emplace_back(op, name, value);
     }
+    void set_matchers(std::vector<LabelMatcher>&& matchers)
+    {
+        this->matchers = std::move(matchers);
+    }
     Duration get_offset() const { return offset; }
     void set_offset(Duration offset) { this->offset = offset; }
+    virtual AtModifier get_at() const { return at; }
+    virtual uint64_t get_at_timestamp() const { return at_timestamp; }
+    void set_at(AtModifier at, uint64_t ts = 0)
+    {
+        this->at = at;
+        at_timestamp = ts;
+    }
 
     virtual ValueType type() const { return ValueType::VECTOR; }
 
     virtual void visit(ASTVisitor& visitor) { visitor.visit(this); }
 
 private:
-    std::string name;
-    Duration offset;
+    std::string_view name;
+    Duration offset{0};
+    AtModifier at = AtModifier::NONE;
+    uint64_t at_timestamp = 0;
     std::vector<LabelMatcher> matchers;
 };
 
 class MatrixSelectorNode : public ASTNode {
 public:
-    std::string get_name() const { return name; }
-    void set_name(const std::string& name) { this->name = name; }
+    std::string_view get_name() const { return name; }
+    void set_name(std::string_view name) { this->name = name; }
     const std::vector<LabelMatcher>& get_matchers() const { return matchers; }
-    void add_matcher(MatchOp op, const std::string& name,
-                     const std::string& value)
+    void add_matcher(MatchOp op, std::string_view name, std::string_view value)
     {
         matchers.emplace_back(op, name, value);
     }
+    void set_matchers(std::vector<LabelMatcher>&& matchers)
+    {
+        this->matchers = std::move(matchers);
+    }
     virtual Duration get_range() const { return range; }
     void set_range(Duration range) { this->range = range; }
     virtual Duration get_offset() const { return offset; }
     void set_offset(Duration offset) { this->offset = offset; }
+    virtual AtModifier get_at() const { return at; }
+    virtual uint64_t get_at_timestamp() const { return at_timestamp; }
+    void set_at(AtModifier at, uint64_t ts = 0)
+    {
+        this->at = at;
+        at_timestamp = ts;
+    }
 
     virtual ValueType type() const { return ValueType::MATRIX; }
 
     virtual void visit(ASTVisitor& visitor) { visitor.visit(this); }
 
 private:
-    std::string name;
-    Duration range;
-    Duration offset;
+    std::string_view name;
+    Duration range{0};
+    Duration offset{0};
+    AtModifier at = AtModifier::NONE;
+    uint64_t at_timestamp = 0;
     std::vector<LabelMatcher> matchers;
 };
 
@@ -214,20 +295,32 @@ class SubqueryNode : public ASTNode {
 public:
     ASTNode* get_expr() const { return expr.get(); }
     void set_expr(PASTNode&& expr) { this->expr = std::move(expr); }
+    PASTNode release_expr() { return std::move(expr); }
     virtual Duration get_range() const { return range; }
     void set_range(Duration range) { this->range = range; }
     Duration get_step() const { return step; }
     void set_step(Duration step) { this->step = step; }
     virtual Duration get_offset() const { return offset; }
     void set_offset(Duration offset) { this->offset = offset; }
+    virtual AtModifier get_at() const { return at; }
+    virtual uint64_t get_at_timestamp() const { return at_timestamp; }
+    void set_at(AtModifier at, uint64_t ts = 0)
+    {
+        this->at = at;
+        at_timestamp = ts;
+    }
+
+    virtual ValueType type() const { return ValueType::MATRIX; }
 
     virtual void visit(ASTVisitor& visitor) { visitor.visit(this); }
 
 private:
     PASTNode expr;
-    Duration range;
-    Duration step;
-    Duration offset;
+    Duration range{0};
+    Duration step{0};
+    Duration offset{0};
+    AtModifier at = AtModifier::NONE;
+    uint64_t at_timestamp = 0;
 };
 
 } // namespace promql
@@ -0,0 +1,59 @@
+#ifndef _PROMQL_CANCELLATION_H_
+#define _PROMQL_CANCELLATION_H_
+
+#include "promql/common.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+namespace promql {
+
+/* cooperative cancellation of a running query. The executors check the token
+ * between nodes, steps and series, and abort the query with an
+ * ExecutionError once it is cancelled or past its deadline. cancel() may be
+ * called from any thread. */
+class CancellationToken {
+public:
+    CancellationToken()
+        : cancelled(false),
+          deadline(std::chrono::steady_clock::time_point::max()), waiters(0)
+    {}
+
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    bool is_cancelled() const
+    {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+
+    /* must be set before the query starts */
+    void set_timeout(Duration timeout)
+    {
+        deadline = std::chrono::steady_clock::now() + timeout;
+    }
+
+    /* makes this the token of a query run by the request of owner on
+     * behalf of other requests, see QueryCoalescer. The query is then
+     * stopped by the owner only while no other request waits for it, the
+     * waiters leave once their own token is cancelled. Must be called before
+     * the query starts. */
+    void share(std::shared_ptr<const CancellationToken> owner)
+    {
+        this->owner = std::move(owner);
+    }
+    void add_waiter() { waiters.fetch_add(1, std::memory_order_relaxed); }
+    void remove_waiter() { waiters.fetch_sub(1, std::memory_order_relaxed); }
+
+    /* throws if the query is cancelled or timed out */
+    void check() const;
+
+private:
+    std::atomic<bool> cancelled;
+    std::chrono::steady_clock::time_point deadline;
+    std::shared_ptr<const CancellationToken> owner;
+    std::atomic<int> waiters;
+};
+
+} // namespace promql
+
+#endif
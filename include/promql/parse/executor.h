@@ -2,11 +2,19 @@
 #define _PROMQL_EXECUTOR_H_
 
 #include "promql/parse/ast.h"
+#include "promql/parse/cancellation.h"
+#include "promql/parse/explain.h"
+#include "promql/parse/memory_tracker.h"
+#include "promql/parse/planner.h"
+#include "promql/parse/query_stats.h"
 #include "promql/storage.h"
 #include "promql/value.h"
 
+#include <map>
 #include <set>
 #include <stack>
+#include <tuple>
+#include <unordered_set>
 
 namespace promql {
 
@@ -21,12 +29,77 @@ struct EvalContext {
     std::unique_ptr<VectorValue> outvec;
 };
 
+inline uint64_t sub_timestamp(uint64_t ts, uint64_t dur)
+{
+    return ts > dur ? ts - dur : 0;
+}
+
+/* building blocks shared by the range and the instant executor */
+double vec_elt_binop(Token op, double lhs, double rhs, bool& keep);
+std::unique_ptr<VectorValue> vec_scalar_binop(Token op, VectorValue* lhs,
+                                              ScalarValue* rhs, bool swap,
+                                              bool logical, EvalContext& ctx);
+std::unique_ptr<VectorValue> vec_vec_binop(Token op, VectorValue* lhs,
+                                           VectorValue* rhs, bool logical,
+                                           EvalContext& ctx);
+std::unique_ptr<VectorValue>
+aggregate(Token op, const std::vector<uint32_t>& grouping, bool without,
+          double param, VectorValue* vec, EvalContext& ctx);
+
+/* select the samples in [mint, maxt] of all series matching the matchers,
+ * the samples read are accounted to the tracker and the token is checked
+ * between series if there are ones */
+std::shared_ptr<MatrixValue>
+fetch(Queryable* queryable, const std::vector<LabelMatcher>& matchers,
+      uint64_t mint, uint64_t maxt,
+      std::pmr::memory_resource* mr = std::pmr::get_default_resource(),
+      MemoryTracker* tracker = nullptr,
+      const CancellationToken* token = nullptr);
+
+/* evaluate the aggregation on the querier at each step in [start, end],
+ * returns null if the aggregation or the querier does not support it */
+std::unique_ptr<MatrixValue> push_down_aggregation(
+    Queryable* queryable, AggregationNode* node, uint64_t start, uint64_t end,
+    uint64_t step,
+    std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
 class Executor : public ASTVisitor {
 public:
     Executor(Queryable* queryable, ASTNode* root, SystemTime start,
              SystemTime end, Duration interval);
+    Executor(Queryable* queryable, const QueryPlan* plan, SystemTime start,
+             SystemTime end, Duration interval);
 
     std::unique_ptr<ExecValue> execute();
+    /* evaluate a subexpression of the plan at each step in [start, end], the
+     * result is allocated from the arena of this executor */
+    std::shared_ptr<MatrixValue> eval_range(ASTNode* node, uint64_t start,
+                                            uint64_t end, Duration interval);
+
+    /* stream subexpressions through operator pipelines when possible */
+    void set_streaming(bool streaming) { this->streaming = streaming; }
+
+    void set_limits(const QueryLimits& limits) { tracker.set_limits(limits); }
+    /* charge the query to a budget shared with other executors instead of
+     * the limits, see QueryBudget */
+    void set_budget(QueryBudget* budget) { tracker.set_budget(budget); }
+    const MemoryTracker& get_tracker() const { return tracker; }
+
+    void set_cancellation_token(std::shared_ptr<CancellationToken> token)
+    {
+        this->token = std::move(token);
+    }
+
+    /* report the progress of the query to its active query slot */
+    void set_active_query(ActiveQuery* query)
+    {
+        tracker.set_active_query(query);
+    }
+
+    /* statistics of the execution so far */
+    QueryStats get_stats() const;
+    /* record the costs of each evaluated node into the profile */
+    void set_profile(QueryProfile* profile) { this->profile = profile; }
 
     virtual void visit(UnaryNode* node);
     virtual void visit(BinaryNode* node);
@@ -43,20 +116,49 @@ private:
         const std::vector<ExecValue*>&, EvalContext&)>;
 
     Queryable* queryable;
+    const QueryPlan* plan;
     ASTNode* root;
+    uint64_t query_start, query_end; /* time range of the whole query */
     uint64_t start_timestamp, end_timestamp;
     Duration interval;
-    std::stack<std::unique_ptr<MatrixValue>> value_stack;
+    bool streaming;
+    std::shared_ptr<CancellationToken> token;
+    QueryStats stats;
+    QueryProfile* profile;
+    /* all values of the query are allocated from the arena and released at
+     * once with the executor, it must outlive them. The arena gets its
+     * memory from the tracker. The small blocks freed during the query are
+     * pooled for reuse and the large buffers are returned to the tracker,
+     * so the operands and windows freed along a long range query do not add
+     * up. */
+    MemoryTracker tracker;
+    std::pmr::unsynchronized_pool_resource arena;
+    AllocationCounter allocations; /* of the values, from the arena */
+    std::stack<std::shared_ptr<MatrixValue>> value_stack;
+    HeldSamples held; /* by the values on the stack and in the cache */
+    std::vector<std::shared_ptr<MatrixValue>> scans;
+    /* results of common subexpressions, keyed by id and time range */
+    std::map<std::tuple<size_t, uint64_t, uint64_t, uint64_t>,
+             std::shared_ptr<MatrixValue>>
+        cse_cache;
 
-    void push_value(std::unique_ptr<MatrixValue>&& val);
-    std::unique_ptr<MatrixValue> pop_value();
+    void eval(ASTNode* node);
+    void check_cancelled() const
+    {
+        if (token) token->check();
+    }
+    void eval_step_invariant(ASTNode* node);
+    bool eval_pipeline(ASTNode* node);
+    uint64_t at_time(const ASTNode* node, uint64_t ts) const;
+    void push_value(std::shared_ptr<MatrixValue>&& val);
+    std::shared_ptr<MatrixValue> pop_value();
 
     std::unique_ptr<MatrixValue> range_eval(EvalFunc&& func,
                                             const std::vector<ASTNode*>& exprs);
 
-    std::unique_ptr<VectorValue>
-    aggregation(Token op, const std::vector<std::string>& grouping,
-                bool without, double param, VectorValue* vec, EvalContext& ctx);
+    std::shared_ptr<MatrixValue>
+    select(const ASTNode* selector, const std::vector<LabelMatcher>& matchers,
+           uint64_t mint, uint64_t maxt);
 };
 
 } // namespace promql
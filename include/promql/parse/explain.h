@@ -0,0 +1,78 @@
+#ifndef _PROMQL_EXPLAIN_H_
+#define _PROMQL_EXPLAIN_H_
+
+#include "promql/parse/memory_tracker.h"
+#include "promql/parse/planner.h"
+#include "promql/value.h"
+
+#include <chrono>
+#include <sstream>
+#include <unordered_map>
+
+namespace promql {
+
+/* costs of a node measured by EXPLAIN ANALYZE. The times and the memory
+ * include the evaluation of the children, the counts are of the output. */
+struct NodeProfile {
+    std::chrono::nanoseconds wall_time{}, cpu_time{};
+    size_t calls = 0; /* evaluations, a subquery may evaluate its expression
+                         several times */
+    size_t series = 0, samples = 0;
+    size_t bytes = 0; /* allocated for the values, freed ones included */
+};
+
+using QueryProfile = std::unordered_map<const ASTNode*, NodeProfile>;
+
+/* measures the evaluation of a node into the profile if there is one, the
+ * output is recorded by finish(). Nothing is recorded if the evaluation
+ * throws. */
+class NodeProfiler {
+public:
+    NodeProfiler(QueryProfile* profile, const ASTNode* node,
+                 const AllocationCounter& allocations);
+
+    void finish(const ExecValue* result);
+
+private:
+    QueryProfile* profile;
+    const ASTNode* node;
+    const AllocationCounter& allocations;
+    std::chrono::steady_clock::time_point start_wall;
+    std::chrono::nanoseconds start_cpu;
+    size_t start_bytes;
+};
+
+/* dumps a plan as JSON: the node tree annotated with the decisions of the
+ * planner and, if a profile is given, the costs of the nodes */
+class PlanExplainer : public ASTVisitor {
+public:
+    PlanExplainer(const QueryPlan* plan, const QueryProfile* profile = nullptr)
+        : plan(plan), profile(profile)
+    {}
+
+    std::string explain();
+
+    virtual void visit(UnaryNode* node);
+    virtual void visit(BinaryNode* node);
+    virtual void visit(StringLiteralNode* node);
+    virtual void visit(NumberLiteralNode* node);
+    virtual void visit(FuncCallNode* node);
+    virtual void visit(AggregationNode* node);
+    virtual void visit(VectorSelectorNode* node);
+    virtual void visit(MatrixSelectorNode* node);
+    virtual void visit(SubqueryNode* node);
+
+private:
+    const QueryPlan* plan;
+    const QueryProfile* profile;
+    std::stringstream ss;
+
+    void begin(ASTNode* node, const std::string& name);
+    void end(ASTNode* node, const std::vector<ASTNode*>& children);
+    void explain_time(ASTNode* node);
+    const NodeProfile* find_profile(const ASTNode* node) const;
+};
+
+} // namespace promql
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _PROMQL_FINGERPRINT_H_
+#define _PROMQL_FINGERPRINT_H_
+
+#include "promql/parse/ast.h"
+
+#include <cstdint>
+
+namespace promql {
+
+/* prints an expression with its number and string literals, the values of
+ * its label matchers but the metric name, and its @ timestamps replaced by
+ * ?. The queries sent by a dashboard panel differ in these only, e.g. with
+ * the instance picked by the user, so they share the same fingerprint. The
+ * matchers are sorted by label name, ranges, offsets and grouping labels are
+ * kept as they change the cost of the query. */
+class QueryFingerprinter : public ASTVisitor {
+public:
+    std::string fingerprint(ASTNode* node);
+
+    /* FNV-1a hash of a fingerprint, stable across processes */
+    static uint64_t hash(const std::string& fingerprint);
+
+    virtual void visit(UnaryNode* node);
+    virtual void visit(BinaryNode* node);
+    virtual void visit(StringLiteralNode* node);
+    virtual void visit(NumberLiteralNode* node);
+    virtual void visit(FuncCallNode* node);
+    virtual void visit(AggregationNode* node);
+    virtual void visit(VectorSelectorNode* node);
+    virtual void visit(MatrixSelectorNode* node);
+    virtual void visit(SubqueryNode* node);
+
+private:
+    std::string out;
+
+    void print_selector(const std::vector<LabelMatcher>& matchers);
+    void print_modifiers(ASTNode* node);
+};
+
+} // namespace promql
+
+#endif
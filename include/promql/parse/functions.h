@@ -6,6 +6,7 @@
 
 #include <functional>
 #include <memory>
+#include <string_view>
 
 namespace promql {
 
@@ -25,7 +26,7 @@ struct ExecFunction {
         : name(name), pfunc(fp), arg_types(argtypes), return_type(rettype)
     {}
 
-    static const ExecFunction* get(const std::string& name);
+    static const ExecFunction* get(std::string_view name);
 };
 
 } // namespace promql
@@ -0,0 +1,79 @@
+#ifndef _PROMQL_INSTANT_EXECUTOR_H_
+#define _PROMQL_INSTANT_EXECUTOR_H_
+
+#include "promql/parse/executor.h"
+
+namespace promql {
+
+/* evaluates a plan at a single timestamp. Unlike the range executor, it works
+ * on vectors directly without materializing one-point matrices for each
+ * subexpression. Scalars are carried as vectors with a single sample. */
+class InstantExecutor : public ASTVisitor {
+public:
+    InstantExecutor(Queryable* queryable, const QueryPlan* plan,
+                    SystemTime time);
+
+    std::unique_ptr<ExecValue> execute();
+
+    void set_limits(const QueryLimits& limits) { tracker.set_limits(limits); }
+    /* charge the query to a budget shared with other executors instead of
+     * the limits, see QueryBudget */
+    void set_budget(QueryBudget* budget) { tracker.set_budget(budget); }
+    const MemoryTracker& get_tracker() const { return tracker; }
+
+    void set_cancellation_token(std::shared_ptr<CancellationToken> token)
+    {
+        this->token = std::move(token);
+    }
+
+    /* report the progress of the query to its active query slot */
+    void set_active_query(ActiveQuery* query)
+    {
+        tracker.set_active_query(query);
+    }
+
+    /* statistics of the execution so far */
+    QueryStats get_stats() const;
+    /* record the costs of each evaluated node into the profile */
+    void set_profile(QueryProfile* profile) { this->profile = profile; }
+
+    virtual void visit(UnaryNode* node);
+    virtual void visit(BinaryNode* node);
+    virtual void visit(StringLiteralNode* node);
+    virtual void visit(NumberLiteralNode* node);
+    virtual void visit(FuncCallNode* node);
+    virtual void visit(AggregationNode* node);
+    virtual void visit(VectorSelectorNode* node);
+    virtual void visit(MatrixSelectorNode* node);
+    virtual void visit(SubqueryNode* node);
+
+private:
+    Queryable* queryable;
+    const QueryPlan* plan;
+    uint64_t timestamp;
+    std::shared_ptr<CancellationToken> token;
+    QueryStats stats;
+    QueryProfile* profile;
+    MemoryTracker tracker;
+    /* must outlive the values, see Executor */
+    std::pmr::unsynchronized_pool_resource arena;
+    AllocationCounter allocations; /* of the values, from the arena */
+    std::stack<std::shared_ptr<ExecValue>> value_stack;
+    HeldSamples held; /* by the values on the stack and in the cache */
+    std::vector<std::shared_ptr<MatrixValue>> scans;
+    /* results of common subexpressions, keyed by id */
+    std::unordered_map<size_t, std::shared_ptr<ExecValue>> cse_cache;
+
+    void eval(ASTNode* node);
+    std::shared_ptr<VectorValue> eval_vector(ASTNode* node);
+    std::shared_ptr<MatrixValue> eval_matrix(ASTNode* node);
+    uint64_t at_time(const ASTNode* node) const;
+
+    std::shared_ptr<MatrixValue>
+    select(const ASTNode* selector, const std::vector<LabelMatcher>& matchers,
+           uint64_t mint, uint64_t maxt);
+};
+
+} // namespace promql
+
+#endif
@@ -5,6 +5,7 @@
 
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 namespace promql {
@@ -14,9 +15,13 @@ public:
     LexError(const std::string& message) : std::runtime_error(message) {}
 };
 
+/* tokenizer over a view of the query. The words, numbers and string literals
+ * it returns are slices of the input, so the input must outlive the lexer.
+ * Only a string literal with escapes is decoded into a buffer of the lexer,
+ * which is valid until the next string literal is read. */
 class Lexer {
 public:
-    Lexer(const std::string& input);
+    Lexer(std::string_view input);
 
     size_t cur_pos() const;
     void peek_begin();
@@ -26,31 +31,43 @@ public:
     Token get_token();
 
     char get_last_char() const { return last_char; }
-    std::string get_last_word() const { return last_word; }
-    std::string get_last_string() const { return last_string; }
+    std::string_view get_last_word() const { return last_word; }
+    std::string_view get_last_string() const { return last_string; }
+    /* whether the last string literal had escapes, it is then decoded into
+     * the buffer of the lexer rather than a slice of the input */
+    bool is_last_string_decoded() const { return string_decoded; }
     char get_last_char_lit() const { return last_char_lit; }
-    std::string get_last_strnum() const { return last_strnum; }
+    std::string_view get_last_strnum() const { return last_strnum; }
 
 private:
-    std::string buf;
+    std::string_view buf;
     size_t pos;
+    size_t char_pos; /* offset of last_char */
 
     size_t peek_start_pos;
+    size_t peek_start_char_pos;
 
     int radix;
     /* last word, number and char in the input */
-    std::string last_word;
+    std::string_view last_word;
     char last_char;
     char last_char_lit;
-    std::string last_string;
-    std::string last_strnum;
+    std::string_view last_string;
+    std::string_view last_strnum;
+    size_t strnum_start;
+
+    /* decoded string literal with escapes */
+    std::string string_buf;
+    bool string_decoded;
 
     bool brace_open;
     bool bracket_open;
 
     /* read a char from input */
     char read_char();
-    Token lookup_keyword(const std::string& key);
+    /* the input from start up to last_char */
+    std::string_view slice(size_t start) const;
+    Token lookup_keyword(std::string_view key);
 
     char lex_char_lit();
     Token lex_number(int rad);
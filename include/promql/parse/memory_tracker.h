@@ -0,0 +1,170 @@
+#ifndef _PROMQL_MEMORY_TRACKER_H_
+#define _PROMQL_MEMORY_TRACKER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+
+namespace promql {
+
+struct ActiveQuery;
+
+/* resource limits of a single query, zero means unlimited */
+struct QueryLimits {
+    size_t max_bytes = 0;   /* memory held by the values of the query */
+    size_t max_samples = 0; /* samples read from the storage */
+};
+
+/* the samples read and the memory held by all executors of a query, e.g. its
+ * shards, the sub-ranges it is split into and its subqueries, which may run
+ * concurrently. Their trackers charge it against the limits of the query, so
+ * that evaluating a query in parts does not multiply its budget. Exceeding a
+ * limit throws an ExecutionError. */
+class QueryBudget {
+public:
+    QueryBudget(const QueryLimits& limits = QueryLimits())
+        : limits(limits), samples(0), bytes(0), peak_bytes(0),
+          held_samples(0), peak_samples(0)
+    {}
+
+    QueryBudget(const QueryBudget&) = delete;
+    QueryBudget& operator=(const QueryBudget&) = delete;
+
+    /* must be set before the budget is charged */
+    void set_limits(const QueryLimits& limits) { this->limits = limits; }
+    const QueryLimits& get_limits() const { return limits; }
+
+    void add_samples(size_t n);
+    void add_bytes(size_t n);
+    void sub_bytes(size_t n) { bytes.fetch_sub(n); }
+    /* samples held by the values of the executors */
+    void hold_samples(size_t n);
+    void release_samples(size_t n) { held_samples.fetch_sub(n); }
+
+    size_t get_samples() const { return samples.load(); }
+    /* high-water marks of what the executors held at the same time */
+    size_t get_peak_bytes() const { return peak_bytes.load(); }
+    size_t get_peak_samples() const { return peak_samples.load(); }
+
+private:
+    QueryLimits limits;
+    std::atomic<size_t> samples, bytes, peak_bytes, held_samples, peak_samples;
+};
+
+/* memory resource accounting the allocations of a query against the budget
+ * of the query and the memory limit shared by all queries of the process.
+ * The query arena allocates its chunks from the tracker. Exceeding a limit
+ * aborts the query with an ExecutionError. */
+class MemoryTracker : public std::pmr::memory_resource {
+public:
+    MemoryTracker(
+        std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : upstream(upstream), budget(&own_budget), active_query(nullptr),
+          bytes(0), samples(0), series(0), held_samples(0)
+    {}
+    ~MemoryTracker() { budget->release_samples(held_samples); }
+
+    /* limits of a query run by this tracker alone */
+    void set_limits(const QueryLimits& limits)
+    {
+        own_budget.set_limits(limits);
+    }
+    const QueryLimits& get_limits() const { return budget->get_limits(); }
+
+    /* charge a budget shared with the other executors of the query instead,
+     * it must outlive the tracker */
+    void set_budget(QueryBudget* budget) { this->budget = budget; }
+    QueryBudget* get_budget() const { return budget; }
+
+    /* also account the samples and the memory to the slot of the query in the
+     * active query tracker */
+    void set_active_query(ActiveQuery* query) { active_query = query; }
+    ActiveQuery* get_active_query() const { return active_query; }
+
+    /* account samples read from the storage */
+    void add_samples(size_t n);
+    /* account a series read from the storage with its samples */
+    void add_series(size_t samples)
+    {
+        series++;
+        add_samples(samples);
+    }
+
+    /* samples held by the values of the executor, see HeldSamples */
+    void hold_samples(size_t n)
+    {
+        held_samples += n;
+        budget->hold_samples(n);
+    }
+    void release_samples(size_t n)
+    {
+        held_samples -= n;
+        budget->release_samples(n);
+    }
+
+    size_t get_bytes() const { return bytes; }
+    size_t get_samples() const { return samples; }
+    size_t get_series() const { return series; }
+    /* of all the executors charged to the budget */
+    size_t get_peak_bytes() const { return budget->get_peak_bytes(); }
+    size_t get_peak_samples() const { return budget->get_peak_samples(); }
+
+    /* memory limit of all queries of the process, zero means unlimited */
+    static void set_global_limit(size_t max_bytes);
+    static size_t get_global_bytes();
+
+private:
+    std::pmr::memory_resource* upstream;
+    QueryBudget own_budget;
+    QueryBudget* budget;
+    ActiveQuery* active_query;
+    size_t bytes, samples, series, held_samples;
+
+    static std::atomic<size_t> global_bytes, global_limit;
+
+    virtual void* do_allocate(size_t bytes, size_t alignment);
+    virtual void do_deallocate(void* p, size_t bytes, size_t alignment);
+    virtual bool do_is_equal(const std::pmr::memory_resource& other) const
+        noexcept
+    {
+        return this == &other;
+    }
+};
+
+/* memory resource counting the bytes allocated through it. The values of a
+ * query are allocated through one on top of the arena so that EXPLAIN
+ * ANALYZE can tell the bytes allocated by each node, which the chunks of the
+ * arena requested from the tracker do not. */
+class AllocationCounter : public std::pmr::memory_resource {
+public:
+    AllocationCounter(std::pmr::memory_resource* upstream)
+        : upstream(upstream), allocated(0)
+    {}
+
+    /* bytes allocated so far, the deallocations are not subtracted */
+    size_t get_allocated() const { return allocated; }
+
+private:
+    std::pmr::memory_resource* upstream;
+    size_t allocated;
+
+    virtual void* do_allocate(size_t bytes, size_t alignment)
+    {
+        auto* p = upstream->allocate(bytes, alignment);
+        allocated += bytes;
+        return p;
+    }
+    virtual void do_deallocate(void* p, size_t bytes, size_t alignment)
+    {
+        upstream->deallocate(p, bytes, alignment);
+    }
+    virtual bool do_is_equal(const std::pmr::memory_resource& other) const
+        noexcept
+    {
+        return this == &other;
+    }
+};
+
+} // namespace promql
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef _PROMQL_OPERATORS_H_
+#define _PROMQL_OPERATORS_H_
+
+#include "promql/parse/ast.h"
+#include "promql/parse/cancellation.h"
+#include "promql/parse/memory_tracker.h"
+#include "promql/parse/planner.h"
+#include "promql/storage.h"
+#include "promql/value.h"
+
+namespace promql {
+
+using SeriesBatch = std::vector<MatrixValue::Series>;
+
+/* pull-based physical operator. Series flow through a pipeline of operators
+ * in batches so that only the batches in flight and the state of the
+ * operators are held in memory, instead of the whole result of every
+ * subexpression. The series produced by an operator are allocated from its
+ * memory resource, usually the memory tracker of the query. */
+class Operator {
+public:
+    /* a batch holds up to BATCH_SIZE series, and is cut once it holds
+     * BATCH_SAMPLES samples so that a batch of long series does not
+     * outweigh the result of an aggregation */
+    static const size_t BATCH_SIZE = 64;
+    static const size_t BATCH_SAMPLES = 1024;
+
+    virtual ~Operator() {}
+
+    virtual void open() = 0;
+    /* replace the content of the batch with the next series, returns false
+     * once the operator is exhausted */
+    virtual bool next_batch(SeriesBatch& batch) = 0;
+    virtual void close() = 0;
+};
+
+/* streams the raw samples in [mint, maxt] of the matching series. The
+ * samples read are accounted to the tracker and the token is checked between
+ * series if there are ones, every pipeline is driven by its selectors. */
+class SelectorOperator : public Operator {
+public:
+    SelectorOperator(Queryable* queryable,
+                     const std::vector<LabelMatcher>& matchers, uint64_t mint,
+                     uint64_t maxt, MemoryTracker* tracker = nullptr,
+                     const CancellationToken* token = nullptr)
+        : queryable(queryable), matchers(matchers), mint(mint), maxt(maxt),
+          tracker(tracker), token(token)
+    {}
+
+    virtual void open();
+    virtual bool next_batch(SeriesBatch& batch);
+    virtual void close();
+
+private:
+    Queryable* queryable;
+    std::vector<LabelMatcher> matchers;
+    uint64_t mint, maxt;
+    MemoryTracker* tracker;
+    const CancellationToken* token;
+    std::shared_ptr<Querier> querier;
+    std::shared_ptr<SeriesSet> series_set;
+};
+
+/* samples the latest point within the lookback delta at each step */
+class InstantSelectorOperator : public Operator {
+public:
+    InstantSelectorOperator(
+        std::unique_ptr<Operator>&& child, uint64_t start, uint64_t end,
+        uint64_t step, uint64_t offset,
+        std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        : child(std::move(child)), start(start), end(end), step(step),
+          offset(offset), mr(mr), input_idx(0)
+    {}
+
+    virtual void open() { child->open(); }
+    virtual bool next_batch(SeriesBatch& batch);
+    virtual void close() { child->close(); }
+
+private:
+    std::unique_ptr<Operator> child;
+    uint64_t start, end, step, offset;
+    std::pmr::memory_resource* mr;
+    SeriesBatch input;
+    size_t input_idx;
+};
+
+/* applies a function taking a single range vector to the windows of each
+ * step */
+class RangeFunctionOperator : public Operator {
+public:
+    RangeFunctionOperator(
+        std::unique_ptr<Operator>&& child, const ExecFunction* func,
+        uint64_t start, uint64_t end, uint64_t step, uint64_t range,
+        uint64_t offset,
+        std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        : child(std::move(child)), func(func), start(start), end(end),
+          step(step), range(range), offset(offset), mr(mr), input_idx(0)
+    {}
+
+    virtual void open() { child->open(); }
+    virtual bool next_batch(SeriesBatch& batch);
+    virtual void close() { child->close(); }
+
+private:
+    std::unique_ptr<Operator> child;
+    const ExecFunction* func;
+    uint64_t start, end, step, range, offset;
+    std::pmr::memory_resource* mr;
+    SeriesBatch input;
+    size_t input_idx;
+};
+
+/* binary operation between a vector and a scalar literal */
+class ScalarBinaryOperator : public Operator {
+public:
+    ScalarBinaryOperator(
+        std::unique_ptr<Operator>&& child, Token op, double scalar, bool swap,
+        bool return_bool,
+        std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        : child(std::move(child)), op(op), scalar(scalar), swap(swap),
+          return_bool(return_bool), mr(mr)
+    {}
+
+    virtual void open() { child->open(); }
+    virtual bool next_batch(SeriesBatch& batch);
+    virtual void close() { child->close(); }
+
+private:
+    std::unique_ptr<Operator> child;
+    Token op;
+    double scalar;
+    bool swap, return_bool;
+    std::pmr::memory_resource* mr;
+};
+
+/* sum/min/max/count/avg of the child series, only the groups are held in
+ * memory while the child is drained and each is freed once output. The
+ * aggregation is pushed down to the querier instead when it supports it. */
+class AggregateOperator : public Operator {
+public:
+    AggregateOperator(
+        std::unique_ptr<Operator>&& child, Queryable* queryable,
+        AggregationNode* node, uint64_t start, uint64_t end, uint64_t step,
+        std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        : child(std::move(child)), queryable(queryable), node(node),
+          grouping(SymbolTable::global().intern(node->get_grouping())),
+          start(start), end(end), step(step), mr(mr)
+    {}
+
+    virtual void open();
+    virtual bool next_batch(SeriesBatch& batch);
+    virtual void close();
+
+private:
+    struct AggregationGroup {
+        LabelSet labels;
+        std::pmr::vector<double> values;
+        std::pmr::vector<uint64_t> counts;
+    };
+
+    std::unique_ptr<Operator> child;
+    Queryable* queryable;
+    AggregationNode* node;
+    std::vector<uint32_t> grouping;
+    uint64_t start, end, step;
+    std::pmr::memory_resource* mr;
+    std::unordered_map<LabelSet, AggregationGroup> groups;
+    std::unordered_map<LabelSet, AggregationGroup>::iterator output;
+    std::unique_ptr<MatrixValue> pushed; /* result of the push-down */
+    size_t pushed_idx;
+
+    void add_series(const MatrixValue::Series& series);
+};
+
+/* builds a pipeline evaluating the expression at each step in [start, end],
+ * returns null if some part of the expression cannot be streamed. The series
+ * are allocated from the tracker if there is one. */
+std::unique_ptr<Operator>
+build_pipeline(Queryable* queryable, const QueryPlan* plan, ASTNode* node,
+               uint64_t start, uint64_t end, uint64_t step,
+               MemoryTracker* tracker = nullptr,
+               const CancellationToken* token = nullptr);
+
+/* drain the operator into a matrix allocated from mr */
+std::unique_ptr<MatrixValue>
+collect(Operator& op,
+        std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+} // namespace promql
+
+#endif
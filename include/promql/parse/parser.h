@@ -21,36 +21,47 @@ public:
 
 class Parser {
 public:
-    Parser(const std::string& input);
+    /* the parser keeps its own copy of the query, which the lexer, the
+     * tokens and the nodes refer to */
+    Parser(std::string input);
 
     Token last_token() const { return cur_tok; }
 
-    std::unique_ptr<ASTNode> parse();
+    /* the nodes are valid, and must be destroyed, while the parser or the
+     * text is alive. The text is handed to the planner with them. */
+    PASTNode parse();
+    std::shared_ptr<QueryText> get_text() const { return text; }
 
-    static Duration parse_duration(const std::string& dur);
+    static Duration parse_duration(std::string_view dur);
 
 private:
+    std::shared_ptr<QueryText> text;
     Lexer lex;
     Token cur_tok;
 
     void read_token();
     void match(Token expected);
 
-    std::unique_ptr<ASTNode> expression();
-    std::unique_ptr<ASTNode> subquery_expression();
-    std::unique_ptr<ASTNode> comparison_expression();
-    std::unique_ptr<ASTNode> arith_expression();
-    std::unique_ptr<ASTNode> term();
-    std::unique_ptr<ASTNode> factor();
-    std::unique_ptr<ASTNode> power();
-    std::unique_ptr<ASTNode> atom();
-
-    std::unique_ptr<ASTNode> vector_selector(const std::string& name);
-    void labels(std::vector<std::string>& labels);
+    PASTNode expression();
+    PASTNode subquery_expression();
+    PASTNode comparison_expression();
+    PASTNode arith_expression();
+    PASTNode term();
+    PASTNode factor();
+    PASTNode power();
+    PASTNode atom();
+
+    PASTNode vector_selector(std::string_view name);
+    void modifiers(Duration& offset, AtModifier& at, uint64_t& at_timestamp);
+    Duration subquery_step();
+    void labels(std::vector<std::string_view>& labels);
     void label_matchers(std::vector<LabelMatcher>& matchers);
 
-    std::unique_ptr<ASTNode> function_call(const std::string& name);
-    std::unique_ptr<ASTNode> aggregation();
+    PASTNode function_call(std::string_view name);
+    PASTNode aggregation();
+
+    /* the last string literal, kept in the text if it was decoded */
+    std::string_view last_string();
 };
 
 } // namespace promql
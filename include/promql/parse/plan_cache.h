@@ -0,0 +1,60 @@
+#ifndef _PROMQL_PLAN_CACHE_H_
+#define _PROMQL_PLAN_CACHE_H_
+
+#include "promql/parse/planner.h"
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace promql {
+
+/* bounded LRU cache of the plans of queries, keyed by the normalized query
+ * string. The cached plans are immutable and shared by all executions of the
+ * query, so the queries sent over and over by dashboards and rules are
+ * parsed and planned once. */
+class PlanCache {
+public:
+    using PlanFunc = std::function<std::unique_ptr<QueryPlan>()>;
+
+    PlanCache(size_t max_entries = 1024)
+        : max_entries(max_entries), hits(0), misses(0)
+    {}
+
+    /* the query with the comments dropped and the whitespace outside of
+     * string literals collapsed, so that formatting does not change the
+     * key */
+    static std::string normalize(const std::string& query);
+
+    /* the plan of the query, parsed and planned on a miss. The errors of
+     * the parser are thrown and not cached. */
+    std::shared_ptr<const QueryPlan> get(const std::string& query);
+    /* the plan cached under the key, planned with func on a miss. The errors
+     * of func are thrown and not cached. */
+    std::shared_ptr<const QueryPlan> get(const std::string& key,
+                                         const PlanFunc& func);
+
+    /* the plan cached for a normalized query, null on a miss */
+    std::shared_ptr<const QueryPlan> find(const std::string& key);
+    void insert(const std::string& key, std::shared_ptr<const QueryPlan> plan);
+
+    void clear();
+
+    size_t size() const;
+    size_t get_hits() const;
+    size_t get_misses() const;
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const QueryPlan>>;
+
+    size_t max_entries;
+    mutable std::mutex mutex;
+    std::list<Entry> lru; /* most recently used first */
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+    size_t hits, misses;
+};
+
+} // namespace promql
+
+#endif
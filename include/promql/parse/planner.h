@@ -0,0 +1,143 @@
+#ifndef _PROMQL_PLANNER_H_
+#define _PROMQL_PLANNER_H_
+
+#include "promql/parse/ast.h"
+
+#include <unordered_map>
+#include <unordered_set>
+
+namespace promql {
+
+/* a storage selection shared by all selectors with identical matchers. The
+ * scanned time range is [start - before, end - after] of the evaluation. */
+struct Scan {
+    std::vector<LabelMatcher> matchers;
+    Duration before, after;
+};
+
+/* physical plan run by the executor. The executors do not modify the plan,
+ * so one may be shared by concurrent executions of the query. */
+struct QueryPlan {
+    /* the nodes refer to the text and are allocated from it, it is declared
+     * first to outlive them */
+    std::shared_ptr<const QueryText> text;
+    PASTNode root;
+    std::string key; /* structural key of the query, see StructuralHasher */
+    std::string fingerprint; /* see QueryFingerprinter */
+    std::vector<Scan> scans;
+    std::unordered_map<const ASTNode*, size_t> scan_index; /* selector ->
+                                                              scan */
+    /* structurally identical subexpressions share the same id and are
+     * evaluated only once */
+    std::unordered_map<const ASTNode*, size_t> cse_index;
+    /* subexpressions that do not depend on the evaluation timestamp, they
+     * are evaluated once and broadcast to all steps */
+    std::unordered_set<const ASTNode*> step_invariant;
+    /* uses @ start() or @ end(), the value at a step then depends on the
+     * range of the query */
+    bool range_dependent = false;
+
+    const Scan* get_scan(const ASTNode* selector, size_t& idx) const
+    {
+        auto it = scan_index.find(selector);
+        if (it == scan_index.end()) return nullptr;
+        idx = it->second;
+        return &scans[idx];
+    }
+
+    bool get_cse(const ASTNode* node, size_t& id) const
+    {
+        auto it = cse_index.find(node);
+        if (it == cse_index.end()) return false;
+        id = it->second;
+        return true;
+    }
+
+    bool is_step_invariant(const ASTNode* node) const
+    {
+        return step_invariant.find(node) != step_invariant.end();
+    }
+
+    /* whether the range query with the steps in [start, end] may be
+     * evaluated as sub-ranges of its steps, e.g. by the results cache. A
+     * single step query is not a range, it is returned with its own type. */
+    bool is_splittable(uint64_t start, uint64_t end, uint64_t step) const
+    {
+        return !range_dependent && start != end && step > 1;
+    }
+};
+
+/* computes a canonical key from the operators, matchers, ranges, offsets and
+ * grouping of an expression, identical subexpressions get the same key */
+class StructuralHasher : public ASTVisitor {
+public:
+    const std::string& key_of(ASTNode* node);
+    const std::unordered_map<const ASTNode*, std::string>& get_keys() const
+    {
+        return keys;
+    }
+    size_t hash_of(ASTNode* node)
+    {
+        return std::hash<std::string>()(key_of(node));
+    }
+
+    virtual void visit(UnaryNode* node);
+    virtual void visit(BinaryNode* node);
+    virtual void visit(StringLiteralNode* node);
+    virtual void visit(NumberLiteralNode* node);
+    virtual void visit(FuncCallNode* node);
+    virtual void visit(AggregationNode* node);
+    virtual void visit(VectorSelectorNode* node);
+    virtual void visit(MatrixSelectorNode* node);
+    virtual void visit(SubqueryNode* node);
+
+private:
+    std::unordered_map<const ASTNode*, std::string> keys;
+    std::string cur_key;
+};
+
+/* rewrites the type-checked AST returned by the parser into a plan:
+ *  - fold scalar-only subtrees, e.g. 2 * 60
+ *  - collapse nested unary operators and turn the rest into binary ops
+ *  - push subquery offsets into the selectors
+ *  - share the storage scans of selectors with identical matchers
+ *  - find common subexpressions
+ *  - mark step-invariant subexpressions */
+class Planner : public ASTVisitor {
+public:
+    /* plans the AST parsed from text, which the plan holds */
+    std::unique_ptr<QueryPlan> plan(PASTNode&& root,
+                                    std::shared_ptr<QueryText> text);
+
+    virtual void visit(UnaryNode* node);
+    virtual void visit(BinaryNode* node);
+    virtual void visit(StringLiteralNode* node);
+    virtual void visit(NumberLiteralNode* node);
+    virtual void visit(FuncCallNode* node);
+    virtual void visit(AggregationNode* node);
+    virtual void visit(VectorSelectorNode* node);
+    virtual void visit(MatrixSelectorNode* node);
+    virtual void visit(SubqueryNode* node);
+
+private:
+    QueryPlan* cur_plan;
+    QueryText* cur_text;    /* the new nodes are allocated from */
+    PASTNode cur;           /* node being rewritten */
+    Duration pushed_offset; /* offset pushed down from enclosing subqueries */
+    Duration outer_before, outer_after; /* time range covered by enclosing
+                                           subqueries */
+    bool fixed_time; /* inside a subquery with @ */
+    std::unordered_map<std::string, size_t> scan_keys;
+
+    PASTNode rewrite(PASTNode&& node);
+    void find_common_subexpressions();
+    void find_step_invariants();
+    void check_at(const ASTNode* node);
+    void add_scan(const ASTNode* selector,
+                  const std::vector<LabelMatcher>& matchers, Duration before,
+                  Duration after);
+};
+
+} // namespace promql
+
+#endif
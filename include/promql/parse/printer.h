@@ -21,6 +21,7 @@ private:
     std::string padding;
 
     void enter(ASTNode* child);
+    void print_at(ASTNode* node);
 };
 
 } // namespace promql
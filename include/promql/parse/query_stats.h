@@ -0,0 +1,78 @@
+#ifndef _PROMQL_QUERY_STATS_H_
+#define _PROMQL_QUERY_STATS_H_
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+namespace promql {
+
+/* statistics of a query, returned with the response on stats=all */
+struct QueryStats {
+    using Clock = std::chrono::steady_clock;
+
+    /* time spent in each phase. The operator pipelines fetch series as they
+     * pull them, that time is counted as evaluation time. */
+    Clock::duration parse_time{}, plan_time{}, select_time{}, eval_time{},
+        encode_time{};
+
+    size_t series = 0;  /* series selected from the storage */
+    size_t samples = 0; /* samples read from the storage */
+    /* high-water marks of the samples held by the values of the query and
+     * of the memory of its arena */
+    size_t peak_samples = 0;
+    size_t peak_bytes = 0;
+    size_t steps = 0; /* evaluation steps of all functions and operators */
+
+    /* adds up the stats of the parts of a query. The peaks are merged with
+     * max, the parts that run at the same time share a budget and report the
+     * peaks of what they held together, see QueryBudget. */
+    QueryStats& operator+=(const QueryStats& rhs);
+
+    std::string to_json() const;
+};
+
+/* tells when the values of an executor stop being held, for the peak of the
+ * samples held by a query. A value is held from the end of the node that
+ * returned it until the end of the node that consumed it, so the operands of
+ * a node are counted with its result. The values shared with the cache of
+ * common subexpressions are held until the query ends. */
+class HeldSamples {
+public:
+    /* a node starts, returns the mark to end it with */
+    size_t enter() const { return released; }
+    /* the node returned its value, returns the samples of its operands
+     * which are freed with it */
+    size_t leave(size_t mark)
+    {
+        auto freed = released - mark;
+        released = mark;
+        return freed;
+    }
+    /* a value was taken by the node consuming it, the shared ones outlive
+     * the node */
+    void consume(size_t samples, bool shared)
+    {
+        if (!shared) released += samples;
+    }
+
+private:
+    size_t released = 0;
+};
+
+/* adds the time spent in its scope to a phase of the stats */
+class StatsTimer {
+public:
+    StatsTimer(QueryStats::Clock::duration& phase)
+        : phase(phase), start(QueryStats::Clock::now())
+    {}
+    ~StatsTimer() { phase += QueryStats::Clock::now() - start; }
+
+private:
+    QueryStats::Clock::duration& phase;
+    QueryStats::Clock::time_point start;
+};
+
+} // namespace promql
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef _PROMQL_QUERY_TRACKER_H_
+#define _PROMQL_QUERY_TRACKER_H_
+
+#include "promql/common.h"
+#include "promql/parse/cancellation.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace promql {
+
+enum class QueryPhase : uint32_t {
+    PARSING,
+    PLANNING,
+    EXECUTING,
+    RENDERING,
+};
+
+const char* phase2str(QueryPhase phase);
+
+/* a slot of the active query tracker. It is written by the thread running the
+ * query and read by any thread, all fields are atomics. The slots may live in
+ * a file mapping, so they contain no pointers. */
+struct ActiveQuery {
+    static const size_t MAX_QUERY_LENGTH = 1024;
+
+    std::atomic<uint64_t> id; /* zero if the slot is free */
+    std::atomic<int64_t> start; /* milliseconds since epoch */
+    std::atomic<uint32_t> phase;
+    std::atomic<uint64_t> samples;
+    std::atomic<int64_t> bytes;
+    /* the text packed in words, truncated and NUL-terminated. A reader may
+     * copy it while the slot is reused, the words are atomics so that the
+     * torn copy is only discarded and not a data race. */
+    std::atomic<uint64_t> query[MAX_QUERY_LENGTH / sizeof(uint64_t)];
+
+    void set_phase(QueryPhase phase)
+    {
+        this->phase.store((uint32_t)phase, std::memory_order_relaxed);
+    }
+    void add_samples(size_t n)
+    {
+        samples.fetch_add(n, std::memory_order_relaxed);
+    }
+    void add_bytes(int64_t n) { bytes.fetch_add(n, std::memory_order_relaxed); }
+};
+
+/* registry of the queries being executed. The slots are claimed and released
+ * with atomic operations only, so tracking a query never blocks. If a path
+ * is given the slots are mapped from that file: the queries left in it when
+ * the process died are reported as crashed queries on the next start. */
+class ActiveQueryTracker {
+public:
+    struct QueryInfo {
+        uint64_t id;
+        std::string query;
+        SystemTime start;
+        Duration elapsed;
+        QueryPhase phase;
+        size_t samples, bytes;
+    };
+
+    ActiveQueryTracker(size_t max_queries = 64, const std::string& path = "");
+    ~ActiveQueryTracker();
+
+    ActiveQueryTracker(const ActiveQueryTracker&) = delete;
+    ActiveQueryTracker& operator=(const ActiveQueryTracker&) = delete;
+
+    /* claim a slot for the query, the owner identifies the request of the
+     * query. Returns null if all slots are in use, the query is not tracked
+     * then. */
+    ActiveQuery* insert(const std::string& query,
+                        std::shared_ptr<CancellationToken> token,
+                        const void* owner = nullptr);
+    void remove(ActiveQuery* query);
+
+    /* cancel the query with the id, returns false if it is not running */
+    bool kill(uint64_t id);
+    /* cancel all queries of the owner */
+    void kill_owner(const void* owner);
+
+    std::vector<QueryInfo> get_active_queries() const;
+    const std::vector<QueryInfo>& get_crashed_queries() const
+    {
+        return crashed_queries;
+    }
+
+private:
+    /* id of a slot being filled */
+    static const uint64_t RESERVED = UINT64_MAX;
+
+    /* the parts of a slot that cannot be persisted. The holder keeps the
+     * token alive and is only touched by the thread of the query, the other
+     * threads use the raw pointer. The id of the slot serves as its
+     * generation: a pointer loaded between two reads of the same id belongs
+     * to the query with that id. Readers announce themselves so that the
+     * token is not released while they cancel it. */
+    struct Owner {
+        std::shared_ptr<CancellationToken> holder;
+        std::atomic<CancellationToken*> token;
+        std::atomic<uint32_t> readers;
+        std::atomic<const void*> request;
+    };
+
+    size_t max_queries;
+    size_t map_size;
+    void* map;
+    ActiveQuery* slots;
+    std::unique_ptr<Owner[]> owners;
+    std::atomic<uint64_t> next_id;
+    std::atomic<size_t> next_slot;
+    std::vector<QueryInfo> crashed_queries;
+
+    bool read_slot(const ActiveQuery& slot, QueryInfo& info) const;
+    bool cancel(size_t idx, uint64_t id);
+};
+
+} // namespace promql
+
+#endif
@@ -23,6 +23,7 @@ enum class Token {
     ASSIGN,
     COLON,
     SEMICOLON,
+    AT,
     STRING,
     NUMBER,
     DURATION,
@@ -106,6 +107,8 @@ static std::string tok2str(Token tok)
         return "COLON";
     case Token::SEMICOLON:
         return "SEMICOLON";
+    case Token::AT:
+        return "AT";
     case Token::STRING:
         return "STRING";
     case Token::NUMBER:
@@ -198,6 +201,7 @@ static std::string tok2str(Token tok)
 static MatchOp tok2mop(Token tok)
 {
     switch (tok) {
+    case Token::ASSIGN:
     case Token::EQL:
         return MatchOp::EQL;
     case Token::NEQ:
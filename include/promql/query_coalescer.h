@@ -0,0 +1,71 @@
+#ifndef _PROMQL_QUERY_COALESCER_H_
+#define _PROMQL_QUERY_COALESCER_H_
+
+#include "promql/parse/cancellation.h"
+#include "promql/parse/query_stats.h"
+#include "promql/value.h"
+
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+
+namespace promql {
+
+/* the result of a query shared by the requests coalesced into it */
+struct QueryResult {
+    std::shared_ptr<const ExecValue> value;
+    /* the cost of the query, accounted by the request that ran it only */
+    QueryStats stats;
+    bool shared = false; /* the query was run by another request */
+};
+
+/* deduplicates concurrent executions of identical queries (singleflight):
+ * the first request of a key runs the query and the requests arriving while
+ * it is running wait for its result instead of running it again. Nothing is
+ * kept once the query is done, see ResultsCache for that.
+ *
+ * The query runs under a token of its own, passed to func: it is stopped by
+ * the token of the request running it only while no other request waits.
+ * A request keeps running the query for the others after its own token is
+ * cancelled or timed out, and if it stopped the query anyway the waiters run
+ * it again. */
+class QueryCoalescer {
+public:
+    using QueryFunc =
+        std::function<QueryResult(std::shared_ptr<CancellationToken>)>;
+
+    QueryCoalescer() : coalesced(0) {}
+
+    /* the result of func, or of the query of the same key in flight. The
+     * error of the query is thrown to all its waiters, a waiter stops
+     * waiting with an ExecutionError once its own token is cancelled or
+     * timed out. */
+    QueryResult run(const std::string& key, const QueryFunc& func,
+                    std::shared_ptr<CancellationToken> token = nullptr);
+
+    /* requests served by the query of another one */
+    size_t get_coalesced() const;
+
+private:
+    struct Flight {
+        std::promise<QueryResult> promise;
+        std::shared_future<QueryResult> result;
+        std::shared_ptr<CancellationToken> token;
+        /* stopped by the token of the request running it, set before the
+         * result */
+        bool aborted = false;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+    size_t coalesced;
+
+    QueryResult lead(const std::string& key, Flight& flight,
+                     const QueryFunc& func,
+                     const std::shared_ptr<CancellationToken>& token);
+};
+
+} // namespace promql
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef _PROMQL_QUERY_SHARDER_H_
+#define _PROMQL_QUERY_SHARDER_H_
+
+#include "promql/parse/plan_cache.h"
+#include "promql/parse/planner.h"
+#include "promql/storage.h"
+#include "promql/value.h"
+
+#include "ctpl.h"
+
+#include <functional>
+
+namespace promql {
+
+/* selects only the series of one shard from the queryable. The selections of
+ * its queriers get a shard matcher so that the storage may skip the other
+ * shards, and the series it returns are filtered by series_shard(). */
+class ShardQueryable : public Queryable {
+public:
+    ShardQueryable(Queryable* queryable, size_t index, size_t count)
+        : queryable(queryable), index(index), count(count)
+    {}
+
+    virtual std::shared_ptr<Querier> querier(uint64_t mint, uint64_t maxt);
+    virtual void label_values(const std::string& name,
+                              std::unordered_set<std::string>& values)
+    {
+        queryable->label_values(name, values);
+    }
+
+private:
+    Queryable* queryable;
+    size_t index, count;
+};
+
+/* evaluates an aggregation of a series-local expression, e.g.
+ * sum by (job) (rate(x[5m])), on shards of the series concurrently and merges
+ * the per-shard groups with the outer aggregation. sum, min, max and count
+ * are merged with themselves (count as a sum), avg is evaluated as a sum and
+ * a count on each shard. */
+class QuerySharder {
+public:
+    /* evaluates a plan on a queryable */
+    using QueryFunc = std::function<std::unique_ptr<ExecValue>(
+        const QueryPlan* plan, Queryable* queryable)>;
+    /* plans the query again, for the shard plans that differ from it */
+    using PlanFunc = PlanCache::PlanFunc;
+
+    QuerySharder(ctpl::thread_pool* pool, size_t num_shards)
+        : pool(pool), num_shards(num_shards), op(Token::ERROR)
+    {}
+
+    /* whether the root of the plan is an aggregation that can be sharded */
+    static bool is_shardable(const QueryPlan* plan);
+
+    /* prepare the plans run on each shard, returns false if the query
+     * cannot be sharded. The shard plans that differ from the plan are
+     * looked up in the cache, keyed by the plan and the number of shards,
+     * and planned with replan on a miss. */
+    bool prepare(const QueryPlan* plan, const PlanFunc& replan,
+                 PlanCache* cache = nullptr);
+
+    /* the merged result of the prepared plans run with func on each shard of
+     * the queryable, func may be called concurrently */
+    std::unique_ptr<ExecValue> query(Queryable* queryable,
+                                     const QueryFunc& func) const;
+
+private:
+    ctpl::thread_pool* pool;
+    size_t num_shards;
+    Token op;
+    /* the plans evaluated on each shard, sum and count for avg */
+    std::vector<const QueryPlan*> shard_plans;
+    std::vector<std::shared_ptr<const QueryPlan>> owned_plans;
+};
+
+} // namespace promql
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _PROMQL_QUERY_SPLITTER_H_
+#define _PROMQL_QUERY_SPLITTER_H_
+
+#include "promql/common.h"
+#include "promql/value.h"
+
+#include "ctpl.h"
+
+#include <functional>
+#include <utility>
+
+namespace promql {
+
+/* runs task(i) for each i in [0, n) on the idle workers of the pool and on
+ * the calling thread, so that a saturated pool runs the tasks sequentially
+ * instead of waiting for itself. The first exception thrown by a task is
+ * rethrown once the running tasks have finished, the tasks not started yet
+ * are skipped. */
+void parallel_for(ctpl::thread_pool* pool, size_t n,
+                  const std::function<void(size_t)>& task);
+
+/* the sub-ranges of the steps start + k * step in [start, end] that do not
+ * cross a multiple of interval */
+std::vector<std::pair<uint64_t, uint64_t>>
+split_range(uint64_t start, uint64_t end, uint64_t step, uint64_t interval);
+
+/* splits long range queries into sub-ranges aligned to the interval, e.g.
+ * days, which are evaluated as independent queries in parallel and stitched
+ * back together. Each step of a range query is evaluated independently of
+ * the others, so the result is the same as that of the whole range. */
+class QuerySplitter {
+public:
+    /* evaluates the query at each step in [start, end] */
+    using QueryFunc = std::function<std::unique_ptr<MatrixValue>(
+        uint64_t start, uint64_t end)>;
+
+    /* the sub-queries are run on the pool by the workers that are idle, the
+     * calling thread evaluates the ones no worker has picked up */
+    QuerySplitter(ctpl::thread_pool* pool,
+                  Duration interval = std::chrono::hours(24))
+        : pool(pool), interval(interval)
+    {}
+
+    /* the result of the query at each step in [start, end], func may be
+     * called concurrently. The first exception thrown by a sub-query is
+     * rethrown once the running sub-queries have finished. */
+    std::unique_ptr<MatrixValue> query(uint64_t start, uint64_t end,
+                                       uint64_t step, const QueryFunc& func);
+
+private:
+    ctpl::thread_pool* pool;
+    Duration interval;
+};
+
+} // namespace promql
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _PROMQL_RESULTS_CACHE_H_
+#define _PROMQL_RESULTS_CACHE_H_
+
+#include "promql/common.h"
+#include "promql/value.h"
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace promql {
+
+/* caches the results of range queries in extents of steps. The entries are
+ * keyed by the normalized query, the step and the alignment of the steps, so
+ * that a query over a sliding window only evaluates the steps it has not seen
+ * before. The steps newer than now - max_freshness may still change as
+ * samples arrive and are never cached. Least recently used entries are
+ * evicted to keep the cache within its byte budget. */
+class ResultsCache {
+public:
+    /* evaluates the query at each step in [start, end] */
+    using QueryFunc = std::function<std::unique_ptr<MatrixValue>(
+        uint64_t start, uint64_t end)>;
+
+    ResultsCache(size_t max_bytes,
+                 Duration max_freshness = std::chrono::minutes(1))
+        : max_bytes(max_bytes), max_freshness(max_freshness), bytes(0),
+          hits(0), misses(0)
+    {}
+
+    /* the result of the query at each step in [start, end], the extents
+     * missing from the cache are evaluated with func */
+    std::unique_ptr<MatrixValue> query(const std::string& query,
+                                       uint64_t start, uint64_t end,
+                                       uint64_t step, uint64_t now,
+                                       const QueryFunc& func);
+
+    /* a sample at t was appended at now. The steps in the last
+     * max_freshness are never cached, so an older sample may change cached
+     * results and drops all entries. */
+    void add_sample(uint64_t t, uint64_t now);
+    /* drop all entries */
+    void invalidate();
+
+    size_t get_bytes() const;
+    /* steps served from the cache and steps evaluated */
+    size_t get_hits() const;
+    size_t get_misses() const;
+
+private:
+    /* the result of consecutive steps in [start, end] */
+    struct Extent {
+        uint64_t start, end;
+        std::shared_ptr<const MatrixValue> result;
+        size_t bytes;
+    };
+
+    struct Entry {
+        std::string key;
+        std::vector<Extent> extents; /* sorted and disjoint */
+        size_t bytes;
+    };
+
+    size_t max_bytes;
+    Duration max_freshness;
+    mutable std::mutex mutex;
+    std::list<Entry> lru; /* most recently used first */
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+    size_t bytes;
+    size_t hits, misses;
+
+    void put(const std::string& key, std::vector<Extent>&& extents,
+             uint64_t step);
+    void evict();
+};
+
+} // namespace promql
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef _PROMQL_SLOW_QUERY_LOG_H_
+#define _PROMQL_SLOW_QUERY_LOG_H_
+
+#include "promql/common.h"
+#include "promql/parse/query_stats.h"
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace promql {
+
+/* a query served by an endpoint, as written to the slow query log */
+struct QueryLogEntry {
+    SystemTime time; /* when the request started */
+    std::string endpoint, query;
+    std::string fingerprint; /* see QueryFingerprinter */
+    SystemTime start, end;   /* evaluated range, start for instant queries */
+    Duration step{0};
+    QueryStats::Clock::duration elapsed{};
+    QueryStats stats;
+    std::string error; /* empty if the query succeeded */
+
+    QueryLogEntry(const std::string& endpoint, const std::string& query)
+        : time(std::chrono::system_clock::now()), endpoint(endpoint),
+          query(query)
+    {}
+
+    /* one line of the log */
+    std::string to_json() const;
+};
+
+/* totals of the queries sharing a fingerprint */
+struct FingerprintStats {
+    std::string fingerprint;
+    uint64_t count = 0;      /* queries */
+    uint64_t slow_count = 0; /* queries over the threshold */
+    QueryStats::Clock::duration total_time{}, max_time{};
+    /* the time of all phases of the queries, summed over the threads of the
+     * split and sharded queries */
+    QueryStats::Clock::duration cpu_time{};
+    /* upper bound of the CPU time counted in cpu_time that was spent by
+     * other fingerprints, see SlowQueryLog */
+    QueryStats::Clock::duration cpu_time_error{};
+    size_t samples = 0;
+
+    std::string to_json() const;
+};
+
+/* accounts every query to its fingerprint and writes the queries running
+ * for at least a threshold to a JSON-lines file.
+ *
+ * The entries are written by a background thread: recording a query only
+ * takes a lock to update its fingerprint and to queue the entry, it never
+ * waits for the file. Once max_pending entries are queued the next ones are
+ * dropped and counted.
+ *
+ * At most max_fingerprints fingerprints are kept, the CPU times are counted
+ * with the space-saving algorithm: a new fingerprint replaces the one with
+ * the least CPU time and inherits that time as its error. A fingerprint
+ * that recurs thus climbs above the ones seen once instead of being evicted
+ * by the next newcomer, and its cpu_time minus cpu_time_error is a lower
+ * bound of its real CPU time. */
+class SlowQueryLog {
+public:
+    /* no file is written if path is empty, the fingerprints are still
+     * counted. Throws if the file cannot be opened. */
+    SlowQueryLog(const std::string& path = "",
+                 Duration threshold = std::chrono::seconds(10),
+                 size_t max_pending = 1024, size_t max_fingerprints = 10000);
+    ~SlowQueryLog();
+
+    SlowQueryLog(const SlowQueryLog&) = delete;
+    SlowQueryLog& operator=(const SlowQueryLog&) = delete;
+
+    /* returns true if the query is slow */
+    bool record(QueryLogEntry&& entry);
+
+    /* wait until the queued entries are written */
+    void flush();
+
+    /* the fingerprints by CPU time, the most expensive first */
+    std::vector<FingerprintStats> get_fingerprints(size_t limit = 100) const;
+
+    uint64_t get_logged() const;
+    uint64_t get_dropped() const;
+
+private:
+    Duration threshold;
+    size_t max_pending;
+    size_t max_fingerprints;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv, idle_cv;
+    std::deque<QueryLogEntry> pending;
+    bool writing;
+    bool stopping;
+    uint64_t logged, dropped;
+    std::unordered_map<std::string, FingerprintStats> fingerprints;
+    /* the fingerprints by CPU time, the keys point into fingerprints */
+    std::set<std::pair<QueryStats::Clock::duration, const std::string*>>
+        by_cpu_time;
+
+    std::ofstream file;
+    std::thread writer;
+
+    void account(const QueryLogEntry& entry, bool slow);
+    void write_entries();
+};
+
+} // namespace promql
+
+#endif
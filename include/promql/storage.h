@@ -2,6 +2,7 @@
 #define _PROMQL_STORAGE_H_
 
 #include "promql/labels.h"
+#include "promql/parse/token.h"
 
 #include <cstdint>
 #include <memory>
@@ -11,6 +12,8 @@ namespace promql {
 
 class SeriesIterator {
 public:
+    virtual ~SeriesIterator() {}
+
     virtual bool seek(uint64_t t) = 0;
     virtual std::pair<uint64_t, double> at() = 0;
     virtual bool next() = 0;
@@ -18,24 +21,73 @@ public:
 
 class Series {
 public:
-    virtual void labels(std::vector<Label>& labels) = 0;
+    virtual ~Series() {}
+
+    virtual void labels(LabelSet& labels) = 0;
     virtual std::unique_ptr<SeriesIterator> iterator() = 0;
 };
 
 class SeriesSet {
 public:
+    virtual ~SeriesSet() {}
+
     virtual bool next() = 0;
     virtual std::shared_ptr<Series> at() = 0;
 };
 
+/* aggregation that a querier may compute next to the data, e.g.
+ * sum by (job) (rate(x[5m])) */
+struct AggregateHints {
+    Token op;                          /* aggregation operator */
+    std::vector<std::string> grouping; /* grouping labels */
+    bool without;
+    std::string func; /* range function applied to each series before
+                         aggregation, empty for instant vector selectors */
+    uint64_t range; /* range of the range function, or the lookback delta of
+                       instant vector selectors */
+    uint64_t offset;
+    uint64_t start, end, step; /* evaluation steps */
+};
+
+/* partial aggregate of one group, may be merged with other partials of the
+ * same group by the executor */
+struct PartialAggregate {
+    struct Point {
+        uint64_t t;
+        double value;   /* sum for SUM/AVG, min for MIN, max for MAX */
+        uint64_t count; /* number of samples aggregated into this point */
+    };
+
+    LabelSet labels;
+    std::vector<Point> points;
+};
+
 class Querier {
 public:
+    virtual ~Querier() {}
+
+    /* the matchers may include a shard matcher, see shard_matcher(). A
+     * querier may return only the series of that shard or ignore it, the
+     * series of the other shards are filtered out by the caller. */
     virtual std::shared_ptr<SeriesSet>
     select(const std::vector<LabelMatcher>& matchers) = 0;
+
+    /* optional capability: compute per-group partial aggregates of the series
+     * matched by the matchers. Return false if the hints or a shard matcher
+     * are not supported, the executor falls back to select() in that
+     * case. */
+    virtual bool select_aggregate(const AggregateHints& hints,
+                                  const std::vector<LabelMatcher>& matchers,
+                                  std::vector<PartialAggregate>& partials)
+    {
+        return false;
+    }
 };
 
 class Queryable {
 public:
+    virtual ~Queryable() {}
+
     virtual std::shared_ptr<Querier> querier(uint64_t mint, uint64_t maxt) = 0;
     virtual void label_values(const std::string& name,
                               std::unordered_set<std::string>& values) = 0;
@@ -43,16 +95,30 @@ public:
 
 class Appender {
 public:
+    virtual ~Appender() {}
+
     virtual void add(const std::vector<Label>& labels, uint64_t t,
                      double v) = 0;
 
     virtual void commit() {}
 };
 
+/* sizes of a storage, reported by the /metrics endpoint of the server */
+struct StorageStats {
+    size_t series = 0;
+    size_t chunks = 0; /* blocks the samples of the series are stored in */
+    size_t samples = 0;
+    size_t bytes = 0; /* memory held by the samples and the series */
+};
+
 class Storage : public Queryable {
 public:
     virtual std::shared_ptr<Appender> appender() = 0;
     virtual void close() {}
+
+    /* optional capability: report the sizes of the storage. Return false if
+     * they are not known. */
+    virtual bool get_stats(StorageStats& stats) { return false; }
 };
 
 } // namespace promql
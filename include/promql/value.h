@@ -3,7 +3,11 @@
 
 #include "promql/labels.h"
 
+#include <limits>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace promql {
@@ -16,11 +20,19 @@ enum class ValueType {
     MATRIX,
 };
 
-/* values used during query execution */
+/* values used during query execution. The samples and points are allocated
+ * from the given memory resource, usually the arena of the running query.
+ * Vectors, matrices and series are move-only and their accessors return
+ * borrowed views; a deep copy must be requested explicitly with the memory
+ * resource it is allocated from, e.g. to take a result out of the arena. */
 class ExecValue {
 public:
+    virtual ~ExecValue() {}
+
     virtual ValueType type() const = 0;
     virtual std::string to_json() const = 0;
+    virtual size_t num_samples() const = 0;
+    virtual size_t num_series() const = 0;
 };
 
 class ScalarValue : public ExecValue {
@@ -31,6 +43,8 @@ public:
 
     virtual ValueType type() const { return ValueType::SCALAR; }
     virtual std::string to_json() const;
+    virtual size_t num_samples() const { return 1; }
+    virtual size_t num_series() const { return 1; }
 
 private:
     uint64_t t;
@@ -40,48 +54,109 @@ private:
 class VectorValue : public ExecValue {
 public:
     struct Sample {
-        std::vector<Label> metric;
+        LabelSet metric;
         ScalarValue value;
         Sample() : value(0, 0) {}
-        Sample(const std::vector<Label>& m, const ScalarValue& v)
+        Sample(const LabelSet& m, const ScalarValue& v)
             : metric(m), value(v)
         {}
     };
 
+    VectorValue(
+        std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        : samples(mr)
+    {}
+    VectorValue(const VectorValue& rhs, std::pmr::memory_resource* mr)
+        : samples(rhs.samples, mr)
+    {}
+    VectorValue(VectorValue&& rhs) = default;
+    VectorValue(const VectorValue&) = delete;
+    VectorValue& operator=(const VectorValue&) = delete;
+
     void add_sample(Sample&& s) { samples.push_back(std::move(s)); }
+    void reserve(size_t n) { samples.reserve(n); }
     virtual ValueType type() const { return ValueType::VECTOR; }
     virtual std::string to_json() const;
+    virtual size_t num_samples() const { return samples.size(); }
+    virtual size_t num_series() const { return samples.size(); }
 
-    const std::vector<Sample> get_samples() const { return samples; }
+    const std::pmr::vector<Sample>& get_samples() const { return samples; }
     void clear() { samples.clear(); }
 
 private:
-    std::vector<Sample> samples;
+    std::pmr::vector<Sample> samples;
 };
 
 class MatrixValue : public ExecValue {
 public:
     struct Series {
-        std::vector<Label> metric;
-        std::vector<ScalarValue> values;
+        LabelSet metric;
+        std::pmr::vector<ScalarValue> values;
 
-        Series() {}
-        Series(const std::vector<Label>& m, const std::vector<ScalarValue>& vs)
-            : metric(m), values(vs)
+        explicit Series(
+            std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+            : values(mr)
+        {}
+        Series(const LabelSet& m,
+               std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+            : metric(m), values(mr)
+        {}
+        template <typename InputIt>
+        Series(const LabelSet& m, InputIt first, InputIt last,
+               std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+            : metric(m), values(first, last, mr)
         {}
+        Series(const Series& rhs, std::pmr::memory_resource* mr)
+            : metric(rhs.metric), values(rhs.values, mr)
+        {}
+        Series(Series&& rhs) = default;
+        Series& operator=(Series&& rhs) = default;
+        Series(const Series&) = delete;
+        Series& operator=(const Series&) = delete;
     };
 
+    MatrixValue(
+        std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        : series(mr)
+    {}
+    MatrixValue(const MatrixValue& rhs, std::pmr::memory_resource* mr);
+    MatrixValue(MatrixValue&& rhs) = default;
+    MatrixValue(const MatrixValue&) = delete;
+    MatrixValue& operator=(const MatrixValue&) = delete;
+
     void add_series(Series&& s) { series.push_back(std::move(s)); }
     virtual ValueType type() const { return ValueType::MATRIX; }
     virtual std::string to_json() const;
+    virtual size_t num_samples() const;
+    virtual size_t num_series() const { return series.size(); }
 
-    const std::vector<Series>& get_series() const { return series; }
+    const std::pmr::vector<Series>& get_series() const { return series; }
+    /* move a series out of the matrix, an empty series is left behind */
+    Series release_series(size_t idx) { return std::move(series[idx]); }
     void clear() { series.clear(); }
 
 private:
-    std::vector<Series> series;
+    std::pmr::vector<Series> series;
 };
 
+/* concatenates the points of matrices over consecutive time ranges, the
+ * series are matched by their labels */
+class MatrixStitcher {
+public:
+    /* append the points of a matrix in [from, to] */
+    void append(const MatrixValue& mat, uint64_t from = 0,
+                uint64_t to = std::numeric_limits<uint64_t>::max());
+
+    std::unique_ptr<MatrixValue> finish();
+
+private:
+    std::vector<MatrixValue::Series> series;
+    std::unordered_map<LabelSet, size_t> index;
+};
+
+/* escape a string to be quoted in JSON */
+std::string json_escape(std::string_view str);
+
 static std::string valtype2str(ValueType vt)
 {
     switch (vt) {
@@ -0,0 +1,72 @@
+#ifndef _PROMQL_CONNECTION_WATCHER_H_
+#define _PROMQL_CONNECTION_WATCHER_H_
+
+#include "promql/common.h"
+#include "promql/parse/cancellation.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <sys/socket.h>
+
+namespace promql {
+
+/* cancels the queries whose client went away. While a request is evaluated
+ * by a worker nothing reads from its connection, so a closed connection goes
+ * unnoticed until the response is written. A background thread peeks at the
+ * watched sockets every interval instead: a socket that reads as end of file
+ * or fails was closed or reset by the client, and its token is cancelled.
+ *
+ * A client that shuts down its side of the connection after sending the
+ * request is taken as gone too.
+ *
+ * Most queries finish well within an interval, so a connection is only
+ * looked up by its addresses, from the background thread, once its query
+ * has run for an interval. The socket found is checked to still have the
+ * addresses before each peek: a descriptor closed with its connection and
+ * reused for another one is taken as gone. */
+class ConnectionWatcher {
+public:
+    ConnectionWatcher(Duration interval = std::chrono::milliseconds(100));
+    ~ConnectionWatcher();
+
+    ConnectionWatcher(const ConnectionWatcher&) = delete;
+    ConnectionWatcher& operator=(const ConnectionWatcher&) = delete;
+
+    /* watch the connection with the addresses until unwatch() is called
+     * with the returned id. The connection must stay open until then. */
+    uint64_t watch(const sockaddr* local, const sockaddr* remote,
+                   std::shared_ptr<CancellationToken> token);
+    void unwatch(uint64_t id);
+
+    /* the descriptor of the connected socket with the addresses, -1 if the
+     * process has none */
+    static int find_socket(const sockaddr* local, const sockaddr* remote);
+
+private:
+    struct Watch {
+        sockaddr_storage local, remote;
+        std::chrono::steady_clock::time_point since;
+        int fd; /* -1 until looked up */
+        std::shared_ptr<CancellationToken> token;
+    };
+
+    Duration interval;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping;
+    uint64_t next_id;
+    std::unordered_map<uint64_t, Watch> watches;
+    std::thread poller;
+
+    void poll_sockets();
+};
+
+} // namespace promql
+
+#endif
@@ -2,12 +2,27 @@
 #define _PROMQL_HTTP_SERVER_H_
 
 #include "promql/common.h"
+#include "promql/metrics.h"
+#include "promql/parse/cancellation.h"
+#include "promql/parse/memory_tracker.h"
+#include "promql/parse/plan_cache.h"
+#include "promql/parse/planner.h"
+#include "promql/parse/query_stats.h"
+#include "promql/parse/query_tracker.h"
+#include "promql/query_coalescer.h"
+#include "promql/query_sharder.h"
+#include "promql/query_splitter.h"
+#include "promql/results_cache.h"
+#include "promql/slow_query_log.h"
 #include "promql/storage.h"
 #include "promql/value.h"
+#include "promql/web/connection_watcher.h"
 #include "server_http.hpp"
 
 #include "ctpl.h"
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <unordered_map>
 
@@ -15,9 +30,50 @@ namespace promql {
 
 class HttpServer {
 public:
-    HttpServer(Storage* storage, int num_workers = 1);
+    /* the active queries are persisted in active_query_file if it is given,
+     * the queries running when the process died are reported on restart */
+    HttpServer(Storage* storage, int num_workers = 1,
+               const std::string& active_query_file = "");
 
+    /* serve the requests until stop() is called */
     void start();
+    void stop();
+
+    /* port to listen on, 9090 by default */
+    void set_port(unsigned short port) { server.config.port = port; }
+
+    /* limits applied to each query, see also MemoryTracker::set_global_limit
+     * for the memory limit of all queries */
+    void set_query_limits(const QueryLimits& limits) { this->limits = limits; }
+
+    /* upper bound of the time a query may run, a request can ask for a
+     * shorter one with the timeout parameter */
+    void set_query_timeout(Duration timeout) { query_timeout = timeout; }
+
+    /* cache the results of range queries within max_bytes, the steps in the
+     * last max_freshness are always evaluated */
+    void set_results_cache(size_t max_bytes,
+                           Duration max_freshness = std::chrono::minutes(1))
+    {
+        results_cache =
+            std::make_unique<ResultsCache>(max_bytes, max_freshness);
+    }
+
+    /* split range queries into sub-queries over the multiples of interval
+     * evaluated in parallel by the idle workers, zero disables it */
+    void set_split_interval(Duration interval) { split_interval = interval; }
+
+    /* evaluate the shardable aggregations, e.g. sum by (job) (rate(x[5m])),
+     * on num_shards shards of the series in parallel, one disables it */
+    void set_query_shards(size_t num_shards) { query_shards = num_shards; }
+
+    /* write the queries running for at least threshold to path as JSON
+     * lines. The totals of the queries by fingerprint are kept either way
+     * and served on /api/v1/status/query_fingerprints. */
+    void set_slow_query_log(const std::string& path, Duration threshold)
+    {
+        query_log = std::make_unique<SlowQueryLog>(path, threshold);
+    }
 
 private:
     using InternalHttpServer = SimpleWeb::Server<SimpleWeb::HTTP>;
@@ -26,13 +82,79 @@ private:
     InternalHttpServer server;
     int num_workers;
     ctpl::thread_pool pool;
+    QueryLimits limits;
+    Duration query_timeout;
+    Duration split_interval;
+    size_t query_shards;
+
+    /* the queries being executed, they are cancelled when the client of the
+     * request goes away or when they are killed through the API */
+    ActiveQueryTracker queries;
+    ConnectionWatcher connections;
+    std::unique_ptr<ResultsCache> results_cache;
+    QueryCoalescer coalescer;
+    PlanCache plan_cache;
+    std::unique_ptr<SlowQueryLog> query_log;
+
+    /* exposed on /metrics */
+    MetricRegistry metrics;
+    Histogram *insert_latency, *query_latency, *query_range_latency,
+        *explain_latency;
+    Histogram* parse_duration;
+    Histogram* pool_wait_duration;
+    Counter* samples_read;
+    Counter* ingested_samples;
+    Counter* slow_queries;
+    std::atomic<int64_t> pool_queued;
+
+    void register_metrics();
+    /* run the task of a request on the worker pool, the time from now
+     * until the task is done is recorded in latency */
+    void submit(Histogram* latency, std::function<void()> task);
+
+    /* track the query of the request and watch its connection until
+     * finish_query() is called */
+    std::shared_ptr<CancellationToken>
+    start_query(ActiveQuery*& active, uint64_t& watch,
+                const std::string& query_str,
+                const InternalHttpServer::Request& request, Duration timeout);
+    void finish_query(ActiveQuery* active, uint64_t watch);
+    Duration parse_timeout(const std::string& timeout) const;
 
     std::string render_template(const std::string& name);
     std::string get_file(const std::string& filename);
 
-    std::unique_ptr<ExecValue> query(const std::string& query_str,
-                                     SystemTime start, SystemTime end,
-                                     Duration interval);
+    /* the plan of the query from the plan cache, parsed and planned on a
+     * miss */
+    std::shared_ptr<const QueryPlan> plan_query(const std::string& query_str,
+                                                ActiveQuery* active,
+                                                QueryStats& stats);
+    /* account the query to its fingerprint once its response is sent */
+    void log_query(QueryLogEntry&& entry, const QueryPlan& plan,
+                   const QueryStats& stats,
+                   QueryStats::Clock::time_point began);
+    /* the result and the stats if asked for with stats=all */
+    std::string encode_result(const ExecValue& value, QueryStats& stats,
+                              const std::string& stats_param);
+    /* the plan of the query as JSON, in analyze mode the query is run and
+     * the plan is annotated with the costs of its nodes. It is evaluated at
+     * start if the interval is zero. */
+    std::string explain(const std::string& query_str, SystemTime start,
+                        SystemTime end, Duration interval, bool analyze,
+                        std::shared_ptr<CancellationToken> token,
+                        ActiveQuery* active);
+    /* identical queries running concurrently, e.g. of a dashboard opened by
+     * many users, are evaluated once for all of them */
+    std::shared_ptr<const ExecValue>
+    query(const std::string& query_str, std::shared_ptr<const QueryPlan> plan,
+          SystemTime start, SystemTime end, Duration interval,
+          std::shared_ptr<CancellationToken> token, ActiveQuery* active,
+          QueryStats& stats);
+    std::shared_ptr<const ExecValue>
+    instant_query(const std::string& query_str,
+                  std::shared_ptr<const QueryPlan> plan, SystemTime time,
+                  std::shared_ptr<CancellationToken> token,
+                  ActiveQuery* active, QueryStats& stats);
 };
 
 } // namespace promql
@@ -0,0 +1,33 @@
+#include "promql/engine.h"
+#include "promql/parse/executor.h"
+#include "promql/parse/instant_executor.h"
+
+namespace promql {
+
+std::unique_ptr<ExecValue>
+PreparedQuery::exec(SystemTime time,
+                    std::shared_ptr<CancellationToken> token) const
+{
+    InstantExecutor executor(queryable, plan.get(), time);
+    executor.set_limits(limits);
+    executor.set_cancellation_token(std::move(token));
+    return executor.execute();
+}
+
+std::unique_ptr<ExecValue>
+PreparedQuery::exec_range(SystemTime start, SystemTime end, Duration interval,
+                          std::shared_ptr<CancellationToken> token) const
+{
+    Executor executor(queryable, plan.get(), start, end, interval);
+    executor.set_limits(limits);
+    executor.set_cancellation_token(std::move(token));
+    return executor.execute();
+}
+
+std::unique_ptr<PreparedQuery> Engine::prepare(const std::string& query)
+{
+    return std::make_unique<PreparedQuery>(queryable, plan_cache.get(query),
+                                           limits);
+}
+
+} // namespace promql
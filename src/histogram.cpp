@@ -0,0 +1,97 @@
+#include "promql/histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace promql {
+
+size_t Histogram::bucket_index(uint64_t value)
+{
+    if (value < SUB_BUCKETS) return value;
+
+    /* shift the value down to the upper half of the sub-buckets */
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - SUB_BUCKET_BITS + 1;
+    return shift * (SUB_BUCKETS / 2) + (value >> shift);
+}
+
+uint64_t Histogram::bucket_lower_bound(size_t index)
+{
+    if (index < SUB_BUCKETS) return index;
+
+    int shift = index / (SUB_BUCKETS / 2) - 1;
+    uint64_t sub_bucket = index - shift * (SUB_BUCKETS / 2);
+    return sub_bucket << shift;
+}
+
+uint64_t Histogram::bucket_upper_bound(size_t index)
+{
+    if (index < SUB_BUCKETS) return index;
+
+    int shift = index / (SUB_BUCKETS / 2) - 1;
+    return bucket_lower_bound(index) + ((uint64_t{1} << shift) - 1);
+}
+
+void Histogram::merge(const Histogram& other)
+{
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        auto count = other.buckets[i].load(std::memory_order_relaxed);
+        if (count) buckets[i].fetch_add(count, std::memory_order_relaxed);
+    }
+    total.fetch_add(other.get_count(), std::memory_order_relaxed);
+    sum.fetch_add(other.get_sum(), std::memory_order_relaxed);
+
+    auto value = other.get_max();
+    auto cur = max.load(std::memory_order_relaxed);
+    while (cur < value &&
+           !max.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+        ;
+}
+
+void Histogram::reset()
+{
+    for (auto&& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+double Histogram::get_mean() const
+{
+    auto count = get_count();
+    return count ? (double)get_sum() / count : 0;
+}
+
+uint64_t Histogram::quantile(double q) const
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        count += buckets[i].load(std::memory_order_relaxed);
+    }
+    if (!count) return 0;
+
+    /* rank of the quantile among the recorded values, from 1 */
+    uint64_t rank = (uint64_t)std::ceil(q * count);
+    if (rank < 1) rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) return std::min(bucket_upper_bound(i), get_max());
+    }
+    return get_max();
+}
+
+uint64_t Histogram::count_le(uint64_t value) const
+{
+    uint64_t count = 0;
+    size_t last = bucket_index(value);
+    for (size_t i = 0; i <= last; i++) {
+        count += buckets[i].load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+} // namespace promql
@@ -1,7 +1,238 @@
 #include "promql/labels.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
 namespace promql {
 
+SymbolTable::SymbolTable()
+    : chunks(std::make_unique<std::unique_ptr<std::string[]>[]>(MAX_CHUNKS)),
+      count(0), bytes(0)
+{}
+
+SymbolTable& SymbolTable::global()
+{
+    static SymbolTable table;
+    return table;
+}
+
+uint32_t SymbolTable::intern(std::string_view str)
+{
+    auto& shard = shards[std::hash<std::string_view>()(str) % NUM_SHARDS];
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.ids.find(str);
+        if (it != shard.ids.end()) return it->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    /* added by another thread since the lookup */
+    auto it = shard.ids.find(str);
+    if (it != shard.ids.end()) return it->second;
+
+    uint32_t id;
+    std::string* slot;
+    {
+        std::lock_guard<std::mutex> guard(add_mutex);
+        id = count.load(std::memory_order_relaxed);
+        auto chunk = id >> CHUNK_BITS;
+        if (chunk >= MAX_CHUNKS)
+            throw std::length_error("symbol table is full");
+        if (!chunks[chunk]) chunks[chunk].reset(new std::string[CHUNK_SIZE]);
+
+        slot = &chunks[chunk][id & (CHUNK_SIZE - 1)];
+        *slot = str;
+        count.store(id + 1, std::memory_order_release);
+    }
+
+    bytes.fetch_add(sizeof(std::string) + slot->capacity(),
+                    std::memory_order_relaxed);
+    shard.ids.emplace(*slot, id);
+    return id;
+}
+
+std::vector<uint32_t> SymbolTable::intern(const std::vector<std::string>& strs)
+{
+    std::vector<uint32_t> result;
+    result.reserve(strs.size());
+    for (auto&& s : strs) {
+        result.push_back(intern(s));
+    }
+    return result;
+}
+
+std::vector<uint32_t>
+SymbolTable::intern(const std::vector<std::string_view>& strs)
+{
+    std::vector<uint32_t> result;
+    result.reserve(strs.size());
+    for (auto&& s : strs) {
+        result.push_back(intern(s));
+    }
+    return result;
+}
+
+LabelSet::LabelSet(const std::vector<Label>& labels) : rep(nullptr)
+{
+    auto& table = SymbolTable::global();
+    std::vector<Symbols> symbols;
+
+    symbols.reserve(labels.size());
+    for (auto&& l : labels) {
+        symbols.push_back({table.intern(l.name), table.intern(l.value)});
+    }
+
+    *this = from_symbols(std::move(symbols));
+}
+
+LabelSet& LabelSet::operator=(const LabelSet& rhs)
+{
+    if (rhs.rep) rhs.rep->refs.fetch_add(1, std::memory_order_relaxed);
+    release();
+    rep = rhs.rep;
+    return *this;
+}
+
+LabelSet& LabelSet::operator=(LabelSet&& rhs) noexcept
+{
+    if (this != &rhs) {
+        release();
+        rep = rhs.rep;
+        rhs.rep = nullptr;
+    }
+    return *this;
+}
+
+void LabelSet::release()
+{
+    if (rep && rep->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        rep->~Rep();
+        ::operator delete(rep);
+    }
+    rep = nullptr;
+}
+
+LabelSet LabelSet::from_symbols(std::vector<Symbols>&& symbols)
+{
+    LabelSet lset;
+    if (symbols.empty()) return lset;
+
+    auto& table = SymbolTable::global();
+    std::sort(symbols.begin(), symbols.end(),
+              [&table](const Symbols& lhs, const Symbols& rhs) {
+                  return table.lookup(lhs.name) < table.lookup(rhs.name);
+              });
+
+    /* FNV-1a over the symbol ids */
+    size_t hash = 14695981039346656037ULL;
+    for (auto&& s : symbols) {
+        hash = (hash ^ s.name) * 1099511628211ULL;
+        hash = (hash ^ s.value) * 1099511628211ULL;
+    }
+
+    void* mem =
+        ::operator new(sizeof(Rep) + symbols.size() * sizeof(Symbols));
+    lset.rep = new (mem) Rep;
+    lset.rep->refs.store(1, std::memory_order_relaxed);
+    lset.rep->size = symbols.size();
+    lset.rep->hash = hash;
+    std::copy(symbols.begin(), symbols.end(), lset.rep->data());
+
+    return lset;
+}
+
+bool LabelSet::operator==(const LabelSet& rhs) const
+{
+    if (rep == rhs.rep) return true;
+    if (size() != rhs.size() || hash() != rhs.hash()) return false;
+    return std::equal(symbols(), symbols() + size(), rhs.symbols());
+}
+
+const std::string& LabelSet::get(std::string_view name) const
+{
+    static const std::string empty;
+    auto& table = SymbolTable::global();
+
+    for (auto p = symbols(); p != symbols() + size(); p++) {
+        if (table.lookup(p->name) == name) return table.lookup(p->value);
+    }
+    return empty;
+}
+
+LabelSet LabelSet::grouping(const std::vector<uint32_t>& names,
+                            bool without) const
+{
+    static const uint32_t metric_name =
+        SymbolTable::global().intern(METRIC_NAME);
+    std::vector<Symbols> result;
+
+    for (auto p = symbols(); p != symbols() + size(); p++) {
+        bool found = std::find(names.begin(), names.end(), p->name) !=
+                     names.end();
+
+        if (without == found) continue;
+        if (without && p->name == metric_name) continue;
+
+        result.push_back(*p);
+    }
+
+    /* nothing dropped, share the block */
+    if (result.size() == size()) return *this;
+    return from_symbols(std::move(result));
+}
+
+LabelSet LabelSet::drop_metric_name() const
+{
+    return grouping({}, true);
+}
+
+LabelMatcher shard_matcher(size_t index, size_t count)
+{
+    auto& table = SymbolTable::global();
+    auto value = table.intern(std::to_string(index) + "_of_" +
+                              std::to_string(count));
+    return LabelMatcher(MatchOp::EQL, SHARD_LABEL, table.lookup(value));
+}
+
+bool parse_shard_matcher(const LabelMatcher& matcher, size_t& index,
+                         size_t& count)
+{
+    if (matcher.name != SHARD_LABEL) return false;
+    if (matcher.op != MatchOp::EQL)
+        throw std::runtime_error("invalid shard matcher");
+
+    unsigned long i, n;
+    int len = 0;
+    std::string value(matcher.value);
+    if (::sscanf(value.c_str(), "%lu_of_%lu%n", &i, &n, &len) != 2 ||
+        (size_t)len != value.length() || i >= n)
+        throw std::runtime_error("invalid shard '" + value + "'");
+
+    index = i;
+    count = n;
+    return true;
+}
+
+size_t series_shard(const LabelSet& labels, size_t count)
+{
+    /* FNV-1a over the names and values, each terminated by a zero byte */
+    uint64_t hash = 14695981039346656037ULL;
+    auto update = [&hash](const std::string& str) {
+        for (unsigned char c : str) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+        hash = hash * 1099511628211ULL;
+    };
+
+    for (auto&& l : labels) {
+        update(l.name);
+        update(l.value);
+    }
+
+    return hash % count;
+}
+
 bool LabelMatcher::match(const Label& label) const
 {
     return label.name == name && match_value(label.value);
@@ -30,7 +261,7 @@ bool LabelMatcher::match_value(const std::string& val) const
         regex_match = true;
         /* fall-through */
     case MatchOp::NEQ_REGEX: {
-        return std::regex_match(val, pattern) == regex_match;
+        return std::regex_match(val, *pattern) == regex_match;
     }
     }
 
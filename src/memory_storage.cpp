@@ -0,0 +1,345 @@
+#include "promql/memory_storage.h"
+#include "promql/parse/executor.h"
+#include "promql/parse/functions.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace promql {
+
+namespace {
+
+class MemSeriesIterator : public SeriesIterator {
+public:
+    MemSeriesIterator(const std::vector<std::pair<uint64_t, double>>& samples)
+        : samples(samples), idx(-1)
+    {}
+
+    virtual bool seek(uint64_t t)
+    {
+        if (idx < 0) idx = 0;
+        while ((size_t)idx < samples.size() && samples[idx].first < t)
+            idx++;
+        return (size_t)idx < samples.size();
+    }
+
+    virtual std::pair<uint64_t, double> at() { return samples[idx]; }
+
+    virtual bool next()
+    {
+        if ((size_t)(idx + 1) >= samples.size()) {
+            idx = samples.size();
+            return false;
+        }
+        idx++;
+        return true;
+    }
+
+private:
+    const std::vector<std::pair<uint64_t, double>>& samples;
+    long idx;
+};
+
+class MemSeriesImpl : public Series {
+public:
+    MemSeriesImpl(MemoryStorage::MemSeries&& series)
+        : series(std::move(series))
+    {}
+
+    virtual void labels(LabelSet& labels)
+    {
+        labels = series.labels;
+    }
+
+    virtual std::unique_ptr<SeriesIterator> iterator()
+    {
+        return std::make_unique<MemSeriesIterator>(series.samples);
+    }
+
+private:
+    MemoryStorage::MemSeries series;
+};
+
+class MemSeriesSet : public SeriesSet {
+public:
+    MemSeriesSet(std::vector<MemoryStorage::MemSeries>&& series)
+        : series(std::move(series)), idx(-1)
+    {}
+
+    virtual bool next() { return (size_t)++idx < series.size(); }
+
+    virtual std::shared_ptr<Series> at()
+    {
+        return std::make_shared<MemSeriesImpl>(std::move(series[idx]));
+    }
+
+private:
+    std::vector<MemoryStorage::MemSeries> series;
+    long idx;
+};
+
+class MemQuerier : public Querier {
+public:
+    MemQuerier(MemoryStorage* storage, uint64_t mint, uint64_t maxt)
+        : storage(storage), mint(mint), maxt(maxt)
+    {}
+
+    virtual std::shared_ptr<SeriesSet>
+    select(const std::vector<LabelMatcher>& matchers)
+    {
+        std::vector<MemoryStorage::MemSeries> result;
+        storage->snapshot(matchers, mint, maxt, result);
+        return std::make_shared<MemSeriesSet>(std::move(result));
+    }
+
+    virtual bool select_aggregate(const AggregateHints& hints,
+                                  const std::vector<LabelMatcher>& matchers,
+                                  std::vector<PartialAggregate>& partials);
+
+private:
+    MemoryStorage* storage;
+    uint64_t mint, maxt;
+};
+
+bool MemQuerier::select_aggregate(const AggregateHints& hints,
+                                  const std::vector<LabelMatcher>& matchers,
+                                  std::vector<PartialAggregate>& partials)
+{
+    const ExecFunction* func = nullptr;
+
+    if (!storage->is_aggregate_pushdown() || !hints.step) return false;
+    if (!hints.func.empty()) {
+        func = ExecFunction::get(hints.func);
+        if (!func || func->arg_types.size() != 1 ||
+            func->arg_types[0] != ValueType::MATRIX)
+            return false;
+    }
+
+    std::vector<MemoryStorage::MemSeries> result;
+    storage->snapshot(matchers, mint, maxt, result);
+
+    auto grouping = SymbolTable::global().intern(hints.grouping);
+    std::unordered_map<LabelSet, PartialAggregate> groups;
+    size_t num_steps = (hints.end - hints.start) / hints.step + 1;
+
+    EvalContext ctx;
+    ctx.outvec = std::make_unique<VectorValue>();
+    MatrixValue window;
+    std::vector<ExecValue*> args{&window};
+
+    for (auto&& s : result) {
+        auto labels = s.labels.grouping(grouping, hints.without);
+
+        auto it = groups.find(labels);
+        if (it == groups.end()) {
+            PartialAggregate partial;
+            partial.labels = labels;
+            partial.points.resize(num_steps);
+            for (size_t i = 0; i < num_steps; i++) {
+                partial.points[i] = {hints.start + i * hints.step, 0, 0};
+            }
+            it = groups.emplace(labels, std::move(partial)).first;
+        }
+        auto& group = it->second;
+
+        auto lower = s.samples.cbegin(), upper = s.samples.cbegin();
+        for (size_t i = 0; i < num_steps; i++) {
+            auto ts = hints.start + i * hints.step;
+            auto maxt = ts > hints.offset ? ts - hints.offset : 0;
+            auto mint = maxt > hints.range ? maxt - hints.range : 0;
+            double value;
+
+            while (upper != s.samples.end() && upper->first <= maxt)
+                upper++;
+
+            if (!func) {
+                /* latest sample within the lookback delta */
+                if (upper == s.samples.begin()) continue;
+                auto prev = upper - 1;
+                if (prev->first <= mint) continue;
+                value = prev->second;
+            } else {
+                while (lower < upper && lower->first < mint)
+                    lower++;
+
+                MatrixValue::Series series(s.labels);
+                for (auto p = lower; p != upper; p++) {
+                    series.values.emplace_back(p->first, p->second);
+                }
+                window.clear();
+                window.add_series(std::move(series));
+
+                ctx.ts = ts;
+                ctx.mat_start = mint;
+                ctx.mat_end = maxt;
+                auto vec = func->pfunc(args, ctx);
+                bool empty = vec->get_samples().empty();
+                if (!empty) value = vec->get_samples()[0].value.get_value();
+                vec->clear();
+                ctx.outvec = std::move(vec);
+
+                if (empty) continue;
+            }
+
+            auto& pt = group.points[i];
+            if (!pt.count) {
+                pt.value = value;
+            } else {
+                switch (hints.op) {
+                case Token::SUM:
+                case Token::AVG:
+                    pt.value += value;
+                    break;
+                case Token::MIN:
+                    if (pt.value > value) pt.value = value;
+                    break;
+                case Token::MAX:
+                    if (pt.value < value) pt.value = value;
+                    break;
+                case Token::COUNT:
+                    break;
+                default:
+                    return false;
+                }
+            }
+            pt.count++;
+        }
+    }
+
+    for (auto&& p : groups) {
+        partials.push_back(std::move(p.second));
+    }
+
+    return true;
+}
+
+class MemAppender : public Appender {
+public:
+    MemAppender(MemoryStorage* storage) : storage(storage) {}
+
+    virtual void add(const std::vector<Label>& labels, uint64_t t, double v)
+    {
+        pending.push_back({labels, t, v});
+    }
+
+    virtual void commit()
+    {
+        for (auto&& p : pending) {
+            storage->add(p.labels, p.t, p.v);
+        }
+        pending.clear();
+    }
+
+private:
+    struct PendingSample {
+        LabelSet labels;
+        uint64_t t;
+        double v;
+    };
+
+    MemoryStorage* storage;
+    std::vector<PendingSample> pending;
+};
+
+bool match_series(const LabelSet& labels,
+                  const std::vector<LabelMatcher>& matchers)
+{
+    for (auto&& m : matchers) {
+        if (m.name == SHARD_LABEL) continue;
+        if (!m.match_value(labels.get(m.name))) return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
+std::shared_ptr<Querier> MemoryStorage::querier(uint64_t mint, uint64_t maxt)
+{
+    return std::make_shared<MemQuerier>(this, mint, maxt);
+}
+
+void MemoryStorage::label_values(const std::string& name,
+                                 std::unordered_set<std::string>& values)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto&& p : series) {
+        for (auto&& l : p.second.labels) {
+            if (l.name == name) values.insert(l.value);
+        }
+    }
+}
+
+std::shared_ptr<Appender> MemoryStorage::appender()
+{
+    return std::make_shared<MemAppender>(this);
+}
+
+void MemoryStorage::add(const LabelSet& labels, uint64_t t, double v)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = series.find(labels);
+    if (it == series.end()) {
+        it = series.emplace(labels, MemSeries{labels, {}}).first;
+    }
+
+    auto& samples = it->second.samples;
+    if (samples.empty() || samples.back().first < t) {
+        samples.emplace_back(t, v);
+        num_samples++;
+        return;
+    }
+
+    auto pos = std::lower_bound(
+        samples.begin(), samples.end(), t,
+        [](const std::pair<uint64_t, double>& p, uint64_t t) {
+            return p.first < t;
+        });
+    if (pos != samples.end() && pos->first == t) {
+        pos->second = v;
+    } else {
+        samples.insert(pos, {t, v});
+        num_samples++;
+    }
+}
+
+bool MemoryStorage::get_stats(StorageStats& stats)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.series = series.size();
+    stats.chunks = series.size();
+    stats.samples = num_samples;
+    stats.bytes = num_samples * sizeof(std::pair<uint64_t, double>) +
+                  series.size() * (sizeof(LabelSet) + sizeof(MemSeries));
+    return true;
+}
+
+void MemoryStorage::snapshot(const std::vector<LabelMatcher>& matchers,
+                             uint64_t mint, uint64_t maxt,
+                             std::vector<MemSeries>& result)
+{
+    size_t shard = 0, num_shards = 0;
+    for (auto&& m : matchers) {
+        parse_shard_matcher(m, shard, num_shards);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto&& p : series) {
+        const auto& s = p.second;
+        if (!match_series(s.labels, matchers)) continue;
+        if (num_shards && series_shard(s.labels, num_shards) != shard)
+            continue;
+
+        MemSeries copy;
+        copy.labels = s.labels;
+        for (auto&& tv : s.samples) {
+            if (tv.first >= mint && tv.first <= maxt) copy.samples.push_back(tv);
+        }
+
+        if (!copy.samples.empty()) result.push_back(std::move(copy));
+    }
+}
+
+} // namespace promql
@@ -0,0 +1,187 @@
+#include "promql/metrics.h"
+
+#include <charconv>
+#include <cmath>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace promql {
+
+const std::vector<double> MetricRegistry::DEFAULT_BUCKETS = {
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+    0.25,  0.5,    1,     2.5,  5,     10,   30};
+
+size_t Counter::thread_slot()
+{
+    static thread_local size_t slot =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % NUM_SLOTS;
+    return slot;
+}
+
+uint64_t Counter::get_value() const
+{
+    uint64_t value = 0;
+    for (auto&& slot : slots) {
+        value += slot.value.load(std::memory_order_relaxed);
+    }
+    return value;
+}
+
+Counter& MetricRegistry::counter(const std::string& name,
+                                 const std::string& help,
+                                 const std::vector<Label>& labels)
+{
+    Metric metric;
+    metric.labels = labels;
+    metric.counter = std::make_unique<Counter>();
+
+    auto& counter = *metric.counter;
+    add_metric(name, help, MetricType::COUNTER, std::move(metric));
+    return counter;
+}
+
+Histogram& MetricRegistry::histogram(const std::string& name,
+                                     const std::string& help,
+                                     const std::vector<Label>& labels,
+                                     double scale)
+{
+    Metric metric;
+    metric.labels = labels;
+    metric.histogram = std::make_unique<Histogram>();
+    metric.scale = scale;
+
+    auto& histogram = *metric.histogram;
+    add_metric(name, help, MetricType::HISTOGRAM, std::move(metric));
+    return histogram;
+}
+
+void MetricRegistry::gauge(const std::string& name, const std::string& help,
+                           const std::vector<Label>& labels, GaugeFunc func)
+{
+    Metric metric;
+    metric.labels = labels;
+    metric.gauge = std::move(func);
+
+    add_metric(name, help, MetricType::GAUGE, std::move(metric));
+}
+
+void MetricRegistry::add_metric(const std::string& name,
+                                const std::string& help, MetricType type,
+                                Metric&& metric)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(name);
+    if (it == index.end()) {
+        it = index.emplace(name, families.size()).first;
+        families.push_back(Family{name, help, type, {}});
+    }
+
+    auto& family = families[it->second];
+    if (family.type != type) {
+        throw std::runtime_error("metric " + name +
+                                 " registered with another type");
+    }
+
+    family.metrics.push_back(std::move(metric));
+}
+
+static std::string escape_label_value(const std::string& value)
+{
+    std::string escaped;
+    for (auto c : value) {
+        if (c == '\\' || c == '"')
+            escaped += std::string("\\") + c;
+        else if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+/* {name="value",...} with an extra label, empty if there are none */
+static std::string format_labels(const std::vector<Label>& labels,
+                                 const Label& extra = {})
+{
+    std::stringstream ss;
+    bool first = true;
+
+    auto add = [&](const Label& l) {
+        ss << (first ? "{" : ",") << l.name << "=\""
+           << escape_label_value(l.value) << "\"";
+        first = false;
+    };
+    for (auto&& l : labels) {
+        add(l);
+    }
+    if (!extra.name.empty()) add(extra);
+
+    if (!first) ss << "}";
+    return ss.str();
+}
+
+static std::string format_value(double value)
+{
+    if (std::isnan(value)) return "NaN";
+    if (std::isinf(value)) return value > 0 ? "+Inf" : "-Inf";
+
+    /* the shortest representation that parses back to the value */
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    return std::string(buf, res.ptr);
+}
+
+std::string MetricRegistry::render() const
+{
+    static const char* type_names[] = {"counter", "gauge", "histogram"};
+    std::lock_guard<std::mutex> lock(mutex);
+    std::stringstream ss;
+
+    for (auto&& family : families) {
+        ss << "# HELP " << family.name << " " << family.help << "\n";
+        ss << "# TYPE " << family.name << " "
+           << type_names[(int)family.type] << "\n";
+
+        for (auto&& metric : family.metrics) {
+            switch (family.type) {
+            case MetricType::COUNTER:
+                ss << family.name << format_labels(metric.labels) << " "
+                   << metric.counter->get_value() << "\n";
+                break;
+            case MetricType::GAUGE:
+                ss << family.name << format_labels(metric.labels) << " "
+                   << format_value(metric.gauge()) << "\n";
+                break;
+            case MetricType::HISTOGRAM: {
+                auto& hist = *metric.histogram;
+                for (auto bound : DEFAULT_BUCKETS) {
+                    auto le = Label("le", format_value(bound));
+                    ss << family.name << "_bucket"
+                       << format_labels(metric.labels, le) << " "
+                       << hist.count_le(std::llround(bound / metric.scale))
+                       << "\n";
+                }
+                /* the count is taken from the buckets, so that it matches
+                 * the +Inf bucket while values are being recorded */
+                auto count = hist.count_le(UINT64_MAX);
+                ss << family.name << "_bucket"
+                   << format_labels(metric.labels, Label("le", "+Inf")) << " "
+                   << count << "\n";
+                ss << family.name << "_sum" << format_labels(metric.labels)
+                   << " " << format_value(hist.get_sum() * metric.scale)
+                   << "\n";
+                ss << family.name << "_count" << format_labels(metric.labels)
+                   << " " << count << "\n";
+                break;
+            }
+            }
+        }
+    }
+
+    return ss.str();
+}
+
+} // namespace promql
@@ -0,0 +1,21 @@
+#include "promql/parse/cancellation.h"
+#include "promql/parse/executor.h"
+
+namespace promql {
+
+void CancellationToken::check() const
+{
+    if (is_cancelled()) {
+        throw ExecutionError("query cancelled");
+    }
+
+    if (owner && !waiters.load(std::memory_order_relaxed)) {
+        owner->check();
+    }
+
+    if (std::chrono::steady_clock::now() > deadline) {
+        throw ExecutionError("query timed out");
+    }
+}
+
+} // namespace promql
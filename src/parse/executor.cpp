@@ -1,16 +1,19 @@
 #include "promql/parse/executor.h"
 #include "promql/labels.h"
+#include "promql/parse/operators.h"
 #include "promql/parse/token.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <map>
 #include <sstream>
 #include <unordered_map>
 #include <unordered_set>
 
 namespace promql {
 
-static inline double vec_elt_binop(Token op, double lhs, double rhs, bool& keep)
+double vec_elt_binop(Token op, double lhs, double rhs, bool& keep)
 {
     keep = true;
     switch (op) {
@@ -49,11 +52,11 @@ static inline double vec_elt_binop(Token op, double lhs, double rhs, bool& keep)
     }
 }
 
-static std::unique_ptr<VectorValue> vec_scalar_binop(Token op, VectorValue* lhs,
-                                                     ScalarValue* rhs,
-                                                     bool swap, bool logical,
-                                                     EvalContext& ctx)
+std::unique_ptr<VectorValue> vec_scalar_binop(Token op, VectorValue* lhs,
+                                              ScalarValue* rhs, bool swap,
+                                              bool logical, EvalContext& ctx)
 {
+    ctx.outvec->reserve(lhs->get_samples().size());
     for (auto&& p : lhs->get_samples()) {
         auto lv = p.value.get_value();
         auto rv = rhs->get_value();
@@ -77,7 +80,60 @@ static std::unique_ptr<VectorValue> vec_scalar_binop(Token op, VectorValue* lhs,
         }
 
         if (keep) {
-            VectorValue::Sample sample(p.metric, {p.value.get_time(), value});
+            /* filtering comparisons keep the metric name, arithmetic drops
+             * it */
+            bool filter = is_comparison_op(op) && !logical;
+            VectorValue::Sample sample(
+                filter ? p.metric : p.metric.drop_metric_name(),
+                {p.value.get_time(), value});
+            ctx.outvec->add_sample(std::move(sample));
+        }
+    }
+
+    return std::move(ctx.outvec);
+}
+
+std::unique_ptr<VectorValue> vec_vec_binop(Token op, VectorValue* lhs,
+                                           VectorValue* rhs, bool logical,
+                                           EvalContext& ctx)
+{
+    /* one-to-one matching on all labels except the metric name */
+    const auto& rhs_samples = rhs->get_samples();
+    std::unordered_map<LabelSet, const VectorValue::Sample*> rhs_map;
+    for (auto&& s : rhs_samples) {
+        if (!rhs_map.emplace(s.metric.drop_metric_name(), &s).second) {
+            throw ExecutionError("many-to-many matching not allowed: found "
+                                 "duplicate series on the right hand-side of "
+                                 "the operation");
+        }
+    }
+
+    std::unordered_set<LabelSet> matched;
+    for (auto&& p : lhs->get_samples()) {
+        auto labels = p.metric.drop_metric_name();
+
+        auto it = rhs_map.find(labels);
+        if (it == rhs_map.end()) continue;
+
+        if (!matched.insert(labels).second) {
+            throw ExecutionError("found duplicate series for the match group "
+                                 "on the left hand-side of the operation");
+        }
+
+        bool keep;
+        auto value = vec_elt_binop(op, p.value.get_value(),
+                                   it->second->value.get_value(), keep);
+
+        if (logical) {
+            value = keep ? 1.0 : 0.0;
+            keep = true;
+        }
+
+        if (keep) {
+            /* filtering comparisons keep the left hand-side metric */
+            bool filter = is_comparison_op(op) && !logical;
+            VectorValue::Sample sample(filter ? p.metric : labels,
+                                       {ctx.ts, value});
             ctx.outvec->add_sample(std::move(sample));
         }
     }
@@ -87,25 +143,44 @@ static std::unique_ptr<VectorValue> vec_scalar_binop(Token op, VectorValue* lhs,
 
 Executor::Executor(Queryable* queryable, ASTNode* root, SystemTime start,
                    SystemTime end, Duration interval)
-    : queryable(queryable), root(root),
-      start_timestamp(
+    : queryable(queryable), plan(nullptr), root(root),
+      query_start(
           std::chrono::duration_cast<Duration>(start.time_since_epoch())
               .count()),
-      end_timestamp(
+      query_end(
           std::chrono::duration_cast<Duration>(end.time_since_epoch()).count()),
-      interval(interval)
+      start_timestamp(query_start), end_timestamp(query_end),
+      interval(interval), streaming(true), profile(nullptr), arena(&tracker),
+      allocations(&arena)
 {}
 
+Executor::Executor(Queryable* queryable, const QueryPlan* plan,
+                   SystemTime start, SystemTime end, Duration interval)
+    : Executor(queryable, plan->root.get(), start, end, interval)
+{
+    this->plan = plan;
+    scans.resize(plan->scans.size());
+}
+
 std::unique_ptr<ExecValue> Executor::execute()
 {
-    root->visit(*this);
+    {
+        StatsTimer timer(stats.eval_time);
+        eval(root);
+    }
+    /* the selection time is counted in the evaluation time above */
+    stats.eval_time -= stats.select_time;
+    cse_cache.clear();
 
     if (root->type() == ValueType::NONE) {
         return nullptr;
     }
 
     assert(value_stack.size() == 1);
-    auto retval = pop_value();
+    auto result = pop_value();
+    /* copy the result out of the arena, it is released with the executor */
+    auto retval = std::make_unique<MatrixValue>(
+        *result, std::pmr::get_default_resource());
 
     if (start_timestamp == end_timestamp && interval.count() == 1) {
         /* instant query: cast the returned matrix to actual type */
@@ -118,12 +193,136 @@ std::unique_ptr<ExecValue> Executor::execute()
     return retval;
 }
 
-void Executor::push_value(std::unique_ptr<MatrixValue>&& val)
+std::shared_ptr<MatrixValue> Executor::eval_range(ASTNode* node,
+                                                  uint64_t start, uint64_t end,
+                                                  Duration interval)
+{
+    auto saved_start = start_timestamp, saved_end = end_timestamp;
+    auto saved_interval = this->interval;
+
+    start_timestamp = start;
+    end_timestamp = end;
+    this->interval = interval;
+    eval(node);
+    start_timestamp = saved_start;
+    end_timestamp = saved_end;
+    this->interval = saved_interval;
+
+    assert(!value_stack.empty());
+    return pop_value();
+}
+
+void Executor::eval(ASTNode* node)
+{
+    size_t id = 0;
+
+    check_cancelled();
+    bool is_cse = plan && plan->get_cse(node, id);
+    auto key =
+        std::make_tuple(id, start_timestamp, end_timestamp, interval.count());
+
+    if (is_cse) {
+        auto it = cse_cache.find(key);
+        if (it != cse_cache.end()) {
+            /* share the result of an identical subexpression */
+            auto val = it->second;
+            push_value(std::move(val));
+            return;
+        }
+    }
+
+    NodeProfiler profiler(profile, node, allocations);
+    auto mark = held.enter();
+    if (plan && start_timestamp != end_timestamp &&
+        plan->is_step_invariant(node)) {
+        eval_step_invariant(node);
+    } else {
+        node->visit(*this);
+    }
+
+    if (!value_stack.empty()) {
+        profiler.finish(value_stack.top().get());
+        tracker.hold_samples(value_stack.top()->num_samples());
+        tracker.release_samples(held.leave(mark));
+    }
+
+    if (is_cse && !value_stack.empty()) {
+        cse_cache.emplace(key, value_stack.top());
+    }
+}
+
+void Executor::eval_step_invariant(ASTNode* node)
+{
+    /* evaluate at the first step only */
+    auto saved_end = end_timestamp;
+    end_timestamp = start_timestamp;
+    node->visit(*this);
+    end_timestamp = saved_end;
+
+    auto val = pop_value();
+    stats.steps++;
+
+    /* broadcast the result across the step grid */
+    auto mat = std::make_unique<MatrixValue>(&allocations);
+    auto num_steps = (end_timestamp - start_timestamp) / interval.count() + 1;
+    for (auto&& s : val->get_series()) {
+        if (s.values.empty()) continue;
+
+        MatrixValue::Series series(s.metric, &allocations);
+        series.values.reserve(num_steps);
+        auto value = s.values.front().get_value();
+        for (auto ts = start_timestamp; ts <= end_timestamp;
+             ts += interval.count()) {
+            series.values.emplace_back(ts, value);
+        }
+
+        mat->add_series(std::move(series));
+    }
+
+    push_value(std::move(mat));
+}
+
+bool Executor::eval_pipeline(ASTNode* node)
+{
+    /* stream the series through operators instead of materializing the
+     * operands when the whole subexpression supports it */
+    if (!streaming) return false;
+    /* the nodes of a pipeline are not evaluated one by one, profile them
+     * separately */
+    if (profile) return false;
+
+    auto pipeline =
+        build_pipeline(queryable, plan, node, start_timestamp, end_timestamp,
+                       interval.count(), &tracker, token.get());
+    if (!pipeline) return false;
+
+    push_value(collect(*pipeline, &tracker));
+    stats.steps += (end_timestamp - start_timestamp) / interval.count() + 1;
+    return true;
+}
+
+uint64_t Executor::at_time(const ASTNode* node, uint64_t ts) const
+{
+    switch (node->get_at()) {
+    case AtModifier::TIMESTAMP:
+        return node->get_at_timestamp();
+    case AtModifier::START:
+        return query_start;
+    case AtModifier::END:
+        return query_end;
+    default:
+        break;
+    }
+
+    return ts;
+}
+
+void Executor::push_value(std::shared_ptr<MatrixValue>&& val)
 {
     value_stack.emplace(std::move(val));
 }
 
-std::unique_ptr<MatrixValue> Executor::pop_value()
+std::shared_ptr<MatrixValue> Executor::pop_value()
 {
     if (value_stack.empty()) {
         return nullptr;
@@ -131,6 +330,8 @@ std::unique_ptr<MatrixValue> Executor::pop_value()
 
     auto val = std::move(value_stack.top());
     value_stack.pop();
+    /* a value still referenced is in the cache */
+    if (val) held.consume(val->num_samples(), val.use_count() > 1);
 
     return val;
 }
@@ -139,29 +340,39 @@ std::unique_ptr<MatrixValue>
 Executor::range_eval(Executor::EvalFunc&& func,
                      const std::vector<ASTNode*>& exprs)
 {
-    std::unordered_map<std::string, MatrixValue::Series> seriess;
-    std::vector<std::unique_ptr<MatrixValue>> mats;
+    std::unordered_map<LabelSet, MatrixValue::Series> seriess;
+    std::vector<std::shared_ptr<MatrixValue>> mats;
     for (auto&& expr : exprs) {
-        expr->visit(*this);
+        eval(expr);
         assert(!value_stack.empty());
         mats.push_back(pop_value());
     }
 
     EvalContext ctx;
-    ctx.outvec = std::make_unique<VectorValue>();
+    ctx.outvec = std::make_unique<VectorValue>(&allocations);
     std::vector<std::vector<size_t>> start_indices;
     for (auto&& mat : mats) {
         start_indices.emplace_back(mat->get_series().size(), 0);
     }
 
+    /* the argument vectors are reused by all steps */
+    std::vector<std::unique_ptr<VectorValue>> vecs;
+    std::vector<ExecValue*> args;
+    for (size_t i = 0; i < mats.size(); i++) {
+        vecs.push_back(std::make_unique<VectorValue>(&allocations));
+        args.push_back(vecs.back().get());
+    }
+
     for (auto ts = start_timestamp; ts <= end_timestamp;
          ts += interval.count()) {
-        std::vector<std::unique_ptr<VectorValue>> vecs;
-        std::vector<ExecValue*> args;
+        check_cancelled();
+        stats.steps++;
 
         auto start_index_mat = start_indices.begin();
+        auto vec_it = vecs.begin();
         for (auto&& mat : mats) {
-            auto vec = std::make_unique<VectorValue>();
+            auto& vec = *vec_it++;
+            vec->clear();
 
             auto start_index = start_index_mat->begin();
             for (auto&& series : mat->get_series()) {
@@ -177,20 +388,17 @@ Executor::range_eval(Executor::EvalFunc&& func,
                 start_index++;
             }
             start_index_mat++;
-            args.push_back(vec.get());
-            vecs.push_back(std::move(vec));
         }
 
         ctx.ts = ts;
         auto result = func(args, ctx);
 
         for (auto&& p : result->get_samples()) {
-            std::string lstr = lset2str(p.metric);
-            auto it = seriess.find(lstr);
+            auto it = seriess.find(p.metric);
 
             if (it == seriess.end()) {
-                auto itp =
-                    seriess.emplace(lstr, MatrixValue::Series{p.metric, {}});
+                auto itp = seriess.emplace(
+                    p.metric, MatrixValue::Series{p.metric, &allocations});
                 it = itp.first;
             }
             it->second.values.emplace_back(ts, p.value.get_value());
@@ -200,7 +408,7 @@ Executor::range_eval(Executor::EvalFunc&& func,
         ctx.outvec = std::move(result);
     }
 
-    auto mat = std::make_unique<MatrixValue>();
+    auto mat = std::make_unique<MatrixValue>(&allocations);
     for (auto&& p : seriess) {
         mat->add_series(std::move(p.second));
     }
@@ -210,6 +418,8 @@ Executor::range_eval(Executor::EvalFunc&& func,
 
 void Executor::visit(BinaryNode* node)
 {
+    if (eval_pipeline(node)) return;
+
     auto lhs_type = node->get_lhs()->type();
     auto rhs_type = node->get_rhs()->type();
 
@@ -235,10 +445,61 @@ void Executor::visit(BinaryNode* node)
                                         node->is_return_bool(), ctx);
             },
             {node->get_lhs(), node->get_rhs()}));
+    } else if (lhs_type == ValueType::SCALAR && rhs_type == ValueType::SCALAR) {
+        push_value(range_eval(
+            [node](const std::vector<ExecValue*>& args, EvalContext& ctx) {
+                VectorValue* lhs = static_cast<VectorValue*>(args[0]);
+                VectorValue* rhs = static_cast<VectorValue*>(args[1]);
+                if (lhs->get_samples().empty() || rhs->get_samples().empty())
+                    return std::move(ctx.outvec);
+
+                bool keep;
+                auto value = vec_elt_binop(
+                    node->get_op(), lhs->get_samples()[0].value.get_value(),
+                    rhs->get_samples()[0].value.get_value(), keep);
+                if (node->is_return_bool()) {
+                    value = keep ? 1.0 : 0.0;
+                }
+
+                ctx.outvec->add_sample({{}, {ctx.ts, value}});
+                return std::move(ctx.outvec);
+            },
+            {node->get_lhs(), node->get_rhs()}));
+    } else {
+        push_value(range_eval(
+            [node](const std::vector<ExecValue*>& args, EvalContext& ctx) {
+                VectorValue* lhs = static_cast<VectorValue*>(args[0]);
+                VectorValue* rhs = static_cast<VectorValue*>(args[1]);
+
+                return vec_vec_binop(node->get_op(), lhs, rhs,
+                                     node->is_return_bool(), ctx);
+            },
+            {node->get_lhs(), node->get_rhs()}));
     }
 }
 
-void Executor::visit(UnaryNode* node) {}
+void Executor::visit(UnaryNode* node)
+{
+    push_value(range_eval(
+        [node](const std::vector<ExecValue*>& args, EvalContext& ctx) {
+            VectorValue* vec = static_cast<VectorValue*>(args[0]);
+            bool negate = node->get_op() == Token::SUB;
+
+            for (auto&& p : vec->get_samples()) {
+                auto value = p.value.get_value();
+                if (!negate) {
+                    ctx.outvec->add_sample({p.metric, {ctx.ts, value}});
+                    continue;
+                }
+
+                ctx.outvec->add_sample(
+                    {p.metric.drop_metric_name(), {ctx.ts, -value}});
+            }
+
+            return std::move(ctx.outvec);
+        },
+        {node->get_operand()}));
+}
 
 void Executor::visit(StringLiteralNode* node) {}
 
@@ -254,6 +515,8 @@ void Executor::visit(NumberLiteralNode* node)
 
 void Executor::visit(FuncCallNode* node)
 {
+    if (eval_pipeline(node)) return;
+
     bool has_matrix_arg = false;
     size_t matrix_arg_idx = 0;
 
@@ -282,34 +545,31 @@ void Executor::visit(FuncCallNode* node)
         return;
     }
 
-    std::vector<std::unique_ptr<MatrixValue>> mats;
+    std::vector<std::shared_ptr<MatrixValue>> mats;
     std::vector<std::unique_ptr<VectorValue>> vec_args;
     std::unique_ptr<MatrixValue> mat_arg;
     std::vector<ExecValue*> args;
-    auto out_mat = std::make_unique<MatrixValue>();
+    auto out_mat = std::make_unique<MatrixValue>(&allocations);
 
     size_t arg_idx = 0;
-    auto saved_sts = start_timestamp;
     Duration mat_range, mat_offset;
     for (auto&& arg : node->get_args()) {
         if (arg_idx == matrix_arg_idx) {
-            /* reset the time range to make sure we get all the points */
+            /* the matrix arg selects the points of all windows itself */
             mat_range = arg->get_range();
             mat_offset = arg->get_offset();
-            start_timestamp -= mat_range.count() + mat_offset.count();
         }
 
-        arg->visit(*this);
+        eval(arg.get());
         assert(!value_stack.empty());
         mats.push_back(pop_value());
-        start_timestamp = saved_sts;
 
         if (arg_idx == matrix_arg_idx) {
-            mat_arg = std::make_unique<MatrixValue>();
+            mat_arg = std::make_unique<MatrixValue>(&allocations);
             vec_args.push_back(nullptr);
             args.push_back(mat_arg.get());
         } else {
-            vec_args.emplace_back();
+            vec_args.push_back(std::make_unique<VectorValue>(&allocations));
             args.push_back(vec_args.back().get());
         }
 
@@ -317,10 +577,14 @@ void Executor::visit(FuncCallNode* node)
     }
 
     auto matrix_arg = mats[matrix_arg_idx].get();
+    auto matrix_arg_node = node->get_args()[matrix_arg_idx].get();
     EvalContext ctx;
-    ctx.outvec = std::make_unique<VectorValue>();
+    ctx.outvec = std::make_unique<VectorValue>(&allocations);
+    auto num_steps = (end_timestamp - start_timestamp) / interval.count() + 1;
     for (auto&& s : matrix_arg->get_series()) {
-        MatrixValue::Series ss(s.metric, {});
+        check_cancelled();
+
+        MatrixValue::Series ss(s.metric, &allocations);
         int step = 0;
         auto lower = s.values.cbegin(), upper = s.values.cbegin();
 
@@ -339,15 +603,16 @@ void Executor::visit(FuncCallNode* node)
             }
 
             /* get data point slice */
-            auto maxt = ts - mat_offset.count();
-            auto mint = maxt - mat_range.count();
+            auto maxt =
+                sub_timestamp(at_time(matrix_arg_node, ts), mat_offset.count());
+            auto mint = sub_timestamp(maxt, mat_range.count());
             while (upper != s.values.end() && upper->get_time() <= maxt)
                 upper++;
             while (lower < upper && lower->get_time() < mint)
                 lower++;
 
             mat_arg->clear();
-            mat_arg->add_series({s.metric, {lower, upper}});
+            mat_arg->add_series({s.metric, lower, upper, &allocations});
 
             ctx.ts = ts;
             ctx.mat_start = mint;
@@ -368,19 +633,156 @@ void Executor::visit(FuncCallNode* node)
         }
     }
 
+    stats.steps += num_steps;
     push_value(std::move(out_mat));
 }
 
+std::unique_ptr<MatrixValue>
+push_down_aggregation(Queryable* queryable, AggregationNode* node,
+                      uint64_t start, uint64_t end, uint64_t step,
+                      std::pmr::memory_resource* mr)
+{
+    switch (node->get_op()) {
+    case Token::SUM:
+    case Token::MIN:
+    case Token::MAX:
+    case Token::COUNT:
+    case Token::AVG:
+        break;
+    default:
+        return nullptr;
+    }
+
+    AggregateHints hints;
+    const std::vector<LabelMatcher>* matchers;
+    auto* expr = node->get_expr();
+
+    if (auto* vs = dynamic_cast<VectorSelectorNode*>(expr)) {
+        /* sum(x) */
+        if (vs->get_at() != AtModifier::NONE) return nullptr;
+
+        hints.range = LOOKBACK_DELTA.count();
+        hints.offset = vs->get_offset().count();
+        matchers = &vs->get_matchers();
+    } else if (auto* call = dynamic_cast<FuncCallNode*>(expr)) {
+        /* sum(rate(x[5m])) */
+        const auto& args = call->get_args();
+        if (args.size() != 1) return nullptr;
+
+        auto* ms = dynamic_cast<MatrixSelectorNode*>(args[0].get());
+        if (!ms || ms->get_at() != AtModifier::NONE) return nullptr;
+
+        hints.func = call->get_func()->name;
+        hints.range = ms->get_range().count();
+        hints.offset = ms->get_offset().count();
+        matchers = &ms->get_matchers();
+    } else {
+        return nullptr;
+    }
+
+    hints.op = node->get_op();
+    hints.grouping.assign(node->get_grouping().begin(),
+                          node->get_grouping().end());
+    hints.without = node->is_without();
+    hints.start = start;
+    hints.end = end;
+    hints.step = step;
+
+    auto q = queryable->querier(sub_timestamp(start, hints.range + hints.offset),
+                                sub_timestamp(end, hints.offset));
+    std::vector<PartialAggregate> partials;
+    if (!q->select_aggregate(hints, *matchers, partials)) {
+        return nullptr;
+    }
+
+    /* merge the partials of each group */
+    struct AggregationGroup {
+        LabelSet labels;
+        std::map<uint64_t, PartialAggregate::Point> points;
+    };
+    std::unordered_map<LabelSet, AggregationGroup> groups;
+
+    for (auto&& p : partials) {
+        auto it = groups.find(p.labels);
+        if (it == groups.end()) {
+            it = groups.emplace(p.labels, AggregationGroup{p.labels, {}}).first;
+        }
+        auto& group = it->second;
+
+        for (auto&& pt : p.points) {
+            if (!pt.count) continue;
+
+            auto pit = group.points.find(pt.t);
+            if (pit == group.points.end()) {
+                group.points.emplace(pt.t, pt);
+                continue;
+            }
+
+            auto& acc = pit->second;
+            switch (hints.op) {
+            case Token::SUM:
+            case Token::AVG:
+                acc.value += pt.value;
+                break;
+            case Token::MIN:
+                if (acc.value > pt.value) acc.value = pt.value;
+                break;
+            case Token::MAX:
+                if (acc.value < pt.value) acc.value = pt.value;
+                break;
+            default:
+                break;
+            }
+            acc.count += pt.count;
+        }
+    }
+
+    auto mat = std::make_unique<MatrixValue>(mr);
+    for (auto&& p : groups) {
+        MatrixValue::Series series(p.second.labels, mr);
+
+        for (auto&& tp : p.second.points) {
+            const auto& pt = tp.second;
+            double value = pt.value;
+
+            if (hints.op == Token::COUNT) {
+                value = pt.count;
+            } else if (hints.op == Token::AVG) {
+                value = pt.value / (double)pt.count;
+            }
+
+            series.values.emplace_back(pt.t, value);
+        }
+
+        if (!series.values.empty()) mat->add_series(std::move(series));
+    }
+
+    return mat;
+}
+
 void Executor::visit(AggregationNode* node)
 {
+    if (eval_pipeline(node)) return;
+
+    auto pushed = push_down_aggregation(queryable, node, start_timestamp,
+                                        end_timestamp, interval.count(),
+                                        &allocations);
+    if (pushed) {
+        push_value(std::move(pushed));
+        return;
+    }
+
     std::vector<ASTNode*> args;
     args.push_back(node->get_expr());
     if (node->get_param()) {
         args.push_back(node->get_param());
     }
 
+    auto grouping = SymbolTable::global().intern(node->get_grouping());
+
     push_value(range_eval(
-        [node, this](const std::vector<ExecValue*>& args, EvalContext& ctx) {
+        [node, &grouping](const std::vector<ExecValue*>& args,
+                          EvalContext& ctx) {
             VectorValue* vec = static_cast<VectorValue*>(args[0]);
             double param = 0;
             if (node->get_param()) {
@@ -389,39 +791,113 @@ void Executor::visit(AggregationNode* node)
                             .value.get_value();
             }
 
-            return this->aggregation(node->get_op(), node->get_grouping(),
-                                     node->is_without(), param, vec, ctx);
+            return aggregate(node->get_op(), grouping, node->is_without(),
+                             param, vec, ctx);
         },
         args));
 }
 
-void Executor::visit(VectorSelectorNode* node)
+QueryStats Executor::get_stats() const
+{
+    auto result = stats;
+    result.series += tracker.get_series();
+    result.samples += tracker.get_samples();
+    result.peak_samples =
+        std::max(result.peak_samples, tracker.get_peak_samples());
+    result.peak_bytes = std::max(result.peak_bytes, tracker.get_peak_bytes());
+    return result;
+}
+
+std::shared_ptr<MatrixValue> fetch(Queryable* queryable,
+                                   const std::vector<LabelMatcher>& matchers,
+                                   uint64_t mint, uint64_t maxt,
+                                   std::pmr::memory_resource* mr,
+                                   MemoryTracker* tracker,
+                                   const CancellationToken* token)
 {
-    auto mat = std::make_unique<MatrixValue>();
+    auto mat = std::make_shared<MatrixValue>(mr);
 
-    auto q = queryable->querier(start_timestamp, end_timestamp);
+    auto q = queryable->querier(mint, maxt);
 
-    auto series_it = q->select(node->get_matchers());
+    auto series_it = q->select(matchers);
 
     while (series_it && series_it->next()) {
-        MatrixValue::Series series;
+        if (token) token->check();
 
+        MatrixValue::Series series(mr);
         auto si = series_it->at();
-        std::vector<Label> labels;
-        si->labels(labels);
-        for (auto&& l : labels) {
-            series.metric.emplace_back(l.name, l.value);
-        }
 
+        si->labels(series.metric);
         auto value_it = si->iterator();
+        while (value_it->next()) {
+            auto tv = value_it->at();
+            if (tv.first < mint) continue;
+            if (tv.first > maxt) break;
+            series.values.emplace_back((uint64_t)tv.first, tv.second);
+        }
+
+        if (tracker) tracker->add_series(series.values.size());
+        if (!series.values.empty()) mat->add_series(std::move(series));
+    }
+
+    return mat;
+}
+
+std::shared_ptr<MatrixValue>
+Executor::select(const ASTNode* selector,
+                 const std::vector<LabelMatcher>& matchers, uint64_t mint,
+                 uint64_t maxt)
+{
+    size_t idx;
+    const Scan* scan = plan ? plan->get_scan(selector, idx) : nullptr;
+
+    StatsTimer timer(stats.select_time);
+    if (!scan) {
+        return fetch(queryable, matchers, mint, maxt, &allocations, &tracker,
+                     token.get());
+    }
+
+    /* the scan is shared by all selectors with the same matchers and covers
+     * the time ranges of all of them */
+    if (!scans[idx]) {
+        scans[idx] = fetch(queryable, scan->matchers,
+                           sub_timestamp(query_start, scan->before.count()),
+                           sub_timestamp(query_end, scan->after.count()),
+                           &allocations, &tracker, token.get());
+    }
+
+    return scans[idx];
+}
+
+void Executor::visit(VectorSelectorNode* node)
+{
+    auto mat = std::make_unique<MatrixValue>(&allocations);
+    auto offset = node->get_offset().count();
+    auto lookback = LOOKBACK_DELTA.count();
+    auto mint =
+        sub_timestamp(at_time(node, start_timestamp), offset + lookback);
+    auto maxt = sub_timestamp(at_time(node, end_timestamp), offset);
+
+    auto raw = select(node, node->get_matchers(), mint, maxt);
+
+    for (auto&& s : raw->get_series()) {
+        check_cancelled();
+
+        MatrixValue::Series series(s.metric, &allocations);
+
+        auto it = s.values.cbegin();
         for (auto ts = start_timestamp; ts <= end_timestamp;
              ts += interval.count()) {
-            if (!value_it->seek(ts)) {
-                continue;
-            }
+            /* latest point within the lookback delta before the step */
+            auto t = sub_timestamp(at_time(node, ts), offset);
+            while (it != s.values.cend() && it->get_time() <= t)
+                it++;
+            if (it == s.values.cbegin()) continue;
 
-            auto tv = value_it->at();
-            series.values.emplace_back(ts, tv.second);
+            auto prev = it - 1;
+            if (prev->get_time() + lookback <= t) continue;
+
+            series.values.emplace_back(ts, prev->get_value());
         }
 
         if (!series.values.empty()) mat->add_series(std::move(series));
@@ -432,28 +908,21 @@ void Executor::visit(VectorSelectorNode* node)
 
 void Executor::visit(MatrixSelectorNode* node)
 {
-    auto mat = std::make_unique<MatrixValue>();
-    auto offset = node->get_offset();
-    auto maxt = end_timestamp - offset.count();
-    auto mint = maxt - node->get_range().count();
+    auto mat = std::make_unique<MatrixValue>(&allocations);
+    auto offset = node->get_offset().count();
+    auto maxt = sub_timestamp(at_time(node, end_timestamp), offset);
+    auto mint = sub_timestamp(at_time(node, start_timestamp),
+                              node->get_range().count() + offset);
 
-    auto q = queryable->querier(start_timestamp, end_timestamp);
+    auto raw = select(node, node->get_matchers(), mint, maxt);
 
-    auto series_it = q->select(node->get_matchers());
-
-    while (series_it && series_it->next()) {
-        MatrixValue::Series series;
-        auto si = series_it->at();
+    for (auto&& s : raw->get_series()) {
+        MatrixValue::Series series(s.metric, &allocations);
 
-        std::vector<Label> labels;
-        si->labels(labels);
-        for (auto&& l : labels) {
-            series.metric.emplace_back(l.name, l.value);
-        }
-        auto value_it = si->iterator();
-        while (value_it->next()) {
-            auto tv = value_it->at();
-            series.values.emplace_back((uint64_t)tv.first, tv.second);
+        for (auto&& v : s.values) {
+            if (v.get_time() < mint) continue;
+            if (v.get_time() > maxt) break;
+            series.values.push_back(v);
         }
 
         if (!series.values.empty()) mat->add_series(std::move(series));
@@ -462,7 +931,27 @@ void Executor::visit(MatrixSelectorNode* node)
     push_value(std::move(mat));
 }
 
-void Executor::visit(SubqueryNode* node) {}
+void Executor::visit(SubqueryNode* node)
+{
+    auto step = node->get_step().count();
+    if (!step) step = DEFAULT_SUBQUERY_STEP.count();
+    auto offset = node->get_offset().count();
+    auto mint = sub_timestamp(at_time(node, start_timestamp),
+                              node->get_range().count() + offset);
+    auto maxt = sub_timestamp(at_time(node, end_timestamp), offset);
+
+    /* evaluate the inner expression once on a grid aligned to multiples of
+     * the subquery step, the windows of all outer steps are sliced from it */
+    auto inner_start = (mint + step - 1) / step * step;
+    auto inner_end = maxt / step * step;
+    if (inner_start > inner_end) {
+        push_value(std::make_unique<MatrixValue>(&allocations));
+        return;
+    }
+
+    push_value(eval_range(node->get_expr(), inner_start, inner_end,
+                          Duration{step}));
+}
 
 static bool sample_lt(const VectorValue::Sample& lhs,
                       const VectorValue::Sample& rhs)
@@ -477,47 +966,28 @@ static bool sample_gt(const VectorValue::Sample& lhs,
 }
 
 std::unique_ptr<VectorValue>
-Executor::aggregation(Token op, const std::vector<std::string>& grouping,
-                      bool without, double param, VectorValue* vec,
-                      EvalContext& ctx)
+aggregate(Token op, const std::vector<uint32_t>& grouping, bool without,
+          double param, VectorValue* vec, EvalContext& ctx)
 {
     struct AggregationGroup {
-        std::vector<Label> labels;
+        LabelSet labels;
         double value, mean;
         int group_count;
         std::vector<VectorValue::Sample> heap;
     };
 
-    std::unordered_map<std::string, AggregationGroup> groups;
-    std::unordered_set<std::string> grouping_set(grouping.begin(),
-                                                 grouping.end());
+    std::unordered_map<LabelSet, AggregationGroup> groups;
     int k = (int)param;
     double q = param;
 
     for (auto&& s : vec->get_samples()) {
-        const auto& metric = s.metric;
-        std::vector<Label> labels;
-
-        for (auto&& l : metric) {
-            bool found = grouping_set.find(l.name) != grouping_set.end();
-
-            if (without == found) {
-                continue;
-            }
-
-            if (without && l.name == METRIC_NAME) continue;
-
-            labels.push_back(l);
-        }
-
-        std::sort(labels.begin(), labels.end());
-        auto lstr = lset2str(labels);
+        auto labels = s.metric.grouping(grouping, without);
 
-        auto it = groups.find(lstr);
+        auto it = groups.find(labels);
         if (it == groups.end()) {
             AggregationGroup group;
             group.group_count = 1;
-            group.labels = std::move(labels);
+            group.labels = labels;
             group.value = s.value.get_value();
             group.mean = s.value.get_value();
 
@@ -535,7 +1005,7 @@ Executor::aggregation(Token op, const std::vector<std::string>& grouping,
                 break;
             }
 
-            groups[lstr] = std::move(group);
+            groups[labels] = std::move(group);
             continue;
         }
 
@@ -0,0 +1,272 @@
+#include "promql/parse/explain.h"
+
+#include <time.h>
+
+namespace promql {
+
+static std::chrono::nanoseconds thread_cpu_time()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) +
+           std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+static double seconds(std::chrono::nanoseconds d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+static const char* matchop2str(MatchOp op)
+{
+    switch (op) {
+    case MatchOp::EQL:
+        return "=";
+    case MatchOp::NEQ:
+        return "!=";
+    case MatchOp::LSS:
+        return "<";
+    case MatchOp::GTR:
+        return ">";
+    case MatchOp::LTE:
+        return "<=";
+    case MatchOp::GTE:
+        return ">=";
+    case MatchOp::EQL_REGEX:
+        return "=~";
+    case MatchOp::NEQ_REGEX:
+        return "!~";
+    default:
+        return "?";
+    }
+}
+
+static std::string matchers2str(const std::vector<LabelMatcher>& matchers)
+{
+    std::string str = "{";
+    bool first = true;
+    for (auto&& p : matchers) {
+        if (!first) str += ", ";
+        str += std::string(p.name) + matchop2str(p.op) + "\"" +
+               std::string(p.value) + "\"";
+        first = false;
+    }
+    return str + "}";
+}
+
+NodeProfiler::NodeProfiler(QueryProfile* profile, const ASTNode* node,
+                           const AllocationCounter& allocations)
+    : profile(profile), node(node), allocations(allocations)
+{
+    if (!profile) return;
+
+    start_wall = std::chrono::steady_clock::now();
+    start_cpu = thread_cpu_time();
+    start_bytes = allocations.get_allocated();
+}
+
+void NodeProfiler::finish(const ExecValue* result)
+{
+    if (!profile) return;
+
+    auto& p = (*profile)[node];
+    p.calls++;
+    p.wall_time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_wall);
+    p.cpu_time += thread_cpu_time() - start_cpu;
+
+    p.bytes += allocations.get_allocated() - start_bytes;
+
+    if (result) {
+        p.series += result->num_series();
+        p.samples += result->num_samples();
+    }
+}
+
+std::string PlanExplainer::explain()
+{
+    ss.str("");
+    ss << "{\"root\": ";
+    plan->root->visit(*this);
+
+    ss << ", \"scans\": [";
+    bool first = true;
+    for (auto&& scan : plan->scans) {
+        ss << (first ? "" : ", ") << "{\"matchers\": \""
+           << json_escape(matchers2str(scan.matchers))
+           << "\", \"before\": " << scan.before.count() / 1000.0
+           << ", \"after\": " << scan.after.count() / 1000.0 << "}";
+        first = false;
+    }
+    ss << "]}";
+
+    return ss.str();
+}
+
+const NodeProfile* PlanExplainer::find_profile(const ASTNode* node) const
+{
+    if (!profile) return nullptr;
+
+    auto it = profile->find(node);
+    return it == profile->end() ? nullptr : &it->second;
+}
+
+void PlanExplainer::begin(ASTNode* node, const std::string& name)
+{
+    ss << "{\"node\": \"" << name << "\", \"type\": \""
+       << valtype2str(node->type()) << "\"";
+
+    size_t idx;
+    if (plan->get_cse(node, idx)) ss << ", \"cse\": " << idx;
+    if (plan->get_scan(node, idx)) ss << ", \"scan\": " << idx;
+    if (plan->is_step_invariant(node)) ss << ", \"stepInvariant\": true";
+}
+
+void PlanExplainer::end(ASTNode* node, const std::vector<ASTNode*>& children)
+{
+    if (!children.empty()) {
+        ss << ", \"children\": [";
+        bool first = true;
+        for (auto&& p : children) {
+            if (!first) ss << ", ";
+            p->visit(*this);
+            first = false;
+        }
+        ss << "]";
+    }
+
+    /* nodes evaluated as part of their parent, e.g. by an aggregation pushed
+     * down to the storage, have no profile */
+    const NodeProfile* p = find_profile(node);
+    if (p) {
+        size_t input_series = 0;
+        for (auto&& child : children) {
+            auto* child_profile = find_profile(child);
+            if (child_profile) input_series += child_profile->series;
+        }
+
+        ss << ", \"analysis\": {\"calls\": " << p->calls
+           << ", \"wallTime\": " << seconds(p->wall_time)
+           << ", \"cpuTime\": " << seconds(p->cpu_time)
+           << ", \"inputSeries\": " << input_series
+           << ", \"outputSeries\": " << p->series
+           << ", \"samples\": " << p->samples << ", \"bytes\": " << p->bytes
+           << "}";
+    }
+
+    ss << "}";
+}
+
+void PlanExplainer::explain_time(ASTNode* node)
+{
+    if (node->get_range().count()) {
+        ss << ", \"range\": " << node->get_range().count() / 1000.0;
+    }
+    if (node->get_offset().count()) {
+        ss << ", \"offset\": " << node->get_offset().count() / 1000.0;
+    }
+
+    switch (node->get_at()) {
+    case AtModifier::TIMESTAMP:
+        ss << ", \"at\": " << node->get_at_timestamp() / 1000.0;
+        break;
+    case AtModifier::START:
+        ss << ", \"at\": \"start()\"";
+        break;
+    case AtModifier::END:
+        ss << ", \"at\": \"end()\"";
+        break;
+    default:
+        break;
+    }
+}
+
+void PlanExplainer::visit(UnaryNode* node)
+{
+    begin(node, "unary");
+    ss << ", \"op\": \"" << tok2str(node->get_op()) << "\"";
+    end(node, {node->get_operand()});
+}
+
+void PlanExplainer::visit(BinaryNode* node)
+{
+    begin(node, "binary");
+    ss << ", \"op\": \"" << tok2str(node->get_op()) << "\"";
+    if (node->is_return_bool()) ss << ", \"bool\": true";
+    end(node, {node->get_lhs(), node->get_rhs()});
+}
+
+void PlanExplainer::visit(StringLiteralNode* node)
+{
+    begin(node, "string");
+    ss << ", \"value\": \"" << json_escape(node->get_value()) << "\"";
+    end(node, {});
+}
+
+void PlanExplainer::visit(NumberLiteralNode* node)
+{
+    begin(node, "number");
+    ss << ", \"value\": " << node->get_value();
+    end(node, {});
+}
+
+void PlanExplainer::visit(FuncCallNode* node)
+{
+    begin(node, "call");
+    ss << ", \"func\": \"" << node->get_func()->name << "\"";
+
+    std::vector<ASTNode*> args;
+    for (auto&& p : node->get_args()) {
+        args.push_back(p.get());
+    }
+    end(node, args);
+}
+
+void PlanExplainer::visit(AggregationNode* node)
+{
+    begin(node, "aggregation");
+    ss << ", \"op\": \"" << tok2str(node->get_op()) << "\"";
+
+    const auto& grouping = node->get_grouping();
+    if (!grouping.empty() || node->is_without()) {
+        ss << ", \"" << (node->is_without() ? "without" : "by") << "\": [";
+        bool first = true;
+        for (auto&& p : grouping) {
+            ss << (first ? "" : ", ") << "\"" << json_escape(p) << "\"";
+            first = false;
+        }
+        ss << "]";
+    }
+
+    std::vector<ASTNode*> children{node->get_expr()};
+    if (node->get_param()) children.push_back(node->get_param());
+    end(node, children);
+}
+
+void PlanExplainer::visit(VectorSelectorNode* node)
+{
+    begin(node, "vectorSelector");
+    ss << ", \"matchers\": \""
+       << json_escape(matchers2str(node->get_matchers())) << "\"";
+    explain_time(node);
+    end(node, {});
+}
+
+void PlanExplainer::visit(MatrixSelectorNode* node)
+{
+    begin(node, "matrixSelector");
+    ss << ", \"matchers\": \""
+       << json_escape(matchers2str(node->get_matchers())) << "\"";
+    explain_time(node);
+    end(node, {});
+}
+
+void PlanExplainer::visit(SubqueryNode* node)
+{
+    begin(node, "subquery");
+    ss << ", \"step\": " << node->get_step().count() / 1000.0;
+    explain_time(node);
+    end(node, {node->get_expr()});
+}
+
+} // namespace promql
@@ -0,0 +1,229 @@
+#include "promql/parse/fingerprint.h"
+#include "promql/parse/functions.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace promql {
+
+static std::string op2str(Token op)
+{
+    switch (op) {
+    case Token::ADD:
+        return "+";
+    case Token::SUB:
+        return "-";
+    case Token::MUL:
+        return "*";
+    case Token::DIV:
+        return "/";
+    case Token::MOD:
+        return "%";
+    case Token::POW:
+        return "^";
+    case Token::EQL:
+        return "==";
+    case Token::NEQ:
+        return "!=";
+    case Token::LTE:
+        return "<=";
+    case Token::LSS:
+        return "<";
+    case Token::GTE:
+        return ">=";
+    case Token::GTR:
+        return ">";
+    case Token::LAND:
+        return "and";
+    case Token::LOR:
+        return "or";
+    case Token::LUNLESS:
+        return "unless";
+    case Token::TOP_K:
+        return "topk";
+    case Token::BOTTOM_K:
+        return "bottomk";
+    case Token::COUNT_VALUES:
+        return "count_values";
+    default:
+        break;
+    }
+
+    /* the other aggregations are spelled as their token */
+    auto str = tok2str(op);
+    std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+    return str;
+}
+
+static const char* mop2symbol(MatchOp op)
+{
+    switch (op) {
+    case MatchOp::NEQ:
+        return "!=";
+    case MatchOp::EQL_REGEX:
+        return "=~";
+    case MatchOp::NEQ_REGEX:
+        return "!~";
+    default:
+        break;
+    }
+    return "=";
+}
+
+static std::string format_duration(Duration d)
+{
+    static const std::pair<int64_t, const char*> units[] = {
+        {86400000, "d"}, {3600000, "h"}, {60000, "m"}, {1000, "s"}};
+
+    auto ms = d.count();
+    for (auto&& u : units) {
+        if (ms && ms % u.first == 0)
+            return std::to_string(ms / u.first) + u.second;
+    }
+    return std::to_string(ms) + "ms";
+}
+
+std::string QueryFingerprinter::fingerprint(ASTNode* node)
+{
+    out.clear();
+    node->visit(*this);
+    return std::move(out);
+}
+
+uint64_t QueryFingerprinter::hash(const std::string& fingerprint)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : fingerprint) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void QueryFingerprinter::visit(UnaryNode* node)
+{
+    out += op2str(node->get_op());
+    node->get_operand()->visit(*this);
+}
+
+void QueryFingerprinter::visit(BinaryNode* node)
+{
+    out += '(';
+    node->get_lhs()->visit(*this);
+    out += ' ' + op2str(node->get_op()) +
+           (node->is_return_bool() ? " bool " : " ");
+    node->get_rhs()->visit(*this);
+    out += ')';
+}
+
+void QueryFingerprinter::visit(StringLiteralNode* node) { out += '?'; }
+
+void QueryFingerprinter::visit(NumberLiteralNode* node) { out += '?'; }
+
+void QueryFingerprinter::visit(FuncCallNode* node)
+{
+    out += node->get_func()->name + "(";
+    bool first = true;
+    for (auto&& p : node->get_args()) {
+        if (!first) out += ", ";
+        p->visit(*this);
+        first = false;
+    }
+    out += ')';
+}
+
+void QueryFingerprinter::visit(AggregationNode* node)
+{
+    /* the grouping labels are sorted as their order does not matter */
+    auto grouping = node->get_grouping();
+    std::sort(grouping.begin(), grouping.end());
+
+    out += op2str(node->get_op());
+    if (!grouping.empty() || node->is_without()) {
+        out += node->is_without() ? " without (" : " by (";
+        for (size_t i = 0; i < grouping.size(); i++) {
+            if (i) out += ", ";
+            out += grouping[i];
+        }
+        out += ") ";
+    }
+
+    out += '(';
+    if (node->get_param()) {
+        node->get_param()->visit(*this);
+        out += ", ";
+    }
+    node->get_expr()->visit(*this);
+    out += ')';
+}
+
+void QueryFingerprinter::visit(VectorSelectorNode* node)
+{
+    print_selector(node->get_matchers());
+    print_modifiers(node);
+}
+
+void QueryFingerprinter::visit(MatrixSelectorNode* node)
+{
+    print_selector(node->get_matchers());
+    out += "[" + format_duration(node->get_range()) + "]";
+    print_modifiers(node);
+}
+
+void QueryFingerprinter::visit(SubqueryNode* node)
+{
+    node->get_expr()->visit(*this);
+    out += "[" + format_duration(node->get_range()) + ":";
+    if (node->get_step().count()) out += format_duration(node->get_step());
+    out += ']';
+    print_modifiers(node);
+}
+
+void QueryFingerprinter::print_selector(
+    const std::vector<LabelMatcher>& matchers)
+{
+    std::vector<const LabelMatcher*> sorted;
+    for (auto&& m : matchers) {
+        /* the metric name is kept, it identifies the selector */
+        if (m.name == METRIC_NAME && m.op == MatchOp::EQL) {
+            out += m.value;
+        } else {
+            sorted.push_back(&m);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const LabelMatcher* a, const LabelMatcher* b) {
+                  if (a->name != b->name) return a->name < b->name;
+                  return a->op < b->op;
+              });
+
+    if (sorted.empty()) return;
+    out += '{';
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (i) out += ", ";
+        out += std::string(sorted[i]->name) + mop2symbol(sorted[i]->op) + "?";
+    }
+    out += '}';
+}
+
+void QueryFingerprinter::print_modifiers(ASTNode* node)
+{
+    auto offset = node->get_offset();
+    if (offset.count()) out += " offset " + format_duration(offset);
+
+    switch (node->get_at()) {
+    case AtModifier::TIMESTAMP:
+        out += " @ ?";
+        break;
+    case AtModifier::START:
+        out += " @ start()";
+        break;
+    case AtModifier::END:
+        out += " @ end()";
+        break;
+    default:
+        break;
+    }
+}
+
+} // namespace promql
@@ -1,6 +1,7 @@
 #include "promql/parse/functions.h"
 #include "promql/parse/executor.h"
 
+#include <cmath>
 #include <unordered_map>
 
 namespace promql {
@@ -26,7 +27,8 @@ extrapolate_rate(const std::vector<ExecValue*>& values, EvalContext& ctx,
             continue;
         }
 
-        double counter_correction = 0, last_value;
+        double counter_correction = 0,
+               last_value = s.values.front().get_value();
         for (auto&& tv : s.values) {
             if (is_counter && tv.get_value() < last_value) {
                 counter_correction += last_value;
@@ -94,23 +96,113 @@ std::unique_ptr<VectorValue> func_rate(const std::vector<ExecValue*>& values,
     return extrapolate_rate(values, ctx, true, true);
 }
 
-static const std::unordered_map<std::string, ExecFunction> function_table = {
+static std::unique_ptr<VectorValue>
+aggregate_over_time(const std::vector<ExecValue*>& values, EvalContext& ctx,
+                    const std::function<double(const MatrixValue::Series&)>& f)
+{
+    const auto* matrix = static_cast<const MatrixValue*>(values.front());
+
+    for (auto&& s : matrix->get_series()) {
+        if (s.values.empty()) {
+            continue;
+        }
+
+        ctx.outvec->add_sample({{}, {ctx.ts, f(s)}});
+    }
+
+    return std::move(ctx.outvec);
+}
+
+std::unique_ptr<VectorValue>
+func_avg_over_time(const std::vector<ExecValue*>& values, EvalContext& ctx)
+{
+    return aggregate_over_time(values, ctx, [](const MatrixValue::Series& s) {
+        double mean = 0;
+        int count = 0;
+        for (auto&& tv : s.values) {
+            count++;
+            mean += (tv.get_value() - mean) / count;
+        }
+        return mean;
+    });
+}
+
+std::unique_ptr<VectorValue>
+func_count_over_time(const std::vector<ExecValue*>& values, EvalContext& ctx)
+{
+    return aggregate_over_time(values, ctx, [](const MatrixValue::Series& s) {
+        return (double)s.values.size();
+    });
+}
+
+std::unique_ptr<VectorValue>
+func_max_over_time(const std::vector<ExecValue*>& values, EvalContext& ctx)
+{
+    return aggregate_over_time(values, ctx, [](const MatrixValue::Series& s) {
+        double max = s.values.front().get_value();
+        for (auto&& tv : s.values) {
+            if (tv.get_value() > max || std::isnan(max)) max = tv.get_value();
+        }
+        return max;
+    });
+}
+
+std::unique_ptr<VectorValue>
+func_min_over_time(const std::vector<ExecValue*>& values, EvalContext& ctx)
+{
+    return aggregate_over_time(values, ctx, [](const MatrixValue::Series& s) {
+        double min = s.values.front().get_value();
+        for (auto&& tv : s.values) {
+            if (tv.get_value() < min || std::isnan(min)) min = tv.get_value();
+        }
+        return min;
+    });
+}
+
+std::unique_ptr<VectorValue>
+func_sum_over_time(const std::vector<ExecValue*>& values, EvalContext& ctx)
+{
+    return aggregate_over_time(values, ctx, [](const MatrixValue::Series& s) {
+        double sum = 0;
+        for (auto&& tv : s.values) {
+            sum += tv.get_value();
+        }
+        return sum;
+    });
+}
+
+/* the names are literals, the table is keyed by views of them */
+using FunctionTable = std::unordered_map<std::string_view, ExecFunction>;
+
+static const FunctionTable function_table = {
+    {"avg_over_time",
+     {"avg_over_time", func_avg_over_time, {ValueType::MATRIX},
+      ValueType::VECTOR}},
+    {"count_over_time",
+     {"count_over_time", func_count_over_time, {ValueType::MATRIX},
+      ValueType::VECTOR}},
     {"delta", {"delta", func_rate, {ValueType::MATRIX}, ValueType::VECTOR}},
     {"increase",
      {"increase", func_rate, {ValueType::MATRIX}, ValueType::VECTOR}},
+    {"max_over_time",
+     {"max_over_time", func_max_over_time, {ValueType::MATRIX},
+      ValueType::VECTOR}},
+    {"min_over_time",
+     {"min_over_time", func_min_over_time, {ValueType::MATRIX},
+      ValueType::VECTOR}},
     {"rate", {"rate", func_rate, {ValueType::MATRIX}, ValueType::VECTOR}},
+    {"sum_over_time",
+     {"sum_over_time", func_sum_over_time, {ValueType::MATRIX},
+      ValueType::VECTOR}},
     {"time", {"time", func_time, {}, ValueType::SCALAR}},
 };
 
 } // namespace detail
 
-const ExecFunction* ExecFunction::get(const std::string& name)
+const ExecFunction* ExecFunction::get(std::string_view name)
 {
-    try {
-        return &detail::function_table.at(name);
-    } catch (const std::out_of_range& e) {
-        return nullptr;
-    }
+    auto it = detail::function_table.find(name);
+    return it == detail::function_table.end() ? nullptr : &it->second;
 }
 
 } // namespace promql
@@ -0,0 +1,415 @@
+#include "promql/parse/instant_executor.h"
+#include "promql/parse/functions.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace promql {
+
+InstantExecutor::InstantExecutor(Queryable* queryable, const QueryPlan* plan,
+                                 SystemTime time)
+    : queryable(queryable), plan(plan),
+      timestamp(std::chrono::duration_cast<Duration>(time.time_since_epoch())
+                    .count()),
+      profile(nullptr), arena(&tracker),
+      allocations(&arena)
+{
+    scans.resize(plan->scans.size());
+}
+
+std::unique_ptr<ExecValue> InstantExecutor::execute()
+{
+    auto* root = plan->root.get();
+
+    {
+        StatsTimer timer(stats.eval_time);
+        eval(root);
+    }
+    /* the selection time is counted in the evaluation time above */
+    stats.eval_time -= stats.select_time;
+    stats.steps++;
+    cse_cache.clear();
+
+    if (root->type() == ValueType::NONE || value_stack.empty()) {
+        return nullptr;
+    }
+
+    assert(value_stack.size() == 1);
+    auto result = std::move(value_stack.top());
+    value_stack.pop();
+
+    /* copy the result out of the arena, it is released with the executor */
+    switch (root->type()) {
+    case ValueType::SCALAR: {
+        const auto& samples =
+            static_cast<VectorValue*>(result.get())->get_samples();
+        return std::make_unique<ScalarValue>(
+            timestamp, samples.empty() ? NAN : samples[0].value.get_value());
+    }
+    case ValueType::VECTOR:
+        return std::make_unique<VectorValue>(
+            *static_cast<VectorValue*>(result.get()),
+            std::pmr::get_default_resource());
+    case ValueType::MATRIX:
+        return std::make_unique<MatrixValue>(
+            *static_cast<MatrixValue*>(result.get()),
+            std::pmr::get_default_resource());
+    default:
+        return nullptr;
+    }
+}
+
+QueryStats InstantExecutor::get_stats() const
+{
+    auto result = stats;
+    result.series += tracker.get_series();
+    result.samples += tracker.get_samples();
+    result.peak_samples =
+        std::max(result.peak_samples, tracker.get_peak_samples());
+    result.peak_bytes = std::max(result.peak_bytes, tracker.get_peak_bytes());
+    return result;
+}
+
+void InstantExecutor::eval(ASTNode* node)
+{
+    size_t id;
+
+    if (token) token->check();
+
+    bool is_cse = plan->get_cse(node, id);
+    if (is_cse) {
+        auto it = cse_cache.find(id);
+        if (it != cse_cache.end()) {
+            value_stack.push(it->second);
+            return;
+        }
+    }
+
+    NodeProfiler profiler(profile, node, allocations);
+    auto mark = held.enter();
+    node->visit(*this);
+    if (!value_stack.empty()) {
+        profiler.finish(value_stack.top().get());
+        tracker.hold_samples(value_stack.top()->num_samples());
+        tracker.release_samples(held.leave(mark));
+        if (is_cse) cse_cache.emplace(id, value_stack.top());
+    }
+}
+
+std::shared_ptr<VectorValue> InstantExecutor::eval_vector(ASTNode* node)
+{
+    eval(node);
+    assert(!value_stack.empty());
+
+    auto val = std::move(value_stack.top());
+    value_stack.pop();
+    /* a value still referenced is in the cache */
+    held.consume(val->num_samples(), val.use_count() > 1);
+    return std::static_pointer_cast<VectorValue>(val);
+}
+
+std::shared_ptr<MatrixValue> InstantExecutor::eval_matrix(ASTNode* node)
+{
+    eval(node);
+    assert(!value_stack.empty());
+
+    auto val = std::move(value_stack.top());
+    value_stack.pop();
+    /* a value still referenced is in the cache */
+    held.consume(val->num_samples(), val.use_count() > 1);
+    return std::static_pointer_cast<MatrixValue>(val);
+}
+
+uint64_t InstantExecutor::at_time(const ASTNode* node) const
+{
+    switch (node->get_at()) {
+    case AtModifier::TIMESTAMP:
+        return node->get_at_timestamp();
+    default:
+        /* start() and end() are both the evaluation time */
+        return timestamp;
+    }
+}
+
+std::shared_ptr<MatrixValue>
+InstantExecutor::select(const ASTNode* selector,
+                        const std::vector<LabelMatcher>& matchers,
+                        uint64_t mint, uint64_t maxt)
+{
+    size_t idx;
+    const Scan* scan = plan->get_scan(selector, idx);
+
+    StatsTimer timer(stats.select_time);
+    if (!scan) {
+        return fetch(queryable, matchers, mint, maxt, &allocations, &tracker,
+                     token.get());
+    }
+
+    if (!scans[idx]) {
+        scans[idx] = fetch(queryable, scan->matchers,
+                           sub_timestamp(timestamp, scan->before.count()),
+                           sub_timestamp(timestamp, scan->after.count()),
+                           &allocations, &tracker, token.get());
+    }
+
+    return scans[idx];
+}
+
+void InstantExecutor::visit(UnaryNode* node)
+{
+    auto vec = eval_vector(node->get_operand());
+    auto out = std::make_shared<VectorValue>(&allocations);
+    bool negate = node->get_op() == Token::SUB;
+
+    for (auto&& p : vec->get_samples()) {
+        auto value = p.value.get_value();
+        if (!negate) {
+            out->add_sample({p.metric, {timestamp, value}});
+            continue;
+        }
+
+        /* like any arithmetic, -x drops the metric name */
+        out->add_sample({p.metric.drop_metric_name(), {timestamp, -value}});
+    }
+
+    value_stack.push(std::move(out));
+}
+
+void InstantExecutor::visit(BinaryNode* node)
+{
+    auto lhs_type = node->get_lhs()->type();
+    auto rhs_type = node->get_rhs()->type();
+    auto lhs = eval_vector(node->get_lhs());
+    auto rhs = eval_vector(node->get_rhs());
+
+    EvalContext ctx;
+    ctx.ts = timestamp;
+    ctx.outvec = std::make_unique<VectorValue>(&allocations);
+
+    if (lhs_type == ValueType::VECTOR && rhs_type == ValueType::VECTOR) {
+        ctx.outvec = vec_vec_binop(node->get_op(), lhs.get(), rhs.get(),
+                                   node->is_return_bool(), ctx);
+        value_stack.push(std::move(ctx.outvec));
+        return;
+    }
+
+    const auto& lhs_samples = lhs->get_samples();
+    const auto& rhs_samples = rhs->get_samples();
+
+    if (lhs_type == ValueType::SCALAR && rhs_type == ValueType::SCALAR) {
+        if (!lhs_samples.empty() && !rhs_samples.empty()) {
+            bool keep;
+            auto value = vec_elt_binop(
+                node->get_op(), lhs_samples[0].value.get_value(),
+                rhs_samples[0].value.get_value(), keep);
+            if (node->is_return_bool()) {
+                value = keep ? 1.0 : 0.0;
+            }
+
+            ctx.outvec->add_sample({{}, {timestamp, value}});
+        }
+    } else if (lhs_type == ValueType::VECTOR) {
+        if (!rhs_samples.empty()) {
+            ScalarValue rv = rhs_samples[0].value;
+            ctx.outvec = vec_scalar_binop(node->get_op(), lhs.get(), &rv,
+                                          false, node->is_return_bool(), ctx);
+        }
+    } else {
+        if (!lhs_samples.empty()) {
+            ScalarValue lv = lhs_samples[0].value;
+            ctx.outvec = vec_scalar_binop(node->get_op(), rhs.get(), &lv,
+                                          true, node->is_return_bool(), ctx);
+        }
+    }
+
+    value_stack.push(std::move(ctx.outvec));
+}
+
+void InstantExecutor::visit(StringLiteralNode* node) {}
+
+void InstantExecutor::visit(NumberLiteralNode* node)
+{
+    auto vec = std::make_shared<VectorValue>(&allocations);
+    vec->add_sample({{}, {timestamp, node->get_value()}});
+    value_stack.push(std::move(vec));
+}
+
+void InstantExecutor::visit(FuncCallNode* node)
+{
+    const auto& arg_types = node->get_func()->arg_types;
+    std::vector<std::shared_ptr<ExecValue>> vals;
+    std::vector<ExecValue*> args;
+    MatrixValue* matrix_arg = nullptr;
+    ASTNode* matrix_arg_node = nullptr;
+    size_t matrix_arg_idx = 0;
+
+    for (size_t i = 0; i < node->get_args().size(); i++) {
+        auto* arg = node->get_args()[i].get();
+
+        if (i < arg_types.size() && arg_types[i] == ValueType::MATRIX) {
+            auto mat = eval_matrix(arg);
+            matrix_arg = mat.get();
+            matrix_arg_node = arg;
+            matrix_arg_idx = i;
+            vals.push_back(std::move(mat));
+        } else {
+            vals.push_back(eval_vector(arg));
+        }
+        args.push_back(vals.back().get());
+    }
+
+    EvalContext ctx;
+    ctx.ts = timestamp;
+    ctx.outvec = std::make_unique<VectorValue>(&allocations);
+
+    if (!matrix_arg) {
+        value_stack.push(node->get_func()->pfunc(args, ctx));
+        return;
+    }
+
+    /* the matrix arg holds exactly the points of the window, call the
+     * function on each series of it */
+    MatrixValue window;
+    args[matrix_arg_idx] = &window;
+
+    ctx.mat_end = sub_timestamp(at_time(matrix_arg_node),
+                                matrix_arg_node->get_offset().count());
+    ctx.mat_start =
+        sub_timestamp(ctx.mat_end, matrix_arg_node->get_range().count());
+
+    auto out = std::make_shared<VectorValue>(&allocations);
+    for (auto&& s : matrix_arg->get_series()) {
+        if (token) token->check();
+
+        window.clear();
+        window.add_series({s.metric, s.values.begin(), s.values.end()});
+
+        auto result = node->get_func()->pfunc(args, ctx);
+        const auto& samples = result->get_samples();
+        if (!samples.empty()) {
+            out->add_sample(
+                {s.metric, {timestamp, samples[0].value.get_value()}});
+        }
+
+        result->clear();
+        ctx.outvec = std::move(result);
+    }
+
+    value_stack.push(std::move(out));
+}
+
+void InstantExecutor::visit(AggregationNode* node)
+{
+    auto pushed = push_down_aggregation(queryable, node, timestamp, timestamp,
+                                        1, &allocations);
+    if (pushed) {
+        auto vec = std::make_shared<VectorValue>(&allocations);
+        for (auto&& s : pushed->get_series()) {
+            vec->add_sample({s.metric, {timestamp, s.values[0].get_value()}});
+        }
+
+        value_stack.push(std::move(vec));
+        return;
+    }
+
+    auto vec = eval_vector(node->get_expr());
+    double param = 0;
+    if (node->get_param()) {
+        auto param_vec = eval_vector(node->get_param());
+        const auto& samples = param_vec->get_samples();
+        if (!samples.empty()) param = samples[0].value.get_value();
+    }
+
+    auto grouping = SymbolTable::global().intern(node->get_grouping());
+
+    EvalContext ctx;
+    ctx.ts = timestamp;
+    ctx.outvec = std::make_unique<VectorValue>(&allocations);
+    value_stack.push(aggregate(node->get_op(), grouping, node->is_without(),
+                               param, vec.get(), ctx));
+}
+
+void InstantExecutor::visit(VectorSelectorNode* node)
+{
+    auto lookback = LOOKBACK_DELTA.count();
+    auto maxt = sub_timestamp(at_time(node), node->get_offset().count());
+    auto mint = sub_timestamp(maxt, lookback);
+
+    auto raw = select(node, node->get_matchers(), mint, maxt);
+    auto vec = std::make_shared<VectorValue>(&allocations);
+
+    for (auto&& s : raw->get_series()) {
+        /* latest point within the lookback delta */
+        auto it = std::upper_bound(
+            s.values.cbegin(), s.values.cend(), maxt,
+            [](uint64_t t, const ScalarValue& v) { return t < v.get_time(); });
+        if (it == s.values.cbegin()) continue;
+
+        auto prev = it - 1;
+        if (prev->get_time() + lookback <= maxt) continue;
+
+        vec->add_sample({s.metric, {timestamp, prev->get_value()}});
+    }
+
+    value_stack.push(std::move(vec));
+}
+
+void InstantExecutor::visit(MatrixSelectorNode* node)
+{
+    auto maxt = sub_timestamp(at_time(node), node->get_offset().count());
+    auto mint = sub_timestamp(maxt, node->get_range().count());
+
+    auto raw = select(node, node->get_matchers(), mint, maxt);
+    auto mat = std::make_shared<MatrixValue>(&allocations);
+
+    for (auto&& s : raw->get_series()) {
+        auto lower = std::lower_bound(
+            s.values.cbegin(), s.values.cend(), mint,
+            [](const ScalarValue& v, uint64_t t) { return v.get_time() < t; });
+        auto upper = std::upper_bound(
+            lower, s.values.cend(), maxt,
+            [](uint64_t t, const ScalarValue& v) { return t < v.get_time(); });
+
+        if (lower != upper) {
+            mat->add_series({s.metric, lower, upper, &allocations});
+        }
+    }
+
+    value_stack.push(std::move(mat));
+}
+
+void InstantExecutor::visit(SubqueryNode* node)
+{
+    auto step = node->get_step().count();
+    if (!step) step = DEFAULT_SUBQUERY_STEP.count();
+    auto maxt = sub_timestamp(at_time(node), node->get_offset().count());
+    auto mint = sub_timestamp(maxt, node->get_range().count());
+    auto inner_start = (mint + step - 1) / step * step;
+    auto inner_end = maxt / step * step;
+
+    if (inner_start > inner_end) {
+        value_stack.push(std::make_shared<MatrixValue>(&allocations));
+        return;
+    }
+
+    /* the inner expression is a range evaluation on the subquery step charged
+     * to the budget of this query under the same token, its result is copied
+     * out of the arena of the range executor */
+    SystemTime time{Duration{timestamp}};
+    Executor executor(queryable, plan, time, time, Duration{1});
+    executor.set_budget(tracker.get_budget());
+    executor.set_cancellation_token(token);
+    executor.set_active_query(tracker.get_active_query());
+    executor.set_profile(profile);
+    auto mat = executor.eval_range(node->get_expr(), inner_start, inner_end,
+                                   Duration{step});
+    value_stack.push(std::make_shared<MatrixValue>(*mat, &allocations));
+
+    /* the time of the subquery is already part of this evaluation */
+    auto inner_stats = executor.get_stats();
+    inner_stats.eval_time = QueryStats::Clock::duration::zero();
+    stats += inner_stats;
+}
+
+} // namespace promql
@@ -4,22 +4,34 @@
 
 namespace promql {
 
-Lexer::Lexer(const std::string& input)
-    : buf(input), pos(0), brace_open(false), bracket_open(false)
+/* ascii only, unlike the <ctype.h> calls that look up the locale per char */
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+static bool is_alpha(char c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; }
+static bool is_alnum(char c) { return is_digit(c) || is_alpha(c); }
+
+Lexer::Lexer(std::string_view input)
+    : buf(input), pos(0), char_pos(0), string_decoded(false),
+      brace_open(false), bracket_open(false)
 {
     last_char = read_char();
 }
 
 char Lexer::read_char()
 {
+    char_pos = pos;
     if (pos == buf.size()) return -1;
 
     return buf[pos++];
 }
 
+std::string_view Lexer::slice(size_t start) const
+{
+    return buf.substr(start, char_pos - start);
+}
+
 Token Lexer::get_token()
 {
-    last_word = "";
+    last_word = {};
 
     // skip \n, \r, space, tab and NULL
     while ((last_char == '\n') || (last_char == '\r') || (last_char == ' ') ||
@@ -55,6 +67,9 @@ Token Lexer::get_token()
     } else if (last_char == '^') {
         last_char = read_char();
         return Token::POW;
+    } else if (last_char == '@') {
+        last_char = read_char();
+        return Token::AT;
     } else if (last_char == '=') {
         last_char = read_char();
         if (last_char == '=') {
@@ -92,13 +107,35 @@ Token Lexer::get_token()
         return Token::LSS;
     } else if (last_char == '"' || last_char == '\'') { /* string literal */
         char quote = last_char;
+        bool escaped = false;
 
-        last_string = "";
         last_char = read_char();
+        size_t start = char_pos;
+
+        /* the literal is a slice of the input until the first escape, from
+         * there on it is decoded into string_buf */
+        size_t end = start;
+        while (end < buf.size() && buf[end] != quote && buf[end] != '\\' &&
+               buf[end] != '\n' && buf[end] != '\r') {
+            end++;
+        }
+        pos = end;
+        last_char = read_char();
+
         while (last_char != quote && last_char != '\n' && last_char != '\r' &&
                last_char != -1) {
-            last_string = last_string + lex_char_lit();
+            if (last_char == '\\' && !escaped) {
+                string_buf.assign(slice(start));
+                escaped = true;
+            }
+
+            if (escaped)
+                string_buf += lex_char_lit();
+            else
+                last_char = read_char();
         }
+        last_string = escaped ? std::string_view(string_buf) : slice(start);
+        string_decoded = escaped;
         if (last_char == quote) {
             last_char = read_char();
             return Token::STRING;
@@ -107,12 +144,13 @@ Token Lexer::get_token()
             throw LexError("unclosed string literal");
         }
     } else if (last_char == '`') { /* raw string literal */
-        last_string = "";
         last_char = read_char();
+        size_t start = char_pos;
         while (last_char != '`' && last_char != -1) {
-            last_string = last_string + last_char;
             last_char = read_char();
         }
+        last_string = slice(start);
+        string_decoded = false;
         if (last_char == '`') {
             last_char = read_char();
             return Token::STRING;
@@ -120,24 +158,22 @@ Token Lexer::get_token()
             last_char = read_char();
             throw LexError("unclosed raw string literal");
         }
-    } else if (::isdigit(last_char)) {
+    } else if (is_digit(last_char)) {
         return lex_number(10);
     } else if (last_char == '.') {
         peek_begin();
         char next = read_char();
         peek_end();
 
-        if (::isdigit(next)) {
+        if (is_digit(next)) {
             return lex_number(10);
         }
-    } else if (::isalpha(last_char) || last_char == '_' || last_char == ':') {
-        peek_begin();
-        char next = read_char();
-        peek_end();
+    } else if (is_alpha(last_char) || last_char == '_' || last_char == ':') {
+        char next = pos < buf.size() ? buf[pos] : -1;
 
         if (bracket_open ||
             last_char == ':' &&
-                !(::isalnum(next) || last_char == '_' || next == ':')) {
+                !(is_alnum(next) || last_char == '_' || next == ':')) {
             last_char = read_char();
 
             return Token::COLON;
@@ -168,7 +204,7 @@ Token Lexer::get_token()
         return Token::RIGHT_BRACE;
     }
 
-    throw LexError("unexpected character: " + last_char);
+    throw LexError(std::string("unexpected character: ") + last_char);
     return Token::ERROR;
 }
 
@@ -221,16 +257,14 @@ static int char2digit(int rad, char c)
 
 Token Lexer::lex_number(int rad)
 {
-    last_strnum = "";
+    strnum_start = char_pos;
     radix = rad;
 
     while (char2digit(rad, last_char) >= 0) {
-        last_strnum = last_strnum + last_char;
         last_char = read_char();
     }
 
     if (rad <= 10 && last_char == '.') {
-        last_strnum = last_strnum + last_char;
         last_char = read_char();
         return scan_fraction_and_suffix();
     } else if (radix <= 10 && (last_char == 'e' || last_char == 'E')) {
@@ -240,27 +274,24 @@ Token Lexer::lex_number(int rad)
         return scan_fraction_and_suffix();
     }
 
+    last_strnum = slice(strnum_start);
     return Token::NUMBER;
 }
 
 Token Lexer::scan_fraction_and_suffix()
 {
     while (char2digit(10, last_char) >= 0) {
-        last_strnum = last_strnum + last_char;
         last_char = read_char();
     }
     if (last_char == 'e' || last_char == 'E') {
-        last_strnum = last_strnum + last_char;
         last_char = read_char();
         if (last_char == '+' || last_char == '-') {
-            last_strnum = last_strnum + last_char;
             last_char = read_char();
         }
-        if (::isdigit(last_char)) {
+        if (is_digit(last_char)) {
             do {
-                last_strnum = last_strnum + last_char;
                 last_char = read_char();
-            } while (::isdigit(last_char));
+            } while (is_digit(last_char));
         } else {
             throw LexError("malformed floating point literal");
         }
@@ -268,25 +299,29 @@ Token Lexer::scan_fraction_and_suffix()
 
     if (last_char == 's' || last_char == 'm' || last_char == 'h' ||
         last_char == 'd' || last_char == 'w' || last_char == 'y') {
-        last_strnum = last_strnum + last_char;
         last_char = read_char();
+        last_strnum = slice(strnum_start);
         return Token::DURATION;
     }
 
+    last_strnum = slice(strnum_start);
     return Token::NUMBER;
 }
 
 Token Lexer::lex_identifier(bool force_identifier)
 {
-    bool has_colon = false;
-
-    last_word = "";
-    do {
-        if (last_char == ':') has_colon = true;
-        last_word = last_word + last_char;
-        last_char = read_char();
-        if (last_char == -1) break;
-    } while (::isalnum(last_char) || last_char == '_' || last_char == ':');
+    bool has_colon = last_char == ':';
+    size_t start = char_pos;
+    size_t end = pos;
+
+    while (end < buf.size() &&
+           (is_alnum(buf[end]) || buf[end] == '_' || buf[end] == ':')) {
+        if (buf[end] == ':') has_colon = true;
+        end++;
+    }
+    pos = end;
+    last_char = read_char();
+    last_word = slice(start);
 
     if (has_colon) {
         return Token::METRIC_IDENTIFIER;
@@ -299,9 +334,9 @@ Token Lexer::lex_identifier(bool force_identifier)
     return lookup_keyword(last_word);
 }
 
-Token Lexer::lookup_keyword(const std::string& key)
+Token Lexer::lookup_keyword(std::string_view key)
 {
-    static const std::unordered_map<std::string, Token> keywords = {
+    static const std::unordered_map<std::string_view, Token> keywords = {
         {"and", Token::LAND},
         {"or", Token::LOR},
         {"unless", Token::LUNLESS},
@@ -333,10 +368,18 @@ Token Lexer::lookup_keyword(const std::string& key)
 
 size_t Lexer::cur_pos() const { return pos; }
 
-void Lexer::peek_begin() { peek_start_pos = pos; }
+void Lexer::peek_begin()
+{
+    peek_start_pos = pos;
+    peek_start_char_pos = char_pos;
+}
 
 Token Lexer::peek_token() { return get_token(); }
 
-void Lexer::peek_end() { pos = peek_start_pos; }
+void Lexer::peek_end()
+{
+    pos = peek_start_pos;
+    char_pos = peek_start_char_pos;
+}
 
 } // namespace promql
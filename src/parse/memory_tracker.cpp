@@ -0,0 +1,97 @@
+#include "promql/parse/memory_tracker.h"
+#include "promql/parse/executor.h"
+#include "promql/parse/query_tracker.h"
+
+namespace promql {
+
+std::atomic<size_t> MemoryTracker::global_bytes(0);
+std::atomic<size_t> MemoryTracker::global_limit(0);
+
+static void update_peak(std::atomic<size_t>& peak, size_t value)
+{
+    auto cur = peak.load();
+    while (value > cur && !peak.compare_exchange_weak(cur, value)) {
+    }
+}
+
+void QueryBudget::add_samples(size_t n)
+{
+    auto total = samples.fetch_add(n) + n;
+
+    if (limits.max_samples && total > limits.max_samples) {
+        throw ExecutionError("query exceeded the limit of " +
+                             std::to_string(limits.max_samples) +
+                             " samples read");
+    }
+}
+
+void QueryBudget::add_bytes(size_t n)
+{
+    auto total = bytes.fetch_add(n) + n;
+
+    if (limits.max_bytes && total > limits.max_bytes) {
+        bytes.fetch_sub(n);
+        throw ExecutionError("query exceeded the memory limit of " +
+                             std::to_string(limits.max_bytes) + " bytes");
+    }
+    update_peak(peak_bytes, total);
+}
+
+void QueryBudget::hold_samples(size_t n)
+{
+    update_peak(peak_samples, held_samples.fetch_add(n) + n);
+}
+
+void MemoryTracker::add_samples(size_t n)
+{
+    samples += n;
+    if (active_query) active_query->add_samples(n);
+
+    budget->add_samples(n);
+}
+
+void MemoryTracker::set_global_limit(size_t max_bytes)
+{
+    global_limit.store(max_bytes);
+}
+
+size_t MemoryTracker::get_global_bytes() { return global_bytes.load(); }
+
+void* MemoryTracker::do_allocate(size_t n, size_t alignment)
+{
+    budget->add_bytes(n);
+
+    auto total = global_bytes.fetch_add(n) + n;
+    auto max_total = global_limit.load();
+    if (max_total && total > max_total) {
+        global_bytes.fetch_sub(n);
+        budget->sub_bytes(n);
+        throw ExecutionError("queries exceeded the global memory limit of " +
+                             std::to_string(max_total) + " bytes");
+    }
+
+    void* p;
+    try {
+        p = upstream->allocate(n, alignment);
+    } catch (...) {
+        global_bytes.fetch_sub(n);
+        budget->sub_bytes(n);
+        throw;
+    }
+
+    bytes += n;
+    if (active_query) active_query->add_bytes(n);
+
+    return p;
+}
+
+void MemoryTracker::do_deallocate(void* p, size_t n, size_t alignment)
+{
+    upstream->deallocate(p, n, alignment);
+    bytes -= n;
+    budget->sub_bytes(n);
+    global_bytes.fetch_sub(n);
+    if (active_query) active_query->add_bytes(-(int64_t)n);
+}
+
+} // namespace promql
@@ -0,0 +1,442 @@
+#include "promql/parse/operators.h"
+#include "promql/parse/executor.h"
+#include "promql/parse/functions.h"
+
+#include <algorithm>
+
+namespace promql {
+
+void SelectorOperator::open()
+{
+    querier = queryable->querier(mint, maxt);
+    series_set = querier->select(matchers);
+}
+
+bool SelectorOperator::next_batch(SeriesBatch& batch)
+{
+    std::pmr::memory_resource* mr = std::pmr::get_default_resource();
+    if (tracker) mr = tracker;
+
+    batch.clear();
+    size_t samples = 0;
+
+    while (series_set && batch.size() < BATCH_SIZE &&
+           samples < BATCH_SAMPLES && series_set->next()) {
+        if (token) token->check();
+
+        MatrixValue::Series series(mr);
+        auto si = series_set->at();
+
+        si->labels(series.metric);
+        auto value_it = si->iterator();
+        while (value_it->next()) {
+            auto tv = value_it->at();
+            if (tv.first < mint) continue;
+            if (tv.first > maxt) break;
+            series.values.emplace_back((uint64_t)tv.first, tv.second);
+        }
+
+        if (tracker) tracker->add_series(series.values.size());
+        samples += series.values.size();
+        if (!series.values.empty()) batch.push_back(std::move(series));
+    }
+
+    return !batch.empty();
+}
+
+void SelectorOperator::close()
+{
+    series_set.reset();
+    querier.reset();
+}
+
+bool InstantSelectorOperator::next_batch(SeriesBatch& batch)
+{
+    auto lookback = LOOKBACK_DELTA.count();
+
+    batch.clear();
+    size_t samples = 0;
+    while (batch.size() < BATCH_SIZE && samples < BATCH_SAMPLES) {
+        if (input_idx == input.size()) {
+            input_idx = 0;
+            if (!child->next_batch(input)) break;
+        }
+
+        auto& s = input[input_idx++];
+        MatrixValue::Series series(s.metric, mr);
+
+        auto it = s.values.cbegin();
+        for (auto ts = start; ts <= end; ts += step) {
+            /* latest point within the lookback delta before the step */
+            auto t = sub_timestamp(ts, offset);
+            while (it != s.values.cend() && it->get_time() <= t)
+                it++;
+            if (it == s.values.cbegin()) continue;
+
+            auto prev = it - 1;
+            if (prev->get_time() + lookback <= t) continue;
+
+            series.values.emplace_back(ts, prev->get_value());
+        }
+
+        samples += series.values.size();
+        if (!series.values.empty()) batch.push_back(std::move(series));
+    }
+
+    return !batch.empty();
+}
+
+bool RangeFunctionOperator::next_batch(SeriesBatch& batch)
+{
+    MatrixValue window;
+    std::vector<ExecValue*> args{&window};
+    EvalContext ctx;
+    ctx.outvec = std::make_unique<VectorValue>();
+
+    batch.clear();
+    size_t samples = 0;
+    while (batch.size() < BATCH_SIZE && samples < BATCH_SAMPLES) {
+        if (input_idx == input.size()) {
+            input_idx = 0;
+            if (!child->next_batch(input)) break;
+        }
+
+        auto& s = input[input_idx++];
+        MatrixValue::Series series(s.metric, mr);
+        auto lower = s.values.cbegin(), upper = s.values.cbegin();
+
+        for (auto ts = start; ts <= end; ts += step) {
+            auto maxt = sub_timestamp(ts, offset);
+            auto mint = sub_timestamp(maxt, range);
+            while (upper != s.values.end() && upper->get_time() <= maxt)
+                upper++;
+            while (lower < upper && lower->get_time() < mint)
+                lower++;
+
+            window.clear();
+            window.add_series({s.metric, lower, upper});
+
+            ctx.ts = ts;
+            ctx.mat_start = mint;
+            ctx.mat_end = maxt;
+            auto result = func->pfunc(args, ctx);
+
+            if (!result->get_samples().empty()) {
+                series.values.emplace_back(
+                    ts, result->get_samples()[0].value.get_value());
+            }
+
+            result->clear();
+            ctx.outvec = std::move(result);
+        }
+
+        samples += series.values.size();
+        if (!series.values.empty()) batch.push_back(std::move(series));
+    }
+
+    return !batch.empty();
+}
+
+bool ScalarBinaryOperator::next_batch(SeriesBatch& batch)
+{
+    SeriesBatch input;
+    /* filtering comparisons keep the metric name, arithmetic drops it */
+    bool filter = is_comparison_op(op) && !return_bool;
+
+    batch.clear();
+    while (batch.empty() && child->next_batch(input)) {
+        for (auto&& s : input) {
+            MatrixValue::Series series(
+                filter ? s.metric : s.metric.drop_metric_name(), mr);
+
+            for (auto&& v : s.values) {
+                auto lv = v.get_value(), rv = scalar;
+                if (swap) std::swap(lv, rv);
+
+                bool keep;
+                auto value = vec_elt_binop(op, lv, rv, keep);
+                if (swap && is_comparison_op(op)) value = rv;
+
+                if (return_bool) {
+                    value = keep ? 1.0 : 0.0;
+                    keep = true;
+                }
+
+                if (keep) series.values.emplace_back(v.get_time(), value);
+            }
+
+            if (!series.values.empty()) batch.push_back(std::move(series));
+        }
+    }
+
+    return !batch.empty();
+}
+
+void AggregateOperator::open()
+{
+    SeriesBatch input;
+
+    groups.clear();
+    output = groups.end();
+
+    pushed = push_down_aggregation(queryable, node, start, end, step, mr);
+    pushed_idx = 0;
+    if (pushed) return;
+
+    child->open();
+    while (child->next_batch(input)) {
+        for (auto&& s : input) {
+            add_series(s);
+        }
+    }
+    child->close();
+
+    output = groups.begin();
+}
+
+void AggregateOperator::add_series(const MatrixValue::Series& series)
+{
+    auto op = node->get_op();
+    auto labels = series.metric.grouping(grouping, node->is_without());
+
+    auto it = groups.find(labels);
+    if (it == groups.end()) {
+        size_t num_steps = (end - start) / step + 1;
+        AggregationGroup group{labels,
+                               std::pmr::vector<double>(num_steps, mr),
+                               std::pmr::vector<uint64_t>(num_steps, mr)};
+        it = groups.emplace(labels, std::move(group)).first;
+    }
+    auto& group = it->second;
+
+    for (auto&& v : series.values) {
+        auto i = (v.get_time() - start) / step;
+        auto value = v.get_value();
+        auto& acc = group.values[i];
+        auto count = ++group.counts[i];
+
+        if (count == 1) {
+            acc = value;
+            continue;
+        }
+
+        switch (op) {
+        case Token::SUM:
+            acc += value;
+            break;
+        case Token::AVG:
+            acc += (value - acc) / (double)count;
+            break;
+        case Token::MAX:
+            if (acc < value) acc = value;
+            break;
+        case Token::MIN:
+            if (acc > value) acc = value;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+bool AggregateOperator::next_batch(SeriesBatch& batch)
+{
+    batch.clear();
+
+    if (pushed) {
+        auto num_series = pushed->get_series().size();
+        while (pushed_idx < num_series && batch.size() < BATCH_SIZE) {
+            batch.push_back(pushed->release_series(pushed_idx++));
+        }
+        return !batch.empty();
+    }
+
+    /* the groups are freed as they are output */
+    while (output != groups.end() && batch.size() < BATCH_SIZE) {
+        auto& group = output->second;
+        MatrixValue::Series series(group.labels, mr);
+
+        for (size_t i = 0; i < group.values.size(); i++) {
+            if (!group.counts[i]) continue;
+
+            double value = group.values[i];
+            if (node->get_op() == Token::COUNT) value = group.counts[i];
+
+            series.values.emplace_back(start + i * step, value);
+        }
+
+        output = groups.erase(output);
+        if (!series.values.empty()) batch.push_back(std::move(series));
+    }
+
+    return !batch.empty();
+}
+
+void AggregateOperator::close()
+{
+    groups.clear();
+    output = groups.end();
+    pushed.reset();
+}
+
+/* builds operators bottom-up, leaves op null if a node cannot be streamed */
+class PipelineBuilder : public ASTVisitor {
+public:
+    PipelineBuilder(Queryable* queryable, const QueryPlan* plan,
+                    uint64_t start, uint64_t end, uint64_t step,
+                    MemoryTracker* tracker, const CancellationToken* token)
+        : queryable(queryable), plan(plan), start(start), end(end),
+          step(step), tracker(tracker), token(token),
+          mr(std::pmr::get_default_resource())
+    {
+        if (tracker) mr = tracker;
+    }
+
+    std::unique_ptr<Operator> build(ASTNode* node)
+    {
+        op.reset();
+        node->visit(*this);
+        return std::move(op);
+    }
+
+    virtual void visit(UnaryNode* node) {}
+    virtual void visit(BinaryNode* node)
+    {
+        auto* lhs = dynamic_cast<NumberLiteralNode*>(node->get_lhs());
+        auto* rhs = dynamic_cast<NumberLiteralNode*>(node->get_rhs());
+        if ((lhs == nullptr) == (rhs == nullptr)) return;
+
+        auto* vec = lhs ? node->get_rhs() : node->get_lhs();
+        if (vec->type() != ValueType::VECTOR) return;
+
+        auto child = build_child(vec);
+        if (!child) return;
+
+        op = std::make_unique<ScalarBinaryOperator>(
+            std::move(child), node->get_op(),
+            lhs ? lhs->get_value() : rhs->get_value(), lhs != nullptr,
+            node->is_return_bool(), mr);
+    }
+    virtual void visit(StringLiteralNode* node) {}
+    virtual void visit(NumberLiteralNode* node) {}
+    virtual void visit(FuncCallNode* node)
+    {
+        const auto& args = node->get_args();
+        if (args.size() != 1 ||
+            node->get_func()->arg_types[0] != ValueType::MATRIX)
+            return;
+
+        auto* ms = dynamic_cast<MatrixSelectorNode*>(args[0].get());
+        if (!ms || !streamable(ms)) return;
+
+        auto range = ms->get_range().count();
+        auto offset = ms->get_offset().count();
+        auto selector = std::make_unique<SelectorOperator>(
+            queryable, ms->get_matchers(),
+            sub_timestamp(start, range + offset), sub_timestamp(end, offset),
+            tracker, token);
+
+        op = std::make_unique<RangeFunctionOperator>(
+            std::move(selector), node->get_func(), start, end, step, range,
+            offset, mr);
+    }
+    virtual void visit(AggregationNode* node)
+    {
+        switch (node->get_op()) {
+        case Token::SUM:
+        case Token::MIN:
+        case Token::MAX:
+        case Token::COUNT:
+        case Token::AVG:
+            break;
+        default:
+            return;
+        }
+
+        auto child = build_child(node->get_expr());
+        if (!child) return;
+
+        op = std::make_unique<AggregateOperator>(std::move(child), queryable,
+                                                 node, start, end, step, mr);
+    }
+    virtual void visit(VectorSelectorNode* node)
+    {
+        if (!streamable(node)) return;
+
+        auto offset = node->get_offset().count();
+        auto selector = std::make_unique<SelectorOperator>(
+            queryable, node->get_matchers(),
+            sub_timestamp(start, offset + LOOKBACK_DELTA.count()),
+            sub_timestamp(end, offset), tracker, token);
+
+        op = std::make_unique<InstantSelectorOperator>(
+            std::move(selector), start, end, step, offset, mr);
+    }
+    virtual void visit(MatrixSelectorNode* node) {}
+    virtual void visit(SubqueryNode* node) {}
+
+private:
+    Queryable* queryable;
+    const QueryPlan* plan;
+    uint64_t start, end, step;
+    MemoryTracker* tracker;
+    const CancellationToken* token;
+    std::pmr::memory_resource* mr;
+    std::unique_ptr<Operator> op;
+
+    std::unique_ptr<Operator> build_child(ASTNode* node)
+    {
+        size_t id;
+
+        /* subexpressions shared with the rest of the query are evaluated by
+         * the executor once */
+        if (plan && (plan->get_cse(node, id) || plan->is_step_invariant(node)))
+            return nullptr;
+
+        return build(node);
+    }
+
+    bool streamable(const ASTNode* selector)
+    {
+        if (selector->get_at() != AtModifier::NONE) return false;
+        if (!plan) return true;
+
+        /* selectors sharing a scan read it from the executor */
+        size_t idx, count = 0;
+        if (!plan->get_scan(selector, idx)) return true;
+        for (auto&& p : plan->scan_index) {
+            if (p.second == idx) count++;
+        }
+        return count == 1;
+    }
+};
+
+std::unique_ptr<Operator> build_pipeline(Queryable* queryable,
+                                         const QueryPlan* plan, ASTNode* node,
+                                         uint64_t start, uint64_t end,
+                                         uint64_t step, MemoryTracker* tracker,
+                                         const CancellationToken* token)
+{
+    PipelineBuilder builder(queryable, plan, start, end, step, tracker,
+                            token);
+    return builder.build(node);
+}
+
+std::unique_ptr<MatrixValue> collect(Operator& op,
+                                     std::pmr::memory_resource* mr)
+{
+    auto mat = std::make_unique<MatrixValue>(mr);
+    SeriesBatch batch;
+
+    op.open();
+    while (op.next_batch(batch)) {
+        for (auto&& s : batch) {
+            mat->add_series(std::move(s));
+        }
+    }
+    op.close();
+
+    return mat;
+}
+
+} // namespace promql
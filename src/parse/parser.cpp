@@ -1,5 +1,8 @@
 #include "promql/parse/parser.h"
 
+#include <charconv>
+#include <cmath>
+
 namespace promql {
 
 class TypeChecker : public ASTVisitor {
@@ -25,13 +28,28 @@ class TypeChecker : public ASTVisitor {
         node->get_rhs()->visit(*this);
 
         auto lt = node->get_lhs()->type();
-        auto rt = node->get_lhs()->type();
+        auto rt = node->get_rhs()->type();
+
+        if (lt == ValueType::SCALAR && rt == ValueType::SCALAR &&
+            is_comparison_op(node->get_op()) && !node->is_return_bool()) {
+            throw TypeCheckError(
+                "comparisons between scalars must use BOOL modifier");
+        }
     }
 
     virtual void visit(StringLiteralNode* node) {}
     virtual void visit(NumberLiteralNode* node) {}
-    virtual void visit(FuncCallNode* node) {}
-    virtual void visit(AggregationNode* node) {}
+    virtual void visit(FuncCallNode* node)
+    {
+        for (auto&& p : node->get_args()) {
+            p->visit(*this);
+        }
+    }
+    virtual void visit(AggregationNode* node)
+    {
+        node->get_expr()->visit(*this);
+        if (node->get_param()) node->get_param()->visit(*this);
+    }
     virtual void visit(VectorSelectorNode* node) {}
     virtual void visit(MatrixSelectorNode* node) {}
     virtual void visit(SubqueryNode* node)
@@ -44,7 +62,40 @@ class TypeChecker : public ASTVisitor {
     }
 };
 
-Parser::Parser(const std::string& input) : lex(input) { read_token(); }
+/* tokens are slices of the input, not NUL terminated */
+static double to_number(std::string_view strnum)
+{
+    double value;
+    auto res =
+        std::from_chars(strnum.data(), strnum.data() + strnum.size(), value);
+
+    /* out of range, which atof rounds to inf or 0 */
+    if (res.ec != std::errc()) return ::atof(std::string(strnum).c_str());
+    return value;
+}
+
+/* the milliseconds of an @ timestamp given in seconds, rounded to the
+ * nearest. The timestamps of the storage are unsigned, a time before the
+ * epoch cannot be selected. */
+static uint64_t at_millis(double ts)
+{
+    if (!std::isfinite(ts))
+        throw ParseError("@ timestamp must be a finite number");
+    if (ts < 0)
+        throw ParseError("@ timestamp before the epoch is not supported");
+
+    double ms = ts * 1000;
+    if (ms >= (double)INT64_MAX)
+        throw ParseError("@ timestamp out of range");
+    return (uint64_t)std::llround(ms);
+}
+
+Parser::Parser(std::string input)
+    : text(std::make_shared<QueryText>(std::move(input))),
+      lex(text->query)
+{
+    read_token();
+}
 
 void Parser::match(Token expected)
 {
@@ -58,7 +109,7 @@ void Parser::match(Token expected)
 
 void Parser::read_token() { cur_tok = lex.get_token(); }
 
-std::unique_ptr<ASTNode> Parser::parse()
+PASTNode Parser::parse()
 {
     auto expr = expression();
     match(Token::EOS);
@@ -69,52 +120,54 @@ std::unique_ptr<ASTNode> Parser::parse()
     return expr;
 }
 
-std::unique_ptr<ASTNode> Parser::expression() { return subquery_expression(); }
+PASTNode Parser::expression() { return subquery_expression(); }
 
-std::unique_ptr<ASTNode> Parser::subquery_expression()
+PASTNode Parser::subquery_expression()
 {
     auto expr = comparison_expression();
-    std::unique_ptr<SubqueryNode> sq;
+    PNode<SubqueryNode> sq;
 
     if (cur_tok ==
         Token::LEFT_BRACKET) { /* expression followed by subquery selector */
         match(Token::LEFT_BRACKET);
-        std::string range = lex.get_last_strnum();
+        auto range = lex.get_last_strnum();
         match(Token::DURATION);
 
         match(Token::COLON);
-        std::string step = lex.get_last_strnum();
-        match(Token::DURATION);
+        auto step = subquery_step();
 
-        sq = std::make_unique<SubqueryNode>();
+        sq = make_node<SubqueryNode>(*text);
         sq->set_expr(std::move(expr));
-        sq->set_step(parse_duration(step));
+        sq->set_step(step);
         sq->set_range(parse_duration(range));
 
         match(Token::RIGHT_BRACKET);
     }
 
-    if (sq && cur_tok == Token::OFFSET) { /* optional offset */
-        match(Token::OFFSET);
-        std::string offset = lex.get_last_strnum();
-        match(Token::DURATION);
+    if (sq) { /* optional offset and @ modifiers */
+        Duration offset{0};
+        AtModifier at;
+        uint64_t at_timestamp;
+
+        modifiers(offset, at, at_timestamp);
+        sq->set_offset(offset);
+        sq->set_at(at, at_timestamp);
 
-        sq->set_offset(parse_duration(offset));
+        return sq;
     }
 
-    if (sq) return sq;
     return expr;
 }
 
-std::unique_ptr<ASTNode> Parser::comparison_expression()
+PASTNode Parser::comparison_expression()
 {
     auto t = arith_expression();
-    std::unique_ptr<BinaryNode> p;
+    PNode<BinaryNode> p;
     if ((cur_tok == Token::LSS) || (cur_tok == Token::GTR) ||
         (cur_tok == Token::LTE) || (cur_tok == Token::GTE) ||
         (cur_tok == Token::EQL) || (cur_tok == Token::NEQ)) {
         bool return_bool = false;
-        p = std::make_unique<BinaryNode>();
+        p = make_node<BinaryNode>(*text);
         p->set_lhs(std::move(t));
         p->set_op(cur_tok);
         match(cur_tok);
@@ -131,12 +184,12 @@ std::unique_ptr<ASTNode> Parser::comparison_expression()
     return t;
 }
 
-std::unique_ptr<ASTNode> Parser::arith_expression()
+PASTNode Parser::arith_expression()
 {
     auto t = term();
-    std::unique_ptr<BinaryNode> p;
+    PNode<BinaryNode> p;
     while ((cur_tok == Token::ADD) || (cur_tok == Token::SUB)) {
-        p = std::make_unique<BinaryNode>();
+        p = make_node<BinaryNode>(*text);
         p->set_lhs(std::move(t));
         p->set_op(cur_tok);
         match(cur_tok);
@@ -146,13 +199,13 @@ std::unique_ptr<ASTNode> Parser::arith_expression()
     return t;
 }
 
-std::unique_ptr<ASTNode> Parser::term()
+PASTNode Parser::term()
 {
     auto t = factor();
-    std::unique_ptr<BinaryNode> p;
+    PNode<BinaryNode> p;
     while ((cur_tok == Token::MUL) || (cur_tok == Token::DIV) ||
            (cur_tok == Token::MOD)) {
-        p = std::make_unique<BinaryNode>();
+        p = make_node<BinaryNode>(*text);
         p->set_lhs(std::move(t));
         p->set_op(cur_tok);
         match(cur_tok);
@@ -162,10 +215,10 @@ std::unique_ptr<ASTNode> Parser::term()
     return t;
 }
 
-std::unique_ptr<ASTNode> Parser::factor()
+PASTNode Parser::factor()
 {
     PASTNode t;
-    std::unique_ptr<UnaryNode> tmp;
+    PNode<UnaryNode> tmp;
 
     Token tok = cur_tok;
     switch (cur_tok) {
@@ -181,7 +234,7 @@ std::unique_ptr<ASTNode> Parser::factor()
     switch (tok) {
     case Token::ADD:
     case Token::SUB:
-        tmp = std::make_unique<UnaryNode>();
+        tmp = make_node<UnaryNode>(*text);
         tmp->set_op(tok);
         tmp->set_operand(std::move(t));
         t = std::move(tmp);
@@ -193,12 +246,12 @@ std::unique_ptr<ASTNode> Parser::factor()
     return t;
 }
 
-std::unique_ptr<ASTNode> Parser::power()
+PASTNode Parser::power()
 {
     auto t = atom();
-    std::unique_ptr<BinaryNode> p;
+    PNode<BinaryNode> p;
     if (cur_tok == Token::POW) {
-        p = std::make_unique<BinaryNode>();
+        p = make_node<BinaryNode>(*text);
         p->set_lhs(std::move(t));
         p->set_op(cur_tok);
         match(cur_tok);
@@ -208,7 +261,7 @@ std::unique_ptr<ASTNode> Parser::power()
     return t;
 }
 
-std::unique_ptr<ASTNode> Parser::atom()
+PASTNode Parser::atom()
 {
     PASTNode t;
 
@@ -220,16 +273,16 @@ std::unique_ptr<ASTNode> Parser::atom()
         break;
 
     case Token::STRING: {
-        auto node = std::make_unique<StringLiteralNode>();
-        node->set_value(lex.get_last_string());
+        auto node = make_node<StringLiteralNode>(*text);
+        node->set_value(last_string());
         match(Token::STRING);
         t = std::move(node);
         break;
     }
 
     case Token::NUMBER: {
-        auto node = std::make_unique<NumberLiteralNode>();
-        node->set_value(::atof(lex.get_last_strnum().c_str()));
+        auto node = make_node<NumberLiteralNode>(*text);
+        node->set_value(to_number(lex.get_last_strnum()));
         match(Token::NUMBER);
         t = std::move(node);
         break;
@@ -240,7 +293,7 @@ std::unique_ptr<ASTNode> Parser::atom()
         break;
 
     case Token::IDENTIFIER: {
-        std::string name = lex.get_last_word();
+        auto name = lex.get_last_word();
 
         match(Token::IDENTIFIER);
         if (cur_tok == Token::LEFT_PAREN) {
@@ -253,10 +306,11 @@ std::unique_ptr<ASTNode> Parser::atom()
     }
 
     case Token::METRIC_IDENTIFIER: {
-        std::string name = lex.get_last_word();
+        auto name = lex.get_last_word();
 
         match(Token::METRIC_IDENTIFIER);
         t = vector_selector(name);
+        break;
     }
 
     case Token::SUM:
@@ -281,42 +335,40 @@ std::unique_ptr<ASTNode> Parser::atom()
     return t;
 }
 
-std::unique_ptr<ASTNode> Parser::vector_selector(const std::string& name)
+PASTNode Parser::vector_selector(std::string_view name)
 {
-    auto vs = std::make_unique<VectorSelectorNode>();
-    std::unique_ptr<MatrixSelectorNode> ms;
-    std::unique_ptr<SubqueryNode> sq;
-
-    vs->set_name(name);
+    PNode<VectorSelectorNode> vs;
+    PNode<MatrixSelectorNode> ms;
+    PNode<SubqueryNode> sq;
+    std::vector<LabelMatcher> matchers;
 
     if (cur_tok == Token::LEFT_BRACE) {
-        std::vector<LabelMatcher> matchers;
         label_matchers(matchers);
-
-        for (auto&& p : matchers) {
-            vs->add_matcher(p.op, p.name, p.value);
-        }
     }
 
     if (name.length()) {
-        vs->add_matcher(MatchOp::EQL, METRIC_NAME, name);
+        matchers.emplace_back(MatchOp::EQL, METRIC_NAME, name);
     }
 
+    /* the node is created once it is known whether a range follows */
     if (cur_tok == Token::LEFT_BRACKET) { /* vector selector followed by
                                              range/subquery selector */
         match(Token::LEFT_BRACKET);
-        std::string range = lex.get_last_strnum();
+        auto range = lex.get_last_strnum();
         match(Token::DURATION);
 
         if (cur_tok == Token::COLON) {
             /* subquery */
             match(Token::COLON);
-            std::string step = lex.get_last_strnum();
-            match(Token::DURATION);
+            auto step = subquery_step();
 
-            sq = std::make_unique<SubqueryNode>();
+            vs = make_node<VectorSelectorNode>(*text);
+            vs->set_name(name);
+            vs->set_matchers(std::move(matchers));
+
+            sq = make_node<SubqueryNode>(*text);
             sq->set_expr(std::move(vs));
-            sq->set_step(parse_duration(step));
+            sq->set_step(step);
             sq->set_range(parse_duration(range));
 
             match(Token::RIGHT_BRACKET);
@@ -324,29 +376,32 @@ std::unique_ptr<ASTNode> Parser::vector_selector(const std::string& name)
             /* range selector */
             match(Token::RIGHT_BRACKET);
 
-            ms = std::make_unique<MatrixSelectorNode>();
-            ms->set_name(vs->get_name());
+            ms = make_node<MatrixSelectorNode>(*text);
+            ms->set_name(name);
             ms->set_range(parse_duration(range));
-            for (auto&& p : vs->get_matchers()) {
-                ms->add_matcher(p.op, p.name, p.value);
-            }
-
-            vs.reset();
-        }
-    }
-
-    if (cur_tok == Token::OFFSET) { /* optional offset */
-        match(Token::OFFSET);
-        std::string offset = lex.get_last_strnum();
-        match(Token::DURATION);
-
-        if (ms) {
-            ms->set_offset(parse_duration(offset));
-        } else if (sq) {
-            sq->set_offset(parse_duration(offset));
-        } else {
-            vs->set_offset(parse_duration(offset));
+            ms->set_matchers(std::move(matchers));
         }
+    } else {
+        vs = make_node<VectorSelectorNode>(*text);
+        vs->set_name(name);
+        vs->set_matchers(std::move(matchers));
+    }
+
+    /* optional offset and @ modifiers */
+    Duration offset{0};
+    AtModifier at;
+    uint64_t at_timestamp;
+    modifiers(offset, at, at_timestamp);
+
+    if (ms) {
+        ms->set_offset(offset);
+        ms->set_at(at, at_timestamp);
+    } else if (sq) {
+        sq->set_offset(offset);
+        sq->set_at(at, at_timestamp);
+    } else {
+        vs->set_offset(offset);
+        vs->set_at(at, at_timestamp);
     }
 
     if (ms)
@@ -356,21 +411,85 @@ std::unique_ptr<ASTNode> Parser::vector_selector(const std::string& name)
     return vs;
 }
 
-void Parser::labels(std::vector<std::string>& labels)
+void Parser::modifiers(Duration& offset, AtModifier& at,
+                       uint64_t& at_timestamp)
+{
+    bool has_offset = false;
+
+    at = AtModifier::NONE;
+    at_timestamp = 0;
+
+    /* offset and @ may appear in any order */
+    while (true) {
+        if (cur_tok == Token::OFFSET && !has_offset) {
+            match(Token::OFFSET);
+            auto dur = lex.get_last_strnum();
+            match(Token::DURATION);
+
+            offset = parse_duration(dur);
+            has_offset = true;
+        } else if (cur_tok == Token::AT && at == AtModifier::NONE) {
+            match(Token::AT);
+
+            if (cur_tok == Token::NUMBER || cur_tok == Token::ADD ||
+                cur_tok == Token::SUB) {
+                bool negative = cur_tok == Token::SUB;
+                if (cur_tok != Token::NUMBER) match(cur_tok);
+
+                double ts = to_number(lex.get_last_strnum());
+                match(Token::NUMBER);
+
+                at = AtModifier::TIMESTAMP;
+                at_timestamp = at_millis(negative ? -ts : ts);
+            } else if (cur_tok == Token::IDENTIFIER &&
+                       (lex.get_last_word() == "start" ||
+                        lex.get_last_word() == "end")) {
+                at = lex.get_last_word() == "start" ? AtModifier::START
+                                                     : AtModifier::END;
+                match(Token::IDENTIFIER);
+                match(Token::LEFT_PAREN);
+                match(Token::RIGHT_PAREN);
+            } else {
+                throw ParseError("unexpected token after @: " +
+                                 tok2str(cur_tok) +
+                                 ", expected timestamp, start() or end()");
+            }
+        } else {
+            break;
+        }
+    }
+}
+
+/* the step after the colon of a subquery, zero if it is omitted as in
+ * x[5m:], the executor then uses DEFAULT_SUBQUERY_STEP */
+Duration Parser::subquery_step()
+{
+    if (cur_tok == Token::RIGHT_BRACKET) return Duration{0};
+
+    auto step = lex.get_last_strnum();
+    match(Token::DURATION);
+
+    auto dur = parse_duration(step);
+    if (dur.count() <= 0) {
+        throw TypeCheckError("subquery step must be positive");
+    }
+    return dur;
+}
+
+void Parser::labels(std::vector<std::string_view>& labels)
 {
     match(Token::LEFT_PAREN);
+    labels.reserve(4);
 
     if (cur_tok != Token::RIGHT_BRACE) {
-        std::string label = lex.get_last_word();
+        labels.push_back(lex.get_last_word());
         match(Token::IDENTIFIER);
-        labels.push_back(label);
 
         while (cur_tok == Token::COMMA) {
             match(cur_tok);
 
-            label = lex.get_last_word();
+            labels.push_back(lex.get_last_word());
             match(Token::IDENTIFIER);
-            labels.push_back(label);
         }
     }
 
@@ -380,9 +499,11 @@ void Parser::labels(std::vector<std::string>& labels)
 void Parser::label_matchers(std::vector<LabelMatcher>& matchers)
 {
     match(Token::LEFT_BRACE);
+    /* room for a few matchers and the metric name */
+    matchers.reserve(4);
 
     if (cur_tok != Token::RIGHT_BRACE) {
-        std::string label = lex.get_last_word();
+        auto label = lex.get_last_word();
         match(Token::IDENTIFIER);
         MatchOp op = tok2mop(cur_tok);
         if (op == MatchOp::ERROR) {
@@ -390,14 +511,14 @@ void Parser::label_matchers(std::vector<LabelMatcher>& matchers)
                              tok2str(cur_tok));
         }
         match(cur_tok);
-        std::string value = lex.get_last_string();
+        auto value = last_string();
         match(Token::STRING);
         matchers.emplace_back(op, label, value);
 
         while (cur_tok == Token::COMMA) {
             match(cur_tok);
 
-            std::string label = lex.get_last_word();
+            auto label = lex.get_last_word();
             match(Token::IDENTIFIER);
             MatchOp op = tok2mop(cur_tok);
             if (op == MatchOp::ERROR) {
@@ -405,7 +526,7 @@ void Parser::label_matchers(std::vector<LabelMatcher>& matchers)
                                  tok2str(cur_tok));
             }
             match(cur_tok);
-            std::string value = lex.get_last_string();
+            auto value = last_string();
             match(Token::STRING);
             matchers.emplace_back(op, label, value);
         }
@@ -414,13 +535,13 @@ void Parser::label_matchers(std::vector<LabelMatcher>& matchers)
     match(Token::RIGHT_BRACE);
 }
 
-std::unique_ptr<ASTNode> Parser::function_call(const std::string& name)
+PASTNode Parser::function_call(std::string_view name)
 {
     const auto* func = ExecFunction::get(name);
-    auto node = std::make_unique<FuncCallNode>();
+    auto node = make_node<FuncCallNode>(*text);
 
     if (!func) {
-        throw ParseError("undefined function: " + name);
+        throw ParseError("undefined function: " + std::string(name));
     }
 
     node->set_func(func);
@@ -445,9 +566,9 @@ std::unique_ptr<ASTNode> Parser::function_call(const std::string& name)
     return node;
 }
 
-std::unique_ptr<ASTNode> Parser::aggregation()
+PASTNode Parser::aggregation()
 {
-    auto node = std::make_unique<AggregationNode>();
+    auto node = make_node<AggregationNode>(*text);
     bool has_param = false;
 
     switch (cur_tok) {
@@ -471,7 +592,7 @@ std::unique_ptr<ASTNode> Parser::aggregation()
     node->set_op(cur_tok);
     match(cur_tok);
 
-    std::vector<std::string> grouping;
+    std::vector<std::string_view> grouping;
     bool without = false;
     bool missing_modifiers = true;
 
@@ -500,18 +621,25 @@ std::unique_ptr<ASTNode> Parser::aggregation()
     }
 
     node->set_without(without);
-    for (auto&& p : grouping) {
-        node->add_grouping(p);
-    }
+    node->set_grouping(std::move(grouping));
 
     return node;
 }
 
-Duration Parser::parse_duration(const std::string& dur)
+std::string_view Parser::last_string()
+{
+    auto str = lex.get_last_string();
+    if (!lex.is_last_string_decoded()) return str;
+
+    text->literals.emplace_back(str);
+    return text->literals.back();
+}
+
+Duration Parser::parse_duration(std::string_view dur)
 {
-    uint64_t val;
     auto unit = dur.back();
-    uint64_t count = ::atoi(dur.substr(0, dur.length() - 1).c_str());
+    uint64_t count = 0;
+    std::from_chars(dur.data(), dur.data() + dur.length() - 1, count);
 
     switch (unit) {
     case 'y':
@@ -0,0 +1,133 @@
+#include "promql/parse/plan_cache.h"
+#include "promql/parse/parser.h"
+
+#include <cctype>
+
+namespace promql {
+
+std::string PlanCache::normalize(const std::string& query)
+{
+    std::string key;
+    key.reserve(query.length());
+
+    char quote = 0;
+    bool space = false;
+    for (size_t i = 0; i < query.length(); i++) {
+        char c = query[i];
+
+        if (quote) {
+            key += c;
+            if (c == '\\' && quote != '`' && i + 1 < query.length()) {
+                key += query[++i];
+            } else if (c == quote) {
+                quote = 0;
+            }
+            continue;
+        }
+
+        /* a comment runs to the end of the line */
+        if (c == '#') {
+            while (i + 1 < query.length() && query[i + 1] != '\n') i++;
+            space = true;
+            continue;
+        }
+
+        if (::isspace((unsigned char)c)) {
+            space = true;
+            continue;
+        }
+
+        if (space && !key.empty()) key += ' ';
+        space = false;
+
+        if (c == '"' || c == '\'' || c == '`') quote = c;
+        key += c;
+    }
+
+    return key;
+}
+
+std::shared_ptr<const QueryPlan> PlanCache::get(const std::string& query)
+{
+    return get(normalize(query), [&] {
+        Parser parser(query);
+        Planner planner;
+        return planner.plan(parser.parse(), parser.get_text());
+    });
+}
+
+std::shared_ptr<const QueryPlan> PlanCache::get(const std::string& key,
+                                                const PlanFunc& func)
+{
+    auto plan = find(key);
+    if (plan) return plan;
+
+    plan = func();
+    insert(key, plan);
+
+    return plan;
+}
+
+std::shared_ptr<const QueryPlan> PlanCache::find(const std::string& key)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        misses++;
+        return nullptr;
+    }
+
+    hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+}
+
+void PlanCache::insert(const std::string& key,
+                       std::shared_ptr<const QueryPlan> plan)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!max_entries) return;
+
+    /* planned concurrently by another request */
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+
+    lru.emplace_front(key, std::move(plan));
+    entries.emplace(key, lru.begin());
+
+    while (lru.size() > max_entries) {
+        entries.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+void PlanCache::clear()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    lru.clear();
+    entries.clear();
+}
+
+size_t PlanCache::size() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return lru.size();
+}
+
+size_t PlanCache::get_hits() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return hits;
+}
+
+size_t PlanCache::get_misses() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return misses;
+}
+
+} // namespace promql
@@ -0,0 +1,512 @@
+#include "promql/parse/planner.h"
+#include "promql/parse/executor.h"
+#include "promql/parse/fingerprint.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace promql {
+
+/* checks whether an expression depends on the evaluation timestamp other than
+ * through the offsets of its selectors, i.e. through time() or @ */
+class TimestampChecker : public ASTVisitor {
+public:
+    bool depends_on_timestamp = false;
+
+    virtual void visit(UnaryNode* node) { node->get_operand()->visit(*this); }
+    virtual void visit(BinaryNode* node)
+    {
+        node->get_lhs()->visit(*this);
+        node->get_rhs()->visit(*this);
+    }
+    virtual void visit(StringLiteralNode* node) {}
+    virtual void visit(NumberLiteralNode* node) {}
+    virtual void visit(FuncCallNode* node)
+    {
+        if (node->get_func()->name == "time") depends_on_timestamp = true;
+
+        for (auto&& p : node->get_args()) {
+            p->visit(*this);
+        }
+    }
+    virtual void visit(AggregationNode* node)
+    {
+        node->get_expr()->visit(*this);
+        if (node->get_param()) node->get_param()->visit(*this);
+    }
+    virtual void visit(VectorSelectorNode* node)
+    {
+        if (node->get_at() != AtModifier::NONE) depends_on_timestamp = true;
+    }
+    virtual void visit(MatrixSelectorNode* node)
+    {
+        if (node->get_at() != AtModifier::NONE) depends_on_timestamp = true;
+    }
+    virtual void visit(SubqueryNode* node)
+    {
+        if (node->get_at() != AtModifier::NONE) depends_on_timestamp = true;
+        node->get_expr()->visit(*this);
+    }
+};
+
+/* marks the largest subexpressions that evaluate to the same instant value at
+ * every step, e.g. number literals and selectors with an @ modifier */
+class StepInvariantMarker : public ASTVisitor {
+public:
+    StepInvariantMarker(std::unordered_set<const ASTNode*>& marked)
+        : marked(marked)
+    {}
+
+    void mark(ASTNode* root)
+    {
+        if (check(root)) mark_node(root);
+    }
+
+    virtual void visit(UnaryNode* node)
+    {
+        invariant = check_children({node->get_operand()});
+    }
+    virtual void visit(BinaryNode* node)
+    {
+        invariant = check_children({node->get_lhs(), node->get_rhs()});
+    }
+    virtual void visit(StringLiteralNode* node) { invariant = true; }
+    virtual void visit(NumberLiteralNode* node) { invariant = true; }
+    virtual void visit(FuncCallNode* node)
+    {
+        std::vector<ASTNode*> args;
+        for (auto&& p : node->get_args()) {
+            args.push_back(p.get());
+        }
+
+        invariant =
+            check_children(args) && node->get_func()->name != "time";
+    }
+    virtual void visit(AggregationNode* node)
+    {
+        std::vector<ASTNode*> args{node->get_expr()};
+        if (node->get_param()) args.push_back(node->get_param());
+
+        invariant = check_children(args);
+    }
+    virtual void visit(VectorSelectorNode* node)
+    {
+        invariant = node->get_at() != AtModifier::NONE;
+    }
+    virtual void visit(MatrixSelectorNode* node)
+    {
+        invariant = node->get_at() != AtModifier::NONE;
+    }
+    virtual void visit(SubqueryNode* node)
+    {
+        check_children({node->get_expr()});
+        invariant = node->get_at() != AtModifier::NONE;
+    }
+
+private:
+    std::unordered_set<const ASTNode*>& marked;
+    bool invariant;
+
+    bool check(ASTNode* node)
+    {
+        node->visit(*this);
+        return invariant;
+    }
+
+    bool check_children(const std::vector<ASTNode*>& children)
+    {
+        std::vector<bool> results;
+        bool all = true;
+
+        for (auto&& p : children) {
+            results.push_back(check(p));
+            all = all && results.back();
+        }
+
+        /* the parent varies with the step, mark the invariant children */
+        if (!all) {
+            for (size_t i = 0; i < children.size(); i++) {
+                if (results[i]) mark_node(children[i]);
+            }
+        }
+
+        return all;
+    }
+
+    void mark_node(ASTNode* node)
+    {
+        /* literals are cheap to evaluate at every step and matrices are not
+         * broadcast */
+        if (dynamic_cast<NumberLiteralNode*>(node) ||
+            dynamic_cast<StringLiteralNode*>(node))
+            return;
+
+        auto type = node->type();
+        if (type == ValueType::VECTOR || type == ValueType::SCALAR) {
+            marked.insert(node);
+        }
+    }
+};
+
+static std::string at_key(const ASTNode* node)
+{
+    switch (node->get_at()) {
+    case AtModifier::TIMESTAMP:
+        return " @ " + std::to_string(node->get_at_timestamp());
+    case AtModifier::START:
+        return " @ start()";
+    case AtModifier::END:
+        return " @ end()";
+    default:
+        break;
+    }
+
+    return "";
+}
+
+static std::string matchers_key(const std::vector<LabelMatcher>& matchers)
+{
+    std::vector<std::string> keys;
+    for (auto&& m : matchers) {
+        auto key = std::string(m.name) + "|" + std::to_string((int)m.op) +
+                   "|" + std::to_string(m.value.length()) + ":";
+        keys.push_back(key.append(m.value));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::string key;
+    for (auto&& k : keys) {
+        key += k + ",";
+    }
+    return key;
+}
+
+const std::string& StructuralHasher::key_of(ASTNode* node)
+{
+    auto it = keys.find(node);
+    if (it != keys.end()) return it->second;
+
+    node->visit(*this);
+    return keys.emplace(node, std::move(cur_key)).first->second;
+}
+
+void StructuralHasher::visit(UnaryNode* node)
+{
+    auto key = "(" + tok2str(node->get_op()) + " " +
+               key_of(node->get_operand()) + ")";
+    cur_key = std::move(key);
+}
+
+void StructuralHasher::visit(BinaryNode* node)
+{
+    auto key = "(" + key_of(node->get_lhs()) + " " + tok2str(node->get_op()) +
+               (node->is_return_bool() ? " bool " : " ") +
+               key_of(node->get_rhs()) + ")";
+    cur_key = std::move(key);
+}
+
+void StructuralHasher::visit(StringLiteralNode* node)
+{
+    cur_key = "s" + std::to_string(node->get_value().length()) + ":";
+    cur_key += node->get_value();
+}
+
+void StructuralHasher::visit(NumberLiteralNode* node)
+{
+    std::ostringstream ss;
+    ss << "n" << std::hexfloat << node->get_value();
+    cur_key = ss.str();
+}
+
+void StructuralHasher::visit(FuncCallNode* node)
+{
+    auto key = node->get_func()->name + "(";
+    for (auto&& p : node->get_args()) {
+        key += key_of(p.get()) + ",";
+    }
+    cur_key = key + ")";
+}
+
+void StructuralHasher::visit(AggregationNode* node)
+{
+    auto grouping = node->get_grouping();
+    std::sort(grouping.begin(), grouping.end());
+
+    auto key = tok2str(node->get_op()) +
+               (node->is_without() ? " without(" : " by(");
+    for (auto&& p : grouping) {
+        key += p;
+        key += ",";
+    }
+    key += ")(";
+    if (node->get_param()) {
+        key += key_of(node->get_param()) + ",";
+    }
+    cur_key = key + key_of(node->get_expr()) + ")";
+}
+
+void StructuralHasher::visit(VectorSelectorNode* node)
+{
+    cur_key = "{" + matchers_key(node->get_matchers()) + "} offset " +
+              std::to_string(node->get_offset().count()) + at_key(node);
+}
+
+void StructuralHasher::visit(MatrixSelectorNode* node)
+{
+    cur_key = "{" + matchers_key(node->get_matchers()) + "}[" +
+              std::to_string(node->get_range().count()) + "] offset " +
+              std::to_string(node->get_offset().count()) + at_key(node);
+}
+
+void StructuralHasher::visit(SubqueryNode* node)
+{
+    auto key = key_of(node->get_expr()) + "[" +
+               std::to_string(node->get_range().count()) + ":" +
+               std::to_string(node->get_step().count()) + "] offset " +
+               std::to_string(node->get_offset().count()) + at_key(node);
+    cur_key = std::move(key);
+}
+
+static PASTNode make_number(QueryText& text, double value)
+{
+    auto node = make_node<NumberLiteralNode>(text);
+    node->set_value(value);
+    return node;
+}
+
+std::unique_ptr<QueryPlan> Planner::plan(PASTNode&& root,
+                                         std::shared_ptr<QueryText> text)
+{
+    auto plan = std::make_unique<QueryPlan>();
+    cur_text = text.get();
+    plan->text = std::move(text);
+
+    cur_plan = plan.get();
+    pushed_offset = outer_before = outer_after = Duration{0};
+    fixed_time = false;
+    scan_keys.clear();
+
+    plan->root = rewrite(std::move(root));
+    find_common_subexpressions();
+    find_step_invariants();
+    plan->fingerprint = QueryFingerprinter().fingerprint(plan->root.get());
+
+    cur_plan = nullptr;
+    cur_text = nullptr;
+    return plan;
+}
+
+PASTNode Planner::rewrite(PASTNode&& node)
+{
+    /* the visitor may replace cur with the rewritten node */
+    auto saved = std::move(cur);
+    cur = std::move(node);
+    cur->visit(*this);
+    auto retval = std::move(cur);
+    cur = std::move(saved);
+
+    return retval;
+}
+
+void Planner::find_common_subexpressions()
+{
+    StructuralHasher hasher;
+    cur_plan->key = hasher.key_of(cur_plan->root.get());
+
+    std::unordered_map<std::string, std::vector<const ASTNode*>> nodes;
+    for (auto&& p : hasher.get_keys()) {
+        nodes[p.second].push_back(p.first);
+    }
+
+    size_t id = 0;
+    for (auto&& p : nodes) {
+        const auto* node = p.second.front();
+        if (p.second.size() < 2) continue;
+
+        /* literals are cheaper to evaluate than to share */
+        if (dynamic_cast<const NumberLiteralNode*>(node) ||
+            dynamic_cast<const StringLiteralNode*>(node))
+            continue;
+
+        for (auto&& q : p.second) {
+            cur_plan->cse_index[q] = id;
+        }
+        id++;
+    }
+}
+
+void Planner::find_step_invariants()
+{
+    StepInvariantMarker marker(cur_plan->step_invariant);
+    marker.mark(cur_plan->root.get());
+}
+
+void Planner::add_scan(const ASTNode* selector,
+                       const std::vector<LabelMatcher>& matchers,
+                       Duration before, Duration after)
+{
+    if (fixed_time) return;
+
+    auto key = matchers_key(matchers);
+
+    size_t idx;
+    auto it = scan_keys.find(key);
+    if (it == scan_keys.end()) {
+        idx = cur_plan->scans.size();
+        cur_plan->scans.push_back({matchers, before, after});
+        scan_keys.emplace(key, idx);
+    } else {
+        idx = it->second;
+        auto& scan = cur_plan->scans[idx];
+        scan.before = std::max(scan.before, before);
+        scan.after = std::min(scan.after, after);
+    }
+
+    cur_plan->scan_index[selector] = idx;
+}
+
+void Planner::visit(UnaryNode* node)
+{
+    /* collapse nested unary operators: -(-x) -> x * 1 */
+    int negations = node->get_op() == Token::SUB;
+    auto operand = node->release_operand();
+
+    while (auto* unary = dynamic_cast<UnaryNode*>(operand.get())) {
+        if (unary->get_op() == Token::SUB) negations++;
+        operand = unary->release_operand();
+    }
+
+    operand = rewrite(std::move(operand));
+    bool negate = negations % 2;
+
+    if (!negations) {
+        cur = std::move(operand);
+        return;
+    }
+
+    if (auto* num = dynamic_cast<NumberLiteralNode*>(operand.get())) {
+        if (negate) num->set_value(-num->get_value());
+        cur = std::move(operand);
+        return;
+    }
+
+    /* -x -> x * -1, which drops the metric name like the negation. An even
+     * number of negations still drops it, hence x * 1 rather than x. */
+    auto binop = make_node<BinaryNode>(*cur_text);
+    binop->set_op(Token::MUL);
+    binop->set_lhs(std::move(operand));
+    binop->set_rhs(make_number(*cur_text, negate ? -1 : 1));
+    cur = std::move(binop);
+}
+
+void Planner::visit(BinaryNode* node)
+{
+    node->set_lhs(rewrite(node->release_lhs()));
+    node->set_rhs(rewrite(node->release_rhs()));
+
+    auto* lhs = dynamic_cast<NumberLiteralNode*>(node->get_lhs());
+    auto* rhs = dynamic_cast<NumberLiteralNode*>(node->get_rhs());
+    if (!lhs || !rhs) return;
+
+    /* fold scalar-only subtrees */
+    bool keep;
+    auto value =
+        vec_elt_binop(node->get_op(), lhs->get_value(), rhs->get_value(), keep);
+    if (node->is_return_bool()) {
+        value = keep ? 1.0 : 0.0;
+    } else if (is_comparison_op(node->get_op())) {
+        return;
+    }
+
+    cur = make_number(*cur_text, value);
+}
+
+void Planner::visit(StringLiteralNode* node) {}
+
+void Planner::visit(NumberLiteralNode* node) {}
+
+void Planner::visit(FuncCallNode* node)
+{
+    for (size_t i = 0; i < node->get_args().size(); i++) {
+        node->set_arg(i, rewrite(node->release_arg(i)));
+    }
+}
+
+void Planner::visit(AggregationNode* node)
+{
+    node->set_expr(rewrite(node->release_expr()));
+    if (node->get_param()) {
+        node->set_param(rewrite(node->release_param()));
+    }
+}
+
+void Planner::check_at(const ASTNode* node)
+{
+    auto at = node->get_at();
+    if (at == AtModifier::START || at == AtModifier::END) {
+        cur_plan->range_dependent = true;
+    }
+}
+
+void Planner::visit(VectorSelectorNode* node)
+{
+    auto offset = node->get_offset() + pushed_offset;
+    node->set_offset(offset);
+    check_at(node);
+
+    /* selectors with @ read a fixed time range */
+    if (node->get_at() != AtModifier::NONE) return;
+
+    add_scan(node, node->get_matchers(), outer_before + offset + LOOKBACK_DELTA,
+             outer_after + offset);
+}
+
+void Planner::visit(MatrixSelectorNode* node)
+{
+    auto offset = node->get_offset() + pushed_offset;
+    node->set_offset(offset);
+    check_at(node);
+
+    if (node->get_at() != AtModifier::NONE) return;
+
+    add_scan(node, node->get_matchers(),
+             outer_before + node->get_range() + offset, outer_after + offset);
+}
+
+void Planner::visit(SubqueryNode* node)
+{
+    auto saved_offset = pushed_offset;
+    auto saved_before = outer_before, saved_after = outer_after;
+    auto saved_fixed = fixed_time;
+    auto offset = node->get_offset();
+    auto step = node->get_step();
+    if (!step.count()) step = DEFAULT_SUBQUERY_STEP;
+
+    TimestampChecker checker;
+    node->get_expr()->visit(checker);
+
+    if (offset.count() && step.count() && offset.count() % step.count() == 0 &&
+        !checker.depends_on_timestamp) {
+        /* the inner steps stay aligned to the subquery step when the offset
+         * is a multiple of it so the selectors can apply it instead */
+        pushed_offset += offset;
+        node->set_offset(Duration{0});
+        outer_before += node->get_range();
+    } else {
+        outer_before += node->get_range() + offset;
+        outer_after += offset;
+    }
+
+    /* the inner selectors of a subquery with @ read a fixed time range */
+    if (node->get_at() != AtModifier::NONE) fixed_time = true;
+    check_at(node);
+
+    node->set_expr(rewrite(node->release_expr()));
+
+    pushed_offset = saved_offset;
+    outer_before = saved_before;
+    outer_after = saved_after;
+    fixed_time = saved_fixed;
+}
+
+} // namespace promql
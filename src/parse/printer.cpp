@@ -88,6 +88,7 @@ void ASTPrinter::visit(VectorSelectorNode* node)
     if (offset.count()) {
         std::cout << padding << "  offset = " << offset.count() << std::endl;
     }
+    print_at(node);
 
     std::cout << padding << "  matchers = [" << std::endl;
     for (auto&& p : node->get_matchers()) {
@@ -110,6 +111,7 @@ void ASTPrinter::visit(MatrixSelectorNode* node)
     if (offset.count()) {
         std::cout << padding << "  offset = " << offset.count() << std::endl;
     }
+    print_at(node);
 
     std::cout << padding << "  matchers = [" << std::endl;
     for (auto&& p : node->get_matchers()) {
@@ -132,12 +134,31 @@ void ASTPrinter::visit(SubqueryNode* node)
     if (offset.count()) {
         std::cout << padding << "  offset = " << offset.count() << std::endl;
     }
+    print_at(node);
 
     std::cout << padding << "  expr =" << std::endl;
     enter(node->get_expr());
     std::cout << padding << "}" << std::endl;
 }
 
+void ASTPrinter::print_at(ASTNode* node)
+{
+    switch (node->get_at()) {
+    case AtModifier::TIMESTAMP:
+        std::cout << padding << "  at = " << node->get_at_timestamp()
+                  << std::endl;
+        break;
+    case AtModifier::START:
+        std::cout << padding << "  at = start()" << std::endl;
+        break;
+    case AtModifier::END:
+        std::cout << padding << "  at = end()" << std::endl;
+        break;
+    default:
+        break;
+    }
+}
+
 void ASTPrinter::enter(ASTNode* node)
 {
     padding += "    ";
@@ -0,0 +1,47 @@
+#include "promql/parse/query_stats.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace promql {
+
+QueryStats& QueryStats::operator+=(const QueryStats& rhs)
+{
+    parse_time += rhs.parse_time;
+    plan_time += rhs.plan_time;
+    select_time += rhs.select_time;
+    eval_time += rhs.eval_time;
+    encode_time += rhs.encode_time;
+    series += rhs.series;
+    samples += rhs.samples;
+    peak_samples = std::max(peak_samples, rhs.peak_samples);
+    peak_bytes = std::max(peak_bytes, rhs.peak_bytes);
+    steps += rhs.steps;
+
+    return *this;
+}
+
+static double seconds(QueryStats::Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+std::string QueryStats::to_json() const
+{
+    std::stringstream ss;
+
+    ss << "{\"timings\": {\"parseTime\": " << seconds(parse_time)
+       << ", \"planTime\": " << seconds(plan_time)
+       << ", \"selectTime\": " << seconds(select_time)
+       << ", \"evalTime\": " << seconds(eval_time)
+       << ", \"encodeTime\": " << seconds(encode_time)
+       << "}, \"samples\": {\"seriesSelected\": " << series
+       << ", \"totalQueryableSamples\": " << samples
+       << ", \"peakSamples\": " << peak_samples
+       << ", \"peakBytes\": " << peak_bytes
+       << ", \"stepsEvaluated\": " << steps << "}}";
+
+    return ss.str();
+}
+
+} // namespace promql
@@ -0,0 +1,274 @@
+#include "promql/parse/query_tracker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace promql {
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the slots must be usable from a shared mapping");
+
+static const uint64_t TRACKER_MAGIC = 0x50524f4d51415131; /* PROMQAQ1 */
+
+/* the header of the mapping, followed by the slots */
+struct TrackerHeader {
+    uint64_t magic;
+    uint64_t max_queries;
+    char padding[48];
+};
+
+static void store_query(ActiveQuery& slot, const std::string& query)
+{
+    char buf[ActiveQuery::MAX_QUERY_LENGTH] = {};
+    ::memcpy(buf, query.c_str(),
+             std::min(query.length(), sizeof(buf) - 1));
+
+    /* the words past the end of the text are left as they are */
+    auto words = std::min(query.length() / sizeof(uint64_t) + 1,
+                          sizeof(buf) / sizeof(uint64_t));
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        ::memcpy(&word, buf + i * sizeof(word), sizeof(word));
+        slot.query[i].store(word, std::memory_order_relaxed);
+    }
+}
+
+static std::string load_query(const ActiveQuery& slot)
+{
+    std::string query;
+    for (auto&& w : slot.query) {
+        uint64_t word = w.load(std::memory_order_relaxed);
+        char buf[sizeof(word)];
+        ::memcpy(buf, &word, sizeof(word));
+
+        auto len = ::strnlen(buf, sizeof(buf));
+        query.append(buf, len);
+        if (len < sizeof(buf)) break;
+    }
+    return query;
+}
+
+const char* phase2str(QueryPhase phase)
+{
+    switch (phase) {
+    case QueryPhase::PARSING:
+        return "parsing";
+    case QueryPhase::PLANNING:
+        return "planning";
+    case QueryPhase::EXECUTING:
+        return "executing";
+    case QueryPhase::RENDERING:
+        return "rendering";
+    }
+
+    return "unknown";
+}
+
+ActiveQueryTracker::ActiveQueryTracker(size_t max_queries,
+                                       const std::string& path)
+    : max_queries(max_queries),
+      map_size(sizeof(TrackerHeader) + max_queries * sizeof(ActiveQuery)),
+      owners(new Owner[max_queries]()), next_id(1), next_slot(0)
+{
+    if (!path.length()) {
+        map = ::mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            throw std::runtime_error("cannot allocate active query tracker");
+        }
+    } else {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1) {
+            throw std::runtime_error("cannot open active query file '" +
+                                     path + "'");
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) == -1 || ::ftruncate(fd, map_size) == -1) {
+            ::close(fd);
+            throw std::runtime_error("cannot resize active query file '" +
+                                     path + "'");
+        }
+
+        map = ::mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            throw std::runtime_error("cannot map active query file '" + path +
+                                     "'");
+        }
+
+        /* queries still in the file were running when the process died */
+        auto* header = static_cast<TrackerHeader*>(map);
+        auto* old_slots = reinterpret_cast<ActiveQuery*>(header + 1);
+        if ((size_t)st.st_size >= map_size && header->magic == TRACKER_MAGIC &&
+            header->max_queries == max_queries) {
+            for (size_t i = 0; i < max_queries; i++) {
+                QueryInfo info;
+                if (read_slot(old_slots[i], info)) {
+                    crashed_queries.push_back(std::move(info));
+                }
+            }
+        }
+
+        ::memset(map, 0, map_size);
+        header->magic = TRACKER_MAGIC;
+        header->max_queries = max_queries;
+    }
+
+    slots = reinterpret_cast<ActiveQuery*>(static_cast<TrackerHeader*>(map) +
+                                           1);
+}
+
+ActiveQueryTracker::~ActiveQueryTracker() { ::munmap(map, map_size); }
+
+ActiveQuery*
+ActiveQueryTracker::insert(const std::string& query,
+                           std::shared_ptr<CancellationToken> token,
+                           const void* owner)
+{
+    auto first = next_slot.fetch_add(1, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < max_queries; i++) {
+        auto idx = (first + i) % max_queries;
+        auto& slot = slots[idx];
+
+        uint64_t free = 0;
+        if (!slot.id.compare_exchange_strong(free, RESERVED,
+                                             std::memory_order_acquire)) {
+            continue;
+        }
+
+        /* readers that copy the slot from here on see the id change */
+        std::atomic_thread_fence(std::memory_order_release);
+
+        store_query(slot, query);
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        slot.start.store(std::chrono::duration_cast<Duration>(now).count(),
+                         std::memory_order_relaxed);
+        slot.phase.store((uint32_t)QueryPhase::PARSING,
+                         std::memory_order_relaxed);
+        slot.samples.store(0, std::memory_order_relaxed);
+        slot.bytes.store(0, std::memory_order_relaxed);
+
+        owners[idx].token.store(token.get());
+        owners[idx].holder = std::move(token);
+        owners[idx].request.store(owner, std::memory_order_relaxed);
+
+        /* publish the slot */
+        slot.id.store(next_id.fetch_add(1, std::memory_order_relaxed),
+                      std::memory_order_release);
+        return &slot;
+    }
+
+    return nullptr;
+}
+
+void ActiveQueryTracker::remove(ActiveQuery* query)
+{
+    if (!query) return;
+
+    /* the id is cleared before the token so that a reader which sees the same
+     * id before and after loading the token got the token of that query */
+    auto idx = query - slots;
+    auto& owner = owners[idx];
+    query->id.store(RESERVED);
+    owner.request.store(nullptr, std::memory_order_relaxed);
+    owner.token.store(nullptr);
+
+    /* a reader which loaded the token before it was cleared is still
+     * counted, it only has the token to cancel */
+    while (owner.readers.load()) {
+        std::this_thread::yield();
+    }
+    owner.holder.reset();
+
+    query->id.store(0, std::memory_order_release);
+}
+
+bool ActiveQueryTracker::cancel(size_t idx, uint64_t id)
+{
+    auto& owner = owners[idx];
+    bool cancelled = false;
+
+    owner.readers.fetch_add(1);
+    if (slots[idx].id.load() == id) {
+        auto* token = owner.token.load();
+        if (token && slots[idx].id.load() == id) {
+            token->cancel();
+            cancelled = true;
+        }
+    }
+    owner.readers.fetch_sub(1, std::memory_order_release);
+
+    return cancelled;
+}
+
+bool ActiveQueryTracker::kill(uint64_t id)
+{
+    if (!id || id == RESERVED) return false;
+
+    for (size_t i = 0; i < max_queries; i++) {
+        if (cancel(i, id)) return true;
+    }
+
+    return false;
+}
+
+void ActiveQueryTracker::kill_owner(const void* owner)
+{
+    for (size_t i = 0; i < max_queries; i++) {
+        auto id = slots[i].id.load(std::memory_order_acquire);
+        if (!id || id == RESERVED) continue;
+        if (owners[i].request.load(std::memory_order_relaxed) != owner) {
+            continue;
+        }
+
+        cancel(i, id);
+    }
+}
+
+bool ActiveQueryTracker::read_slot(const ActiveQuery& slot,
+                                   QueryInfo& info) const
+{
+    auto id = slot.id.load(std::memory_order_acquire);
+    if (!id || id == RESERVED) return false;
+
+    info.id = id;
+    info.query = load_query(slot);
+    info.start = SystemTime(Duration(slot.start.load()));
+    info.phase = (QueryPhase)slot.phase.load();
+    info.samples = slot.samples.load();
+    info.bytes = (size_t)std::max<int64_t>(0, slot.bytes.load());
+    info.elapsed = std::chrono::duration_cast<Duration>(
+        std::chrono::system_clock::now() - info.start);
+
+    /* false if the slot was released while being read */
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.id.load(std::memory_order_relaxed) == id;
+}
+
+std::vector<ActiveQueryTracker::QueryInfo>
+ActiveQueryTracker::get_active_queries() const
+{
+    std::vector<QueryInfo> queries;
+
+    for (size_t i = 0; i < max_queries; i++) {
+        QueryInfo info;
+        if (read_slot(slots[i], info)) queries.push_back(std::move(info));
+    }
+
+    std::sort(
+        queries.begin(), queries.end(),
+        [](const QueryInfo& a, const QueryInfo& b) { return a.id < b.id; });
+    return queries;
+}
+
+} // namespace promql
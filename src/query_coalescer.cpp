@@ -0,0 +1,95 @@
+#include "promql/query_coalescer.h"
+#include "promql/parse/executor.h"
+
+namespace promql {
+
+QueryResult QueryCoalescer::run(const std::string& key, const QueryFunc& func,
+                                std::shared_ptr<CancellationToken> token)
+{
+    while (true) {
+        std::shared_ptr<Flight> flight;
+        bool leader = false;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            auto it = flights.find(key);
+            if (it == flights.end()) {
+                flight = std::make_shared<Flight>();
+                flight->result = flight->promise.get_future().share();
+                flight->token = std::make_shared<CancellationToken>();
+                flight->token->share(token);
+                flights.emplace(key, flight);
+                leader = true;
+            } else {
+                flight = it->second;
+                flight->token->add_waiter();
+                coalesced++;
+            }
+        }
+
+        if (leader) return lead(key, *flight, func, token);
+
+        while (flight->result.wait_for(std::chrono::milliseconds(10)) !=
+               std::future_status::ready) {
+            if (!token) continue;
+
+            try {
+                token->check();
+            } catch (...) {
+                flight->token->remove_waiter();
+                throw;
+            }
+        }
+        flight->token->remove_waiter();
+
+        /* the request running the query went away before this one joined
+         * it, run the query again */
+        if (flight->aborted) continue;
+
+        auto result = flight->result.get();
+        result.shared = true;
+        return result;
+    }
+}
+
+QueryResult
+QueryCoalescer::lead(const std::string& key, Flight& flight,
+                     const QueryFunc& func,
+                     const std::shared_ptr<CancellationToken>& token)
+{
+    /* the flight is removed before its result is set, a request arriving
+     * from then on runs the query again */
+    try {
+        auto result = func(flight.token);
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            flights.erase(key);
+        }
+        flight.promise.set_value(result);
+        return result;
+    } catch (...) {
+        auto error = std::current_exception();
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            flights.erase(key);
+        }
+
+        /* the waiters that joined after the query was stopped run it again */
+        if (token) {
+            try {
+                token->check();
+            } catch (const ExecutionError&) {
+                flight.aborted = true;
+            }
+        }
+        flight.promise.set_exception(error);
+        throw;
+    }
+}
+
+size_t QueryCoalescer::get_coalesced() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return coalesced;
+}
+
+} // namespace promql
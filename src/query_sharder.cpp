@@ -0,0 +1,305 @@
+#include "promql/query_sharder.h"
+#include "promql/parse/functions.h"
+#include "promql/query_splitter.h"
+
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace promql {
+
+namespace {
+
+/* the series of a set in one shard */
+class ShardSeriesSet : public SeriesSet {
+public:
+    ShardSeriesSet(std::shared_ptr<SeriesSet> set, size_t index, size_t count)
+        : set(std::move(set)), index(index), count(count)
+    {}
+
+    virtual bool next()
+    {
+        while (set->next()) {
+            cur = set->at();
+            LabelSet labels;
+            cur->labels(labels);
+            if (series_shard(labels, count) == index) return true;
+        }
+
+        cur.reset();
+        return false;
+    }
+
+    virtual std::shared_ptr<Series> at() { return cur; }
+
+private:
+    std::shared_ptr<SeriesSet> set;
+    std::shared_ptr<Series> cur;
+    size_t index, count;
+};
+
+class ShardQuerier : public Querier {
+public:
+    ShardQuerier(std::shared_ptr<Querier> querier, size_t index, size_t count)
+        : querier(std::move(querier)), shard(shard_matcher(index, count)),
+          index(index), count(count)
+    {}
+
+    virtual std::shared_ptr<SeriesSet>
+    select(const std::vector<LabelMatcher>& matchers)
+    {
+        /* the querier may ignore the shard matcher, it only saves reading
+         * the series of the other shards */
+        auto set = querier->select(with_shard(matchers));
+        if (!set) return set;
+        return std::make_shared<ShardSeriesSet>(std::move(set), index, count);
+    }
+
+    virtual bool select_aggregate(const AggregateHints& hints,
+                                  const std::vector<LabelMatcher>& matchers,
+                                  std::vector<PartialAggregate>& partials)
+    {
+        /* the partials cannot be filtered, the querier declines the hints
+         * unless it honours the shard matcher */
+        return querier->select_aggregate(hints, with_shard(matchers),
+                                         partials);
+    }
+
+private:
+    std::shared_ptr<Querier> querier;
+    LabelMatcher shard;
+    size_t index, count;
+
+    std::vector<LabelMatcher>
+    with_shard(const std::vector<LabelMatcher>& matchers) const
+    {
+        auto sharded = matchers;
+        sharded.push_back(shard);
+        return sharded;
+    }
+};
+
+/* checks that each output series of an expression is computed from a single
+ * input series, so that the expression gives the same series whether it is
+ * evaluated on all series at once or on each shard */
+class SeriesLocalChecker : public ASTVisitor {
+public:
+    bool check(ASTNode* node)
+    {
+        local = true;
+        node->visit(*this);
+        return local;
+    }
+
+    virtual void visit(UnaryNode* node) { node->get_operand()->visit(*this); }
+
+    virtual void visit(BinaryNode* node)
+    {
+        /* vector-vector operations match series of both sides */
+        if (node->get_lhs()->type() != ValueType::SCALAR &&
+            node->get_rhs()->type() != ValueType::SCALAR) {
+            local = false;
+            return;
+        }
+        node->get_lhs()->visit(*this);
+        node->get_rhs()->visit(*this);
+    }
+
+    virtual void visit(StringLiteralNode* node) {}
+    virtual void visit(NumberLiteralNode* node) {}
+
+    virtual void visit(FuncCallNode* node)
+    {
+        static const std::unordered_set<std::string> series_local{
+            "avg_over_time", "count_over_time", "delta",
+            "increase",      "max_over_time",   "min_over_time",
+            "rate",          "sum_over_time",   "time"};
+
+        if (!series_local.count(node->get_func()->name)) {
+            local = false;
+            return;
+        }
+        for (auto&& p : node->get_args()) {
+            p->visit(*this);
+        }
+    }
+
+    virtual void visit(AggregationNode* node) { local = false; }
+    virtual void visit(VectorSelectorNode* node) {}
+    virtual void visit(MatrixSelectorNode* node) {}
+    virtual void visit(SubqueryNode* node) { node->get_expr()->visit(*this); }
+
+private:
+    bool local;
+};
+
+/* the merged points of a group */
+struct Group {
+    LabelSet labels;
+    std::map<uint64_t, std::pair<double, double>> points; /* value and, for
+                                                             avg, count */
+};
+
+} // namespace
+
+std::shared_ptr<Querier> ShardQueryable::querier(uint64_t mint, uint64_t maxt)
+{
+    return std::make_shared<ShardQuerier>(queryable->querier(mint, maxt),
+                                          index, count);
+}
+
+bool QuerySharder::is_shardable(const QueryPlan* plan)
+{
+    auto* agg = dynamic_cast<AggregationNode*>(plan->root.get());
+    if (!agg || agg->get_param()) return false;
+
+    switch (agg->get_op()) {
+    case Token::SUM:
+    case Token::MIN:
+    case Token::MAX:
+    case Token::COUNT:
+    case Token::AVG:
+        break;
+    default:
+        return false;
+    }
+
+    return SeriesLocalChecker().check(agg->get_expr());
+}
+
+bool QuerySharder::prepare(const QueryPlan* plan, const PlanFunc& replan,
+                           PlanCache* cache)
+{
+    shard_plans.clear();
+    owned_plans.clear();
+    if (num_shards < 2 || !is_shardable(plan)) return false;
+
+    op = static_cast<AggregationNode*>(plan->root.get())->get_op();
+    if (op != Token::AVG) {
+        shard_plans.push_back(plan);
+        return true;
+    }
+
+    /* only the key of the plan depends on the operator of the root, it can
+     * be changed once planned */
+    for (auto shard_op : {Token::SUM, Token::COUNT}) {
+        auto plan_op = [&] {
+            auto shard_plan = replan();
+            static_cast<AggregationNode*>(shard_plan->root.get())
+                ->set_op(shard_op);
+            return shard_plan;
+        };
+
+        std::shared_ptr<const QueryPlan> shard_plan;
+        if (cache) {
+            shard_plan = cache->get("shard|" + std::to_string(num_shards) +
+                                        "|" + tok2str(shard_op) + "|" +
+                                        plan->key,
+                                    plan_op);
+        } else {
+            shard_plan = plan_op();
+        }
+        shard_plans.push_back(shard_plan.get());
+        owned_plans.push_back(std::move(shard_plan));
+    }
+    return true;
+}
+
+std::unique_ptr<ExecValue> QuerySharder::query(Queryable* queryable,
+                                               const QueryFunc& func) const
+{
+    std::vector<ShardQueryable> shards;
+    for (size_t i = 0; i < num_shards; i++) {
+        shards.emplace_back(queryable, i, num_shards);
+    }
+
+    /* the results of plan p on shard i at p * num_shards + i */
+    size_t num_plans = shard_plans.size();
+    std::vector<std::unique_ptr<ExecValue>> results(num_plans * num_shards);
+    parallel_for(pool, results.size(), [&](size_t i) {
+        results[i] = func(shard_plans[i / num_shards], &shards[i % num_shards]);
+    });
+
+    std::vector<Group> groups;
+    std::unordered_map<LabelSet, size_t> index;
+    auto merge = [&](const LabelSet& labels, uint64_t t, double v, size_t p) {
+        auto it = index.find(labels);
+        if (it == index.end()) {
+            it = index.emplace(labels, groups.size()).first;
+            groups.push_back(Group{labels, {}});
+        }
+
+        auto& points = groups[it->second].points;
+        auto pit = points.find(t);
+        if (pit == points.end()) {
+            if (p == 0)
+                points.emplace(t, std::make_pair(v, 0.0));
+            else
+                points.emplace(t, std::make_pair(0.0, v));
+            return;
+        }
+
+        auto& point = pit->second;
+        switch (op) {
+        case Token::MIN:
+            if (v < point.first || std::isnan(point.first)) point.first = v;
+            break;
+        case Token::MAX:
+            if (v > point.first || std::isnan(point.first)) point.first = v;
+            break;
+        default:
+            /* sum, count and the sum and count of avg */
+            (p == 0 ? point.first : point.second) += v;
+            break;
+        }
+    };
+
+    bool vector_result = false;
+    for (size_t i = 0; i < results.size(); i++) {
+        auto* result = results[i].get();
+        size_t p = i / num_shards;
+
+        if (result->type() == ValueType::VECTOR) {
+            vector_result = true;
+            for (auto&& s : static_cast<VectorValue*>(result)->get_samples()) {
+                merge(s.metric, s.value.get_time(), s.value.get_value(), p);
+            }
+            continue;
+        }
+
+        for (auto&& s : static_cast<MatrixValue*>(result)->get_series()) {
+            for (auto&& v : s.values) {
+                merge(s.metric, v.get_time(), v.get_value(), p);
+            }
+        }
+    }
+
+    auto value_of = [this](const std::pair<double, double>& point) {
+        return op == Token::AVG ? point.first / point.second : point.first;
+    };
+
+    if (vector_result) {
+        auto vec = std::make_unique<VectorValue>();
+        for (auto&& g : groups) {
+            for (auto&& p : g.points) {
+                vec->add_sample(VectorValue::Sample(
+                    g.labels, ScalarValue(p.first, value_of(p.second))));
+            }
+        }
+        return vec;
+    }
+
+    auto mat = std::make_unique<MatrixValue>();
+    for (auto&& g : groups) {
+        MatrixValue::Series series(g.labels);
+        series.values.reserve(g.points.size());
+        for (auto&& p : g.points) {
+            series.values.emplace_back(p.first, value_of(p.second));
+        }
+        mat->add_series(std::move(series));
+    }
+    return mat;
+}
+
+} // namespace promql
@@ -0,0 +1,106 @@
+#include "promql/query_splitter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+namespace promql {
+
+std::vector<std::pair<uint64_t, uint64_t>>
+split_range(uint64_t start, uint64_t end, uint64_t step, uint64_t interval)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+
+    uint64_t t = start;
+    while (t <= end) {
+        /* the last step before the next multiple of interval */
+        uint64_t boundary = (t / interval + 1) * interval;
+        uint64_t last =
+            boundary - 1 >= end ? end : t + (boundary - 1 - t) / step * step;
+
+        ranges.emplace_back(t, last);
+        t = last + step;
+    }
+
+    return ranges;
+}
+
+/* the tasks are claimed in order by the calling thread and the helpers on
+ * the pool. A helper may be scheduled after parallel_for has returned, so the
+ * state is shared with it and it must not touch the task unless it claims
+ * one, which the calling thread waits for. */
+struct ParallelState {
+    size_t n;
+    const std::function<void(size_t)>* task;
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t done = 0;
+    std::exception_ptr error;
+
+    void run()
+    {
+        size_t i;
+        while ((i = next.fetch_add(1)) < n) {
+            std::exception_ptr e;
+            if (!failed.load()) {
+                try {
+                    (*task)(i);
+                } catch (...) {
+                    e = std::current_exception();
+                    failed.store(true);
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(mutex);
+            if (e && !error) error = e;
+            if (++done == n) cv.notify_all();
+        }
+    }
+};
+
+void parallel_for(ctpl::thread_pool* pool, size_t n,
+                  const std::function<void(size_t)>& task)
+{
+    if (!n) return;
+
+    auto state = std::make_shared<ParallelState>();
+    state->n = n;
+    state->task = &task;
+
+    size_t helpers = std::min((size_t)pool->n_idle(), n - 1);
+    for (size_t i = 0; i < helpers; i++) {
+        pool->push([state](int) { state->run(); });
+    }
+    state->run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [&] { return state->done == n; });
+    if (state->error) std::rethrow_exception(state->error);
+}
+
+std::unique_ptr<MatrixValue> QuerySplitter::query(uint64_t start,
+                                                  uint64_t end, uint64_t step,
+                                                  const QueryFunc& func)
+{
+    auto ranges = split_range(start, end, step, interval.count());
+    if (ranges.size() <= 1) return func(start, end);
+
+    std::vector<std::unique_ptr<MatrixValue>> results(ranges.size());
+    parallel_for(pool, ranges.size(), [&](size_t i) {
+        results[i] = func(ranges[i].first, ranges[i].second);
+    });
+
+    MatrixStitcher stitcher;
+    for (auto&& result : results) {
+        stitcher.append(*result);
+    }
+    return stitcher.finish();
+}
+
+} // namespace promql
@@ -0,0 +1,191 @@
+#include "promql/results_cache.h"
+
+#include <algorithm>
+
+namespace promql {
+
+static size_t matrix_bytes(const MatrixValue& mat)
+{
+    size_t bytes = sizeof(MatrixValue);
+    for (auto&& s : mat.get_series()) {
+        bytes += sizeof(s) + s.values.capacity() * sizeof(ScalarValue);
+    }
+    return bytes;
+}
+
+std::unique_ptr<MatrixValue>
+ResultsCache::query(const std::string& query, uint64_t start, uint64_t end,
+                    uint64_t step, uint64_t now, const QueryFunc& func)
+{
+    auto key = query + "|" + std::to_string(step) + "|" +
+               std::to_string(start % step);
+
+    std::vector<Extent> cached;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            cached = it->second->extents;
+        }
+    }
+
+    /* walk the steps, serving the cached extents and evaluating the gaps
+     * between them */
+    std::vector<Extent> pieces, computed;
+    size_t hit_steps = 0, miss_steps = 0;
+    auto evaluate = [&](uint64_t from, uint64_t to) {
+        std::shared_ptr<const MatrixValue> result = func(from, to);
+        Extent extent{from, to, result, matrix_bytes(*result)};
+        pieces.push_back(extent);
+        computed.push_back(std::move(extent));
+        miss_steps += (to - from) / step + 1;
+    };
+
+    uint64_t t = start;
+    for (auto&& extent : cached) {
+        if (t > end) break;
+        if (extent.end < t) continue;
+        if (extent.start > end) break;
+
+        if (extent.start > t) {
+            evaluate(t, extent.start - step);
+            t = extent.start;
+        }
+
+        pieces.push_back(extent);
+        hit_steps += (std::min(extent.end, end) - t) / step + 1;
+        t = extent.end + step;
+    }
+    if (t <= end) evaluate(t, end);
+
+    MatrixStitcher stitcher;
+    for (auto&& piece : pieces) {
+        stitcher.append(*piece.result, start, end);
+    }
+
+    /* keep the computed extents up to the mutable window */
+    auto cutoff = now > (uint64_t)max_freshness.count()
+                      ? now - max_freshness.count()
+                      : 0;
+    std::vector<Extent> cacheable;
+    for (auto&& extent : computed) {
+        if (extent.start > cutoff) continue;
+
+        if (extent.end > cutoff) {
+            auto last = extent.start + (cutoff - extent.start) / step * step;
+            MatrixStitcher trimmed;
+            trimmed.append(*extent.result, extent.start, last);
+
+            extent.end = last;
+            extent.result = trimmed.finish();
+            extent.bytes = matrix_bytes(*extent.result);
+        }
+
+        cacheable.push_back(std::move(extent));
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        hits += hit_steps;
+        misses += miss_steps;
+        if (!cacheable.empty()) put(key, std::move(cacheable), step);
+    }
+
+    return stitcher.finish();
+}
+
+void ResultsCache::put(const std::string& key, std::vector<Extent>&& extents,
+                       uint64_t step)
+{
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        lru.push_front(Entry{key, {}, key.size()});
+        it = entries.emplace(key, lru.begin()).first;
+        bytes += key.size();
+    } else {
+        lru.splice(lru.begin(), lru, it->second);
+    }
+
+    auto& entry = *it->second;
+    extents.insert(extents.end(), entry.extents.begin(), entry.extents.end());
+    std::sort(extents.begin(), extents.end(),
+              [](const Extent& lhs, const Extent& rhs) {
+                  return lhs.start < rhs.start;
+              });
+
+    /* merge the overlapping and adjacent extents */
+    std::vector<Extent> merged;
+    for (auto&& extent : extents) {
+        if (merged.empty() || extent.start > merged.back().end + step) {
+            merged.push_back(std::move(extent));
+            continue;
+        }
+
+        auto& last = merged.back();
+        if (extent.end <= last.end) continue;
+
+        MatrixStitcher stitcher;
+        stitcher.append(*last.result, last.start, last.end);
+        stitcher.append(*extent.result, last.end + step, extent.end);
+
+        last.end = extent.end;
+        last.result = stitcher.finish();
+        last.bytes = matrix_bytes(*last.result);
+    }
+
+    size_t entry_bytes = key.size();
+    for (auto&& extent : merged) {
+        entry_bytes += extent.bytes;
+    }
+
+    bytes = bytes - entry.bytes + entry_bytes;
+    entry.bytes = entry_bytes;
+    entry.extents = std::move(merged);
+
+    evict();
+}
+
+void ResultsCache::evict()
+{
+    while (bytes > max_bytes && !lru.empty()) {
+        auto& entry = lru.back();
+        bytes -= entry.bytes;
+        entries.erase(entry.key);
+        lru.pop_back();
+    }
+}
+
+void ResultsCache::add_sample(uint64_t t, uint64_t now)
+{
+    auto fresh = (uint64_t)max_freshness.count();
+    if (t + fresh < now) invalidate();
+}
+
+void ResultsCache::invalidate()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    lru.clear();
+    entries.clear();
+    bytes = 0;
+}
+
+size_t ResultsCache::get_bytes() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return bytes;
+}
+
+size_t ResultsCache::get_hits() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return hits;
+}
+
+size_t ResultsCache::get_misses() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return misses;
+}
+
+} // namespace promql
@@ -0,0 +1,209 @@
+#include "promql/slow_query_log.h"
+#include "promql/parse/fingerprint.h"
+#include "promql/value.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace promql {
+
+static double seconds(QueryStats::Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+static std::string timestamp(SystemTime tp)
+{
+    auto ms = std::chrono::duration_cast<Duration>(tp.time_since_epoch());
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3) << ms.count() / 1000.0;
+    return ss.str();
+}
+
+static QueryStats::Clock::duration cpu_time(const QueryStats& stats)
+{
+    return stats.parse_time + stats.plan_time + stats.select_time +
+           stats.eval_time + stats.encode_time;
+}
+
+std::string QueryLogEntry::to_json() const
+{
+    std::stringstream ss;
+
+    ss << "{\"time\": " << timestamp(time) << ", \"endpoint\": \""
+       << json_escape(endpoint) << "\", \"query\": \"" << json_escape(query)
+       << "\", \"fingerprint\": \"" << json_escape(fingerprint)
+       << "\", \"fingerprintId\": \"" << std::hex << std::setw(16)
+       << std::setfill('0') << QueryFingerprinter::hash(fingerprint)
+       << std::dec << "\", \"start\": " << timestamp(start)
+       << ", \"end\": " << timestamp(end)
+       << ", \"step\": " << step.count() / 1000.0
+       << ", \"duration\": " << seconds(elapsed);
+    if (!error.empty()) {
+        ss << ", \"error\": \"" << json_escape(error) << "\"";
+    }
+    ss << ", \"stats\": " << stats.to_json() << "}";
+
+    return ss.str();
+}
+
+std::string FingerprintStats::to_json() const
+{
+    std::stringstream ss;
+
+    ss << "{\"fingerprint\": \"" << json_escape(fingerprint)
+       << "\", \"count\": " << count << ", \"slowCount\": " << slow_count
+       << ", \"totalTime\": " << seconds(total_time)
+       << ", \"maxTime\": " << seconds(max_time)
+       << ", \"cpuTime\": " << seconds(cpu_time)
+       << ", \"cpuTimeError\": " << seconds(cpu_time_error)
+       << ", \"samples\": " << samples << "}";
+
+    return ss.str();
+}
+
+SlowQueryLog::SlowQueryLog(const std::string& path, Duration threshold,
+                           size_t max_pending, size_t max_fingerprints)
+    : threshold(threshold), max_pending(max_pending),
+      max_fingerprints(max_fingerprints), writing(false), stopping(false),
+      logged(0), dropped(0)
+{
+    if (path.empty()) return;
+
+    file.open(path, std::ios::out | std::ios::app);
+    if (!file.is_open())
+        throw std::runtime_error("cannot open slow query log '" + path + "'");
+
+    writer = std::thread([this] { write_entries(); });
+}
+
+SlowQueryLog::~SlowQueryLog()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+
+    /* the entries queued so far are written before the thread exits */
+    if (writer.joinable()) writer.join();
+}
+
+bool SlowQueryLog::record(QueryLogEntry&& entry)
+{
+    bool slow = entry.elapsed >= threshold;
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        account(entry, slow);
+        if (!slow || !writer.joinable()) return slow;
+
+        if (pending.size() >= max_pending) {
+            dropped++;
+            return slow;
+        }
+        pending.push_back(std::move(entry));
+    }
+    cv.notify_one();
+
+    return slow;
+}
+
+void SlowQueryLog::account(const QueryLogEntry& entry, bool slow)
+{
+    auto it = fingerprints.find(entry.fingerprint);
+    if (it == fingerprints.end()) {
+        QueryStats::Clock::duration inherited{};
+        if (max_fingerprints && fingerprints.size() >= max_fingerprints) {
+            auto cheapest = by_cpu_time.begin();
+            inherited = cheapest->first;
+            fingerprints.erase(*cheapest->second);
+            by_cpu_time.erase(cheapest);
+        }
+
+        it = fingerprints.emplace(entry.fingerprint, FingerprintStats())
+                 .first;
+        it->second.fingerprint = entry.fingerprint;
+        it->second.cpu_time = it->second.cpu_time_error = inherited;
+    } else {
+        by_cpu_time.erase({it->second.cpu_time, &it->first});
+    }
+
+    auto& fp = it->second;
+    fp.count++;
+    if (slow) fp.slow_count++;
+    fp.total_time += entry.elapsed;
+    fp.max_time = std::max(fp.max_time, entry.elapsed);
+    fp.cpu_time += cpu_time(entry.stats);
+    fp.samples += entry.stats.samples;
+    by_cpu_time.emplace(fp.cpu_time, &it->first);
+}
+
+void SlowQueryLog::write_entries()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        cv.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty()) break;
+
+        std::deque<QueryLogEntry> batch;
+        batch.swap(pending);
+        writing = true;
+        lock.unlock();
+
+        for (auto&& entry : batch) {
+            file << entry.to_json() << '\n';
+        }
+        file.flush();
+
+        lock.lock();
+        writing = false;
+        logged += batch.size();
+        idle_cv.notify_all();
+    }
+}
+
+void SlowQueryLog::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle_cv.wait(lock, [this] {
+        return !writer.joinable() || (pending.empty() && !writing);
+    });
+}
+
+std::vector<FingerprintStats>
+SlowQueryLog::get_fingerprints(size_t limit) const
+{
+    std::vector<FingerprintStats> result;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        result.reserve(fingerprints.size());
+        for (auto&& p : fingerprints) {
+            result.push_back(p.second);
+        }
+    }
+
+    std::sort(result.begin(), result.end(),
+              [](const FingerprintStats& a, const FingerprintStats& b) {
+                  return a.cpu_time > b.cpu_time;
+              });
+    if (result.size() > limit) result.resize(limit);
+
+    return result;
+}
+
+uint64_t SlowQueryLog::get_logged() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return logged;
+}
+
+uint64_t SlowQueryLog::get_dropped() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return dropped;
+}
+
+} // namespace promql
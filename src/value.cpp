@@ -1,10 +1,35 @@
 #include "promql/value.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 
 namespace promql {
 
+std::string json_escape(std::string_view str)
+{
+    std::string escaped;
+    for (char c : str) {
+        switch (c) {
+        case '"':
+            escaped += "\\\"";
+            break;
+        case '\\':
+            escaped += "\\\\";
+            break;
+        case '\n':
+            escaped += "\\n";
+            break;
+        case '\t':
+            escaped += "\\t";
+            break;
+        default:
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
 std::string ScalarValue::to_json() const
 {
     std::stringstream ss;
@@ -38,6 +63,58 @@ std::string VectorValue::to_json() const
     return ss.str();
 }
 
+MatrixValue::MatrixValue(const MatrixValue& rhs,
+                         std::pmr::memory_resource* mr)
+    : series(mr)
+{
+    series.reserve(rhs.series.size());
+    for (auto&& s : rhs.series) {
+        series.emplace_back(s, mr);
+    }
+}
+
+size_t MatrixValue::num_samples() const
+{
+    size_t n = 0;
+    for (auto&& s : series) {
+        n += s.values.size();
+    }
+    return n;
+}
+
+void MatrixStitcher::append(const MatrixValue& mat, uint64_t from, uint64_t to)
+{
+    for (auto&& s : mat.get_series()) {
+        auto lower = std::lower_bound(
+            s.values.cbegin(), s.values.cend(), from,
+            [](const ScalarValue& v, uint64_t t) { return v.get_time() < t; });
+        auto upper = std::upper_bound(
+            lower, s.values.cend(), to,
+            [](uint64_t t, const ScalarValue& v) { return t < v.get_time(); });
+        if (lower == upper) continue;
+
+        auto it = index.find(s.metric);
+        if (it == index.end()) {
+            it = index.emplace(s.metric, series.size()).first;
+            series.emplace_back(s.metric);
+        }
+
+        auto& values = series[it->second].values;
+        values.insert(values.end(), lower, upper);
+    }
+}
+
+std::unique_ptr<MatrixValue> MatrixStitcher::finish()
+{
+    auto mat = std::make_unique<MatrixValue>();
+    for (auto&& s : series) {
+        mat->add_series(std::move(s));
+    }
+    series.clear();
+    index.clear();
+    return mat;
+}
+
 std::string MatrixValue::to_json() const
 {
     std::stringstream ss;
@@ -0,0 +1,190 @@
+#include "promql/web/connection_watcher.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <dirent.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+namespace promql {
+
+static bool same_address(const sockaddr* a, const sockaddr* b)
+{
+    if (a->sa_family != b->sa_family) return false;
+
+    if (a->sa_family == AF_INET) {
+        auto* a4 = reinterpret_cast<const sockaddr_in*>(a);
+        auto* b4 = reinterpret_cast<const sockaddr_in*>(b);
+        return a4->sin_port == b4->sin_port &&
+               a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+
+    if (a->sa_family == AF_INET6) {
+        auto* a6 = reinterpret_cast<const sockaddr_in6*>(a);
+        auto* b6 = reinterpret_cast<const sockaddr_in6*>(b);
+        return a6->sin6_port == b6->sin6_port &&
+               !::memcmp(&a6->sin6_addr, &b6->sin6_addr,
+                         sizeof(a6->sin6_addr));
+    }
+
+    return false;
+}
+
+static socklen_t address_length(const sockaddr* addr)
+{
+    return addr->sa_family == AF_INET6 ? sizeof(sockaddr_in6)
+                                       : sizeof(sockaddr_in);
+}
+
+/* whether fd is a socket connected from local to remote */
+static bool has_addresses(int fd, const sockaddr* local,
+                          const sockaddr* remote)
+{
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (::getsockname(fd, (sockaddr*)&addr, &len) == -1 ||
+        !same_address((sockaddr*)&addr, local)) {
+        return false;
+    }
+
+    len = sizeof(addr);
+    return ::getpeername(fd, (sockaddr*)&addr, &len) != -1 &&
+           same_address((sockaddr*)&addr, remote);
+}
+
+ConnectionWatcher::ConnectionWatcher(Duration interval)
+    : interval(interval), stopping(false), next_id(1)
+{
+    poller = std::thread([this] { poll_sockets(); });
+}
+
+ConnectionWatcher::~ConnectionWatcher()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    poller.join();
+}
+
+uint64_t ConnectionWatcher::watch(const sockaddr* local,
+                                  const sockaddr* remote,
+                                  std::shared_ptr<CancellationToken> token)
+{
+    Watch watch;
+    ::memcpy(&watch.local, local, address_length(local));
+    ::memcpy(&watch.remote, remote, address_length(remote));
+    watch.since = std::chrono::steady_clock::now();
+    watch.fd = -1;
+    watch.token = std::move(token);
+
+    std::lock_guard<std::mutex> guard(mutex);
+    auto id = next_id++;
+    watches.emplace(id, std::move(watch));
+    return id;
+}
+
+void ConnectionWatcher::unwatch(uint64_t id)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    watches.erase(id);
+}
+
+void ConnectionWatcher::poll_sockets()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!cv.wait_for(lock, interval, [this] { return stopping; })) {
+        /* the connections of the queries that ran for an interval are
+         * looked up without the lock, starting and finishing queries do
+         * not wait for the descriptors to be scanned */
+        std::vector<std::pair<uint64_t, Watch>> lookups;
+        auto now = std::chrono::steady_clock::now();
+        for (auto& entry : watches) {
+            if (entry.second.fd == -1 && now - entry.second.since >= interval)
+                lookups.push_back(entry);
+        }
+
+        if (!lookups.empty()) {
+            lock.unlock();
+            for (auto& entry : lookups) {
+                entry.second.fd =
+                    find_socket((sockaddr*)&entry.second.local,
+                                (sockaddr*)&entry.second.remote);
+            }
+            lock.lock();
+
+            /* the queries finished in the meantime are left alone, their
+             * descriptors may be closed or reused already */
+            for (auto& entry : lookups) {
+                auto it = watches.find(entry.first);
+                if (it == watches.end()) continue;
+
+                if (entry.second.fd == -1) {
+                    it->second.token->cancel();
+                    watches.erase(it);
+                } else {
+                    it->second.fd = entry.second.fd;
+                }
+            }
+        }
+
+        for (auto it = watches.begin(); it != watches.end();) {
+            auto& watch = it->second;
+            if (watch.fd == -1) {
+                ++it;
+                continue;
+            }
+
+            /* the next request of a keep-alive connection may be pending,
+             * peeking leaves it to the server */
+            char c;
+            bool gone = !has_addresses(watch.fd, (sockaddr*)&watch.local,
+                                       (sockaddr*)&watch.remote);
+            if (!gone) {
+                auto n = ::recv(watch.fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+                gone = n == 0 || (n < 0 && errno != EAGAIN &&
+                                  errno != EWOULDBLOCK && errno != EINTR);
+            }
+
+            if (gone) {
+                watch.token->cancel();
+                it = watches.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+int ConnectionWatcher::find_socket(const sockaddr* local,
+                                   const sockaddr* remote)
+{
+    /* the server does not expose the sockets of its connections, the one
+     * with the addresses of the request is looked up among the open
+     * descriptors */
+    DIR* dir = ::opendir("/proc/self/fd");
+    if (!dir) dir = ::opendir("/dev/fd");
+    if (!dir) return -1;
+
+    int found = -1;
+    while (auto* entry = ::readdir(dir)) {
+        char* endp;
+        int fd = (int)::strtol(entry->d_name, &endp, 10);
+        if (*endp || endp == entry->d_name || fd == ::dirfd(dir)) continue;
+
+        if (has_addresses(fd, local, remote)) {
+            found = fd;
+            break;
+        }
+    }
+
+    ::closedir(dir);
+    return found;
+}
+
+} // namespace promql
@@ -2,17 +2,64 @@
 #include "inja/inja.hpp"
 #include "promql/common.h"
 #include "promql/parse/executor.h"
+#include "promql/parse/instant_executor.h"
 #include "promql/parse/parser.h"
+#include "promql/parse/planner.h"
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <mutex>
 #include <sstream>
 
 namespace promql {
 
-HttpServer::HttpServer(Storage* storage, int num_workers)
-    : storage(storage), num_workers(num_workers), pool(num_workers)
+static SystemTime parse_timestamp(const std::string& str,
+                                  const std::string& param)
+{
+    char* endp;
+    double ts = ::strtod(str.c_str(), &endp);
+    if (!str.length() || endp != str.c_str() + str.length())
+        throw std::runtime_error("invalid parameter '" + param + "'");
+
+    return SystemTime(std::chrono::milliseconds((uint64_t)(ts * 1000)));
+}
+
+static std::string
+queries_to_json(const std::vector<ActiveQueryTracker::QueryInfo>& queries)
+{
+    std::stringstream ss;
+
+    ss << "[";
+    bool first = true;
+    for (auto&& q : queries) {
+        if (!first) ss << ", ";
+        ss << "{\"id\": " << q.id << ", \"query\": \"" << json_escape(q.query)
+           << "\", \"start\": "
+           << std::chrono::duration_cast<Duration>(q.start.time_since_epoch())
+                      .count() /
+                  1000.0
+           << ", \"elapsed\": " << q.elapsed.count() / 1000.0
+           << ", \"phase\": \"" << phase2str(q.phase)
+           << "\", \"samples\": " << q.samples << ", \"bytes\": " << q.bytes
+           << "}";
+        first = false;
+    }
+    ss << "]";
+
+    return ss.str();
+}
+
+HttpServer::HttpServer(Storage* storage, int num_workers,
+                       const std::string& active_query_file)
+    : storage(storage), num_workers(num_workers), pool(num_workers),
+      query_timeout(std::chrono::minutes(2)),
+      split_interval(std::chrono::hours(24)), query_shards(1),
+      queries(num_workers, active_query_file),
+      query_log(std::make_unique<SlowQueryLog>()), pool_queued(0)
 {
     server.config.port = 9090;
+    register_metrics();
 
     server.resource["^/graph$"]["GET"] =
         [this](std::shared_ptr<InternalHttpServer::Response> response,
@@ -30,22 +77,27 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
     server.resource["^/insert$"]["POST"] =
         [this](std::shared_ptr<InternalHttpServer::Response> response,
                std::shared_ptr<InternalHttpServer::Request> request) {
-            pool.push([this, response, request](int id) {
+            submit(insert_latency, [this, response, request] {
                 std::stringstream ss;
 
-                std::string series, value_str;
+                std::string series, value_str, time;
                 auto query_fields = request->parse_query_string();
                 for (auto& field : query_fields) {
                     if (field.first == "series") {
                         series = field.second;
                     } else if (field.first == "value") {
                         value_str = field.second;
+                    } else if (field.first == "time") {
+                        time = field.second;
                     }
                 }
 
                 try {
                     SystemTime now = std::chrono::system_clock::now();
                     double value = ::strtod(value_str.c_str(), nullptr);
+                    /* the sample is at the current time by default */
+                    auto ts = time.length() ? parse_timestamp(time, "time")
+                                            : now;
 
                     Parser parser(series);
                     auto root = parser.parse();
@@ -59,16 +111,24 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
 
                     std::vector<Label> labels;
                     for (auto&& p : vs->get_matchers()) {
-                        labels.emplace_back(p.name, p.value);
+                        labels.emplace_back(std::string(p.name),
+                                            std::string(p.value));
                     }
 
+                    auto to_ms = [](SystemTime tp) {
+                        return (uint64_t)std::chrono::duration_cast<Duration>(
+                                   tp.time_since_epoch())
+                            .count();
+                    };
+
                     auto app = this->storage->appender();
-                    app->add(labels,
-                             std::chrono::duration_cast<Duration>(
-                                 now.time_since_epoch())
-                                 .count(),
-                             value);
+                    app->add(labels, to_ms(ts), value);
                     app->commit();
+                    ingested_samples->add();
+
+                    if (results_cache) {
+                        results_cache->add_sample(to_ms(ts), to_ms(now));
+                    }
 
                     ss << "{\"status\": \"ok\"}";
                     response->write(ss);
@@ -87,19 +147,29 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
         ["^/api/v1/query$"]
         ["GET"] = [this](std::shared_ptr<InternalHttpServer::Response> response,
                          std::shared_ptr<InternalHttpServer::Request> request) {
-        pool.push([this, response, request](int id) {
+        submit(query_latency, [this, response, request] {
             std::stringstream ss;
 
-            std::string query_str, time;
+            std::string query_str, time, timeout, stats_param;
             auto query_fields = request->parse_query_string();
             for (auto& field : query_fields) {
                 if (field.first == "query") {
                     query_str = field.second;
                 } else if (field.first == "time") {
                     time = field.second;
+                } else if (field.first == "timeout") {
+                    timeout = field.second;
+                } else if (field.first == "stats") {
+                    stats_param = field.second;
                 }
             }
 
+            auto began = QueryStats::Clock::now();
+            QueryLogEntry entry("/api/v1/query", query_str);
+            std::shared_ptr<const QueryPlan> plan;
+            QueryStats stats;
+            ActiveQuery* active = nullptr;
+            uint64_t watch = 0;
             try {
                 SystemTime qt = std::chrono::system_clock::now();
                 if (time.length()) {
@@ -112,11 +182,19 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
                         std::chrono::milliseconds((uint64_t)(time_ts * 1000)));
                 }
 
-                auto value = this->query(query_str, qt, qt, Duration{1});
+                entry.start = entry.end = qt;
+
+                auto token = this->start_query(active, watch, query_str,
+                                               *request,
+                                               this->parse_timeout(timeout));
+                plan = this->plan_query(query_str, active, stats);
+                auto value = this->instant_query(query_str, plan, qt, token,
+                                                 active, stats);
+                if (active) active->set_phase(QueryPhase::RENDERING);
 
                 ss << "{\"status\": \"success\", \"data\": {\"resultType\": \""
-                   << valtype2str(value->type())
-                   << "\", \"result\": " << value->to_json() << "}}";
+                   << valtype2str(value->type()) << "\", \"result\": "
+                   << encode_result(*value, stats, stats_param) << "}}";
                 auto resp = ss.str();
 
                 *response << "HTTP/1.1 200 OK\r\nContent-Length: "
@@ -124,6 +202,7 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
                           << "\r\nContent-Type: application/json\r\n\r\n"
                           << resp;
             } catch (const std::runtime_error& e) {
+                entry.error = e.what();
                 ss << "{\"status\": \"error\", \"message\": \"" << e.what()
                    << "\"}";
                 auto resp = ss.str();
@@ -131,6 +210,9 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
                           << resp.length() << "\r\n\r\n"
                           << resp;
             }
+
+            this->finish_query(active, watch);
+            if (plan) this->log_query(std::move(entry), *plan, stats, began);
         });
     };
 
@@ -138,10 +220,10 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
         ["^/api/v1/query_range$"]
         ["GET"] = [this](std::shared_ptr<InternalHttpServer::Response> response,
                          std::shared_ptr<InternalHttpServer::Request> request) {
-        pool.push([this, request, response](int id) {
+        submit(query_range_latency, [this, request, response] {
             std::stringstream ss;
 
-            std::string query_str, start, end, step;
+            std::string query_str, start, end, step, timeout, stats_param;
             auto query_fields = request->parse_query_string();
             for (auto& field : query_fields) {
                 if (field.first == "query") {
@@ -152,9 +234,19 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
                     end = field.second;
                 } else if (field.first == "step") {
                     step = field.second;
+                } else if (field.first == "timeout") {
+                    timeout = field.second;
+                } else if (field.first == "stats") {
+                    stats_param = field.second;
                 }
             }
 
+            auto began = QueryStats::Clock::now();
+            QueryLogEntry entry("/api/v1/query_range", query_str);
+            std::shared_ptr<const QueryPlan> plan;
+            QueryStats stats;
+            ActiveQuery* active = nullptr;
+            uint64_t watch = 0;
             try {
                 if (!start.length())
                     throw std::runtime_error("invalid parameter 'start'");
@@ -185,11 +277,21 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
                     std::chrono::milliseconds((uint64_t)(start_ts * 1000)));
                 SystemTime end_tp(
                     std::chrono::milliseconds((uint64_t)(end_ts * 1000)));
-                auto value = this->query(query_str, start_tp, end_tp, step_dur);
+                entry.start = start_tp;
+                entry.end = end_tp;
+                entry.step = step_dur;
+
+                auto token = this->start_query(active, watch, query_str,
+                                               *request,
+                                               this->parse_timeout(timeout));
+                plan = this->plan_query(query_str, active, stats);
+                auto value = this->query(query_str, plan, start_tp, end_tp,
+                                         step_dur, token, active, stats);
+                if (active) active->set_phase(QueryPhase::RENDERING);
 
                 ss << "{\"status\": \"success\", \"data\": {\"resultType\": \""
-                   << valtype2str(value->type())
-                   << "\", \"result\": " << value->to_json() << "}}";
+                   << valtype2str(value->type()) << "\", \"result\": "
+                   << encode_result(*value, stats, stats_param) << "}}";
                 auto resp = ss.str();
 
                 *response << "HTTP/1.1 200 OK\r\nContent-Length: "
@@ -197,6 +299,7 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
                           << "\r\nContent-Type: application/json\r\n\r\n"
                           << resp;
             } catch (const std::runtime_error& e) {
+                entry.error = e.what();
                 ss << "{\"status\": \"error\", \"message\": \"" << e.what()
                    << "\"}";
                 auto resp = ss.str();
@@ -204,6 +307,89 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
                           << resp.length() << "\r\n\r\n"
                           << resp;
             }
+
+            this->finish_query(active, watch);
+            if (plan) this->log_query(std::move(entry), *plan, stats, began);
+        });
+    };
+
+    server.resource
+        ["^/api/v1/explain$"]
+        ["GET"] = [this](std::shared_ptr<InternalHttpServer::Response> response,
+                         std::shared_ptr<InternalHttpServer::Request> request) {
+        submit(explain_latency, [this, request, response] {
+            std::stringstream ss;
+
+            std::string query_str, time, start, end, step, timeout, analyze;
+            auto query_fields = request->parse_query_string();
+            for (auto& field : query_fields) {
+                if (field.first == "query") {
+                    query_str = field.second;
+                } else if (field.first == "time") {
+                    time = field.second;
+                } else if (field.first == "start") {
+                    start = field.second;
+                } else if (field.first == "end") {
+                    end = field.second;
+                } else if (field.first == "step") {
+                    step = field.second;
+                } else if (field.first == "timeout") {
+                    timeout = field.second;
+                } else if (field.first == "analyze") {
+                    analyze = field.second;
+                }
+            }
+
+            ActiveQuery* active = nullptr;
+            uint64_t watch = 0;
+            try {
+                /* a range query if start is given, an instant query at time
+                 * or now otherwise */
+                SystemTime start_tp = std::chrono::system_clock::now();
+                SystemTime end_tp = start_tp;
+                Duration step_dur{0};
+                if (start.length()) {
+                    start_tp = parse_timestamp(start, "start");
+                    end_tp = parse_timestamp(end, "end");
+
+                    char* endp;
+                    double step_ts = ::strtod(step.c_str(), &endp);
+                    if (!step.length())
+                        throw std::runtime_error("invalid parameter 'step'");
+                    if (endp == step.c_str() + step.length()) {
+                        step_dur = std::chrono::seconds((uint64_t)step_ts);
+                    } else {
+                        step_dur = Parser::parse_duration(step);
+                    }
+                } else if (time.length()) {
+                    start_tp = end_tp = parse_timestamp(time, "time");
+                }
+
+                auto token = this->start_query(active, watch, query_str,
+                                               *request,
+                                               this->parse_timeout(timeout));
+                auto result = this->explain(
+                    query_str, start_tp, end_tp, step_dur,
+                    analyze == "true" || analyze == "1", token, active);
+
+                ss << "{\"status\": \"success\", \"data\": " << result
+                   << "}";
+                auto resp = ss.str();
+
+                *response << "HTTP/1.1 200 OK\r\nContent-Length: "
+                          << resp.length()
+                          << "\r\nContent-Type: application/json\r\n\r\n"
+                          << resp;
+            } catch (const std::runtime_error& e) {
+                ss << "{\"status\": \"error\", \"message\": \"" << e.what()
+                   << "\"}";
+                auto resp = ss.str();
+                *response << "HTTP/1.1 400 Bad Request\r\nContent-Length: "
+                          << resp.length() << "\r\n\r\n"
+                          << resp;
+            }
+
+            this->finish_query(active, watch);
         });
     };
 
@@ -232,6 +418,83 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
                       << resp;
         };
 
+    server.resource["^/api/v1/status/active_queries$"]["GET"] =
+        [this](std::shared_ptr<InternalHttpServer::Response> response,
+               std::shared_ptr<InternalHttpServer::Request> request) {
+            std::stringstream ss;
+
+            ss << "{\"status\": \"success\", \"data\": {\"active\": "
+               << queries_to_json(queries.get_active_queries())
+               << ", \"crashed\": "
+               << queries_to_json(queries.get_crashed_queries()) << "}}";
+
+            auto resp = ss.str();
+
+            *response << "HTTP/1.1 200 OK\r\nContent-Length: " << resp.length()
+                      << "\r\nContent-Type: application/json\r\n\r\n"
+                      << resp;
+        };
+
+    server.resource["^/api/v1/status/active_queries/([0-9]+)$"]["DELETE"] =
+        [this](std::shared_ptr<InternalHttpServer::Response> response,
+               std::shared_ptr<InternalHttpServer::Request> request) {
+            uint64_t id = std::stoull(request->path_match[1]);
+
+            if (queries.kill(id)) {
+                std::string resp = "{\"status\": \"success\"}";
+                *response << "HTTP/1.1 200 OK\r\nContent-Length: "
+                          << resp.length()
+                          << "\r\nContent-Type: application/json\r\n\r\n"
+                          << resp;
+            } else {
+                std::string resp = "{\"status\": \"error\", \"message\": "
+                                   "\"query not found\"}";
+                *response << "HTTP/1.1 404 Not Found\r\nContent-Length: "
+                          << resp.length() << "\r\n\r\n"
+                          << resp;
+            }
+        };
+
+    server.resource["^/api/v1/status/query_fingerprints$"]["GET"] =
+        [this](std::shared_ptr<InternalHttpServer::Response> response,
+               std::shared_ptr<InternalHttpServer::Request> request) {
+            std::stringstream ss;
+
+            size_t limit = 100;
+            auto query_fields = request->parse_query_string();
+            for (auto& field : query_fields) {
+                if (field.first == "limit") {
+                    limit = ::strtoull(field.second.c_str(), nullptr, 10);
+                }
+            }
+
+            ss << "{\"status\": \"success\", \"data\": {\"fingerprints\": [";
+            bool first = true;
+            for (auto&& fp : query_log->get_fingerprints(limit)) {
+                if (!first) ss << ", ";
+                ss << fp.to_json();
+                first = false;
+            }
+            ss << "], \"logged\": " << query_log->get_logged()
+               << ", \"dropped\": " << query_log->get_dropped() << "}}";
+
+            auto resp = ss.str();
+
+            *response << "HTTP/1.1 200 OK\r\nContent-Length: " << resp.length()
+                      << "\r\nContent-Type: application/json\r\n\r\n"
+                      << resp;
+        };
+
+    server.resource["^/metrics$"]["GET"] =
+        [this](std::shared_ptr<InternalHttpServer::Response> response,
+               std::shared_ptr<InternalHttpServer::Request> request) {
+            auto resp = metrics.render();
+
+            *response << "HTTP/1.1 200 OK\r\nContent-Length: " << resp.length()
+                      << "\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n"
+                      << resp;
+        };
+
     server.resource["^/static/(.+)$"]["GET"] =
         [this](std::shared_ptr<InternalHttpServer::Response> response,
                std::shared_ptr<InternalHttpServer::Request> request) {
@@ -251,6 +514,107 @@ HttpServer::HttpServer(Storage* storage, int num_workers)
 
 void HttpServer::start() { server.start(); }
 
+void HttpServer::stop() { server.stop(); }
+
+void HttpServer::register_metrics()
+{
+    const double us = 1e-6;
+
+    auto request_latency = [&](const std::string& endpoint) {
+        return &metrics.histogram("promql_http_request_duration_seconds",
+                                  "Latency of the HTTP requests.",
+                                  {{"endpoint", endpoint}}, us);
+    };
+    insert_latency = request_latency("/insert");
+    query_latency = request_latency("/api/v1/query");
+    query_range_latency = request_latency("/api/v1/query_range");
+    explain_latency = request_latency("/api/v1/explain");
+
+    parse_duration = &metrics.histogram("promql_query_parse_duration_seconds",
+                                        "Time spent parsing queries.", {}, us);
+    samples_read =
+        &metrics.counter("promql_query_samples_read_total",
+                         "Samples read from the storage by the queries.");
+    ingested_samples = &metrics.counter("promql_ingested_samples_total",
+                                        "Samples inserted through /insert.");
+    slow_queries =
+        &metrics.counter("promql_slow_queries_total",
+                         "Queries running for longer than the slow query "
+                         "log threshold.");
+
+    pool_wait_duration = &metrics.histogram(
+        "promql_worker_pool_wait_duration_seconds",
+        "Time the requests waited for a worker.", {}, us);
+    metrics.gauge("promql_worker_pool_queue_depth",
+                  "Requests waiting for a worker.", {},
+                  [this] { return (double)pool_queued.load(); });
+    metrics.gauge("promql_worker_pool_idle_workers", "Idle workers.", {},
+                  [this] { return (double)pool.n_idle(); });
+    metrics.gauge("promql_active_queries", "Queries being executed.", {},
+                  [this] {
+                      return (double)queries.get_active_queries().size();
+                  });
+
+    auto storage_gauge = [&](const std::string& name, const std::string& help,
+                             size_t StorageStats::*field) {
+        metrics.gauge(name, help, {}, [this, field] {
+            StorageStats stats;
+            if (!storage->get_stats(stats)) return std::nan("");
+            return (double)(stats.*field);
+        });
+    };
+    storage_gauge("promql_storage_series", "Series in the storage.",
+                  &StorageStats::series);
+    storage_gauge("promql_storage_chunks", "Chunks in the storage.",
+                  &StorageStats::chunks);
+    storage_gauge("promql_storage_samples", "Samples in the storage.",
+                  &StorageStats::samples);
+
+    auto memory_gauge = [&](const std::string& subsystem,
+                            MetricRegistry::GaugeFunc func) {
+        metrics.gauge("promql_memory_bytes",
+                      "Memory held by each subsystem, estimated.",
+                      {{"subsystem", subsystem}}, std::move(func));
+    };
+    memory_gauge("queries",
+                 [] { return (double)MemoryTracker::get_global_bytes(); });
+    memory_gauge("results_cache", [this] {
+        return results_cache ? (double)results_cache->get_bytes() : 0;
+    });
+    memory_gauge("symbols", [] {
+        return (double)SymbolTable::global().get_bytes();
+    });
+    memory_gauge("storage", [this] {
+        StorageStats stats;
+        if (!storage->get_stats(stats)) return std::nan("");
+        return (double)stats.bytes;
+    });
+
+    metrics.gauge("promql_symbols", "Interned label names and values.", {},
+                  [] { return (double)SymbolTable::global().size(); });
+    metrics.gauge("promql_plan_cache_entries", "Plans in the plan cache.", {},
+                  [this] { return (double)plan_cache.size(); });
+}
+
+void HttpServer::submit(Histogram* latency, std::function<void()> task)
+{
+    auto queued = std::chrono::steady_clock::now();
+    auto elapsed_us = [queued] {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - queued)
+            .count();
+    };
+
+    pool_queued++;
+    pool.push([this, latency, task = std::move(task), elapsed_us](int id) {
+        pool_queued--;
+        pool_wait_duration->record(elapsed_us());
+
+        task();
+        latency->record(elapsed_us());
+    });
+}
+
 std::string HttpServer::render_template(const std::string& name)
 {
     std::string content = get_file("templates/" + name + ".html");
@@ -279,17 +643,289 @@ std::string HttpServer::get_file(const std::string& filename)
     return "";
 }
 
-std::unique_ptr<ExecValue> HttpServer::query(const std::string& query_str,
-                                             SystemTime start, SystemTime end,
-                                             Duration interval)
+std::shared_ptr<CancellationToken>
+HttpServer::start_query(ActiveQuery*& active, uint64_t& watch,
+                        const std::string& query_str,
+                        const InternalHttpServer::Request& request,
+                        Duration timeout)
+{
+    auto token = std::make_shared<CancellationToken>();
+    token->set_timeout(timeout);
+    active = queries.insert(query_str, token, &request);
+
+    /* the connection stays open until the response is sent, after
+     * finish_query() */
+    auto local = request.local_endpoint(), remote = request.remote_endpoint();
+    watch = connections.watch(local.data(), remote.data(), token);
+
+    return token;
+}
+
+void HttpServer::finish_query(ActiveQuery* active, uint64_t watch)
+{
+    if (watch) connections.unwatch(watch);
+    queries.remove(active);
+}
+
+Duration HttpServer::parse_timeout(const std::string& timeout) const
 {
-    Parser parser(query_str);
-    auto root = parser.parse();
+    if (!timeout.length()) return query_timeout;
+
+    char* endp;
+    double timeout_ts = ::strtod(timeout.c_str(), &endp);
+    if (endp != timeout.c_str() + timeout.length()) {
+        auto timeout_dur = Parser::parse_duration(timeout);
+        if (timeout_dur.count() <= 0)
+            throw std::runtime_error("invalid parameter 'timeout'");
+        return std::min(timeout_dur, query_timeout);
+    }
+
+    /* seconds, rounded to milliseconds. Clamped before the conversion as
+     * larger values would overflow it. */
+    if (!std::isfinite(timeout_ts) || timeout_ts <= 0)
+        throw std::runtime_error("invalid parameter 'timeout'");
+    if (timeout_ts >= query_timeout.count() / 1000.0) return query_timeout;
+
+    return std::max(Duration(std::llround(timeout_ts * 1000)), Duration(1));
+}
+
+std::shared_ptr<const QueryPlan>
+HttpServer::plan_query(const std::string& query_str, ActiveQuery* active,
+                       QueryStats& stats)
+{
+    return plan_cache.get(PlanCache::normalize(query_str), [&] {
+        std::shared_ptr<QueryText> text; /* declared first to outlive root */
+        PASTNode root;
+        {
+            StatsTimer timer(stats.parse_time);
+            Parser parser(query_str);
+            root = parser.parse();
+            text = parser.get_text();
+        }
+        parse_duration->record(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                stats.parse_time)
+                .count());
+
+        if (active) active->set_phase(QueryPhase::PLANNING);
+        StatsTimer timer(stats.plan_time);
+        Planner planner;
+        return planner.plan(std::move(root), std::move(text));
+    });
+}
+
+void HttpServer::log_query(QueryLogEntry&& entry, const QueryPlan& plan,
+                           const QueryStats& stats,
+                           QueryStats::Clock::time_point began)
+{
+    entry.fingerprint = plan.fingerprint;
+    entry.elapsed = QueryStats::Clock::now() - began;
+    entry.stats = stats;
 
-    Executor executor(storage, root.get(), start, end, interval);
-    auto value = executor.execute();
+    if (query_log->record(std::move(entry))) slow_queries->add();
+}
+
+std::string HttpServer::encode_result(const ExecValue& value,
+                                      QueryStats& stats,
+                                      const std::string& stats_param)
+{
+    std::string result;
+    {
+        StatsTimer timer(stats.encode_time);
+        result = value.to_json();
+    }
+
+    if (stats_param == "all") {
+        result += ", \"stats\": " + stats.to_json();
+    }
+
+    return result;
+}
+
+std::string HttpServer::explain(const std::string& query_str,
+                                SystemTime start, SystemTime end,
+                                Duration interval, bool analyze,
+                                std::shared_ptr<CancellationToken> token,
+                                ActiveQuery* active)
+{
+    QueryStats stats;
+    auto plan = plan_query(query_str, active, stats);
+
+    if (!analyze) {
+        return "{\"plan\": " + PlanExplainer(plan.get()).explain() + "}";
+    }
+
+    /* run the query node by node and annotate the plan with the costs */
+    if (active) active->set_phase(QueryPhase::EXECUTING);
+    QueryProfile profile;
+    if (interval.count()) {
+        Executor executor(storage, plan.get(), start, end, interval);
+        executor.set_limits(limits);
+        executor.set_cancellation_token(std::move(token));
+        executor.set_active_query(active);
+        executor.set_profile(&profile);
+        executor.execute();
+        stats += executor.get_stats();
+        samples_read->add(executor.get_stats().samples);
+    } else {
+        InstantExecutor executor(storage, plan.get(), start);
+        executor.set_limits(limits);
+        executor.set_cancellation_token(std::move(token));
+        executor.set_active_query(active);
+        executor.set_profile(&profile);
+        executor.execute();
+        stats += executor.get_stats();
+        samples_read->add(executor.get_stats().samples);
+    }
+
+    return "{\"plan\": " + PlanExplainer(plan.get(), &profile).explain() +
+           ", \"stats\": " + stats.to_json() + "}";
+}
+
+std::shared_ptr<const ExecValue>
+HttpServer::query(const std::string& query_str,
+                  std::shared_ptr<const QueryPlan> plan, SystemTime start,
+                  SystemTime end, Duration interval,
+                  std::shared_ptr<CancellationToken> token,
+                  ActiveQuery* active, QueryStats& stats)
+{
+    QuerySharder sharder(&pool, query_shards);
+    bool sharded = sharder.prepare(
+        plan.get(),
+        [&] {
+            Parser parser(query_str);
+            return Planner().plan(parser.parse(), parser.get_text());
+        },
+        &plan_cache);
+
+    if (active) active->set_phase(QueryPhase::EXECUTING);
+    const auto& key = plan->key;
+    auto to_ms = [](SystemTime tp) {
+        return (uint64_t)std::chrono::duration_cast<Duration>(
+                   tp.time_since_epoch())
+            .count();
+    };
+
+    /* token is the one of the coalesced query, see QueryCoalescer */
+    auto evaluate = [&](std::shared_ptr<CancellationToken> token,
+                        QueryStats& stats) -> std::unique_ptr<ExecValue> {
+        std::mutex stats_mutex;
+        /* the sub-ranges and shards of the query share its limits */
+        QueryBudget budget(limits);
+        auto run = [&](SystemTime start, SystemTime end) {
+            auto eval = [&](const QueryPlan* plan, Queryable* queryable) {
+                Executor executor(queryable, plan, start, end, interval);
+                executor.set_budget(&budget);
+                executor.set_cancellation_token(token);
+                executor.set_active_query(active);
+                auto value = executor.execute();
+                samples_read->add(executor.get_stats().samples);
+
+                std::lock_guard<std::mutex> guard(stats_mutex);
+                stats += executor.get_stats();
+                return value;
+            };
+
+            if (sharded) return sharder.query(storage, eval);
+            return eval(plan.get(), storage);
+        };
+
+        if (!plan->is_splittable(to_ms(start), to_ms(end),
+                                 interval.count())) {
+            return run(start, end);
+        }
+
+        auto run_range = [&](uint64_t from, uint64_t to) {
+            auto value =
+                run(SystemTime{Duration{from}}, SystemTime{Duration{to}});
+            return std::unique_ptr<MatrixValue>(
+                static_cast<MatrixValue*>(value.release()));
+        };
+
+        /* the extents missing from the cache are split in turn */
+        QuerySplitter::QueryFunc func = run_range;
+        if (split_interval.count()) {
+            func = [&](uint64_t from, uint64_t to) {
+                return QuerySplitter(&pool, split_interval)
+                    .query(from, to, interval.count(), run_range);
+            };
+        }
+
+        if (!results_cache) return func(to_ms(start), to_ms(end));
+
+        return results_cache->query(
+            key, to_ms(start), to_ms(end), interval.count(),
+            to_ms(std::chrono::system_clock::now()), func);
+    };
+
+    auto result = coalescer.run(
+        "range|" + key + "|" + std::to_string(to_ms(start)) + "|" +
+            std::to_string(to_ms(end)) + "|" +
+            std::to_string(interval.count()),
+        [&](std::shared_ptr<CancellationToken> flight_token) {
+            QueryResult result;
+            result.value = evaluate(std::move(flight_token), result.stats);
+            return result;
+        },
+        token);
+    /* the cost of a shared query is accounted to the request running it */
+    if (!result.shared) stats += result.stats;
+
+    return result.value;
+}
+
+std::shared_ptr<const ExecValue>
+HttpServer::instant_query(const std::string& query_str,
+                          std::shared_ptr<const QueryPlan> plan,
+                          SystemTime time,
+                          std::shared_ptr<CancellationToken> token,
+                          ActiveQuery* active, QueryStats& stats)
+{
+    QuerySharder sharder(&pool, query_shards);
+    bool sharded = sharder.prepare(
+        plan.get(),
+        [&] {
+            Parser parser(query_str);
+            return Planner().plan(parser.parse(), parser.get_text());
+        },
+        &plan_cache);
+
+    if (active) active->set_phase(QueryPhase::EXECUTING);
+    auto evaluate = [&](std::shared_ptr<CancellationToken> token,
+                        QueryStats& stats) {
+        std::mutex stats_mutex;
+        /* the shards of the query share its limits */
+        QueryBudget budget(limits);
+        auto eval = [&](const QueryPlan* plan, Queryable* queryable) {
+            InstantExecutor executor(queryable, plan, time);
+            executor.set_budget(&budget);
+            executor.set_cancellation_token(token);
+            executor.set_active_query(active);
+            auto value = executor.execute();
+            samples_read->add(executor.get_stats().samples);
+
+            std::lock_guard<std::mutex> guard(stats_mutex);
+            stats += executor.get_stats();
+            return value;
+        };
+
+        if (sharded) return sharder.query(storage, eval);
+        return eval(plan.get(), storage);
+    };
 
-    return value;
+    auto ts = std::chrono::duration_cast<Duration>(time.time_since_epoch());
+    auto result = coalescer.run(
+        "instant|" + plan->key + "|" +
+            std::to_string(ts.count()),
+        [&](std::shared_ptr<CancellationToken> flight_token) {
+            QueryResult result;
+            result.value = evaluate(std::move(flight_token), result.stats);
+            return result;
+        },
+        token);
+    if (!result.shared) stats += result.stats;
+
+    return result.value;
 }
 
 } // namespace promql
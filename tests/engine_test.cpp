@@ -0,0 +1,65 @@
+#include "engine.h"
+#include "memory_storage.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace promql;
+
+static const uint64_t MINUTE = 60 * 1000;
+
+TEST(EngineTest, ExecutePreparedQuery)
+{
+    MemoryStorage storage;
+    auto app = storage.appender();
+    for (uint64_t t = 0; t <= 60 * MINUTE; t += 15 * 1000) {
+        app->add({{METRIC_NAME, "x"}, {"job", "a"}}, t, t / 1000.0);
+        app->add({{METRIC_NAME, "x"}, {"job", "b"}}, t, t / 500.0);
+    }
+    app->commit();
+
+    Engine engine(&storage);
+    auto query = engine.prepare("sum(rate(x[5m]))");
+    /* the plan is shared by the queries prepared from the same string */
+    EXPECT_EQ(query->get_plan(),
+              engine.prepare(" sum(rate(x[5m]))\n")->get_plan());
+    EXPECT_EQ(1, engine.get_plan_cache().get_hits());
+
+    auto time = [](uint64_t t) {
+        return SystemTime{std::chrono::milliseconds(t)};
+    };
+
+    /* executed concurrently over different time ranges */
+    std::vector<std::string> results(4);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < results.size(); i++) {
+        threads.emplace_back([&, i] {
+            results[i] = query
+                             ->exec_range(time((10 + i) * MINUTE),
+                                          time((20 + i) * MINUTE),
+                                          std::chrono::minutes(1))
+                             ->to_json();
+        });
+    }
+    for (auto&& t : threads) {
+        t.join();
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        Engine fresh(&storage);
+        EXPECT_EQ(fresh.prepare("sum(rate(x[5m]))")
+                      ->exec_range(time((10 + i) * MINUTE),
+                                   time((20 + i) * MINUTE),
+                                   std::chrono::minutes(1))
+                      ->to_json(),
+                  results[i]);
+    }
+
+    auto value = query->exec(time(30 * MINUTE));
+    ASSERT_EQ(ValueType::VECTOR, value->type());
+    EXPECT_EQ(1, value->num_samples());
+    EXPECT_DOUBLE_EQ(3, static_cast<VectorValue*>(value.get())
+                            ->get_samples()[0]
+                            .value.get_value());
+}
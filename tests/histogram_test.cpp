@@ -0,0 +1,70 @@
+#include "histogram.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace promql;
+
+TEST(HistogramTest, BucketsCoverAllValues)
+{
+    EXPECT_EQ(0, Histogram::bucket_index(0));
+    EXPECT_EQ(Histogram::NUM_BUCKETS - 1,
+              Histogram::bucket_index(UINT64_MAX));
+
+    /* the buckets are contiguous and their width is within the precision */
+    for (size_t i = 1; i < Histogram::NUM_BUCKETS; i++) {
+        auto lower = Histogram::bucket_lower_bound(i);
+        auto upper = Histogram::bucket_upper_bound(i);
+        ASSERT_EQ(Histogram::bucket_upper_bound(i - 1) + 1, lower);
+        ASSERT_EQ(i, Histogram::bucket_index(lower));
+        ASSERT_EQ(i, Histogram::bucket_index(upper));
+        ASSERT_LE((double)(upper - lower) / lower,
+                  2.0 / Histogram::SUB_BUCKETS);
+    }
+}
+
+TEST(HistogramTest, Quantiles)
+{
+    const double precision = 2.0 / Histogram::SUB_BUCKETS;
+    Histogram hist;
+    EXPECT_EQ(0, hist.quantile(0.5));
+
+    for (uint64_t v = 1; v <= 100000; v++) {
+        hist.record(v);
+    }
+
+    EXPECT_EQ(100000, hist.get_count());
+    EXPECT_EQ(100000, hist.get_max());
+    EXPECT_DOUBLE_EQ(50000.5, hist.get_mean());
+    EXPECT_NEAR(50000, hist.quantile(0.5), 50000 * precision);
+    EXPECT_NEAR(99000, hist.quantile(0.99), 99000 * precision);
+    EXPECT_EQ(1, hist.quantile(0));
+    EXPECT_EQ(100000, hist.quantile(1));
+}
+
+TEST(HistogramTest, RecordConcurrently)
+{
+    Histogram hist, merged;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&hist] {
+            for (uint64_t v = 0; v < 10000; v++) {
+                hist.record(v);
+            }
+        });
+    }
+    for (auto&& t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(40000, hist.get_count());
+    EXPECT_EQ(9999, hist.get_max());
+
+    merged.record(20000);
+    merged.merge(hist);
+    EXPECT_EQ(40001, merged.get_count());
+    EXPECT_EQ(20000, merged.get_max());
+    EXPECT_EQ(4 * 49995000 + 20000, merged.get_sum());
+}
@@ -0,0 +1,85 @@
+#include "labels.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+
+using namespace promql;
+
+TEST(LabelsTest, InternSymbols)
+{
+    auto& table = SymbolTable::global();
+    auto id = table.intern("job");
+
+    EXPECT_EQ(id, table.intern(std::string("job")));
+    EXPECT_NE(id, table.intern("instance"));
+    EXPECT_EQ("job", table.lookup(id));
+}
+
+TEST(LabelsTest, InternFromManyThreads)
+{
+    SymbolTable table;
+    std::vector<std::vector<uint32_t>> ids(4);
+    std::vector<std::thread> threads;
+
+    /* the threads intern the same strings in different orders */
+    for (size_t t = 0; t < ids.size(); t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 1000; i++) {
+                int n = (t % 2) ? 999 - i : i;
+                ids[t].push_back(table.intern("s" + std::to_string(n)));
+            }
+            if (t % 2) std::reverse(ids[t].begin(), ids[t].end());
+        });
+    }
+    for (auto&& t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(1000, table.size());
+    EXPECT_LT(0, table.get_bytes());
+    for (size_t t = 1; t < ids.size(); t++) {
+        EXPECT_EQ(ids[0], ids[t]);
+    }
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ("s" + std::to_string(i), table.lookup(ids[0][i]));
+    }
+}
+
+TEST(LabelsTest, LabelSetIsSortedByName)
+{
+    LabelSet lset{{"job", "a"}, {METRIC_NAME, "x"}, {"instance", "1"}};
+
+    EXPECT_EQ(3, lset.size());
+    EXPECT_EQ("__name__:x|instance:1|job:a|", lset2str(lset));
+    EXPECT_EQ("a", lset.get("job"));
+    EXPECT_EQ("", lset.get("env"));
+}
+
+TEST(LabelsTest, CompareLabelSets)
+{
+    LabelSet lhs{{"job", "a"}, {"instance", "1"}};
+    LabelSet rhs{{"instance", "1"}, {"job", "a"}};
+    LabelSet other{{"instance", "2"}, {"job", "a"}};
+
+    EXPECT_EQ(lhs, rhs);
+    EXPECT_EQ(lhs.hash(), rhs.hash());
+    EXPECT_NE(lhs, other);
+    EXPECT_EQ(LabelSet(), LabelSet(std::vector<Label>{}));
+
+    auto copy = lhs;
+    EXPECT_EQ(lhs.symbols(), copy.symbols());
+}
+
+TEST(LabelsTest, GroupLabels)
+{
+    LabelSet lset{{METRIC_NAME, "x"}, {"job", "a"}, {"instance", "1"}};
+    auto names = SymbolTable::global().intern(
+        std::vector<std::string>{"instance", "env"});
+
+    EXPECT_EQ(LabelSet({{"instance", "1"}}), lset.grouping(names, false));
+    EXPECT_EQ(LabelSet({{"job", "a"}}), lset.grouping(names, true));
+    EXPECT_EQ(LabelSet({{"job", "a"}, {"instance", "1"}}),
+              lset.drop_metric_name());
+}
@@ -0,0 +1,76 @@
+#include "metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace promql;
+
+TEST(MetricsTest, CountFromManyThreads)
+{
+    Counter counter;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < 8; i++) {
+        threads.emplace_back([&counter] {
+            for (int j = 0; j < 10000; j++) {
+                counter.add();
+            }
+        });
+    }
+    for (auto&& t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(80000, counter.get_value());
+}
+
+TEST(MetricsTest, RenderTextFormat)
+{
+    MetricRegistry registry;
+    auto& requests = registry.counter("requests_total", "Requests.",
+                                      {{"endpoint", "/query"}});
+    registry.gauge("queue_depth", "Queue depth.", {}, [] { return 3.0; });
+    auto& latency = registry.histogram("latency_seconds", "Latency.", {},
+                                       1e-6);
+
+    requests.add(2);
+    latency.record(2000);    /* 2ms */
+    latency.record(2000000); /* 2s */
+
+    EXPECT_EQ("# HELP requests_total Requests.\n"
+              "# TYPE requests_total counter\n"
+              "requests_total{endpoint=\"/query\"} 2\n"
+              "# HELP queue_depth Queue depth.\n"
+              "# TYPE queue_depth gauge\n"
+              "queue_depth 3\n"
+              "# HELP latency_seconds Latency.\n"
+              "# TYPE latency_seconds histogram\n"
+              "latency_seconds_bucket{le=\"0.001\"} 0\n"
+              "latency_seconds_bucket{le=\"0.0025\"} 1\n"
+              "latency_seconds_bucket{le=\"0.005\"} 1\n"
+              "latency_seconds_bucket{le=\"0.01\"} 1\n"
+              "latency_seconds_bucket{le=\"0.025\"} 1\n"
+              "latency_seconds_bucket{le=\"0.05\"} 1\n"
+              "latency_seconds_bucket{le=\"0.1\"} 1\n"
+              "latency_seconds_bucket{le=\"0.25\"} 1\n"
+              "latency_seconds_bucket{le=\"0.5\"} 1\n"
+              "latency_seconds_bucket{le=\"1\"} 1\n"
+              "latency_seconds_bucket{le=\"2.5\"} 2\n"
+              "latency_seconds_bucket{le=\"5\"} 2\n"
+              "latency_seconds_bucket{le=\"10\"} 2\n"
+              "latency_seconds_bucket{le=\"30\"} 2\n"
+              "latency_seconds_bucket{le=\"+Inf\"} 2\n"
+              "latency_seconds_sum 2.002\n"
+              "latency_seconds_count 2\n",
+              registry.render());
+}
+
+TEST(MetricsTest, RejectTypeMismatch)
+{
+    MetricRegistry registry;
+    registry.counter("x", "X.");
+
+    EXPECT_THROW(registry.gauge("x", "X.", {}, [] { return 0.0; }),
+                 std::runtime_error);
+}
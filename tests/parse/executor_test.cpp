@@ -0,0 +1,621 @@
+#include "memory_storage.h"
+#include "parse/executor.h"
+#include "parse/instant_executor.h"
+#include "parse/operators.h"
+#include "parse/parser.h"
+#include "parse/planner.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+
+using namespace promql;
+
+static const uint64_t SCRAPE_INTERVAL = 15 * 1000;
+
+static void populate(Storage& storage)
+{
+    auto app = storage.appender();
+
+    for (uint64_t t = 0; t <= 30 * 60 * 1000; t += SCRAPE_INTERVAL) {
+        double i = t / SCRAPE_INTERVAL;
+        app->add({{METRIC_NAME, "x"}, {"job", "a"}, {"instance", "1"}}, t, i);
+        app->add({{METRIC_NAME, "x"}, {"job", "a"}, {"instance", "2"}}, t,
+                 2 * i);
+        app->add({{METRIC_NAME, "x"}, {"job", "b"}, {"instance", "1"}}, t,
+                 3 * i + 1);
+    }
+
+    app->commit();
+}
+
+static std::map<std::string, std::vector<std::pair<uint64_t, double>>>
+run_query(Storage& storage, const std::string& query, uint64_t start,
+          uint64_t end, uint64_t step, bool planned = true,
+          bool streaming = true)
+{
+    std::map<std::string, std::vector<std::pair<uint64_t, double>>> result;
+
+    SystemTime start_tp{std::chrono::milliseconds(start)};
+    SystemTime end_tp{std::chrono::milliseconds(end)};
+    Parser parser(query);
+    auto root = parser.parse();
+    std::unique_ptr<QueryPlan> plan;
+    std::unique_ptr<Executor> executor;
+
+    if (planned) {
+        Planner planner;
+        plan = planner.plan(std::move(root), parser.get_text());
+        executor = std::make_unique<Executor>(&storage, plan.get(), start_tp,
+                                              end_tp, Duration{step});
+    } else {
+        executor = std::make_unique<Executor>(&storage, root.get(), start_tp,
+                                              end_tp, Duration{step});
+    }
+    executor->set_streaming(streaming);
+    auto value = executor->execute();
+
+    if (auto* scalar = dynamic_cast<ScalarValue*>(value.get())) {
+        result[lset2str({})].emplace_back(scalar->get_time(),
+                                          scalar->get_value());
+        return result;
+    }
+
+    auto* mat = dynamic_cast<MatrixValue*>(value.get());
+    if (!mat) return result;
+
+    for (auto&& s : mat->get_series()) {
+        auto& values = result[lset2str(s.metric)];
+        for (auto&& v : s.values) {
+            values.emplace_back(v.get_time(), v.get_value());
+        }
+    }
+
+    return result;
+}
+
+TEST(ExecutorTest, AggregationPushDownMatchesGenericPath)
+{
+    MemoryStorage generic(false), pushdown(true);
+    populate(generic);
+    populate(pushdown);
+
+    for (auto&& query : {"sum by (job) (rate(x[5m]))", "max(x)",
+                         "avg without (instance) (increase(x[2m]))",
+                         "count(rate(x{job=\"a\"}[5m]))"}) {
+        auto expected =
+            run_query(generic, query, 10 * 60 * 1000, 20 * 60 * 1000, 60000);
+        auto actual =
+            run_query(pushdown, query, 10 * 60 * 1000, 20 * 60 * 1000, 60000);
+
+        ASSERT_FALSE(expected.empty()) << query;
+        ASSERT_EQ(expected.size(), actual.size()) << query;
+        for (auto&& p : expected) {
+            auto it = actual.find(p.first);
+            ASSERT_NE(it, actual.end()) << query;
+            ASSERT_EQ(p.second.size(), it->second.size()) << query;
+
+            for (size_t i = 0; i < p.second.size(); i++) {
+                EXPECT_EQ(p.second[i].first, it->second[i].first) << query;
+                EXPECT_DOUBLE_EQ(p.second[i].second, it->second[i].second)
+                    << query;
+            }
+        }
+    }
+}
+
+TEST(ExecutorTest, PlannedQueryMatchesUnplanned)
+{
+    MemoryStorage storage;
+    populate(storage);
+
+    for (auto&& query :
+         {"sum(x) / sum(x)", "-x", "-(-x)", "x offset 1m * (2 * 60)",
+          "sum by (job) (rate(x[5m])) / sum by (job) (rate(x[10m]))",
+          "x > bool 1 + 2", "x{job=\"a\"} - x",
+          "sum(rate(x[5m])) / (sum(rate(x[5m])) + sum(rate(x[1m])))",
+          "sum(x @ 300)", "rate(x[5m] @ end()) - rate(x[5m])",
+          "max_over_time(rate(x[5m])[30m:1m] offset 2m)",
+          "sum_over_time(x[5m:30s] @ 900)"}) {
+        auto expected = run_query(storage, query, 10 * 60 * 1000,
+                                  20 * 60 * 1000, 60000, false);
+        auto actual = run_query(storage, query, 10 * 60 * 1000,
+                                20 * 60 * 1000, 60000, true);
+
+        ASSERT_FALSE(expected.empty()) << query;
+        EXPECT_EQ(expected, actual) << query;
+    }
+}
+
+TEST(ExecutorTest, AtModifierIsConstantAcrossSteps)
+{
+    MemoryStorage storage;
+    populate(storage);
+
+    auto result =
+        run_query(storage, "x @ 300", 10 * 60 * 1000, 20 * 60 * 1000, 60000);
+
+    ASSERT_EQ(3, result.size());
+    for (auto&& p : result) {
+        ASSERT_EQ(11, p.second.size());
+        for (auto&& v : p.second) {
+            EXPECT_EQ(p.second.front().second, v.second);
+        }
+    }
+
+    auto& values = result[lset2str(
+        {{METRIC_NAME, "x"}, {"instance", "1"}, {"job", "a"}})];
+    ASSERT_FALSE(values.empty());
+    EXPECT_EQ(20, values.front().second);
+}
+
+TEST(ExecutorTest, ArithmeticDropsMetricName)
+{
+    MemoryStorage storage;
+    populate(storage);
+    uint64_t ts = 15 * 60 * 1000;
+
+    for (auto&& query : {"-x", "-(-x)", "x * 2", "2 - x", "x > bool 10"}) {
+        for (bool planned : {false, true}) {
+            for (bool streaming : {false, true}) {
+                auto result = run_query(storage, query, ts, ts + 60000,
+                                        60000, planned, streaming);
+                ASSERT_EQ(3, result.size()) << query;
+                EXPECT_EQ(1, result.count(lset2str(
+                                 {{"instance", "1"}, {"job", "a"}})))
+                    << query << " " << planned << " " << streaming;
+            }
+        }
+
+        Parser parser(query);
+        Planner planner;
+        auto plan = planner.plan(parser.parse(), parser.get_text());
+        InstantExecutor executor(&storage, plan.get(),
+                                 SystemTime{std::chrono::milliseconds(ts)});
+        auto value = executor.execute();
+        auto* vec = dynamic_cast<VectorValue*>(value.get());
+        ASSERT_NE(nullptr, vec) << query;
+        EXPECT_EQ(3, vec->get_samples().size()) << query;
+        for (auto&& s : vec->get_samples()) {
+            EXPECT_EQ("", s.metric.get(METRIC_NAME)) << query;
+        }
+    }
+
+    /* filtering comparisons keep the series as they are */
+    auto result = run_query(storage, "x > 10", ts, ts, 1);
+    EXPECT_EQ(1, result.count(lset2str(
+                     {{METRIC_NAME, "x"}, {"instance", "1"}, {"job", "a"}})));
+}
+
+TEST(ExecutorTest, InstantQueryMatchesRangeQuery)
+{
+    MemoryStorage storage;
+    populate(storage);
+    uint64_t ts = 15 * 60 * 1000 + 7000;
+
+    for (auto&& query :
+         {"x", "x offset 1m", "sum by (job) (rate(x[5m]))", "-x * 2", "-(-x)",
+          "x{job=\"a\"} - x", "x > bool 10", "topk(1, x)", "1 + 2",
+          "rate(x[5m] @ 600)", "max_over_time(rate(x[5m])[1h:1m])",
+          "min_over_time(x[10m:1m] offset 1m)", "max_over_time(x[5m:])",
+          "sum(rate(x[5m])) / (sum(rate(x[5m])) + sum(rate(x[1m])))"}) {
+        auto expected = run_query(storage, query, ts, ts, 1);
+
+        Parser parser(query);
+        Planner planner;
+        auto plan = planner.plan(parser.parse(), parser.get_text());
+        InstantExecutor executor(&storage, plan.get(),
+                                 SystemTime{std::chrono::milliseconds(ts)});
+        auto value = executor.execute();
+        ASSERT_NE(nullptr, value) << query;
+
+        std::map<std::string, std::vector<std::pair<uint64_t, double>>> actual;
+        if (auto* vec = dynamic_cast<VectorValue*>(value.get())) {
+            for (auto&& s : vec->get_samples()) {
+                actual[lset2str(s.metric)].emplace_back(
+                    s.value.get_time(), s.value.get_value());
+            }
+        } else if (auto* scalar = dynamic_cast<ScalarValue*>(value.get())) {
+            actual[lset2str({})].emplace_back(scalar->get_time(),
+                                              scalar->get_value());
+        }
+
+        ASSERT_FALSE(expected.empty()) << query;
+        EXPECT_EQ(expected, actual) << query;
+    }
+}
+
+class CountingStorage : public MemoryStorage {
+public:
+    int num_queriers = 0;
+
+    virtual std::shared_ptr<Querier> querier(uint64_t mint, uint64_t maxt)
+    {
+        num_queriers++;
+        return MemoryStorage::querier(mint, maxt);
+    }
+};
+
+TEST(ExecutorTest, SubqueryEvaluatesInnerExpressionOnce)
+{
+    CountingStorage storage;
+    populate(storage);
+
+    /* x is increasing so the extrema of the windows are their last and
+     * first inner steps */
+    auto max = run_query(storage, "max_over_time(x[10m:1m])", 10 * 60 * 1000,
+                         20 * 60 * 1000, 60000, false);
+    EXPECT_EQ(1, storage.num_queriers);
+    EXPECT_EQ(run_query(storage, "x", 10 * 60 * 1000, 20 * 60 * 1000, 60000),
+              max);
+
+    auto min = run_query(storage, "min_over_time(x[10m:1m])", 10 * 60 * 1000,
+                         20 * 60 * 1000, 60000);
+    EXPECT_EQ(run_query(storage, "x offset 10m", 10 * 60 * 1000,
+                        20 * 60 * 1000, 60000),
+              min);
+
+    auto count = run_query(storage, "count_over_time(x[10m:1m])",
+                           10 * 60 * 1000, 20 * 60 * 1000, 60000);
+    ASSERT_EQ(3, count.size());
+    for (auto&& p : count) {
+        ASSERT_EQ(11, p.second.size());
+        EXPECT_EQ(11, p.second.front().second);
+    }
+}
+
+TEST(ExecutorTest, SubqueryDefaultStep)
+{
+    MemoryStorage storage;
+    populate(storage);
+
+    /* the step of x[10m:] is DEFAULT_SUBQUERY_STEP, whatever the step of
+     * the query */
+    for (uint64_t step : {15000, 60000, 300000}) {
+        EXPECT_EQ(run_query(storage, "count_over_time(x[10m:1m])",
+                            10 * 60 * 1000, 20 * 60 * 1000, step),
+                  run_query(storage, "count_over_time(x[10m:])",
+                            10 * 60 * 1000, 20 * 60 * 1000, step))
+            << step;
+    }
+    EXPECT_EQ(run_query(storage, "max_over_time(rate(x[5m])[10m:1m])",
+                        20 * 60 * 1000, 20 * 60 * 1000, 1),
+              run_query(storage, "max_over_time(rate(x[5m])[10m:])",
+                        20 * 60 * 1000, 20 * 60 * 1000, 1));
+}
+
+TEST(ExecutorTest, StreamingMatchesMaterialized)
+{
+    MemoryStorage storage(false);
+    populate(storage);
+
+    for (auto&& query :
+         {"sum by (job) (rate(x[5m]))", "avg(x) * 2", "2 - x offset 1m",
+          "max without (instance) (increase(x[2m]))", "min(x > 20)",
+          "count(rate(x[1m]) > bool 0.1)"}) {
+        auto expected = run_query(storage, query, 10 * 60 * 1000,
+                                  20 * 60 * 1000, 60000, true, false);
+        auto actual = run_query(storage, query, 10 * 60 * 1000,
+                                20 * 60 * 1000, 60000, true, true);
+
+        ASSERT_FALSE(expected.empty()) << query;
+        EXPECT_EQ(expected, actual) << query;
+    }
+
+    Parser streamed("sum by (job) (rate(x[5m]))");
+    auto root = streamed.parse();
+    EXPECT_NE(nullptr, build_pipeline(&storage, nullptr, root.get(), 0,
+                                      60000, 15000));
+
+    Parser materialized("topk(1, x)");
+    auto materialized_root = materialized.parse();
+    EXPECT_EQ(nullptr, build_pipeline(&storage, nullptr,
+                                      materialized_root.get(), 0,
+                                      60000, 15000));
+}
+
+TEST(ExecutorTest, ResultOutlivesQueryArena)
+{
+    MemoryStorage storage;
+    populate(storage);
+
+    Parser parser("rate(x{job=\"a\"}[5m]) * x");
+    Planner planner;
+    auto plan = planner.plan(parser.parse(), parser.get_text());
+    std::unique_ptr<ExecValue> value;
+    {
+        Executor executor(&storage, plan.get(),
+                          SystemTime{std::chrono::minutes(10)},
+                          SystemTime{std::chrono::minutes(20)},
+                          std::chrono::minutes(1));
+        value = executor.execute();
+    }
+
+    auto* mat = dynamic_cast<MatrixValue*>(value.get());
+    ASSERT_NE(nullptr, mat);
+    ASSERT_EQ(2, mat->get_series().size());
+    for (auto&& s : mat->get_series()) {
+        EXPECT_EQ(11, s.values.size());
+        EXPECT_EQ(std::pmr::get_default_resource(),
+                  s.values.get_allocator().resource());
+    }
+}
+
+static std::unique_ptr<ExecValue> run_limited(Storage& storage,
+                                              const std::string& query,
+                                              const QueryLimits& limits,
+                                              bool streaming)
+{
+    Parser parser(query);
+    Planner planner;
+    auto plan = planner.plan(parser.parse(), parser.get_text());
+    Executor executor(&storage, plan.get(),
+                      SystemTime{std::chrono::minutes(10)},
+                      SystemTime{std::chrono::minutes(20)},
+                      std::chrono::minutes(1));
+    executor.set_streaming(streaming);
+    executor.set_limits(limits);
+    return executor.execute();
+}
+
+TEST(ExecutorTest, QueryLimitsAbortQuery)
+{
+    MemoryStorage storage(false);
+    populate(storage);
+
+    for (bool streaming : {false, true}) {
+        for (auto&& query : {"x", "sum(rate(x[5m]))"}) {
+            QueryLimits samples_limit;
+            samples_limit.max_samples = 100;
+            EXPECT_THROW(run_limited(storage, query, samples_limit, streaming),
+                         ExecutionError)
+                << query;
+
+            QueryLimits bytes_limit;
+            bytes_limit.max_bytes = 4096;
+            EXPECT_THROW(run_limited(storage, query, bytes_limit, streaming),
+                         ExecutionError)
+                << query;
+
+            EXPECT_NE(nullptr,
+                      run_limited(storage, query, QueryLimits(), streaming));
+        }
+    }
+
+    MemoryTracker::set_global_limit(4096);
+    EXPECT_THROW(run_limited(storage, "x", QueryLimits(), false),
+                 ExecutionError);
+    MemoryTracker::set_global_limit(0);
+
+    /* all memory is returned once the executors are gone */
+    EXPECT_EQ(0, MemoryTracker::get_global_bytes());
+}
+
+TEST(ExecutorTest, ChargeSubqueriesToQuery)
+{
+    MemoryStorage storage(false);
+    populate(storage);
+
+    auto run = [&](const std::string& query, const QueryLimits& limits) {
+        Parser parser(query);
+        Planner planner;
+        auto plan = planner.plan(parser.parse(), parser.get_text());
+        InstantExecutor executor(&storage, plan.get(),
+                                 SystemTime{std::chrono::minutes(20)});
+        executor.set_limits(limits);
+        executor.execute();
+        return executor.get_stats().samples;
+    };
+
+    auto outer = run("x", QueryLimits());
+    auto inner = run("max_over_time(x[10m:1m])", QueryLimits());
+    ASSERT_LT(0, outer);
+    ASSERT_LT(0, inner);
+    /* the reads of the subquery are counted with those of the query */
+    EXPECT_LT(std::max(outer, inner),
+              run("x + max_over_time(x[10m:1m])", QueryLimits()));
+
+    /* the subquery does not get a budget of its own */
+    QueryLimits limits;
+    limits.max_samples = std::max(outer, inner);
+    EXPECT_EQ(inner, run("max_over_time(x[10m:1m])", limits));
+    EXPECT_THROW(run("x + max_over_time(x[10m:1m])", limits),
+                 ExecutionError);
+}
+
+TEST(ExecutorTest, TrackQueryMemory)
+{
+    MemoryStorage storage;
+    populate(storage);
+
+    Parser parser("x");
+    Planner planner;
+    auto plan = planner.plan(parser.parse(), parser.get_text());
+    Executor executor(&storage, plan.get(),
+                      SystemTime{std::chrono::minutes(10)},
+                      SystemTime{std::chrono::minutes(20)},
+                      std::chrono::minutes(1));
+    executor.execute();
+
+    /* 3 series with 15 minutes of samples at a 15s interval */
+    EXPECT_EQ(3 * 61, executor.get_tracker().get_samples());
+    EXPECT_LT(0, executor.get_tracker().get_peak_bytes());
+    EXPECT_LE(executor.get_tracker().get_bytes(),
+              MemoryTracker::get_global_bytes());
+}
+
+TEST(ExecutorTest, PeakBytesOfLongRangeQuery)
+{
+    MemoryStorage storage(false);
+    auto app = storage.appender();
+    for (uint64_t t = 0; t <= 30 * 60 * 1000; t += SCRAPE_INTERVAL) {
+        for (int i = 0; i < 100; i++) {
+            app->add({{METRIC_NAME, "x"}, {"instance", std::to_string(i)}},
+                     t, t);
+        }
+    }
+    app->commit();
+
+    /* the operands and the windows of the previous steps are freed, the
+     * query holds little more than its result */
+    for (auto&& query : {"rate(x[5m])", "max_over_time(x[5m:1m])"}) {
+        Parser parser(query);
+        Planner planner;
+        auto plan = planner.plan(parser.parse(), parser.get_text());
+        Executor executor(&storage, plan.get(), SystemTime{},
+                          SystemTime{std::chrono::minutes(30)},
+                          std::chrono::seconds(1));
+        executor.set_streaming(false);
+        auto value = executor.execute();
+
+        size_t result_bytes = 0;
+        auto* mat = dynamic_cast<MatrixValue*>(value.get());
+        ASSERT_NE(nullptr, mat);
+        for (auto&& s : mat->get_series()) {
+            result_bytes += s.values.size() * sizeof(ScalarValue);
+        }
+
+        EXPECT_EQ(100, mat->get_series().size()) << query;
+        EXPECT_LT(executor.get_stats().peak_bytes, 2 * result_bytes)
+            << query;
+    }
+}
+
+TEST(ExecutorTest, PeakBytesOfStreamingAggregation)
+{
+    MemoryStorage storage(false);
+    auto app = storage.appender();
+    for (uint64_t t = 0; t <= 30 * 60 * 1000; t += SCRAPE_INTERVAL) {
+        for (int i = 0; i < 100; i++) {
+            app->add({{METRIC_NAME, "x"},
+                      {"job", i % 2 ? "a" : "b"},
+                      {"instance", std::to_string(i)}},
+                     t, t);
+        }
+    }
+    app->commit();
+
+    auto run = [&storage](bool streaming, size_t& result_bytes) {
+        Parser parser("sum by (job) (rate(x[5m]))");
+        Planner planner;
+        auto plan = planner.plan(parser.parse(), parser.get_text());
+        Executor executor(&storage, plan.get(), SystemTime{},
+                          SystemTime{std::chrono::minutes(30)},
+                          std::chrono::seconds(1));
+        executor.set_streaming(streaming);
+        auto value = executor.execute();
+
+        result_bytes = 0;
+        auto* mat = dynamic_cast<MatrixValue*>(value.get());
+        EXPECT_NE(nullptr, mat);
+        if (!mat) return (size_t)0;
+        EXPECT_EQ(2, mat->get_series().size());
+        for (auto&& s : mat->get_series()) {
+            result_bytes += s.values.size() * sizeof(ScalarValue);
+        }
+        return executor.get_stats().peak_bytes;
+    };
+
+    /* the series are folded into the groups a few at a time, the query holds
+     * little more than its result while the materialized path holds the
+     * rates of all series */
+    size_t result_bytes;
+    auto materialized = run(false, result_bytes);
+    auto streamed = run(true, result_bytes);
+    EXPECT_LT(streamed, 2 * result_bytes);
+    EXPECT_LT(10 * streamed, materialized);
+}
+
+TEST(ExecutorTest, CancelQuery)
+{
+    MemoryStorage storage;
+    populate(storage);
+
+    Parser parser("sum(rate(x[5m]))");
+    Planner planner;
+    auto plan = planner.plan(parser.parse(), parser.get_text());
+
+    auto cancelled = std::make_shared<CancellationToken>();
+    cancelled->cancel();
+    auto timed_out = std::make_shared<CancellationToken>();
+    timed_out->set_timeout(Duration{-1});
+
+    for (auto&& token : {cancelled, timed_out}) {
+        for (bool streaming : {false, true}) {
+            Executor executor(&storage, plan.get(),
+                              SystemTime{std::chrono::minutes(10)},
+                              SystemTime{std::chrono::minutes(20)},
+                              std::chrono::minutes(1));
+            executor.set_streaming(streaming);
+            executor.set_cancellation_token(token);
+            EXPECT_THROW(executor.execute(), ExecutionError);
+        }
+
+        InstantExecutor executor(&storage, plan.get(),
+                                 SystemTime{std::chrono::minutes(10)});
+        executor.set_cancellation_token(token);
+        EXPECT_THROW(executor.execute(), ExecutionError);
+    }
+
+    try {
+        timed_out->check();
+        FAIL();
+    } catch (const ExecutionError& e) {
+        EXPECT_STREQ("query timed out", e.what());
+    }
+
+    /* a token that is never triggered does not affect the query */
+    Executor executor(&storage, plan.get(),
+                      SystemTime{std::chrono::minutes(10)},
+                      SystemTime{std::chrono::minutes(20)},
+                      std::chrono::minutes(1));
+    executor.set_cancellation_token(std::make_shared<CancellationToken>());
+    EXPECT_NE(nullptr, executor.execute());
+}
+
+TEST(ExecutorTest, CollectQueryStats)
+{
+    MemoryStorage storage;
+    populate(storage);
+
+    Parser parser("rate(x[5m]) * 2");
+    Planner planner;
+    auto plan = planner.plan(parser.parse(), parser.get_text());
+
+    for (bool streaming : {false, true}) {
+        Executor executor(&storage, plan.get(),
+                          SystemTime{std::chrono::minutes(10)},
+                          SystemTime{std::chrono::minutes(20)},
+                          std::chrono::minutes(1));
+        executor.set_streaming(streaming);
+        executor.execute();
+
+        auto stats = executor.get_stats();
+        EXPECT_EQ(3, stats.series);
+        EXPECT_EQ(executor.get_tracker().get_samples(), stats.samples);
+        EXPECT_LT(0, stats.peak_samples);
+        EXPECT_EQ(executor.get_tracker().get_peak_bytes(), stats.peak_bytes);
+        /* at least the steps of the outermost operator */
+        EXPECT_LE(11, stats.steps);
+        EXPECT_NE(std::string::npos,
+                  stats.to_json().find("\"seriesSelected\": 3"));
+    }
+
+    InstantExecutor executor(&storage, plan.get(),
+                             SystemTime{std::chrono::minutes(10)});
+    executor.execute();
+
+    auto stats = executor.get_stats();
+    EXPECT_EQ(3, stats.series);
+    EXPECT_EQ(1, stats.steps);
+    /* the selected points are freed with the rates, before the literal and
+     * the products */
+    EXPECT_EQ(3 * 21 + 3, stats.peak_samples);
+
+    /* the peaks of the parts of a query are not added up */
+    auto merged = stats;
+    merged += stats;
+    EXPECT_EQ(stats.peak_samples, merged.peak_samples);
+    EXPECT_EQ(stats.peak_bytes, merged.peak_bytes);
+    EXPECT_EQ(2 * stats.samples, merged.samples);
+}
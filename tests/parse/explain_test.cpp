@@ -0,0 +1,86 @@
+#include "memory_storage.h"
+#include "parse/executor.h"
+#include "parse/explain.h"
+#include "parse/instant_executor.h"
+#include "parse/parser.h"
+#include "parse/planner.h"
+
+#include <gtest/gtest.h>
+
+using namespace promql;
+
+static std::unique_ptr<QueryPlan> plan_query(const std::string& query)
+{
+    Parser parser(query);
+    Planner planner;
+    return planner.plan(parser.parse(), parser.get_text());
+}
+
+static void populate(Storage& storage)
+{
+    auto app = storage.appender();
+    for (uint64_t t = 0; t <= 20 * 60 * 1000; t += 15 * 1000) {
+        app->add({{METRIC_NAME, "x"}, {"job", "a"}}, t, t);
+        app->add({{METRIC_NAME, "x"}, {"job", "b"}}, t, 2 * t);
+    }
+    app->commit();
+}
+
+TEST(ExplainTest, ExplainPlan)
+{
+    auto plan = plan_query("max by (job) (rate(x{job=\"a\"}[5m])) * 2");
+    auto json = PlanExplainer(plan.get()).explain();
+
+    EXPECT_NE(std::string::npos, json.find("\"node\": \"binary\""));
+    EXPECT_NE(std::string::npos, json.find("\"by\": [\"job\"]"));
+    EXPECT_NE(std::string::npos, json.find("\"func\": \"rate\""));
+    EXPECT_NE(std::string::npos, json.find("\"range\": 300"));
+    EXPECT_NE(std::string::npos,
+              json.find("{job=\\\"a\\\", __name__=\\\"x\\\"}"))
+        << json;
+    EXPECT_NE(std::string::npos, json.find("\"scans\": [{"));
+    /* nothing is analyzed without a profile */
+    EXPECT_EQ(std::string::npos, json.find("\"analysis\""));
+}
+
+TEST(ExplainTest, AnalyzeQuery)
+{
+    MemoryStorage storage;
+    populate(storage);
+
+    auto plan = plan_query("max(rate(x[5m])) * 2");
+    auto* root = static_cast<BinaryNode*>(plan->root.get());
+    auto* max = root->get_lhs();
+
+    QueryProfile profile;
+    Executor executor(&storage, plan.get(),
+                      SystemTime{std::chrono::minutes(10)},
+                      SystemTime{std::chrono::minutes(20)},
+                      std::chrono::minutes(1));
+    executor.set_profile(&profile);
+    executor.execute();
+
+    ASSERT_EQ(1, profile.count(root));
+    EXPECT_EQ(1, profile[root].calls);
+    EXPECT_EQ(1, profile[root].series);
+    EXPECT_EQ(11, profile[root].samples);
+    EXPECT_LE(profile[max].wall_time, profile[root].wall_time);
+
+    /* the bytes of a node include those of its children */
+    EXPECT_GT(profile[max].bytes, 0);
+    EXPECT_GT(profile[root].bytes, profile[max].bytes);
+
+    /* the rate has two input series */
+    auto json = PlanExplainer(plan.get(), &profile).explain();
+    EXPECT_NE(std::string::npos,
+              json.find("\"inputSeries\": 2, \"outputSeries\": 1"))
+        << json;
+
+    QueryProfile instant_profile;
+    InstantExecutor instant(&storage, plan.get(),
+                            SystemTime{std::chrono::minutes(10)});
+    instant.set_profile(&instant_profile);
+    instant.execute();
+    EXPECT_EQ(1, instant_profile[root].series);
+    EXPECT_EQ(1, instant_profile[root].samples);
+}
@@ -0,0 +1,56 @@
+#include "parse/fingerprint.h"
+#include "parse/parser.h"
+#include "parse/planner.h"
+
+#include <gtest/gtest.h>
+
+using namespace promql;
+
+static std::string fingerprint(const std::string& query)
+{
+    Parser parser(query);
+    auto root = parser.parse();
+    return QueryFingerprinter().fingerprint(root.get());
+}
+
+TEST(FingerprintTest, NormalizeLiterals)
+{
+    EXPECT_EQ("sum by (job) (rate(http_requests_total{instance=?, job=~?}"
+              "[5m]))",
+              fingerprint("sum by (job) (rate(http_requests_total{"
+                          "job=~\"api|web\", instance=\"host-1\"}[5m]))"));
+    EXPECT_EQ("topk(?, (x{job!=?} > bool ?))",
+              fingerprint("topk(3, x{job!='a'} > bool 0.5)"));
+    EXPECT_EQ("count_values(?, x)", fingerprint("count_values(\"v\", x)"));
+    EXPECT_EQ("max_over_time(x[1h:1m] offset 1d @ ?)",
+              fingerprint("max_over_time(x[1h:1m] offset 1d @ 1600000000)"));
+    EXPECT_EQ("{job=?}", fingerprint("{job=\"a\"}"));
+    EXPECT_EQ("max_over_time(x[1h:])", fingerprint("max_over_time(x[1h:])"));
+}
+
+TEST(FingerprintTest, SameFingerprint)
+{
+    /* the queries of a panel sent with different variables */
+    EXPECT_EQ(fingerprint("rate(x{job=\"a\", instance=\"b\"}[5m]) * 100"),
+              fingerprint("rate(x{instance=\"c\",job=\"d\"}[5m]) * 8"));
+    EXPECT_EQ(fingerprint("sum by (a, b) (x)"),
+              fingerprint("sum by (b, a) (x)"));
+
+    /* the ranges, offsets and metric names are kept */
+    EXPECT_NE(fingerprint("rate(x[5m])"), fingerprint("rate(x[1h])"));
+    EXPECT_NE(fingerprint("x offset 5m"), fingerprint("x"));
+    EXPECT_NE(fingerprint("x"), fingerprint("y"));
+    EXPECT_NE(fingerprint("sum by (a) (x)"),
+              fingerprint("sum without (a) (x)"));
+
+    EXPECT_EQ(QueryFingerprinter::hash("x"), QueryFingerprinter::hash("x"));
+    EXPECT_NE(QueryFingerprinter::hash("x"), QueryFingerprinter::hash("y"));
+}
+
+TEST(FingerprintTest, PlanFingerprint)
+{
+    /* the constants are folded by the planner */
+    Parser parser("rate(x{job=\"a\"}[5m]) > 2 * 60");
+    auto plan = Planner().plan(parser.parse(), parser.get_text());
+    EXPECT_EQ("(rate(x{job=?}[5m]) > ?)", plan->fingerprint);
+}
@@ -78,3 +78,50 @@ TEST(LexerTest, HandleKeywordAndIdentifier)
     EXPECT_EQ(Token::COLON, lexer.get_token());
     EXPECT_EQ(Token::EOS, lexer.get_token());
 }
+
+TEST(LexerTest, HandleAtModifier)
+{
+    Lexer lexer("foo @ 1609746000");
+
+    EXPECT_EQ(Token::IDENTIFIER, lexer.get_token());
+    EXPECT_EQ(Token::AT, lexer.get_token());
+    EXPECT_EQ(Token::NUMBER, lexer.get_token());
+    EXPECT_EQ(Token::EOS, lexer.get_token());
+}
+
+TEST(LexerTest, HandleEscapeInsideStringLiteral)
+{
+    Lexer lexer("{a=\"x\\\"y\", b='plain'}");
+
+    EXPECT_EQ(Token::LEFT_BRACE, lexer.get_token());
+    EXPECT_EQ(Token::IDENTIFIER, lexer.get_token());
+    EXPECT_EQ(Token::ASSIGN, lexer.get_token());
+    EXPECT_EQ(Token::STRING, lexer.get_token());
+    EXPECT_EQ("x\"y", lexer.get_last_string());
+    EXPECT_EQ(Token::COMMA, lexer.get_token());
+    EXPECT_EQ(Token::IDENTIFIER, lexer.get_token());
+    EXPECT_EQ("b", lexer.get_last_word());
+    EXPECT_EQ(Token::ASSIGN, lexer.get_token());
+    EXPECT_EQ(Token::STRING, lexer.get_token());
+    EXPECT_EQ("plain", lexer.get_last_string());
+    EXPECT_EQ(Token::RIGHT_BRACE, lexer.get_token());
+    EXPECT_EQ(Token::EOS, lexer.get_token());
+}
+
+TEST(LexerTest, TokensAreSlicesOfInput)
+{
+    std::string input = "rate(http_requests_total[5m])";
+    Lexer lexer(input);
+
+    EXPECT_EQ(Token::IDENTIFIER, lexer.get_token());
+    auto word = lexer.get_last_word();
+    EXPECT_EQ(input.data(), word.data());
+    EXPECT_EQ(Token::LEFT_PAREN, lexer.get_token());
+    EXPECT_EQ(Token::IDENTIFIER, lexer.get_token());
+    EXPECT_EQ(Token::LEFT_BRACKET, lexer.get_token());
+    EXPECT_EQ(Token::DURATION, lexer.get_token());
+    EXPECT_EQ("5m", lexer.get_last_strnum());
+
+    /* earlier tokens are still valid */
+    EXPECT_EQ("rate", word);
+}
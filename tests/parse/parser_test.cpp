@@ -34,3 +34,71 @@ TEST(ParserTest, UnaryOnlyAllowedForScalarAndVector)
     Parser parser("-'string'");
     EXPECT_THROW(parser.parse(), TypeCheckError);
 }
+
+TEST(ParserTest, HandleAtModifier)
+{
+    Parser parser("foo @ 1609746000");
+    auto root = parser.parse();
+    EXPECT_EQ(AtModifier::TIMESTAMP, root->get_at());
+    EXPECT_EQ(1609746000000ULL, root->get_at_timestamp());
+
+    Parser range_parser("foo[5m] @ start() offset 1m");
+    auto range_root = range_parser.parse();
+    EXPECT_EQ(AtModifier::START, range_root->get_at());
+
+    Parser end_parser("foo @ end()");
+    auto end_root = end_parser.parse();
+    EXPECT_EQ(AtModifier::END, end_root->get_at());
+}
+
+TEST(ParserTest, AtModifierMustBeTimestampOrStartEnd)
+{
+    Parser parser("foo @ bar");
+    EXPECT_THROW(parser.parse(), ParseError);
+}
+
+TEST(ParserTest, AtTimestampIsRounded)
+{
+    Parser parser("foo @ 1.0009");
+    EXPECT_EQ(1001ULL, parser.parse()->get_at_timestamp());
+
+    Parser plus_parser("foo @ +2.5");
+    EXPECT_EQ(2500ULL, plus_parser.parse()->get_at_timestamp());
+
+    Parser zero_parser("foo @ 0");
+    EXPECT_EQ(0ULL, zero_parser.parse()->get_at_timestamp());
+}
+
+TEST(ParserTest, AtTimestampMustBeInRange)
+{
+    for (auto query : {"foo @ -1", "foo @ -0.5", "foo @ 1e400",
+                       "foo @ 1e300"}) {
+        Parser parser(query);
+        EXPECT_THROW(parser.parse(), ParseError) << query;
+    }
+}
+
+TEST(ParserTest, SubqueryStepMustBePositive)
+{
+    Parser parser("max_over_time(foo[5m:0s])");
+    EXPECT_THROW(parser.parse(), TypeCheckError);
+}
+
+TEST(ParserTest, SubqueryStepMayBeOmitted)
+{
+    Parser parser("max_over_time(foo[5m:])");
+    auto root = parser.parse();
+    auto* call = dynamic_cast<FuncCallNode*>(root.get());
+    ASSERT_NE(nullptr, call);
+    auto* sq = dynamic_cast<SubqueryNode*>(call->get_args()[0].get());
+    ASSERT_NE(nullptr, sq);
+    EXPECT_EQ(0, sq->get_step().count());
+    EXPECT_EQ(300000, sq->get_range().count());
+
+    Parser expr_parser("rate(foo[1m])[5m:] offset 1m");
+    auto expr_root = expr_parser.parse();
+    sq = dynamic_cast<SubqueryNode*>(expr_root.get());
+    ASSERT_NE(nullptr, sq);
+    EXPECT_EQ(0, sq->get_step().count());
+    EXPECT_EQ(60000, sq->get_offset().count());
+}
@@ -0,0 +1,55 @@
+#include "parse/parser.h"
+#include "parse/plan_cache.h"
+
+#include <gtest/gtest.h>
+
+using namespace promql;
+
+TEST(PlanCacheTest, NormalizeQuery)
+{
+    EXPECT_EQ("sum by (job) (rate(x[5m]))",
+              PlanCache::normalize("  sum  by (job)\n\t(rate(x[5m])) "));
+    /* string literals are kept as they are */
+    EXPECT_EQ("x{job=\"a  b\\\"  c\"} + y{job='d  e'}",
+              PlanCache::normalize("x{job=\"a  b\\\"  c\"}  +\ny{job='d  e'}"));
+    /* comments are dropped */
+    EXPECT_EQ("x + y", PlanCache::normalize("x # a \"comment\"\n+ y"));
+}
+
+TEST(PlanCacheTest, CachePlans)
+{
+    PlanCache cache(2);
+
+    auto plan = cache.get("sum(rate(x[5m]))");
+    EXPECT_EQ(plan, cache.get("sum(rate(x[5m]))"));
+    EXPECT_EQ(plan, cache.get("\tsum(rate(x[5m]))\n"));
+    EXPECT_NE(plan, cache.get("sum(rate(y[5m]))"));
+    EXPECT_EQ(2, cache.size());
+
+    /* the least recently used plan is evicted */
+    cache.get("sum(rate(x[5m]))");
+    cache.get("z");
+    EXPECT_EQ(2, cache.size());
+    EXPECT_EQ(plan, cache.find("sum(rate(x[5m]))"));
+    EXPECT_EQ(nullptr, cache.find("sum(rate(y[5m]))"));
+
+    /* errors are not cached */
+    EXPECT_THROW(cache.get("sum("), std::runtime_error);
+    EXPECT_EQ(nullptr, cache.find("sum("));
+}
+
+TEST(PlanCacheTest, PlanMissesWithFunction)
+{
+    PlanCache cache;
+    size_t planned = 0;
+    auto plan_func = [&] {
+        planned++;
+        Parser parser("x");
+        return Planner().plan(parser.parse(), parser.get_text());
+    };
+
+    auto plan = cache.get("key", plan_func);
+    EXPECT_EQ(plan, cache.get("key", plan_func));
+    EXPECT_EQ(1, planned);
+    EXPECT_EQ(plan, cache.find("key"));
+}
@@ -0,0 +1,115 @@
+#include "parse/parser.h"
+#include "parse/planner.h"
+
+#include <gtest/gtest.h>
+
+using namespace promql;
+
+static std::unique_ptr<QueryPlan> plan_query(const std::string& query)
+{
+    Parser parser(query);
+    Planner planner;
+    return planner.plan(parser.parse(), parser.get_text());
+}
+
+TEST(PlannerTest, FoldScalarSubtrees)
+{
+    auto plan = plan_query("2 * 60 + -(3 - 1)");
+    auto* num = dynamic_cast<NumberLiteralNode*>(plan->root.get());
+
+    ASSERT_NE(nullptr, num);
+    EXPECT_EQ(118, num->get_value());
+}
+
+TEST(PlannerTest, CollapseNestedUnary)
+{
+    auto plan = plan_query("+(+some_metric)");
+    EXPECT_NE(nullptr, dynamic_cast<VectorSelectorNode*>(plan->root.get()));
+
+    plan = plan_query("-(+some_metric)");
+    auto* binop = dynamic_cast<BinaryNode*>(plan->root.get());
+    ASSERT_NE(nullptr, binop);
+    EXPECT_EQ(Token::MUL, binop->get_op());
+
+    /* the negations cancel out but still drop the metric name */
+    plan = plan_query("-(-some_metric)");
+    binop = dynamic_cast<BinaryNode*>(plan->root.get());
+    ASSERT_NE(nullptr, binop);
+    EXPECT_EQ(Token::MUL, binop->get_op());
+    auto* num = dynamic_cast<NumberLiteralNode*>(binop->get_rhs());
+    ASSERT_NE(nullptr, num);
+    EXPECT_EQ(1, num->get_value());
+}
+
+TEST(PlannerTest, PushSubqueryOffsetIntoSelectors)
+{
+    auto plan = plan_query("some_metric[1h:1m] offset 5m");
+    auto* sq = dynamic_cast<SubqueryNode*>(plan->root.get());
+
+    ASSERT_NE(nullptr, sq);
+    EXPECT_EQ(0, sq->get_offset().count());
+    EXPECT_EQ(Parser::parse_duration("5m"), sq->get_expr()->get_offset());
+}
+
+TEST(PlannerTest, ShareScans)
+{
+    auto plan =
+        plan_query("sum(rate(some_metric[5m])) / sum(rate(some_metric[1h]))");
+
+    ASSERT_EQ(1, plan->scans.size());
+    EXPECT_EQ(Parser::parse_duration("1h"), plan->scans[0].before);
+    EXPECT_EQ(2, plan->scan_index.size());
+}
+
+TEST(PlannerTest, FindCommonSubexpressions)
+{
+    auto plan = plan_query("sum(rate(x[5m])) / (sum(rate(x[5m])) + "
+                           "sum by (job) (rate(x[5m])))");
+    auto* div = dynamic_cast<BinaryNode*>(plan->root.get());
+    ASSERT_NE(nullptr, div);
+    auto* add = dynamic_cast<BinaryNode*>(div->get_rhs());
+    ASSERT_NE(nullptr, add);
+
+    size_t lhs_id, rhs_id, other_id;
+    ASSERT_TRUE(plan->get_cse(div->get_lhs(), lhs_id));
+    ASSERT_TRUE(plan->get_cse(add->get_lhs(), rhs_id));
+    EXPECT_EQ(lhs_id, rhs_id);
+    EXPECT_FALSE(plan->get_cse(add->get_rhs(), other_id));
+    EXPECT_FALSE(plan->get_cse(plan->root.get(), other_id));
+
+    StructuralHasher hasher;
+    EXPECT_EQ(hasher.hash_of(div->get_lhs()), hasher.hash_of(add->get_lhs()));
+    EXPECT_NE(hasher.hash_of(div->get_lhs()), hasher.hash_of(add->get_rhs()));
+}
+
+TEST(PlannerTest, MarkStepInvariants)
+{
+    auto plan = plan_query("rate(x[5m] @ 100) / rate(x[5m])");
+    auto* div = dynamic_cast<BinaryNode*>(plan->root.get());
+
+    ASSERT_NE(nullptr, div);
+    EXPECT_TRUE(plan->is_step_invariant(div->get_lhs()));
+    EXPECT_FALSE(plan->is_step_invariant(div->get_rhs()));
+    EXPECT_FALSE(plan->is_step_invariant(div));
+
+    plan = plan_query("sum(x @ end()) + time()");
+    div = dynamic_cast<BinaryNode*>(plan->root.get());
+    ASSERT_NE(nullptr, div);
+    EXPECT_TRUE(plan->is_step_invariant(div->get_lhs()));
+    EXPECT_FALSE(plan->is_step_invariant(div->get_rhs()));
+}
+
+TEST(PlannerTest, MarkRangeDependentPlans)
+{
+    EXPECT_FALSE(plan_query("rate(x[5m] @ 100)")->range_dependent);
+    EXPECT_TRUE(plan_query("rate(x[5m] @ start())")->range_dependent);
+    EXPECT_TRUE(plan_query("sum(x @ end()) + time()")->range_dependent);
+    EXPECT_TRUE(plan_query("max_over_time(x[5m:1m] @ end())")->range_dependent);
+
+    auto plan = plan_query("rate(x[5m])");
+    EXPECT_TRUE(plan->is_splittable(0, 60000, 1000));
+    /* a single step query */
+    EXPECT_FALSE(plan->is_splittable(60000, 60000, 1000));
+    EXPECT_FALSE(plan->is_splittable(60000, 60000, 1));
+    EXPECT_FALSE(plan_query("x @ start()")->is_splittable(0, 60000, 1000));
+}
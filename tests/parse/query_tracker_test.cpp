@@ -0,0 +1,150 @@
+#include "memory_storage.h"
+#include "parse/executor.h"
+#include "parse/parser.h"
+#include "parse/planner.h"
+#include "parse/query_tracker.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+using namespace promql;
+
+TEST(QueryTrackerTest, TrackQueries)
+{
+    ActiveQueryTracker tracker(2);
+    auto token = std::make_shared<CancellationToken>();
+
+    auto* a = tracker.insert("up", token);
+    auto* b = tracker.insert("sum(x)", std::make_shared<CancellationToken>());
+    ASSERT_NE(nullptr, a);
+    ASSERT_NE(nullptr, b);
+
+    /* all slots are in use */
+    EXPECT_EQ(nullptr,
+              tracker.insert("x", std::make_shared<CancellationToken>()));
+
+    b->set_phase(QueryPhase::EXECUTING);
+    b->add_samples(10);
+    b->add_bytes(100);
+
+    auto queries = tracker.get_active_queries();
+    ASSERT_EQ(2, queries.size());
+    EXPECT_EQ("up", queries[0].query);
+    EXPECT_EQ(QueryPhase::PARSING, queries[0].phase);
+    EXPECT_EQ("sum(x)", queries[1].query);
+    EXPECT_EQ(QueryPhase::EXECUTING, queries[1].phase);
+    EXPECT_EQ(10, queries[1].samples);
+    EXPECT_EQ(100, queries[1].bytes);
+
+    EXPECT_TRUE(tracker.kill(queries[0].id));
+    EXPECT_TRUE(token->is_cancelled());
+
+    tracker.remove(a);
+    EXPECT_FALSE(tracker.kill(queries[0].id));
+    ASSERT_EQ(1, tracker.get_active_queries().size());
+    EXPECT_NE(nullptr,
+              tracker.insert("x", std::make_shared<CancellationToken>()));
+}
+
+TEST(QueryTrackerTest, KillQueriesOfOwner)
+{
+    ActiveQueryTracker tracker;
+    int request, other_request;
+    auto token = std::make_shared<CancellationToken>();
+    auto other_token = std::make_shared<CancellationToken>();
+
+    tracker.insert("x", token, &request);
+    tracker.insert("x", other_token, &other_request);
+    tracker.kill_owner(&request);
+
+    EXPECT_TRUE(token->is_cancelled());
+    EXPECT_FALSE(other_token->is_cancelled());
+}
+
+TEST(QueryTrackerTest, KillWhileSlotsAreReused)
+{
+    ActiveQueryTracker tracker(2);
+    const std::string long_query(2000, 'x');
+    std::atomic<bool> done(false);
+
+    std::thread reader([&] {
+        while (!done) {
+            for (auto&& q : tracker.get_active_queries()) {
+                /* a copy of a reused slot is never returned */
+                EXPECT_TRUE(q.query == "up" ||
+                            q.query == long_query.substr(0, 1023))
+                    << q.query;
+                tracker.kill(q.id);
+            }
+        }
+    });
+
+    for (int i = 0; i < 20000; i++) {
+        auto* q = tracker.insert(i % 2 ? "up" : long_query,
+                                 std::make_shared<CancellationToken>());
+        ASSERT_NE(nullptr, q);
+        tracker.remove(q);
+    }
+    done = true;
+    reader.join();
+}
+
+TEST(QueryTrackerTest, ReportCrashedQueries)
+{
+    std::string path = testing::TempDir() + "promql_active_queries";
+    std::remove(path.c_str());
+
+    {
+        ActiveQueryTracker tracker(4, path);
+        EXPECT_TRUE(tracker.get_crashed_queries().empty());
+
+        auto* done = tracker.insert("up", nullptr);
+        tracker.insert("sum(rate(x[5m]))", nullptr);
+        tracker.remove(done);
+    }
+
+    /* the second query was never removed */
+    ActiveQueryTracker tracker(4, path);
+    const auto& crashed = tracker.get_crashed_queries();
+    ASSERT_EQ(1, crashed.size());
+    EXPECT_EQ("sum(rate(x[5m]))", crashed[0].query);
+    EXPECT_TRUE(tracker.get_active_queries().empty());
+
+    std::remove(path.c_str());
+}
+
+TEST(QueryTrackerTest, ExecutorReportsProgress)
+{
+    MemoryStorage storage;
+    auto app = storage.appender();
+    for (uint64_t t = 0; t < 60 * 1000; t += 1000) {
+        app->add({{METRIC_NAME, "x"}}, t, t);
+    }
+    app->commit();
+
+    ActiveQueryTracker tracker;
+    auto* active = tracker.insert("x", nullptr);
+
+    Parser parser("x");
+    Planner planner;
+    auto plan = planner.plan(parser.parse(), parser.get_text());
+    {
+        Executor executor(&storage, plan.get(),
+                          SystemTime{std::chrono::seconds(0)},
+                          SystemTime{std::chrono::seconds(60)},
+                          std::chrono::seconds(10));
+        executor.set_active_query(active);
+        executor.execute();
+
+        auto queries = tracker.get_active_queries();
+        ASSERT_EQ(1, queries.size());
+        EXPECT_EQ(60, queries[0].samples);
+        EXPECT_LT(0, queries[0].bytes);
+    }
+
+    /* the memory of the query is released with the executor */
+    EXPECT_EQ(0, tracker.get_active_queries()[0].bytes);
+}
@@ -0,0 +1,176 @@
+#include "parse/executor.h"
+#include "query_coalescer.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace promql;
+
+TEST(QueryCoalescerTest, CoalesceConcurrentQueries)
+{
+    QueryCoalescer coalescer;
+    std::atomic<int> runs{0};
+    std::promise<void> release;
+    auto released = release.get_future().share();
+
+    auto func = [&](std::shared_ptr<CancellationToken>) {
+        runs++;
+        released.wait();
+
+        QueryResult result;
+        result.value = std::make_shared<ScalarValue>(1000, 42);
+        result.stats.samples = 10;
+        return result;
+    };
+
+    /* the first request runs the query, the others wait for it */
+    std::vector<std::thread> threads;
+    std::vector<QueryResult> results(4);
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back(
+            [&, i] { results[i] = coalescer.run("up|1000", func); });
+    }
+    while (coalescer.get_coalesced() < 3) {
+        std::this_thread::yield();
+    }
+    release.set_value();
+    for (auto&& t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(1, runs.load());
+    int shared = 0;
+    for (auto&& result : results) {
+        EXPECT_EQ(results[0].value, result.value);
+        EXPECT_EQ(10, result.stats.samples);
+        shared += result.shared;
+    }
+    EXPECT_EQ(3, shared);
+
+    /* nothing is kept once the query is done */
+    coalescer.run("up|1000", func);
+    EXPECT_EQ(2, runs.load());
+}
+
+TEST(QueryCoalescerTest, ShareErrors)
+{
+    QueryCoalescer coalescer;
+    std::promise<void> started, release;
+    auto released = release.get_future().share();
+
+    auto func = [&](std::shared_ptr<CancellationToken>) -> QueryResult {
+        started.set_value();
+        released.wait();
+        throw ExecutionError("failed");
+    };
+    std::thread leader(
+        [&] { EXPECT_THROW(coalescer.run("x", func), ExecutionError); });
+    started.get_future().wait();
+
+    /* a waiter gives up with its own timeout */
+    auto token = std::make_shared<CancellationToken>();
+    token->set_timeout(std::chrono::milliseconds(20));
+    EXPECT_THROW(coalescer.run("x", func, token), ExecutionError);
+
+    /* the others get the error of the query */
+    std::thread waiter([&] {
+        try {
+            coalescer.run("x", func);
+            ADD_FAILURE();
+        } catch (const ExecutionError& e) {
+            EXPECT_STREQ("failed", e.what());
+        }
+    });
+    while (coalescer.get_coalesced() < 2) {
+        std::this_thread::yield();
+    }
+    release.set_value();
+
+    leader.join();
+    waiter.join();
+}
+
+/* runs until released or cancelled */
+static QueryResult wait_released(const std::shared_future<void>& released,
+                                 std::shared_ptr<CancellationToken> token)
+{
+    while (released.wait_for(std::chrono::milliseconds(1)) !=
+           std::future_status::ready) {
+        token->check();
+    }
+
+    QueryResult result;
+    result.value = std::make_shared<ScalarValue>(1000, 42);
+    return result;
+}
+
+TEST(QueryCoalescerTest, WaiterOutlivesCancelledLeader)
+{
+    QueryCoalescer coalescer;
+    std::promise<void> started, release;
+    auto released = release.get_future().share();
+    auto func = [&](std::shared_ptr<CancellationToken> token) {
+        started.set_value();
+        return wait_released(released, std::move(token));
+    };
+
+    auto leader_token = std::make_shared<CancellationToken>();
+    std::thread leader([&] {
+        auto result = coalescer.run("x", func, leader_token);
+        EXPECT_FALSE(result.shared);
+    });
+    started.get_future().wait();
+
+    QueryResult result;
+    std::thread waiter([&] {
+        result =
+            coalescer.run("x", func, std::make_shared<CancellationToken>());
+    });
+    while (coalescer.get_coalesced() < 1) {
+        std::this_thread::yield();
+    }
+
+    /* the query goes on for the waiter */
+    leader_token->cancel();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release.set_value();
+
+    leader.join();
+    waiter.join();
+    ASSERT_NE(nullptr, result.value);
+    EXPECT_TRUE(result.shared);
+}
+
+TEST(QueryCoalescerTest, StopQueryOnceAllRequestsCancelled)
+{
+    QueryCoalescer coalescer;
+    std::promise<void> started, release;
+    auto released = release.get_future().share();
+    auto func = [&](std::shared_ptr<CancellationToken> token) {
+        started.set_value();
+        return wait_released(released, std::move(token));
+    };
+
+    auto leader_token = std::make_shared<CancellationToken>();
+    std::thread leader([&] {
+        EXPECT_THROW(coalescer.run("x", func, leader_token), ExecutionError);
+    });
+    started.get_future().wait();
+
+    auto waiter_token = std::make_shared<CancellationToken>();
+    std::thread waiter([&] {
+        EXPECT_THROW(coalescer.run("x", func, waiter_token), ExecutionError);
+    });
+    while (coalescer.get_coalesced() < 1) {
+        std::this_thread::yield();
+    }
+
+    waiter_token->cancel();
+    waiter.join();
+    leader_token->cancel();
+    leader.join();
+
+    release.set_value();
+}
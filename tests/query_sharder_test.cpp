@@ -0,0 +1,332 @@
+#include "memory_storage.h"
+#include "parse/executor.h"
+#include "parse/instant_executor.h"
+#include "parse/parser.h"
+#include "parse/planner.h"
+#include "query_sharder.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <set>
+
+using namespace promql;
+
+static const uint64_t MINUTE = 60 * 1000;
+
+using Result = std::map<std::string, std::vector<std::pair<uint64_t, double>>>;
+
+static void populate(Storage& storage)
+{
+    auto app = storage.appender();
+
+    for (uint64_t t = 0; t <= 30 * MINUTE; t += 15 * 1000) {
+        for (int i = 0; i < 20; i++) {
+            app->add({{METRIC_NAME, "x"},
+                      {"job", i % 3 ? "a" : "b"},
+                      {"instance", std::to_string(i)}},
+                     t, (i + 1) * t / 1000.0);
+        }
+    }
+
+    app->commit();
+}
+
+static Result to_result(const ExecValue& value)
+{
+    Result result;
+
+    if (auto* vec = dynamic_cast<const VectorValue*>(&value)) {
+        for (auto&& s : vec->get_samples()) {
+            result[lset2str(s.metric)].emplace_back(s.value.get_time(),
+                                                    s.value.get_value());
+        }
+    } else if (auto* mat = dynamic_cast<const MatrixValue*>(&value)) {
+        for (auto&& s : mat->get_series()) {
+            auto& values = result[lset2str(s.metric)];
+            for (auto&& v : s.values) {
+                values.emplace_back(v.get_time(), v.get_value());
+            }
+        }
+    }
+
+    return result;
+}
+
+static void expect_same(const Result& expected, const Result& actual,
+                        const std::string& query)
+{
+    ASSERT_FALSE(expected.empty()) << query;
+    ASSERT_EQ(expected.size(), actual.size()) << query;
+    for (auto&& p : expected) {
+        auto it = actual.find(p.first);
+        ASSERT_NE(it, actual.end()) << query;
+        ASSERT_EQ(p.second.size(), it->second.size()) << query;
+
+        for (size_t i = 0; i < p.second.size(); i++) {
+            EXPECT_EQ(p.second[i].first, it->second[i].first) << query;
+            EXPECT_DOUBLE_EQ(p.second[i].second, it->second[i].second)
+                << query;
+        }
+    }
+}
+
+static std::unique_ptr<QueryPlan> plan_query(const std::string& query)
+{
+    Parser parser(query);
+    Planner planner;
+    return planner.plan(parser.parse(), parser.get_text());
+}
+
+TEST(QuerySharderTest, SelectShards)
+{
+    MemoryStorage storage;
+    populate(storage);
+
+    /* each series is in exactly one shard */
+    std::vector<MemoryStorage::MemSeries> all, sharded;
+    storage.snapshot({}, 0, 0, all);
+    for (size_t i = 0; i < 4; i++) {
+        storage.snapshot({shard_matcher(i, 4)}, 0, 0, sharded);
+    }
+    EXPECT_EQ(20, all.size());
+    ASSERT_EQ(all.size(), sharded.size());
+
+    std::set<std::string> names;
+    for (auto&& s : sharded) {
+        names.insert(lset2str(s.labels));
+    }
+    EXPECT_EQ(all.size(), names.size());
+
+    size_t index, count;
+    EXPECT_TRUE(parse_shard_matcher(shard_matcher(1, 4), index, count));
+    EXPECT_EQ(1, index);
+    EXPECT_EQ(4, count);
+    EXPECT_FALSE(parse_shard_matcher(LabelMatcher(MatchOp::EQL, "job", "a"),
+                                     index, count));
+    EXPECT_THROW(parse_shard_matcher(
+                     LabelMatcher(MatchOp::EQL, SHARD_LABEL, "4_of_4"), index,
+                     count),
+                 std::runtime_error);
+}
+
+TEST(QuerySharderTest, ShardableAggregations)
+{
+    for (auto&& query :
+         {"sum by (job) (rate(x[5m]))", "max(x)", "avg(x * 2)",
+          "count without (instance) (max_over_time(rate(x[5m])[10m:1m]))"}) {
+        EXPECT_TRUE(QuerySharder::is_shardable(plan_query(query).get()))
+            << query;
+    }
+
+    for (auto&& query :
+         {"x", "rate(x[5m])", "topk(1, x)", "sum(x - x)",
+          "sum(sum by (instance) (x))", "quantile(0.5, x)"}) {
+        EXPECT_FALSE(QuerySharder::is_shardable(plan_query(query).get()))
+            << query;
+    }
+}
+
+TEST(QuerySharderTest, ShardedQueryMatchesUnsharded)
+{
+    ctpl::thread_pool pool(3);
+
+    for (bool pushdown : {false, true}) {
+        MemoryStorage storage(pushdown);
+        populate(storage);
+
+        for (auto&& query :
+             {"sum by (job) (rate(x[5m]))", "min(x)", "max by (job) (x)",
+              "count without (instance) (x > 1000)",
+              "avg by (job) (increase(x[2m]))"}) {
+            auto plan = plan_query(query);
+            QuerySharder sharder(&pool, 4);
+            ASSERT_TRUE(sharder.prepare(plan.get(),
+                                        [&] { return plan_query(query); }))
+                << query;
+
+            /* range query */
+            SystemTime start{std::chrono::milliseconds(10 * MINUTE)};
+            SystemTime end{std::chrono::milliseconds(20 * MINUTE)};
+            auto range = [&](const QueryPlan* plan, Queryable* queryable) {
+                Executor executor(queryable, plan, start, end,
+                                  std::chrono::minutes(1));
+                return executor.execute();
+            };
+            expect_same(to_result(*range(plan.get(), &storage)),
+                        to_result(*sharder.query(&storage, range)), query);
+
+            /* instant query */
+            SystemTime ts{std::chrono::milliseconds(15 * MINUTE + 7000)};
+            auto instant = [&](const QueryPlan* plan, Queryable* queryable) {
+                InstantExecutor executor(queryable, plan, ts);
+                return executor.execute();
+            };
+            auto sharded = sharder.query(&storage, instant);
+            EXPECT_EQ(ValueType::VECTOR, sharded->type());
+            expect_same(to_result(*instant(plan.get(), &storage)),
+                        to_result(*sharded), query);
+        }
+    }
+}
+
+/* a storage that ignores the shard matchers */
+class UnshardedQueryable : public Queryable {
+public:
+    UnshardedQueryable(Queryable* queryable) : queryable(queryable) {}
+
+    virtual std::shared_ptr<Querier> querier(uint64_t mint, uint64_t maxt)
+    {
+        return std::make_shared<UnshardedQuerier>(
+            queryable->querier(mint, maxt));
+    }
+    virtual void label_values(const std::string& name,
+                              std::unordered_set<std::string>& values)
+    {
+        queryable->label_values(name, values);
+    }
+
+private:
+    class UnshardedQuerier : public Querier {
+    public:
+        UnshardedQuerier(std::shared_ptr<Querier> querier)
+            : querier(std::move(querier))
+        {}
+
+        virtual std::shared_ptr<SeriesSet>
+        select(const std::vector<LabelMatcher>& matchers)
+        {
+            std::vector<LabelMatcher> unsharded;
+            size_t index, count;
+            for (auto&& m : matchers) {
+                if (!parse_shard_matcher(m, index, count)) {
+                    unsharded.push_back(m);
+                }
+            }
+            return querier->select(unsharded);
+        }
+
+    private:
+        std::shared_ptr<Querier> querier;
+    };
+
+    Queryable* queryable;
+};
+
+TEST(QuerySharderTest, FilterSeriesOfOtherShards)
+{
+    ctpl::thread_pool pool(3);
+    MemoryStorage storage;
+    populate(storage);
+    UnshardedQueryable unsharded(&storage);
+
+    const char* query = "sum by (job) (rate(x[5m]))";
+    auto plan = plan_query(query);
+    QuerySharder sharder(&pool, 4);
+    ASSERT_TRUE(
+        sharder.prepare(plan.get(), [&] { return plan_query(query); }));
+
+    SystemTime ts{std::chrono::milliseconds(15 * MINUTE)};
+    auto instant = [&](const QueryPlan* plan, Queryable* queryable) {
+        InstantExecutor executor(queryable, plan, ts);
+        return executor.execute();
+    };
+    /* each series is still counted in a single shard */
+    expect_same(to_result(*instant(plan.get(), &storage)),
+                to_result(*sharder.query(&unsharded, instant)), query);
+}
+
+TEST(QuerySharderTest, CacheShardPlans)
+{
+    ctpl::thread_pool pool(3);
+    PlanCache cache;
+    const char* query = "avg by (job) (x)";
+    auto plan = cache.get(query);
+
+    size_t replanned = 0;
+    auto replan = [&] {
+        replanned++;
+        return plan_query(query);
+    };
+
+    /* avg is run as a sum and a count, planned on the first query only */
+    QuerySharder sharder(&pool, 4);
+    ASSERT_TRUE(sharder.prepare(plan.get(), replan, &cache));
+    EXPECT_EQ(2, replanned);
+    QuerySharder again(&pool, 4);
+    ASSERT_TRUE(again.prepare(plan.get(), replan, &cache));
+    EXPECT_EQ(2, replanned);
+    EXPECT_EQ(3, cache.size());
+
+    /* the shard plans are cached per number of shards */
+    QuerySharder other(&pool, 2);
+    ASSERT_TRUE(other.prepare(plan.get(), replan, &cache));
+    EXPECT_EQ(4, replanned);
+
+    MemoryStorage storage;
+    populate(storage);
+    SystemTime ts{std::chrono::milliseconds(15 * MINUTE)};
+    auto instant = [&](const QueryPlan* plan, Queryable* queryable) {
+        InstantExecutor executor(queryable, plan, ts);
+        return executor.execute();
+    };
+    expect_same(to_result(*instant(plan.get(), &storage)),
+                to_result(*again.query(&storage, instant)), query);
+}
+
+TEST(QuerySharderTest, ShareBudgetOfShards)
+{
+    ctpl::thread_pool pool(3);
+    MemoryStorage storage(false);
+    populate(storage);
+
+    const char* query = "sum by (job) (x)";
+    auto plan = plan_query(query);
+    QuerySharder sharder(&pool, 4);
+    ASSERT_TRUE(
+        sharder.prepare(plan.get(), [&] { return plan_query(query); }));
+
+    /* the 20 series have 21 samples in the lookback window, a shard reads a
+     * quarter of them */
+    QueryLimits limits;
+    limits.max_samples = 300;
+    SystemTime ts{std::chrono::milliseconds(15 * MINUTE)};
+    auto sharded_query = [&](QueryBudget* budget) {
+        return sharder.query(&storage, [&](const QueryPlan* plan,
+                                           Queryable* queryable) {
+            InstantExecutor executor(queryable, plan, ts);
+            if (budget) {
+                executor.set_budget(budget);
+            } else {
+                executor.set_limits(limits);
+            }
+            return executor.execute();
+        });
+    };
+
+    EXPECT_NO_THROW(sharded_query(nullptr));
+    QueryBudget budget(limits);
+    EXPECT_THROW(sharded_query(&budget), ExecutionError);
+
+    /* the peaks are those of the shards held at the same time */
+    ShardQueryable first(&storage, 0, 4), second(&storage, 1, 4);
+    auto peak_alone = [&](Queryable* queryable) {
+        InstantExecutor executor(queryable, plan.get(), ts);
+        executor.execute();
+        return executor.get_stats();
+    };
+    auto first_stats = peak_alone(&first);
+    auto second_stats = peak_alone(&second);
+
+    QueryBudget shared;
+    InstantExecutor a(&first, plan.get(), ts), b(&second, plan.get(), ts);
+    a.set_budget(&shared);
+    b.set_budget(&shared);
+    a.execute();
+    b.execute();
+    EXPECT_GT(shared.get_peak_samples(),
+              std::max(first_stats.peak_samples, second_stats.peak_samples));
+    EXPECT_GT(shared.get_peak_bytes(),
+              std::max(first_stats.peak_bytes, second_stats.peak_bytes));
+    EXPECT_EQ(shared.get_peak_bytes(), b.get_stats().peak_bytes);
+}
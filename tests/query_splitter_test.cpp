@@ -0,0 +1,148 @@
+#include "memory_storage.h"
+#include "parse/executor.h"
+#include "parse/parser.h"
+#include "parse/planner.h"
+#include "query_splitter.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <mutex>
+
+using namespace promql;
+
+static const uint64_t MINUTE = 60 * 1000;
+
+/* the series of a matrix as JSON, sorted as the order of the series in the
+ * stitched result may differ */
+static std::vector<std::string> sorted_series(const MatrixValue& mat)
+{
+    std::vector<std::string> series;
+    for (auto&& s : mat.get_series()) {
+        MatrixValue single;
+        single.add_series(
+            MatrixValue::Series(s, std::pmr::get_default_resource()));
+        series.push_back(single.to_json());
+    }
+    std::sort(series.begin(), series.end());
+    return series;
+}
+
+TEST(QuerySplitterTest, SplitRange)
+{
+    using Ranges = std::vector<std::pair<uint64_t, uint64_t>>;
+
+    EXPECT_EQ((Ranges{{10, 40}}), split_range(10, 40, 10, 100));
+    EXPECT_EQ((Ranges{{50, 95}, {110, 185}, {200, 230}}),
+              split_range(50, 230, 15, 100));
+    /* a step on the boundary starts a sub-range */
+    EXPECT_EQ((Ranges{{0, 50}, {100, 150}, {200, 200}}),
+              split_range(0, 200, 50, 100));
+    /* steps longer than the interval */
+    EXPECT_EQ((Ranges{{20, 20}, {270, 270}, {520, 520}}),
+              split_range(20, 600, 250, 100));
+}
+
+TEST(QuerySplitterTest, StitchSubqueries)
+{
+    MemoryStorage storage;
+    auto app = storage.appender();
+    for (uint64_t t = 0; t <= 60 * MINUTE; t += 15 * 1000) {
+        app->add({{METRIC_NAME, "x"}, {"job", "a"}}, t, t);
+        /* a series that only exists in some of the sub-ranges */
+        if (t > 25 * MINUTE && t < 35 * MINUTE) {
+            app->add({{METRIC_NAME, "x"}, {"job", "b"}}, t, 2 * t);
+        }
+    }
+    app->commit();
+
+    Parser parser("rate(x[5m])");
+    Planner planner;
+    auto plan = planner.plan(parser.parse(), parser.get_text());
+
+    auto run = [&](uint64_t start, uint64_t end) {
+        Executor executor(&storage, plan.get(),
+                          SystemTime{std::chrono::milliseconds(start)},
+                          SystemTime{std::chrono::milliseconds(end)},
+                          std::chrono::minutes(1));
+        auto value = executor.execute();
+        return std::unique_ptr<MatrixValue>(
+            static_cast<MatrixValue*>(value.release()));
+    };
+
+    std::mutex mutex;
+    std::vector<std::pair<uint64_t, uint64_t>> evaluated;
+    ctpl::thread_pool pool(2);
+    QuerySplitter splitter(&pool, std::chrono::minutes(10));
+
+    auto result = splitter.query(
+        5 * MINUTE, 45 * MINUTE, MINUTE, [&](uint64_t start, uint64_t end) {
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                evaluated.emplace_back(start, end);
+            }
+            return run(start, end);
+        });
+    EXPECT_EQ(sorted_series(*run(5 * MINUTE, 45 * MINUTE)),
+              sorted_series(*result));
+
+    std::sort(evaluated.begin(), evaluated.end());
+    ASSERT_EQ(5, evaluated.size());
+    EXPECT_EQ(std::make_pair(5 * MINUTE, 9 * MINUTE), evaluated[0]);
+    EXPECT_EQ(std::make_pair(40 * MINUTE, 45 * MINUTE), evaluated[4]);
+
+    /* the query fails with its first failing sub-query */
+    EXPECT_THROW(splitter.query(5 * MINUTE, 45 * MINUTE, MINUTE,
+                                [&](uint64_t start, uint64_t end) {
+                                    if (start == 20 * MINUTE) {
+                                        throw ExecutionError("failed");
+                                    }
+                                    return run(start, end);
+                                }),
+                 ExecutionError);
+}
+
+TEST(QuerySplitterTest, ShareBudgetOfQuery)
+{
+    MemoryStorage storage;
+    auto app = storage.appender();
+    for (uint64_t t = 0; t <= 60 * MINUTE; t += 15 * 1000) {
+        app->add({{METRIC_NAME, "x"}}, t, t);
+    }
+    app->commit();
+
+    Parser parser("rate(x[5m])");
+    Planner planner;
+    auto plan = planner.plan(parser.parse(), parser.get_text());
+
+    /* a sub-range reads 15m of samples, the whole range 60m */
+    QueryLimits limits;
+    limits.max_samples = 100;
+    auto split_query = [&](QueryBudget* budget) {
+        auto run = [&](uint64_t start, uint64_t end) {
+            Executor executor(&storage, plan.get(),
+                              SystemTime{std::chrono::milliseconds(start)},
+                              SystemTime{std::chrono::milliseconds(end)},
+                              std::chrono::minutes(1));
+            if (budget) {
+                executor.set_budget(budget);
+            } else {
+                executor.set_limits(limits);
+            }
+            auto value = executor.execute();
+            return std::unique_ptr<MatrixValue>(
+                static_cast<MatrixValue*>(value.release()));
+        };
+
+        ctpl::thread_pool pool(2);
+        QuerySplitter(&pool, std::chrono::minutes(10))
+            .query(5 * MINUTE, 60 * MINUTE, MINUTE, run);
+    };
+
+    /* each sub-range is within the limits on its own */
+    EXPECT_NO_THROW(split_query(nullptr));
+
+    QueryBudget budget(limits);
+    EXPECT_THROW(split_query(&budget), ExecutionError);
+    EXPECT_LT(limits.max_samples, budget.get_samples());
+}
@@ -0,0 +1,140 @@
+#include "memory_storage.h"
+#include "parse/executor.h"
+#include "parse/parser.h"
+#include "parse/planner.h"
+#include "results_cache.h"
+
+#include <gtest/gtest.h>
+
+using namespace promql;
+
+static const uint64_t MINUTE = 60 * 1000;
+
+class ResultsCacheTest : public ::testing::Test {
+protected:
+    MemoryStorage storage;
+    std::unique_ptr<QueryPlan> plan;
+    /* the ranges evaluated by the executor */
+    std::vector<std::pair<uint64_t, uint64_t>> evaluated;
+
+    virtual void SetUp()
+    {
+        auto app = storage.appender();
+        for (uint64_t t = 0; t <= 60 * MINUTE; t += 15 * 1000) {
+            app->add({{METRIC_NAME, "x"}, {"job", "a"}}, t, t);
+            app->add({{METRIC_NAME, "x"}, {"job", "b"}}, t, 2 * t);
+        }
+        app->commit();
+
+        Parser parser("rate(x[5m])");
+        Planner planner;
+        plan = planner.plan(parser.parse(), parser.get_text());
+    }
+
+    std::unique_ptr<MatrixValue> run(uint64_t start, uint64_t end)
+    {
+        Executor executor(&storage, plan.get(),
+                          SystemTime{std::chrono::milliseconds(start)},
+                          SystemTime{std::chrono::milliseconds(end)},
+                          std::chrono::minutes(1));
+        auto value = executor.execute();
+        return std::unique_ptr<MatrixValue>(
+            static_cast<MatrixValue*>(value.release()));
+    }
+
+    std::unique_ptr<MatrixValue> cached_run(ResultsCache& cache,
+                                            uint64_t start, uint64_t end,
+                                            uint64_t now = 60 * MINUTE)
+    {
+        return cache.query("rate(x[5m])", start, end, MINUTE, now,
+                           [this](uint64_t from, uint64_t to) {
+                               evaluated.emplace_back(from, to);
+                               return run(from, to);
+                           });
+    }
+};
+
+TEST_F(ResultsCacheTest, EvaluateMissingExtents)
+{
+    ResultsCache cache(1 << 20);
+
+    auto first = cached_run(cache, 10 * MINUTE, 30 * MINUTE);
+    EXPECT_EQ(first->to_json(), run(10 * MINUTE, 30 * MINUTE)->to_json());
+
+    /* a sliding window evaluates the new tail only */
+    evaluated.clear();
+    auto slid = cached_run(cache, 15 * MINUTE, 35 * MINUTE);
+    EXPECT_EQ(slid->to_json(), run(15 * MINUTE, 35 * MINUTE)->to_json());
+    ASSERT_EQ(1, evaluated.size());
+    EXPECT_EQ(31 * MINUTE, evaluated[0].first);
+    EXPECT_EQ(35 * MINUTE, evaluated[0].second);
+
+    /* and a wider one the head and the tail */
+    evaluated.clear();
+    auto wide = cached_run(cache, 5 * MINUTE, 40 * MINUTE);
+    EXPECT_EQ(wide->to_json(), run(5 * MINUTE, 40 * MINUTE)->to_json());
+    ASSERT_EQ(2, evaluated.size());
+    EXPECT_EQ(std::make_pair(5 * MINUTE, 9 * MINUTE), evaluated[0]);
+    EXPECT_EQ(std::make_pair(36 * MINUTE, 40 * MINUTE), evaluated[1]);
+
+    evaluated.clear();
+    cached_run(cache, 5 * MINUTE, 40 * MINUTE);
+    EXPECT_TRUE(evaluated.empty());
+    EXPECT_EQ(21 + 5 + 10, cache.get_misses());
+    EXPECT_EQ(16 + 26 + 36, cache.get_hits());
+
+    /* steps on another alignment are cached separately */
+    cached_run(cache, 5 * MINUTE + 1000, 10 * MINUTE + 1000);
+    ASSERT_EQ(1, evaluated.size());
+}
+
+TEST_F(ResultsCacheTest, DoNotCacheRecentSteps)
+{
+    ResultsCache cache(1 << 20, std::chrono::minutes(10));
+
+    cached_run(cache, 10 * MINUTE, 30 * MINUTE, 25 * MINUTE);
+    evaluated.clear();
+    cached_run(cache, 10 * MINUTE, 30 * MINUTE, 25 * MINUTE);
+
+    /* the steps after now - 10m are evaluated again */
+    ASSERT_EQ(1, evaluated.size());
+    EXPECT_EQ(16 * MINUTE, evaluated[0].first);
+
+    /* the samples in the last 10m only change steps that are not cached */
+    auto bytes = cache.get_bytes();
+    cache.add_sample(16 * MINUTE, 25 * MINUTE);
+    EXPECT_EQ(bytes, cache.get_bytes());
+    cache.add_sample(14 * MINUTE, 25 * MINUTE);
+    EXPECT_EQ(0, cache.get_bytes());
+}
+
+TEST_F(ResultsCacheTest, EvictLeastRecentlyUsed)
+{
+    ResultsCache cache(1 << 20);
+    cached_run(cache, 10 * MINUTE, 30 * MINUTE);
+    auto entry_bytes = cache.get_bytes();
+    EXPECT_LT(0, entry_bytes);
+
+    /* room for a single entry */
+    ResultsCache small(entry_bytes + entry_bytes / 2);
+    small.query("a", 10 * MINUTE, 30 * MINUTE, MINUTE, 60 * MINUTE,
+                [this](uint64_t from, uint64_t to) { return run(from, to); });
+    small.query("b", 10 * MINUTE, 30 * MINUTE, MINUTE, 60 * MINUTE,
+                [this](uint64_t from, uint64_t to) { return run(from, to); });
+    EXPECT_LE(small.get_bytes(), entry_bytes + entry_bytes / 2);
+
+    evaluated.clear();
+    small.query("b", 10 * MINUTE, 30 * MINUTE, MINUTE, 60 * MINUTE,
+                [this](uint64_t from, uint64_t to) {
+                    evaluated.emplace_back(from, to);
+                    return run(from, to);
+                });
+    EXPECT_TRUE(evaluated.empty());
+
+    small.query("a", 10 * MINUTE, 30 * MINUTE, MINUTE, 60 * MINUTE,
+                [this](uint64_t from, uint64_t to) {
+                    evaluated.emplace_back(from, to);
+                    return run(from, to);
+                });
+    EXPECT_EQ(1, evaluated.size());
+}
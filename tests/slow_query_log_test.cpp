@@ -0,0 +1,134 @@
+#include "slow_query_log.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+using namespace promql;
+
+static QueryLogEntry make_entry(const std::string& query,
+                                const std::string& fingerprint, int elapsed_ms,
+                                int eval_ms)
+{
+    QueryLogEntry entry("/api/v1/query", query);
+    entry.fingerprint = fingerprint;
+    entry.elapsed = std::chrono::milliseconds(elapsed_ms);
+    entry.stats.eval_time = std::chrono::milliseconds(eval_ms);
+    entry.stats.samples = 10;
+    return entry;
+}
+
+/* an empty file, created so that no other process can take its name */
+static std::string temp_file()
+{
+    std::string path = ::testing::TempDir() + "slow_query_log_XXXXXX";
+    int fd = ::mkstemp(&path[0]);
+    EXPECT_NE(-1, fd);
+    ::close(fd);
+    return path;
+}
+
+static std::vector<std::string> read_lines(const std::string& path)
+{
+    std::ifstream ifs(path);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+TEST(SlowQueryLogTest, LogSlowQueries)
+{
+    std::string path = temp_file();
+    {
+        SlowQueryLog log(path, std::chrono::milliseconds(100));
+
+        EXPECT_FALSE(log.record(make_entry("x{job=\"a\"}", "x{job=?}", 10, 5)));
+        EXPECT_TRUE(
+            log.record(make_entry("x{job=\"b\"}", "x{job=?}", 200, 150)));
+        log.flush();
+        EXPECT_EQ(1, log.get_logged());
+
+        auto lines = read_lines(path);
+        ASSERT_EQ(1, lines.size());
+        EXPECT_NE(std::string::npos,
+                  lines[0].find("\"query\": \"x{job=\\\"b\\\"}\""));
+        EXPECT_NE(std::string::npos,
+                  lines[0].find("\"fingerprint\": \"x{job=?}\""));
+        EXPECT_NE(std::string::npos, lines[0].find("\"duration\": 0.2,"));
+        EXPECT_EQ(std::string::npos, lines[0].find("\"error\""));
+
+        auto entry = make_entry("y", "y", 300, 0);
+        entry.error = "query timed out";
+        log.record(std::move(entry));
+    }
+
+    /* the queued entries are written when the log is closed */
+    auto lines = read_lines(path);
+    ASSERT_EQ(2, lines.size());
+    EXPECT_NE(std::string::npos,
+              lines[1].find("\"error\": \"query timed out\""));
+    ::remove(path.c_str());
+}
+
+TEST(SlowQueryLogTest, AggregateFingerprints)
+{
+    SlowQueryLog log("", std::chrono::milliseconds(100), 1024, 2);
+
+    /* a cheap query run often costs more than a single slow one */
+    for (int i = 0; i < 10; i++) {
+        log.record(make_entry("a", "a", 50, 40));
+    }
+    log.record(make_entry("b", "b", 250, 200));
+
+    auto fps = log.get_fingerprints();
+    ASSERT_EQ(2, fps.size());
+    EXPECT_EQ("a", fps[0].fingerprint);
+    EXPECT_EQ(10, fps[0].count);
+    EXPECT_EQ(0, fps[0].slow_count);
+    EXPECT_EQ(std::chrono::milliseconds(400), fps[0].cpu_time);
+    EXPECT_EQ(std::chrono::milliseconds(500), fps[0].total_time);
+    EXPECT_EQ(std::chrono::milliseconds(50), fps[0].max_time);
+    EXPECT_EQ(100, fps[0].samples);
+    EXPECT_EQ("b", fps[1].fingerprint);
+    EXPECT_EQ(1, fps[1].slow_count);
+
+    /* the cheapest fingerprint is replaced when full */
+    log.record(make_entry("c", "c", 10, 10));
+    fps = log.get_fingerprints();
+    ASSERT_EQ(2, fps.size());
+    EXPECT_EQ("a", fps[0].fingerprint);
+    EXPECT_EQ("c", fps[1].fingerprint);
+    /* c inherits the CPU time of b as its error */
+    EXPECT_EQ(std::chrono::milliseconds(210), fps[1].cpu_time);
+    EXPECT_EQ(std::chrono::milliseconds(200), fps[1].cpu_time_error);
+    EXPECT_EQ(1, fps[1].count);
+
+    EXPECT_EQ(1, log.get_fingerprints(1).size());
+    /* nothing is written without a file */
+    EXPECT_EQ(0, log.get_logged());
+}
+
+TEST(SlowQueryLogTest, KeepRecurringFingerprints)
+{
+    SlowQueryLog log("", std::chrono::seconds(1), 1024, 10);
+
+    /* an expensive panel first seen once the table is full of one-off
+     * queries is not evicted by the next one-off query */
+    for (int i = 0; i < 100; i++) {
+        log.record(make_entry("once", "once-" + std::to_string(i), 10, 10));
+        if (i >= 50) log.record(make_entry("panel", "panel", 10, 10));
+    }
+
+    auto fps = log.get_fingerprints(1);
+    ASSERT_EQ(1, fps.size());
+    EXPECT_EQ("panel", fps[0].fingerprint);
+    EXPECT_EQ(50, fps[0].count);
+    EXPECT_LE(std::chrono::milliseconds(500),
+              fps[0].cpu_time - fps[0].cpu_time_error);
+}
@@ -0,0 +1,118 @@
+#include "parse/executor.h"
+#include "value.h"
+
+#include <gtest/gtest.h>
+
+#include <type_traits>
+
+using namespace promql;
+
+/* counts the allocations made through it */
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t allocations = 0;
+
+private:
+    virtual void* do_allocate(size_t bytes, size_t alignment)
+    {
+        allocations++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    virtual void do_deallocate(void* p, size_t bytes, size_t alignment)
+    {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    virtual bool do_is_equal(const std::pmr::memory_resource& other) const
+        noexcept
+    {
+        return this == &other;
+    }
+};
+
+/* makes the counting resource the default one for the scope of a test */
+class ValueTest : public ::testing::Test {
+protected:
+    CountingResource counter;
+    std::pmr::memory_resource* saved;
+
+    virtual void SetUp() { saved = std::pmr::set_default_resource(&counter); }
+    virtual void TearDown() { std::pmr::set_default_resource(saved); }
+};
+
+static_assert(!std::is_copy_constructible<VectorValue>::value,
+              "vectors are move-only");
+static_assert(!std::is_copy_constructible<MatrixValue>::value,
+              "matrices are move-only");
+static_assert(!std::is_copy_constructible<MatrixValue::Series>::value,
+              "series are move-only");
+
+TEST_F(ValueTest, AccessorsDoNotCopy)
+{
+    VectorValue vec;
+    MatrixValue mat;
+    for (int i = 0; i < 100; i++) {
+        vec.add_sample({{{"i", std::to_string(i)}}, {0, (double)i}});
+
+        MatrixValue::Series series({{"i", std::to_string(i)}});
+        series.values.emplace_back(0, i);
+        mat.add_series(std::move(series));
+    }
+
+    auto allocations = counter.allocations;
+    double sum = 0;
+    for (auto&& s : vec.get_samples()) {
+        sum += s.value.get_value();
+    }
+    for (auto&& s : mat.get_series()) {
+        sum += s.values[0].get_value();
+    }
+
+    EXPECT_EQ(2 * 4950, sum);
+    EXPECT_EQ(allocations, counter.allocations);
+}
+
+TEST_F(ValueTest, BinopAllocatesOnlyTheResult)
+{
+    VectorValue vec;
+    for (int i = 0; i < 100; i++) {
+        vec.add_sample({{{"i", std::to_string(i)}}, {0, (double)i}});
+    }
+    ScalarValue two(0, 2);
+
+    EvalContext ctx;
+    ctx.outvec = std::make_unique<VectorValue>();
+    auto allocations = counter.allocations;
+    auto result = vec_scalar_binop(Token::MUL, &vec, &two, false, false, ctx);
+
+    ASSERT_EQ(100, result->get_samples().size());
+    EXPECT_EQ(198, result->get_samples().back().value.get_value());
+    EXPECT_EQ(allocations + 1, counter.allocations);
+
+    /* the output vector is reused without allocating at the next step */
+    result->clear();
+    ctx.outvec = std::move(result);
+    allocations = counter.allocations;
+    result = vec_scalar_binop(Token::MUL, &vec, &two, false, false, ctx);
+    EXPECT_EQ(allocations, counter.allocations);
+}
+
+TEST_F(ValueTest, CopyToResource)
+{
+    std::pmr::monotonic_buffer_resource arena;
+    MatrixValue mat(&arena);
+    MatrixValue::Series series({{"job", "a"}}, &arena);
+    series.values.emplace_back(1000, 1);
+    mat.add_series(std::move(series));
+
+    auto allocations = counter.allocations;
+    MatrixValue copy(mat, std::pmr::get_default_resource());
+
+    /* the series array and the values of the series */
+    EXPECT_EQ(allocations + 2, counter.allocations);
+    ASSERT_EQ(1, copy.get_series().size());
+    EXPECT_EQ(mat.get_series()[0].metric, copy.get_series()[0].metric);
+    EXPECT_EQ(1, copy.get_series()[0].values[0].get_value());
+    EXPECT_EQ(&counter, copy.get_series()[0].values.get_allocator().resource());
+}
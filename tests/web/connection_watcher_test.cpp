@@ -0,0 +1,165 @@
+#include "web/connection_watcher.h"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+using namespace promql;
+
+/* a client connected to a server socket over the loopback */
+struct Connection {
+    int listener, client, server;
+    /* the addresses of the server side */
+    sockaddr_storage local, remote;
+
+    Connection()
+    {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+
+        listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        ::bind(listener, (sockaddr*)&addr, sizeof(addr));
+        ::listen(listener, 1);
+        ::getsockname(listener, (sockaddr*)&addr, &len);
+
+        client = ::socket(AF_INET, SOCK_STREAM, 0);
+        ::connect(client, (sockaddr*)&addr, sizeof(addr));
+        server = ::accept(listener, nullptr, nullptr);
+
+        len = sizeof(local);
+        ::getsockname(server, (sockaddr*)&local, &len);
+        len = sizeof(remote);
+        ::getpeername(server, (sockaddr*)&remote, &len);
+    }
+
+    ~Connection()
+    {
+        if (client != -1) ::close(client);
+        if (server != -1) ::close(server);
+        ::close(listener);
+    }
+
+    const sockaddr* local_address() const { return (sockaddr*)&local; }
+    const sockaddr* remote_address() const { return (sockaddr*)&remote; }
+
+    void drop()
+    {
+        ::close(client);
+        client = -1;
+    }
+
+    /* the server side closed the connection */
+    void close_server()
+    {
+        ::close(server);
+        server = -1;
+    }
+};
+
+static bool wait_cancelled(const CancellationToken& token)
+{
+    for (int i = 0; i < 500 && !token.is_cancelled(); i++) {
+        ::usleep(10000);
+    }
+    return token.is_cancelled();
+}
+
+TEST(ConnectionWatcherTest, FindSocket)
+{
+    Connection conn;
+
+    EXPECT_EQ(conn.server, ConnectionWatcher::find_socket(
+                               conn.local_address(), conn.remote_address()));
+    /* the client socket has the addresses swapped */
+    EXPECT_EQ(conn.client, ConnectionWatcher::find_socket(
+                               conn.remote_address(), conn.local_address()));
+
+    conn.drop();
+    EXPECT_EQ(-1, ConnectionWatcher::find_socket(conn.remote_address(),
+                                                 conn.local_address()));
+}
+
+TEST(ConnectionWatcherTest, CancelQueryOfDroppedConnection)
+{
+    ConnectionWatcher watcher(std::chrono::milliseconds(10));
+    Connection conn, other;
+    auto token = std::make_shared<CancellationToken>();
+    auto other_token = std::make_shared<CancellationToken>();
+
+    watcher.watch(conn.local_address(), conn.remote_address(), token);
+    watcher.watch(other.local_address(), other.remote_address(),
+                  other_token);
+
+    /* the next request of a keep-alive connection is not a disconnect */
+    ASSERT_EQ(1, ::write(other.client, "G", 1));
+    ::usleep(50000);
+    EXPECT_FALSE(token->is_cancelled());
+    EXPECT_FALSE(other_token->is_cancelled());
+
+    conn.drop();
+    EXPECT_TRUE(wait_cancelled(*token));
+    EXPECT_FALSE(other_token->is_cancelled());
+}
+
+TEST(ConnectionWatcherTest, Unwatch)
+{
+    ConnectionWatcher watcher(std::chrono::milliseconds(10));
+    Connection conn;
+    auto token = std::make_shared<CancellationToken>();
+
+    watcher.unwatch(
+        watcher.watch(conn.local_address(), conn.remote_address(), token));
+    conn.drop();
+    ::usleep(50000);
+    EXPECT_FALSE(token->is_cancelled());
+}
+
+TEST(ConnectionWatcherTest, CancelQueryOfReusedDescriptor)
+{
+    ConnectionWatcher watcher(std::chrono::milliseconds(10));
+    Connection conn;
+    auto token = std::make_shared<CancellationToken>();
+
+    watcher.watch(conn.local_address(), conn.remote_address(), token);
+    ::usleep(50000);
+    EXPECT_FALSE(token->is_cancelled());
+
+    /* the descriptor of the watched socket is reused by the next
+     * connection, which is open and quiet. Unwatching no query orders the
+     * close between the peeks. */
+    int fd = conn.server;
+    watcher.unwatch(0);
+    conn.close_server();
+    Connection other;
+    watcher.unwatch(0);
+    EXPECT_TRUE(fd == other.listener || fd == other.client ||
+                fd == other.server);
+
+    EXPECT_TRUE(wait_cancelled(*token));
+}
+
+TEST(ConnectionWatcherTest, WatchQueriesAfterInterval)
+{
+    ConnectionWatcher watcher(std::chrono::milliseconds(200));
+    Connection conn, other;
+    auto token = std::make_shared<CancellationToken>();
+    auto other_token = std::make_shared<CancellationToken>();
+
+    watcher.watch(conn.local_address(), conn.remote_address(), token);
+    conn.drop();
+    ASSERT_TRUE(wait_cancelled(*token));
+
+    /* the next poll comes within an interval of the watch, the connection
+     * is left alone until the one after */
+    ::usleep(50000);
+    watcher.watch(other.local_address(), other.remote_address(),
+                  other_token);
+    other.drop();
+    ::usleep(250000);
+    EXPECT_FALSE(other_token->is_cancelled());
+    EXPECT_TRUE(wait_cancelled(*other_token));
+}